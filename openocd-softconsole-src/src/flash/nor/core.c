@@ -26,6 +26,7 @@
 #include <flash/common.h>
 #include <flash/nor/core.h>
 #include <flash/nor/imp.h>
+#include <jtag/jtag.h>
 #include <target/image.h>
 
 /**
@@ -37,11 +38,404 @@
 
 static struct flash_bank *flash_banks;
 
+/* Number of cached sectors compared with the flash before the cache of a
+ * bank is trusted for a write */
+#define FLASH_CACHE_SPOT_CHECKS 2
+
+/**
+ * The sector cache remembers the checksum of what OpenOCD last wrote to
+ * each sector, in a file, so that incremental writes in later sessions can
+ * skip sectors which are known to hold the image already without reading
+ * them back. A few sampled sectors are still compared with the flash to
+ * catch changes made behind OpenOCD's back.
+ */
+struct flash_cache_sector {
+	/* range last written, relative to the bank, size zero if unknown */
+	uint32_t offset;
+	uint32_t size;
+	uint32_t checksum;
+};
+
+struct flash_cache_bank {
+	char *key;
+	int num_sectors;
+	struct flash_cache_sector *sectors;
+	/* value of flash_cache_generation when last spot checked */
+	unsigned checked;
+	struct flash_cache_bank *next;
+};
+
+static char *flash_cache_file;
+static char *flash_cache_tag;
+static struct flash_cache_bank *flash_cache_banks;
+static unsigned flash_cache_generation;
+/* changed since last saved, saved once at the end of an operation */
+static bool flash_cache_dirty;
+
+/* The cache entry of a bank is tied to the chip it was written on */
+static char *flash_cache_key(struct flash_bank *bank)
+{
+	uint32_t idcode = 0;
+	if (bank->target->tap && bank->target->tap->hasidcode)
+		idcode = bank->target->tap->idcode;
+
+	return alloc_printf("%s:0x%08" PRIx32 ":" TARGET_ADDR_FMT ":0x%08" PRIx32 "%s%s",
+			bank->name, idcode, bank->base, bank->size,
+			flash_cache_tag ? ":" : "", flash_cache_tag ? flash_cache_tag : "");
+}
+
+static struct flash_cache_bank *flash_cache_get(const char *key, int num_sectors, bool create)
+{
+	struct flash_cache_bank *cache;
+
+	for (cache = flash_cache_banks; cache; cache = cache->next)
+		if (strcmp(cache->key, key) == 0)
+			break;
+
+	if (cache == NULL) {
+		if (!create)
+			return NULL;
+		cache = calloc(1, sizeof(*cache));
+		if (cache == NULL)
+			return NULL;
+		cache->key = strdup(key);
+		cache->next = flash_cache_banks;
+		flash_cache_banks = cache;
+	}
+
+	if (cache->num_sectors < num_sectors) {
+		struct flash_cache_sector *sectors = realloc(cache->sectors,
+				num_sectors * sizeof(*sectors));
+		if (sectors == NULL)
+			return NULL;
+		memset(sectors + cache->num_sectors, 0,
+				(num_sectors - cache->num_sectors) * sizeof(*sectors));
+		cache->sectors = sectors;
+		cache->num_sectors = num_sectors;
+	}
+
+	return cache;
+}
+
+static struct flash_cache_bank *flash_cache_find(struct flash_bank *bank, bool create)
+{
+	if (flash_cache_file == NULL || bank->num_sectors == 0)
+		return NULL;
+
+	char *key = flash_cache_key(bank);
+	struct flash_cache_bank *cache = flash_cache_get(key, bank->num_sectors, create);
+	free(key);
+
+	return cache;
+}
+
+static void flash_cache_free(void)
+{
+	while (flash_cache_banks) {
+		struct flash_cache_bank *cache = flash_cache_banks;
+		flash_cache_banks = cache->next;
+		free(cache->key);
+		free(cache->sectors);
+		free(cache);
+	}
+}
+
+static void flash_cache_save(void)
+{
+	FILE *file = fopen(flash_cache_file, "w");
+	if (file == NULL) {
+		LOG_WARNING("couldn't write flash sector cache %s: %s",
+				flash_cache_file, strerror(errno));
+		return;
+	}
+
+	fprintf(file, "# OpenOCD flash sector cache\n");
+	for (struct flash_cache_bank *cache = flash_cache_banks; cache; cache = cache->next) {
+		fprintf(file, "bank %s\n", cache->key);
+		for (int i = 0; i < cache->num_sectors; i++) {
+			struct flash_cache_sector *sector = &cache->sectors[i];
+			if (sector->size)
+				fprintf(file, "%d 0x%08" PRIx32 " 0x%08" PRIx32 " 0x%08" PRIx32 "\n",
+						i, sector->offset, sector->size, sector->checksum);
+		}
+	}
+
+	if (fclose(file) != 0)
+		LOG_WARNING("couldn't write flash sector cache %s", flash_cache_file);
+}
+
+void flash_sector_cache_flush(void)
+{
+	if (flash_cache_file == NULL || !flash_cache_dirty)
+		return;
+
+	flash_cache_dirty = false;
+	flash_cache_save();
+}
+
+/* Catches changes by the flash commands which drive the banks directly */
+static int flash_cache_flush_callback(void *priv)
+{
+	flash_sector_cache_flush();
+	return ERROR_OK;
+}
+
+static int flash_cache_load(void)
+{
+	FILE *file = fopen(flash_cache_file, "r");
+	if (file == NULL) {
+		/* starting a new cache */
+		if (errno == ENOENT)
+			return ERROR_OK;
+		LOG_ERROR("couldn't read flash sector cache %s: %s",
+				flash_cache_file, strerror(errno));
+		return ERROR_FAIL;
+	}
+
+	struct flash_cache_bank *cache = NULL;
+	char line[256];
+	int retval = ERROR_OK;
+
+	while (fgets(line, sizeof(line), file)) {
+		char key[sizeof(line)];
+		int index;
+		struct flash_cache_sector sector;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (sscanf(line, "bank %255s", key) == 1) {
+			cache = flash_cache_get(key, 0, true);
+		} else if (cache && sscanf(line, "%d %" SCNx32 " %" SCNx32 " %" SCNx32,
+				&index, &sector.offset, &sector.size, &sector.checksum) == 4
+				&& index >= 0 && index < 0x10000) {
+			if (flash_cache_get(cache->key, index + 1, false) == NULL) {
+				retval = ERROR_FAIL;
+				break;
+			}
+			cache->sectors[index] = sector;
+		} else {
+			LOG_ERROR("malformed flash sector cache %s: %s", flash_cache_file, line);
+			retval = ERROR_FAIL;
+			break;
+		}
+	}
+
+	fclose(file);
+	if (retval != ERROR_OK)
+		flash_cache_free();
+
+	return retval;
+}
+
+int flash_sector_cache_open(const char *filename, const char *device_tag)
+{
+	flash_sector_cache_close();
+
+	flash_cache_file = strdup(filename);
+	flash_cache_tag = device_tag ? strdup(device_tag) : NULL;
+
+	int retval = flash_cache_load();
+	if (retval != ERROR_OK) {
+		flash_sector_cache_close();
+		return retval;
+	}
+
+	return target_register_timer_callback(flash_cache_flush_callback, 1000,
+			TARGET_TIMER_TYPE_PERIODIC, NULL);
+}
+
+void flash_sector_cache_close(void)
+{
+	if (flash_cache_file)
+		target_unregister_timer_callback(flash_cache_flush_callback, NULL);
+	flash_sector_cache_flush();
+	flash_cache_free();
+	free(flash_cache_file);
+	flash_cache_file = NULL;
+	free(flash_cache_tag);
+	flash_cache_tag = NULL;
+}
+
+bool flash_sector_cache_enabled(void)
+{
+	return flash_cache_file != NULL;
+}
+
+void flash_sector_cache_clear(void)
+{
+	if (flash_cache_file == NULL)
+		return;
+
+	flash_cache_free();
+	flash_cache_dirty = false;
+	flash_cache_save();
+}
+
+unsigned flash_sector_cache_count(void)
+{
+	unsigned count = 0;
+
+	for (struct flash_cache_bank *cache = flash_cache_banks; cache; cache = cache->next)
+		for (int i = 0; i < cache->num_sectors; i++)
+			if (cache->sectors[i].size)
+				count++;
+
+	return count;
+}
+
+const char *flash_sector_cache_file(void)
+{
+	return flash_cache_file;
+}
+
+/* Drop what the cache knows about a range that is being modified */
+static void flash_cache_forget(struct flash_bank *bank, uint32_t offset, uint32_t count)
+{
+	struct flash_cache_bank *cache = flash_cache_find(bank, false);
+	if (cache == NULL)
+		return;
+
+	bool changed = false;
+	for (int i = 0; i < bank->num_sectors; i++) {
+		struct flash_sector *sector = &bank->sectors[i];
+		if (sector->offset < offset + count && sector->offset + sector->size > offset
+				&& cache->sectors[i].size) {
+			cache->sectors[i].size = 0;
+			changed = true;
+		}
+	}
+
+	if (changed)
+		flash_cache_dirty = true;
+}
+
+/* Remember that the flash holds data in the given range */
+static void flash_cache_record(struct flash_bank *bank, const uint8_t *data,
+	uint32_t offset, uint32_t count)
+{
+	struct flash_cache_bank *cache = flash_cache_find(bank, true);
+	if (cache == NULL)
+		return;
+
+	for (int i = 0; i < bank->num_sectors; i++) {
+		uint32_t start = MAX(bank->sectors[i].offset, offset);
+		uint32_t end = MIN(bank->sectors[i].offset + bank->sectors[i].size, offset + count);
+		if (start >= end)
+			continue;
+
+		struct flash_cache_sector *sector = &cache->sectors[i];
+		sector->offset = start;
+		sector->size = end - start;
+		image_calculate_checksum(data + (start - offset), end - start, &sector->checksum);
+	}
+
+	flash_cache_dirty = true;
+}
+
+/* CRC of the flash contents, as computed by image_calculate_checksum() */
+static int flash_checksum(struct flash_bank *bank, uint32_t offset, uint32_t count,
+	uint32_t *checksum)
+{
+	int retval;
+
+	/* memory mapped banks are checked by the target */
+	if (bank->driver->read == default_flash_read)
+		return target_checksum_memory(bank->target, bank->base + offset, count, checksum);
+
+	uint8_t *buffer = malloc(count);
+	if (buffer == NULL)
+		return ERROR_FAIL;
+	retval = flash_driver_read(bank, buffer, offset, count);
+	if (retval == ERROR_OK)
+		image_calculate_checksum(buffer, count, checksum);
+	free(buffer);
+
+	return retval;
+}
+
+/**
+ * Compare a few of the cached sectors with the flash, once per write
+ * operation. If any of them changed, something other than OpenOCD wrote
+ * the flash and the cache of the bank is dropped.
+ */
+static bool flash_cache_spot_check(struct flash_bank *bank)
+{
+	struct flash_cache_bank *cache = flash_cache_find(bank, false);
+	if (cache == NULL)
+		return false;
+	if (cache->checked == flash_cache_generation)
+		return true;
+
+	int *known = malloc(bank->num_sectors * sizeof(*known));
+	int num_known = 0;
+	if (known == NULL)
+		return false;
+
+	for (int i = 0; i < bank->num_sectors; i++)
+		if (cache->sectors[i].size)
+			known[num_known++] = i;
+
+	/* spread the samples over the known sectors, starting at a different
+	 * one every time so that all of them get checked eventually */
+	int skip = num_known ? rand() % num_known : 0;
+	int num_checks = MIN(num_known, FLASH_CACHE_SPOT_CHECKS);
+	for (int i = 0; i < num_checks; i++) {
+		int index = known[(skip + i * num_known / num_checks) % num_known];
+		struct flash_cache_sector *sector = &cache->sectors[index];
+		uint32_t checksum;
+
+		if (flash_checksum(bank, sector->offset, sector->size, &checksum) != ERROR_OK
+				|| checksum != sector->checksum) {
+			free(known);
+			LOG_WARNING("flash %s was modified outside OpenOCD, dropping its sector cache",
+					bank->name);
+			memset(cache->sectors, 0, cache->num_sectors * sizeof(*cache->sectors));
+			flash_cache_dirty = true;
+			return false;
+		}
+	}
+
+	free(known);
+	cache->checked = flash_cache_generation;
+	return true;
+}
+
+enum flash_cache_state {
+	FLASH_CACHE_UNKNOWN,
+	FLASH_CACHE_SAME,
+	FLASH_CACHE_DIFFERENT,
+};
+
+/* What the cache knows about data to be written to a range of one sector */
+static enum flash_cache_state flash_cache_lookup(struct flash_bank *bank, int index,
+	const uint8_t *data, uint32_t offset, uint32_t count)
+{
+	struct flash_cache_bank *cache = flash_cache_find(bank, false);
+	if (cache == NULL)
+		return FLASH_CACHE_UNKNOWN;
+
+	struct flash_cache_sector *sector = &cache->sectors[index];
+	if (sector->offset != offset || sector->size != count)
+		return FLASH_CACHE_UNKNOWN;
+
+	uint32_t checksum;
+	image_calculate_checksum(data, count, &checksum);
+	return checksum == sector->checksum ? FLASH_CACHE_SAME : FLASH_CACHE_DIFFERENT;
+}
+
 int flash_driver_erase(struct flash_bank *bank, int first, int last)
 {
 	int retval;
 
+	if (first >= 0 && first <= last && last < bank->num_sectors)
+		flash_cache_forget(bank, bank->sectors[first].offset, bank->sectors[last].offset
+				+ bank->sectors[last].size - bank->sectors[first].offset);
+
+	target_memcache_invalidate(bank->target);
+	jtag_flush_origin_push("flash");
 	retval = bank->driver->erase(bank, first, last);
+	jtag_flush_origin_pop();
 	if (retval != ERROR_OK)
 		LOG_ERROR("failed erasing sectors %d to %d", first, last);
 
@@ -84,7 +478,9 @@ int flash_driver_protect(struct flash_bank *bank, int set, int first, int last)
 	 *
 	 * Drivers only receive valid protection block range.
 	 */
+	jtag_flush_origin_push("flash");
 	retval = bank->driver->protect(bank, set, first, last);
+	jtag_flush_origin_pop();
 	if (retval != ERROR_OK)
 		LOG_ERROR("failed setting protection for blocks %d to %d", first, last);
 
@@ -92,12 +488,19 @@ int flash_driver_protect(struct flash_bank *bank, int set, int first, int last)
 }
 
 int flash_driver_write(struct flash_bank *bank,
-	uint8_t *buffer, uint32_t offset, uint32_t count)
+	const uint8_t *buffer, uint32_t offset, uint32_t count)
 {
 	int retval;
 
+	flash_cache_forget(bank, offset, count);
+	target_memcache_invalidate(bank->target);
+
+	jtag_flush_origin_push("flash");
 	retval = bank->driver->write(bank, buffer, offset, count);
-	if (retval != ERROR_OK) {
+	jtag_flush_origin_pop();
+	if (retval == ERROR_OK)
+		flash_cache_record(bank, buffer, offset, count);
+	else {
 		LOG_ERROR(
 			"error writing to flash at address " TARGET_ADDR_FMT
 			" at offset 0x%8.8" PRIx32,
@@ -115,7 +518,9 @@ int flash_driver_read(struct flash_bank *bank,
 
 	LOG_DEBUG("call flash_driver_read()");
 
+	jtag_flush_origin_push("flash");
 	retval = bank->driver->read(bank, buffer, offset, count);
+	jtag_flush_origin_pop();
 	if (retval != ERROR_OK) {
 		LOG_ERROR(
 			"error reading to flash at address " TARGET_ADDR_FMT
@@ -188,6 +593,8 @@ void default_flash_free_driver_priv(struct flash_bank *bank)
 void flash_free_all_banks(void)
 {
 	struct flash_bank *bank = flash_banks;
+
+	flash_sector_cache_flush();
 	while (bank) {
 		struct flash_bank *next = bank->next;
 		if (bank->driver->free_driver_priv)
@@ -581,8 +988,103 @@ static int flash_iterate_address_range(struct target *target,
 int flash_erase_address_range(struct target *target,
 	bool pad, target_addr_t addr, uint32_t length)
 {
-	return flash_iterate_address_range(target, pad ? "erase" : NULL,
+	int retval = flash_iterate_address_range(target, pad ? "erase" : NULL,
 		addr, length, false, &flash_driver_erase);
+	flash_sector_cache_flush();
+	return retval;
+}
+
+/* Whether the bytes of a sector which no section of @a image writes to
+ * are erased, as they would be after erasing the sector */
+static bool flash_sector_rest_erased(struct flash_bank *bank, int index,
+	struct image *image)
+{
+	struct flash_sector *sector = &bank->sectors[index];
+	target_addr_t start = bank->base + sector->offset;
+	target_addr_t end = start + sector->size;
+
+	uint8_t *buffer = malloc(sector->size);
+	if (buffer == NULL)
+		return false;
+	if (flash_driver_read(bank, buffer, sector->offset, sector->size) != ERROR_OK) {
+		free(buffer);
+		return false;
+	}
+
+	/* the image decides what its own bytes become */
+	for (int s = 0; s < image->num_sections; s++) {
+		struct imagesection *section = &image->sections[s];
+		target_addr_t from = MAX(section->base_address, start);
+		target_addr_t to = MIN(section->base_address + section->size, end);
+		if (from < to)
+			memset(buffer + (from - start), bank->erased_value, to - from);
+	}
+
+	bool erased = true;
+	for (uint32_t i = 0; erased && i < sector->size; i++)
+		erased = buffer[i] == bank->erased_value;
+
+	free(buffer);
+	return erased;
+}
+
+/**
+ * Erase the sectors in a range which no section of @a image writes to,
+ * and those it writes only partly whose other bytes are not erased yet.
+ * This completes an erase deferred to an incremental write of the image,
+ * which then rewrites the parts of the erased sectors the image covers.
+ */
+int flash_erase_unwritten(struct target *target, struct image *image,
+	target_addr_t addr, uint32_t length)
+{
+	while (length > 0) {
+		struct flash_bank *c;
+		int retval = get_flash_bank_by_addr(target, addr, true, &c);
+		if (retval != ERROR_OK)
+			return retval;
+
+		uint32_t offset = addr - c->base;
+		uint32_t count = MIN(length, c->size - offset);
+		int first = -1;
+
+		for (int i = 0; i <= c->num_sectors; i++) {
+			bool erase = false;
+
+			if (i < c->num_sectors) {
+				target_addr_t start = c->base + c->sectors[i].offset;
+				target_addr_t end = start + c->sectors[i].size;
+
+				erase = start < addr + count && end > addr;
+				/* bytes of the sector the image writes, sections don't overlap */
+				target_addr_t written = 0;
+				for (int s = 0; erase && image && s < image->num_sections; s++) {
+					struct imagesection *section = &image->sections[s];
+					target_addr_t from = MAX(section->base_address, start);
+					target_addr_t to = MIN(section->base_address + section->size, end);
+					if (from < to)
+						written += to - from;
+				}
+				if (written >= c->sectors[i].size)
+					erase = false;
+				else if (written > 0)
+					erase = !flash_sector_rest_erased(c, i, image);
+			}
+
+			if (erase && first < 0)
+				first = i;
+			if (!erase && first >= 0) {
+				retval = flash_driver_erase(c, first, i - 1);
+				if (retval != ERROR_OK)
+					return retval;
+				first = -1;
+			}
+		}
+
+		addr += count;
+		length -= count;
+	}
+
+	return ERROR_OK;
 }
 
 static int flash_driver_unprotect(struct flash_bank *bank, int first, int last)
@@ -696,8 +1198,184 @@ static bool flash_write_check_gap(struct flash_bank *bank,
 }
 
 
+/* unlock, erase and program one run of an image */
+static int flash_write_run(struct flash_bank *c, const uint8_t *data,
+	target_addr_t run_address, uint32_t run_size, int erase, bool unlock)
+{
+	int retval = ERROR_OK;
+
+	if (unlock)
+		retval = flash_unlock_address_range(c->target, run_address, run_size);
+	if (retval == ERROR_OK) {
+		if (erase) {
+			/* calculate and erase sectors */
+			retval = flash_erase_address_range(c->target,
+					true, run_address, run_size);
+		}
+	}
+
+	if (retval == ERROR_OK) {
+		/* write flash sectors */
+		retval = flash_driver_write(c, data, run_address - c->base, run_size);
+	}
+
+	return retval;
+}
+
+/**
+ * Check whether the flash already holds @a data at @a address. Anything
+ * that keeps the check from completing counts as a difference.
+ */
+static bool flash_write_matches(struct flash_bank *c, const uint8_t *data,
+	target_addr_t address, uint32_t size)
+{
+	uint32_t checksum, contents;
+
+	image_calculate_checksum(data, size, &checksum);
+
+	if (flash_checksum(c, address - c->base, size, &contents) != ERROR_OK) {
+		LOG_DEBUG("couldn't check flash contents at " TARGET_ADDR_FMT, address);
+		return false;
+	}
+
+	return checksum == contents;
+}
+
+/* Program the part of [start, end) which the image changes */
+static int flash_write_diff_range(struct flash_bank *c, const uint8_t *data,
+	target_addr_t run_address, uint32_t start, uint32_t end,
+	int erase, bool unlock, struct flash_write_diff *diff)
+{
+	target_addr_t address = run_address + start;
+
+	if (diff->dry_run) {
+		LOG_INFO("flash %s: would write %" PRIu32 " bytes at " TARGET_ADDR_FMT,
+				c->name, end - start, address);
+		return ERROR_OK;
+	}
+
+	LOG_DEBUG("flash %s: writing %" PRIu32 " changed bytes at " TARGET_ADDR_FMT,
+			c->name, end - start, address);
+	return flash_write_run(c, data + start, address, end - start, erase, unlock);
+}
+
+/**
+ * Program one run of an image, skipping the sectors whose contents already
+ * match. The sector cache is asked first; without its help the whole run
+ * is compared, so that an unchanged run costs a single checksum, and then
+ * each sector. Consecutive differing sectors are erased and programmed
+ * together.
+ */
+static int flash_write_run_diff(struct flash_bank *c, const uint8_t *data,
+	target_addr_t run_address, uint32_t run_size, int erase, bool unlock,
+	struct flash_write_diff *diff, uint32_t *run_written)
+{
+	uint32_t run_offset = run_address - c->base;
+	uint32_t run_end = run_offset + run_size;
+	int retval;
+
+	*run_written = 0;
+
+	if (c->num_sectors == 0) {
+		diff->sectors_checked++;
+		if (flash_write_matches(c, data, run_address, run_size)) {
+			diff->bytes_unchanged += run_size;
+			return ERROR_OK;
+		}
+		diff->sectors_changed++;
+		*run_written = run_size;
+		return flash_write_diff_range(c, data, run_address, 0, run_size,
+				erase, unlock, diff);
+	}
+
+	/* sectors covered by the run */
+	int first = 0, last = c->num_sectors - 1;
+	while (first < c->num_sectors - 1
+			&& c->sectors[first].offset + c->sectors[first].size <= run_offset)
+		first++;
+	while (last > first && c->sectors[last].offset >= run_end)
+		last--;
+
+	diff->sectors_checked += last - first + 1;
+
+	/* what the sector cache knows, where it can be trusted */
+	enum flash_cache_state *known = calloc(last - first + 1, sizeof(*known));
+	if (known == NULL)
+		return ERROR_FAIL;
+
+	bool all_same = true, any_different = false;
+	bool use_cache = flash_cache_spot_check(c);
+	for (int sector = first; sector <= last; sector++) {
+		uint32_t start = MAX(c->sectors[sector].offset, run_offset);
+		uint32_t end = MIN(c->sectors[sector].offset + c->sectors[sector].size, run_end);
+
+		if (use_cache)
+			known[sector - first] = flash_cache_lookup(c, sector,
+					data + (start - run_offset), start, end - start);
+		all_same &= known[sector - first] == FLASH_CACHE_SAME;
+		any_different |= known[sector - first] == FLASH_CACHE_DIFFERENT;
+	}
+
+	if (all_same || (!any_different && flash_write_matches(c, data, run_address, run_size))) {
+		if (!all_same)
+			flash_cache_record(c, data, run_offset, run_size);
+		diff->bytes_unchanged += run_size;
+		free(known);
+		return ERROR_OK;
+	}
+
+	/* start of the pending range of differing sectors, relative to the run */
+	bool pending = false;
+	uint32_t pending_start = 0;
+
+	for (int sector = first; sector <= last; sector++) {
+		uint32_t start = MAX(c->sectors[sector].offset, run_offset) - run_offset;
+		uint32_t end = MIN(c->sectors[sector].offset + c->sectors[sector].size, run_end)
+				- run_offset;
+		enum flash_cache_state state = known[sector - first];
+
+		if (state == FLASH_CACHE_UNKNOWN) {
+			if (flash_write_matches(c, data + start, run_address + start, end - start)) {
+				flash_cache_record(c, data + start, run_offset + start, end - start);
+				state = FLASH_CACHE_SAME;
+			}
+		}
+
+		if (state != FLASH_CACHE_SAME) {
+			diff->sectors_changed++;
+			if (!pending) {
+				pending = true;
+				pending_start = start;
+			}
+			continue;
+		}
+
+		diff->bytes_unchanged += end - start;
+		if (pending) {
+			retval = flash_write_diff_range(c, data, run_address, pending_start, start,
+					erase, unlock, diff);
+			if (retval != ERROR_OK)
+				goto done;
+			*run_written += start - pending_start;
+			pending = false;
+		}
+	}
+
+	retval = ERROR_OK;
+	if (pending) {
+		retval = flash_write_diff_range(c, data, run_address, pending_start, run_size,
+				erase, unlock, diff);
+		if (retval == ERROR_OK)
+			*run_written += run_size - pending_start;
+	}
+
+done:
+	free(known);
+	return retval;
+}
+
 int flash_write_unlock(struct target *target, struct image *image,
-	uint32_t *written, int erase, bool unlock)
+	uint32_t *written, int erase, bool unlock, struct flash_write_diff *incremental)
 {
 	int retval = ERROR_OK;
 
@@ -709,6 +1387,9 @@ int flash_write_unlock(struct target *target, struct image *image,
 	section = 0;
 	section_offset = 0;
 
+	/* spot check each bank's sector cache once per write */
+	flash_cache_generation++;
+
 	if (written)
 		*written = 0;
 
@@ -864,78 +1545,86 @@ int flash_write_unlock(struct target *target, struct image *image,
 			run_size += delta;
 		}
 
-		/* allocate buffer */
-		buffer = malloc(run_size);
-		if (buffer == NULL) {
-			LOG_ERROR("Out of memory for flash bank buffer");
-			retval = ERROR_FAIL;
-			goto done;
-		}
-
-		if (padding_at_start)
-			memset(buffer, c->default_padded_value, padding_at_start);
-
-		buffer_idx = padding_at_start;
-
-		/* read sections to the buffer */
-		while (buffer_idx < run_size) {
-			size_t size_read;
-
-			size_read = run_size - buffer_idx;
-			if (size_read > sections[section]->size - section_offset)
-				size_read = sections[section]->size - section_offset;
-
-			/* KLUDGE!
-			 *
-			 * #¤%#"%¤% we have to figure out the section # from the sorted
-			 * list of pointers to sections to invoke image_read_section()...
-			 */
-			intptr_t diff = (intptr_t)sections[section] - (intptr_t)image->sections;
-			int t_section_num = diff / sizeof(struct imagesection);
-
-			LOG_DEBUG("image_read_section: section = %d, t_section_num = %d, "
-					"section_offset = %"PRIu32", buffer_idx = %"PRIu32", size_read = %zu",
-				section, t_section_num, section_offset,
-				buffer_idx, size_read);
-			retval = image_read_section(image, t_section_num, section_offset,
-					size_read, buffer + buffer_idx, &size_read);
-			if (retval != ERROR_OK || size_read == 0) {
-				free(buffer);
-				goto done;
-			}
-
-			buffer_idx += size_read;
-			section_offset += size_read;
-
-			/* see if we need to pad the section */
-			if (padding[section]) {
-				memset(buffer + buffer_idx, c->default_padded_value, padding[section]);
-				buffer_idx += padding[section];
-			}
+		/* A run of a single section without any padding is written
+		 * straight from the image, if the image holds it in memory */
+		const uint8_t *data = NULL;
+		if (section_last == section && padding_at_start == 0 && padding[section] == 0)
+			data = image_section_data(image, sections[section] - image->sections);
 
+		if (data != NULL) {
+			buffer = NULL;
+			data += section_offset;
+			section_offset += run_size;
 			if (section_offset >= sections[section]->size) {
 				section++;
 				section_offset = 0;
 			}
-		}
+		} else {
+			/* allocate buffer */
+			buffer = malloc(run_size);
+			if (buffer == NULL) {
+				LOG_ERROR("Out of memory for flash bank buffer");
+				retval = ERROR_FAIL;
+				goto done;
+			}
 
-		retval = ERROR_OK;
+			if (padding_at_start)
+				memset(buffer, c->default_padded_value, padding_at_start);
+
+			buffer_idx = padding_at_start;
+
+			/* read sections to the buffer */
+			while (buffer_idx < run_size) {
+				size_t size_read;
+
+				size_read = run_size - buffer_idx;
+				if (size_read > sections[section]->size - section_offset)
+					size_read = sections[section]->size - section_offset;
+
+				/* KLUDGE!
+				 *
+				 * #¤%#"%¤% we have to figure out the section # from the sorted
+				 * list of pointers to sections to invoke image_read_section()...
+				 */
+				intptr_t diff = (intptr_t)sections[section] - (intptr_t)image->sections;
+				int t_section_num = diff / sizeof(struct imagesection);
+
+				LOG_DEBUG("image_read_section: section = %d, t_section_num = %d, "
+						"section_offset = %"PRIu32", buffer_idx = %"PRIu32", size_read = %zu",
+					section, t_section_num, section_offset,
+					buffer_idx, size_read);
+				retval = image_read_section(image, t_section_num, section_offset,
+						size_read, buffer + buffer_idx, &size_read);
+				if (retval != ERROR_OK || size_read == 0) {
+					free(buffer);
+					goto done;
+				}
 
-		if (unlock)
-			retval = flash_unlock_address_range(target, run_address, run_size);
-		if (retval == ERROR_OK) {
-			if (erase) {
-				/* calculate and erase sectors */
-				retval = flash_erase_address_range(target,
-						true, run_address, run_size);
+				buffer_idx += size_read;
+				section_offset += size_read;
+
+				/* see if we need to pad the section */
+				if (padding[section]) {
+					memset(buffer + buffer_idx, c->default_padded_value, padding[section]);
+					buffer_idx += padding[section];
+				}
+
+				if (section_offset >= sections[section]->size) {
+					section++;
+					section_offset = 0;
+				}
 			}
-		}
 
-		if (retval == ERROR_OK) {
-			/* write flash sectors */
-			retval = flash_driver_write(c, buffer, run_address - c->base, run_size);
+			data = buffer;
 		}
 
+		uint32_t run_written = run_size;
+		if (incremental)
+			retval = flash_write_run_diff(c, data, run_address, run_size,
+					erase, unlock, incremental, &run_written);
+		else
+			retval = flash_write_run(c, data, run_address, run_size, erase, unlock);
+
 		free(buffer);
 
 		if (retval != ERROR_OK) {
@@ -944,12 +1633,13 @@ int flash_write_unlock(struct target *target, struct image *image,
 		}
 
 		if (written != NULL)
-			*written += run_size;	/* add run size to total written counter */
+			*written += run_written;	/* add run size to total written counter */
 	}
 
 done:
 	free(sections);
 	free(padding);
+	flash_sector_cache_flush();
 
 	return retval;
 }
@@ -957,7 +1647,21 @@ done:
 int flash_write(struct target *target, struct image *image,
 	uint32_t *written, int erase)
 {
-	return flash_write_unlock(target, image, written, erase, false);
+	return flash_write_unlock(target, image, written, erase, false, NULL);
+}
+
+int flash_write_changed(struct target *target, struct image *image,
+	uint32_t *written, int erase)
+{
+	struct flash_write_diff diff;
+
+	memset(&diff, 0, sizeof(diff));
+	int retval = flash_write_unlock(target, image, written, erase, false, &diff);
+	if (retval == ERROR_OK)
+		LOG_INFO("%u of %u sectors rewritten, %" PRIu32 " bytes unchanged",
+				diff.sectors_changed, diff.sectors_checked, diff.bytes_unchanged);
+
+	return retval;
 }
 
 struct flash_sector *alloc_block_array(uint32_t offset, uint32_t size, int num_blocks)
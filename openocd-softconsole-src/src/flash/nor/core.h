@@ -157,6 +157,32 @@ int flash_erase_address_range(struct target *target,
 int flash_unlock_address_range(struct target *target, target_addr_t addr,
 		uint32_t length);
 
+/**
+ * Erases the sectors of the given range which no section of @a image
+ * covers, and those it covers partly whose remaining bytes are not erased.
+ * The other sectors are left to an incremental write of the image.
+ * @returns ERROR_OK if successful; otherwise, an error code.
+ */
+int flash_erase_unwritten(struct target *target, struct image *image,
+		target_addr_t addr, uint32_t length);
+
+/**
+ * Keeps the checksums of the sectors written to flash in @a filename,
+ * so that incremental writes in later sessions can skip sectors which
+ * already hold the image without reading them. The cache of a bank is
+ * keyed by bank name, base and size and the IDCODE of its TAP, plus the
+ * optional @a device_tag, e.g. a board serial number.
+ */
+int flash_sector_cache_open(const char *filename, const char *device_tag);
+void flash_sector_cache_close(void);
+void flash_sector_cache_clear(void);
+/** Saves the sector cache if it changed, done once per flash operation. */
+void flash_sector_cache_flush(void);
+bool flash_sector_cache_enabled(void);
+const char *flash_sector_cache_file(void);
+/** @returns the number of sectors with a known checksum. */
+unsigned flash_sector_cache_count(void);
+
 /**
  * Align start address of a flash write region according to bank requirements.
  * @param bank Pointer to bank descriptor structure
@@ -186,6 +212,13 @@ target_addr_t flash_write_align_end(struct flash_bank *bank, target_addr_t addr)
 int flash_write(struct target *target,
 		struct image *image, uint32_t *written, int erase);
 
+/**
+ * Like flash_write(), but only erases and programs the sectors whose
+ * contents differ from @a image.
+ */
+int flash_write_changed(struct target *target,
+		struct image *image, uint32_t *written, int erase);
+
 /**
  * Forces targets to re-examine their erase/protection state.
  * This routine must be called when the system may modify the status.
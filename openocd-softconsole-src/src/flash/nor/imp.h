@@ -38,12 +38,22 @@ struct flash_bank *flash_bank_list(void);
 int flash_driver_erase(struct flash_bank *bank, int first, int last);
 int flash_driver_protect(struct flash_bank *bank, int set, int first, int last);
 int flash_driver_write(struct flash_bank *bank,
-		uint8_t *buffer, uint32_t offset, uint32_t count);
+		const uint8_t *buffer, uint32_t offset, uint32_t count);
 int flash_driver_read(struct flash_bank *bank,
 		uint8_t *buffer, uint32_t offset, uint32_t count);
 
-/* write (optional verify) an image to flash memory of the given target */
+/** Incremental programming state for flash_write_unlock(). */
+struct flash_write_diff {
+	/* only find the sectors that differ, don't modify the flash */
+	bool dry_run;
+	unsigned sectors_checked;
+	unsigned sectors_changed;
+	uint32_t bytes_unchanged;
+};
+
+/* write (optional verify) an image to flash memory of the given target,
+ * only touching the sectors that differ from the image if incremental is given */
 int flash_write_unlock(struct target *target, struct image *image,
-		uint32_t *written, int erase, bool unlock);
+		uint32_t *written, int erase, bool unlock, struct flash_write_diff *incremental);
 
 #endif /* OPENOCD_FLASH_NOR_IMP_H */
@@ -71,8 +71,7 @@ static void jtagspi_set_ir(struct flash_bank *bank)
 
 static void flip_u8(uint8_t *in, uint8_t *out, int len)
 {
-	for (int i = 0; i < len; i++)
-		out[i] = flip_u32(in[i], 8);
+	buf_bit_reverse(out, in, len);
 }
 
 static int jtagspi_cmd(struct flash_bank *bank, uint8_t cmd,
@@ -239,7 +238,7 @@ static void jtagspi_read_status(struct flash_bank *bank, uint32_t *status)
 
 static int jtagspi_wait(struct flash_bank *bank, int timeout_ms)
 {
-	uint32_t status;
+	uint32_t status = SPIFLASH_BSY_BIT;
 	int64_t t0 = timeval_ms();
 	int64_t dt;
 
@@ -259,7 +258,7 @@ static int jtagspi_wait(struct flash_bank *bank, int timeout_ms)
 
 static int jtagspi_write_enable(struct flash_bank *bank)
 {
-	uint32_t status;
+	uint32_t status = 0;
 
 	jtagspi_cmd(bank, SPIFLASH_WRITE_ENABLE, NULL, NULL, 0);
 	jtagspi_read_status(bank, &status);
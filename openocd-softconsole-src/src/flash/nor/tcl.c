@@ -22,9 +22,15 @@
 #include "config.h"
 #endif
 #include "imp.h"
+#include <helper/configuration.h>
 #include <helper/time_support.h>
 #include <target/image.h>
 
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/wait.h>
+#endif
+
 /**
  * @file
  * Implements Tcl commands used to access NOR flash facilities.
@@ -415,6 +421,10 @@ COMMAND_HANDLER(handle_flash_write_image_command)
 	/* flash auto-erase is disabled by default*/
 	int auto_erase = 0;
 	bool auto_unlock = false;
+	bool incremental = false;
+	struct flash_write_diff diff;
+
+	memset(&diff, 0, sizeof(diff));
 
 	while (CMD_ARGC) {
 		if (strcmp(CMD_ARGV[0], "erase") == 0) {
@@ -427,6 +437,17 @@ COMMAND_HANDLER(handle_flash_write_image_command)
 			CMD_ARGV++;
 			CMD_ARGC--;
 			command_print(CMD, "auto unlock enabled");
+		} else if (strcmp(CMD_ARGV[0], "incremental") == 0) {
+			incremental = true;
+			CMD_ARGV++;
+			CMD_ARGC--;
+			command_print(CMD, "incremental write enabled");
+		} else if (strcmp(CMD_ARGV[0], "dry_run") == 0) {
+			incremental = true;
+			diff.dry_run = true;
+			CMD_ARGV++;
+			CMD_ARGC--;
+			command_print(CMD, "dry run, flash will not be modified");
 		} else
 			break;
 	}
@@ -456,13 +477,19 @@ COMMAND_HANDLER(handle_flash_write_image_command)
 	if (retval != ERROR_OK)
 		return retval;
 
-	retval = flash_write_unlock(target, &image, &written, auto_erase, auto_unlock);
+	retval = flash_write_unlock(target, &image, &written, auto_erase, auto_unlock,
+			incremental ? &diff : NULL);
 	if (retval != ERROR_OK) {
 		image_close(&image);
 		return retval;
 	}
 
-	if ((ERROR_OK == retval) && (duration_measure(&bench) == ERROR_OK)) {
+	if (incremental)
+		command_print(CMD, "%u of %u sectors %s, %" PRIu32 " bytes unchanged",
+				diff.sectors_changed, diff.sectors_checked,
+				diff.dry_run ? "differ" : "rewritten", diff.bytes_unchanged);
+
+	if ((ERROR_OK == retval) && !diff.dry_run && (duration_measure(&bench) == ERROR_OK)) {
 		command_print(CMD, "wrote %" PRIu32 " bytes from file %s "
 			"in %fs (%0.3f KiB/s)", written, CMD_ARGV[0],
 			duration_elapsed(&bench), duration_kbps(&bench, written));
@@ -1038,10 +1065,11 @@ static const struct command_registration flash_exec_command_handlers[] = {
 		.name = "write_image",
 		.handler = handle_flash_write_image_command,
 		.mode = COMMAND_EXEC,
-		.usage = "[erase] [unlock] filename [offset [file_type]]",
+		.usage = "[erase] [unlock] [incremental|dry_run] filename [offset [file_type]]",
 		.help = "Write an image to flash.  Optionally first unprotect "
 			"and/or erase the region to be used.  Allow optional "
-			"offset from beginning of bank (defaults to zero)",
+			"offset from beginning of bank (defaults to zero).  "
+			"Incremental writes only touch sectors that differ.",
 	},
 	{
 		.name = "read_bank",
@@ -1160,6 +1188,31 @@ COMMAND_HANDLER(handle_flash_bank_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_flash_sector_cache_command)
+{
+	if (CMD_ARGC > 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1 && strcmp(CMD_ARGV[0], "off") == 0) {
+		flash_sector_cache_close();
+	} else if (CMD_ARGC == 1 && strcmp(CMD_ARGV[0], "clear") == 0) {
+		flash_sector_cache_clear();
+	} else if (CMD_ARGC >= 1) {
+		int retval = flash_sector_cache_open(CMD_ARGV[0],
+				CMD_ARGC == 2 ? CMD_ARGV[1] : NULL);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	if (flash_sector_cache_enabled())
+		command_print(CMD, "flash sector cache %s, %u sectors known",
+				flash_sector_cache_file(), flash_sector_cache_count());
+	else
+		command_print(CMD, "flash sector cache disabled");
+
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_flash_banks_command)
 {
 	if (CMD_ARGC != 0)
@@ -1248,6 +1301,14 @@ static const struct command_registration flash_config_command_handlers[] = {
 		.help = "Display table with information about flash banks.",
 		.usage = "",
 	},
+	{
+		.name = "sector_cache",
+		.mode = COMMAND_ANY,
+		.handler = handle_flash_sector_cache_command,
+		.help = "Keep the checksums of written sectors in a file so that "
+			"incremental writes can skip unchanged sectors.",
+		.usage = "[filename [device_tag] | off | clear]",
+	},
 	{
 		.name = "list",
 		.mode = COMMAND_ANY,
@@ -1256,6 +1317,299 @@ static const struct command_registration flash_config_command_handlers[] = {
 	},
 	COMMAND_REGISTRATION_DONE
 };
+#ifndef _WIN32
+
+/* A program_parallel job, run by an OpenOCD process of its own */
+struct program_job {
+	char *name;
+	char **argv;
+	pid_t pid;
+	/* output of the process, -1 once it exited */
+	int fd;
+	char line[256];
+	size_t line_len;
+	int status;
+	struct duration bench;
+};
+
+static int program_job_start(struct program_job *job)
+{
+	int pipefd[2];
+
+	if (pipe(pipefd) != 0) {
+		LOG_ERROR("%s: couldn't create pipe: %s", job->name, strerror(errno));
+		return ERROR_FAIL;
+	}
+
+	duration_start(&job->bench);
+
+	job->pid = fork();
+	if (job->pid < 0) {
+		LOG_ERROR("%s: couldn't start OpenOCD: %s", job->name, strerror(errno));
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return ERROR_FAIL;
+	}
+
+	if (job->pid == 0) {
+		dup2(pipefd[1], STDOUT_FILENO);
+		dup2(pipefd[1], STDERR_FILENO);
+
+		/* don't pass on our sockets, adapter handles and other jobs' pipes */
+		long max_fd = sysconf(_SC_OPEN_MAX);
+		if (max_fd < 0 || max_fd > 65536)
+			max_fd = 65536;
+		for (int fd = STDERR_FILENO + 1; fd < max_fd; fd++)
+			close(fd);
+
+		execv(job->argv[0], job->argv);
+		fprintf(stderr, "couldn't run %s: %s\n", job->argv[0], strerror(errno));
+		_exit(127);
+	}
+
+	close(pipefd[1]);
+	job->fd = pipefd[0];
+
+	return ERROR_OK;
+}
+
+/* Log the output of a job line by line, prefixed by its name */
+static void program_job_output(struct program_job *job)
+{
+	char buffer[1024];
+	ssize_t count = read(job->fd, buffer, sizeof(buffer));
+
+	if (count < 0 && (errno == EINTR || errno == EAGAIN))
+		return;
+
+	for (ssize_t i = 0; i < count; i++) {
+		bool full = job->line_len == sizeof(job->line) - 1;
+		if (buffer[i] != '\n' && !full) {
+			if (buffer[i] != '\r')
+				job->line[job->line_len++] = buffer[i];
+			continue;
+		}
+		job->line[job->line_len] = '\0';
+		LOG_USER("%s: %s", job->name, job->line);
+		job->line_len = 0;
+		if (full && buffer[i] != '\n')
+			job->line[job->line_len++] = buffer[i];
+	}
+
+	if (count > 0)
+		return;
+
+	/* end of output, the process is exiting */
+	if (job->line_len) {
+		job->line[job->line_len] = '\0';
+		LOG_USER("%s: %s", job->name, job->line);
+	}
+	close(job->fd);
+	job->fd = -1;
+
+	while (waitpid(job->pid, &job->status, 0) < 0) {
+		if (errno != EINTR) {
+			job->status = -1;
+			break;
+		}
+	}
+	duration_measure(&job->bench);
+}
+
+/* Build the command line of an OpenOCD process running "program" for
+ * the job described by {name config_file filename [program args ...]} */
+static int program_job_parse(struct command_invocation *cmd, struct program_job *job,
+	const char *exe, const char *description)
+{
+	Jim_Interp *interp = CMD_CTX->interp;
+	Jim_Obj *list = Jim_NewStringObj(interp, description, -1);
+	int retval = ERROR_OK;
+
+	Jim_IncrRefCount(list);
+
+	int len = Jim_ListLength(interp, list);
+	if (len < 3) {
+		command_print(CMD, "program_parallel: job needs a name, a configuration file "
+				"and an image: %s", description);
+		retval = ERROR_COMMAND_SYNTAX_ERROR;
+		goto done;
+	}
+
+	job->name = strdup(Jim_GetString(Jim_ListGetIndex(interp, list, 0), NULL));
+
+	char *program = alloc_printf("program {%s}",
+			Jim_GetString(Jim_ListGetIndex(interp, list, 2), NULL));
+	for (int i = 3; program && i < len; i++) {
+		char *next = alloc_printf("%s %s", program,
+				Jim_GetString(Jim_ListGetIndex(interp, list, i), NULL));
+		free(program);
+		program = next;
+	}
+	if (program) {
+		char *next = alloc_printf("%s exit", program);
+		free(program);
+		program = next;
+	}
+
+	char **dirs = get_script_search_dirs();
+	int num_dirs = 0;
+	while (dirs && dirs[num_dirs])
+		num_dirs++;
+
+	/* exe, -s dir..., -f config, 3 ports, program, NULL */
+	job->argv = calloc(2 * num_dirs + 12, sizeof(char *));
+	if (job->name == NULL || program == NULL || job->argv == NULL) {
+		free(program);
+		retval = ERROR_FAIL;
+		goto done;
+	}
+
+	int argc = 0;
+	job->argv[argc++] = strdup(exe);
+	for (int i = 0; i < num_dirs; i++) {
+		job->argv[argc++] = strdup("-s");
+		job->argv[argc++] = strdup(dirs[i]);
+	}
+	job->argv[argc++] = strdup("-f");
+	job->argv[argc++] = strdup(Jim_GetString(Jim_ListGetIndex(interp, list, 1), NULL));
+	job->argv[argc++] = strdup("-c");
+	job->argv[argc++] = strdup("gdb_port disabled; telnet_port disabled; tcl_port disabled");
+	job->argv[argc++] = strdup("-c");
+	job->argv[argc++] = program;
+
+done:
+	Jim_DecrRefCount(interp, list);
+	return retval;
+}
+
+static void program_job_free(struct program_job *job)
+{
+	if (job->argv) {
+		for (char **arg = job->argv; *arg; arg++)
+			free(*arg);
+		free(job->argv);
+	}
+	free(job->name);
+}
+
+COMMAND_HANDLER(handle_program_parallel_command)
+{
+	if (CMD_ARGC < 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	char *exe = find_exe_file();
+	if (exe == NULL) {
+		LOG_ERROR("couldn't determine the OpenOCD executable");
+		return ERROR_FAIL;
+	}
+
+	struct program_job *jobs = calloc(CMD_ARGC, sizeof(*jobs));
+	if (jobs == NULL) {
+		free(exe);
+		return ERROR_FAIL;
+	}
+
+	int retval = ERROR_OK;
+	unsigned num_jobs = 0;
+	for (; num_jobs < CMD_ARGC; num_jobs++) {
+		jobs[num_jobs].fd = -1;
+		retval = program_job_parse(cmd, &jobs[num_jobs], exe, CMD_ARGV[num_jobs]);
+		if (retval != ERROR_OK) {
+			num_jobs++;
+			goto done;
+		}
+	}
+
+	unsigned running = 0;
+	for (unsigned i = 0; i < num_jobs; i++) {
+		if (program_job_start(&jobs[i]) != ERROR_OK) {
+			jobs[i].status = -1;
+			continue;
+		}
+		running++;
+	}
+
+	struct pollfd *fds = calloc(num_jobs, sizeof(*fds));
+	struct program_job **polled = calloc(num_jobs, sizeof(*polled));
+	if (fds == NULL || polled == NULL)
+		running = 0;
+
+	while (running) {
+		nfds_t nfds = 0;
+		for (unsigned i = 0; i < num_jobs; i++) {
+			if (jobs[i].fd < 0)
+				continue;
+			fds[nfds].fd = jobs[i].fd;
+			fds[nfds].events = POLLIN;
+			fds[nfds].revents = 0;
+			polled[nfds++] = &jobs[i];
+		}
+
+		int ready = poll(fds, nfds, 100);
+		keep_alive();
+		if (ready < 0 && errno != EINTR) {
+			LOG_ERROR("program_parallel: poll failed: %s", strerror(errno));
+			break;
+		}
+
+		for (nfds_t i = 0; ready > 0 && i < nfds; i++) {
+			if (fds[i].revents == 0)
+				continue;
+			program_job_output(polled[i]);
+			if (polled[i]->fd < 0)
+				running--;
+		}
+	}
+	free(polled);
+	free(fds);
+
+	/* don't leave orphans behind if polling failed */
+	for (unsigned i = 0; i < num_jobs; i++) {
+		if (jobs[i].fd < 0)
+			continue;
+		kill(jobs[i].pid, SIGTERM);
+		close(jobs[i].fd);
+		jobs[i].fd = -1;
+		waitpid(jobs[i].pid, NULL, 0);
+		jobs[i].status = -1;
+		duration_measure(&jobs[i].bench);
+	}
+
+	for (unsigned i = 0; i < num_jobs; i++) {
+		struct program_job *job = &jobs[i];
+		if (job->status == 0 && job->pid > 0) {
+			command_print(CMD, "%s: programmed in %fs", job->name,
+					duration_elapsed(&job->bench));
+			continue;
+		}
+
+		if (job->pid > 0 && WIFEXITED(job->status))
+			command_print(CMD, "%s: failed with exit status %d after %fs", job->name,
+					WEXITSTATUS(job->status), duration_elapsed(&job->bench));
+		else
+			command_print(CMD, "%s: failed", job->name);
+		retval = ERROR_FAIL;
+	}
+
+done:
+	for (unsigned i = 0; i < num_jobs; i++)
+		program_job_free(&jobs[i]);
+	free(jobs);
+	free(exe);
+
+	return retval;
+}
+
+#else
+
+COMMAND_HANDLER(handle_program_parallel_command)
+{
+	LOG_ERROR("program_parallel is not supported on this host");
+	return ERROR_FAIL;
+}
+
+#endif
+
 static const struct command_registration flash_command_handlers[] = {
 	{
 		.name = "flash",
@@ -1264,6 +1618,15 @@ static const struct command_registration flash_command_handlers[] = {
 		.chain = flash_config_command_handlers,
 		.usage = "",
 	},
+	{
+		.name = "program_parallel",
+		.mode = COMMAND_ANY,
+		.handler = handle_program_parallel_command,
+		.help = "Program the targets on several adapters at once, each "
+			"job running the program command in an OpenOCD process "
+			"of its own.",
+		.usage = "{name config_file filename [verify] [reset] [offset]} ...",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -386,8 +386,7 @@ static int isc_set_data_done(struct flash_bank *bank, int sector)
 
 static void flip_u8(uint8_t *out, const uint8_t *in, int len)
 {
-	for (int i = 0; i < len; i++)
-		out[i] = flip_u32(in[i], 8);
+	buf_bit_reverse(out, in, len);
 }
 
 /*
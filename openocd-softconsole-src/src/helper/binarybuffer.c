@@ -50,6 +50,14 @@ static const char hex_digits[] = {
 	'a', 'b', 'c', 'd', 'e', 'f'
 };
 
+/* value of a hexadecimal digit plus one, zero for other characters */
+static const uint8_t hex_values[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
 void *buf_cpy(const void *from, void *_to, unsigned size)
 {
 	if (NULL == from || NULL == _to)
@@ -128,49 +136,124 @@ void *buf_set_ones(void *_buf, unsigned size)
 	return buf;
 }
 
+/* copy len bits one by one, starting at bit sq of src and dq of dst */
+static void buf_set_bits(const uint8_t *src, unsigned sq,
+	uint8_t *dst, unsigned dq, unsigned len)
+{
+	for (unsigned i = 0; i < len; i++) {
+		if (((*src >> (sq&7)) & 1) == 1)
+			*dst |= 1 << (dq&7);
+		else
+			*dst &= ~(1 << (dq&7));
+		if (sq++ == 7) {
+			sq = 0;
+			src++;
+		}
+		if (dq++ == 7) {
+			dq = 0;
+			dst++;
+		}
+	}
+}
+
 void *buf_set_buf(const void *_src, unsigned src_start,
 	void *_dst, unsigned dst_start, unsigned len)
 {
 	const uint8_t *src = _src;
 	uint8_t *dst = _dst;
-	unsigned i, sb, db, sq, dq, lb, lq;
+	unsigned i, sq, dq, lb, lq;
 
-	sb = src_start / 8;
-	db = dst_start / 8;
+	src += src_start / 8;
+	dst += dst_start / 8;
 	sq = src_start % 8;
 	dq = dst_start % 8;
+
+	/* copy single bits until the destination is on a byte boundary */
+	if (dq) {
+		unsigned head = MIN(len, 8 - dq);
+		buf_set_bits(src, sq, dst, dq, head);
+		if (head == len)
+			return _dst;
+		src += (sq + head) / 8;
+		sq = (sq + head) % 8;
+		dst++;
+		len -= head;
+	}
+
 	lb = len / 8;
 	lq = len % 8;
 
-	src += sb;
-	dst += db;
+	if (sq == 0) {
+		/* both buffers are on a byte boundary */
+		memcpy(dst, src, lb);
+	} else {
+		/* assemble every destination byte from two source bytes, eight
+		 * at a time. The source holds at least lb + 1 bytes here. */
+		for (i = 0; i + 8 <= lb; i += 8) {
+			uint64_t word = le_to_h_u64(src + i) >> sq;
+			word |= (uint64_t)src[i + 8] << (64 - sq);
+			h_u64_to_le(dst + i, word);
+		}
+		for (; i < lb; i++)
+			dst[i] = (src[i] >> sq) | (src[i + 1] << (8 - sq));
+	}
+
+	buf_set_bits(src + lb, sq, dst + lb, 0, lq);
+
+	return _dst;
+}
+
+static inline uint64_t bit_reverse_bytes_u64(uint64_t value)
+{
+	value = ((value >> 1) & 0x5555555555555555ull) | ((value & 0x5555555555555555ull) << 1);
+	value = ((value >> 2) & 0x3333333333333333ull) | ((value & 0x3333333333333333ull) << 2);
+	return ((value >> 4) & 0x0f0f0f0f0f0f0f0full) | ((value & 0x0f0f0f0f0f0f0f0full) << 4);
+}
+
+void buf_bit_reverse(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	size_t i;
 
-	/* check if both buffers are on byte boundary and
-	 * len is a multiple of 8bit so we can simple copy
-	 * the buffer */
-	if ((sq == 0) && (dq == 0) &&  (lq == 0)) {
-		for (i = 0; i < lb; i++)
-			*dst++ = *src++;
-		return _dst;
+	/* bytes are reversed in place, so host byte order doesn't matter */
+	for (i = 0; i + 8 <= count; i += 8) {
+		uint64_t word;
+		memcpy(&word, src + i, sizeof(word));
+		word = bit_reverse_bytes_u64(word);
+		memcpy(dst + i, &word, sizeof(word));
 	}
+	for (; i < count; i++)
+		dst[i] = bit_reverse_table256[src[i]];
+}
 
-	/* fallback to slow bit copy */
-	for (i = 0; i < len; i++) {
-		if (((*src >> (sq&7)) & 1) == 1)
-			*dst |= 1 << (dq&7);
-		else
-			*dst &= ~(1 << (dq&7));
-		if (sq++ == 7) {
-			sq = 0;
-			src++;
-		}
-		if (dq++ == 7) {
-			dq = 0;
-			dst++;
+uint8_t buf_checksum(const void *_buf, size_t len)
+{
+	const uint64_t lane_mask = 0x00ff00ff00ff00ffULL;
+	const uint8_t *buf = _buf;
+	uint8_t checksum = 0;
+	size_t i = 0;
+
+	/* Eight bytes per step into four 16 bit lanes, each collecting two
+	 * bytes per word: 128 * 2 * 255 < 65536, so no lane carries over
+	 * before the lanes are added up. */
+	while (len - i >= 8) {
+		size_t words = (len - i) / 8;
+		uint64_t acc = 0;
+
+		if (words > 128)
+			words = 128;
+		for (size_t n = 0; n < words; n++, i += 8) {
+			uint64_t w;
+			memcpy(&w, buf + i, sizeof(w));
+			acc += (w & lane_mask) + ((w >> 8) & lane_mask);
 		}
+		uint32_t sum = (acc & 0xffff) + ((acc >> 16) & 0xffff) +
+			((acc >> 32) & 0xffff) + (acc >> 48);
+		checksum += sum % 256;
 	}
+	for (; i < len; i++)
+		checksum += buf[i];
 
-	return _dst;
+	return checksum;
 }
 
 uint32_t flip_u32(uint32_t value, unsigned int num)
@@ -389,27 +472,29 @@ void bit_copy_discard(struct bit_copy_queue *q)
 size_t unhexify(uint8_t *bin, const char *hex, size_t count)
 {
 	size_t i;
-	char tmp;
 
 	if (!bin || !hex)
 		return 0;
 
-	memset(bin, 0, count);
+	for (i = 0; i < count; i++) {
+		uint8_t high = hex_values[(uint8_t)hex[2 * i]];
+		if (!high)
+			break;
 
-	for (i = 0; i < 2 * count; i++) {
-		if (hex[i] >= 'a' && hex[i] <= 'f')
-			tmp = hex[i] - 'a' + 10;
-		else if (hex[i] >= 'A' && hex[i] <= 'F')
-			tmp = hex[i] - 'A' + 10;
-		else if (hex[i] >= '0' && hex[i] <= '9')
-			tmp = hex[i] - '0';
-		else
-			return i / 2;
+		uint8_t low = hex_values[(uint8_t)hex[2 * i + 1]];
+		if (!low) {
+			/* keep the odd digit, but don't count the pair */
+			bin[i++] = (high - 1) << 4;
+			memset(bin + i, 0, count - i);
+			return i - 1;
+		}
 
-		bin[i / 2] |= tmp << (4 * ((i + 1) % 2));
+		bin[i] = ((high - 1) << 4) | (low - 1);
 	}
 
-	return i / 2;
+	memset(bin + i, 0, count - i);
+
+	return i;
 }
 
 /**
@@ -427,16 +512,21 @@ size_t unhexify(uint8_t *bin, const char *hex, size_t count)
 size_t hexify(char *hex, const uint8_t *bin, size_t count, size_t length)
 {
 	size_t i;
-	uint8_t tmp;
 
 	if (!length)
 		return 0;
 
-	for (i = 0; i < length - 1 && i < 2 * count; i++) {
-		tmp = (bin[i / 2] >> (4 * ((i + 1) % 2))) & 0x0f;
-		hex[i] = hex_digits[tmp];
+	size_t pairs = MIN(count, (length - 1) / 2);
+	for (i = 0; i < pairs; i++) {
+		hex[2 * i] = hex_digits[bin[i] >> 4];
+		hex[2 * i + 1] = hex_digits[bin[i] & 0x0f];
 	}
 
+	i = 2 * pairs;
+	/* room for the high digit of one more byte only */
+	if (i < length - 1 && pairs < count)
+		hex[i++] = hex_digits[bin[pairs] >> 4];
+
 	hex[i] = 0;
 
 	return i;
@@ -452,13 +542,28 @@ void buffer_shr(void *_buf, unsigned buf_len, unsigned count)
 	bytes_to_remove = count / 8;
 	shift = count - (bytes_to_remove * 8);
 
-	for (i = 0; i < (buf_len - 1); i++)
-		buf[i] = (buf[i] >> shift) | ((buf[i+1] << (8 - shift)) & 0xff);
-
-	buf[(buf_len - 1)] = buf[(buf_len - 1)] >> shift;
+	if (bytes_to_remove >= buf_len) {
+		memset(buf, 0, buf_len);
+		return;
+	}
 
 	if (bytes_to_remove) {
 		memmove(buf, &buf[bytes_to_remove], buf_len - bytes_to_remove);
 		memset(&buf[buf_len - bytes_to_remove], 0, bytes_to_remove);
+		buf_len -= bytes_to_remove;
+	}
+
+	if (!shift)
+		return;
+
+	/* eight bytes at a time, each pulling in bits of the byte after it */
+	for (i = 0; i + 8 < buf_len; i += 8) {
+		uint64_t word = le_to_h_u64(&buf[i]) >> shift;
+		word |= (uint64_t)buf[i + 8] << (64 - shift);
+		h_u64_to_le(&buf[i], word);
 	}
+	for (; i < (buf_len - 1); i++)
+		buf[i] = (buf[i] >> shift) | ((buf[i+1] << (8 - shift)) & 0xff);
+
+	buf[(buf_len - 1)] = buf[(buf_len - 1)] >> shift;
 }
@@ -172,6 +172,10 @@ static inline uint64_t buf_get_u64(const uint8_t *_buffer,
  * @returns A 32-bit word with @c value in reversed bit-order.
  */
 uint32_t flip_u32(uint32_t value, unsigned width);
+/* reverse the bit order within each of count bytes, dst may be src */
+void buf_bit_reverse(uint8_t *dst, const uint8_t *src, size_t count);
+/* sum of len bytes modulo 256, e.g. the gdb remote protocol checksum */
+uint8_t buf_checksum(const void *buf, size_t len);
 
 bool buf_cmp(const void *buf1, const void *buf2, unsigned size);
 bool buf_cmp_mask(const void *buf1, const void *buf2,
@@ -31,6 +31,8 @@ int parse_config_file(struct command_context *cmd_ctx);
 void add_config_command(const char *cfg);
 
 void add_script_search_dir(const char *dir);
+/* NULL terminated list of the script search directories, or NULL */
+char **get_script_search_dirs(void);
 
 void free_config(void);
 
@@ -41,5 +43,6 @@ FILE *open_file_from_path(const char *file, const char *mode);
 
 char *find_file(const char *name);
 char *get_home_dir(const char *append_path);
+char *find_exe_file(void);
 
 #endif /* OPENOCD_HELPER_CONFIGURATION_H */
@@ -30,12 +30,21 @@
 #include "configuration.h"
 #include "fileio.h"
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
+
 struct fileio {
 	char *url;
 	size_t size;
 	enum fileio_type type;
 	enum fileio_access access;
 	FILE *file;
+	/* contents of the whole file, see fileio_map() */
+	uint8_t *map;
+	bool map_is_mmap;
 };
 
 static inline int fileio_close_local(struct fileio *fileio)
@@ -127,6 +136,8 @@ int fileio_open(struct fileio **fileio, const char *url,
 	tmp->type = type;
 	tmp->access = access_type;
 	tmp->url = strdup(url);
+	tmp->map = NULL;
+	tmp->map_is_mmap = false;
 
 	retval = fileio_open_local(tmp);
 
@@ -145,6 +156,17 @@ int fileio_close(struct fileio *fileio)
 {
 	int retval;
 
+	if (fileio->map) {
+		if (fileio->map_is_mmap)
+#ifdef _WIN32
+			UnmapViewOfFile(fileio->map);
+#else
+			munmap(fileio->map, fileio->size);
+#endif
+		else
+			free(fileio->map);
+	}
+
 	retval = fileio_close_local(fileio);
 
 	free(fileio->url);
@@ -257,6 +279,77 @@ int fileio_write_u32(struct fileio *fileio, uint32_t data)
 	return retval;
 }
 
+/**
+ * Make the whole contents of a file opened for reading available in memory.
+ * Where possible the file is mapped, so that the data is only paged in when
+ * it is used and never copied to the heap; otherwise it is read into a
+ * buffer. The memory remains valid until the file is closed, the file
+ * position is left unchanged.
+ */
+int fileio_map(struct fileio *fileio, const uint8_t **data)
+{
+	if (fileio->map) {
+		*data = fileio->map;
+		return ERROR_OK;
+	}
+
+	if (fileio->access != FILEIO_READ)
+		return ERROR_FILEIO_OPERATION_NOT_SUPPORTED;
+
+	/* there is nothing to map in an empty file */
+	if (fileio->size == 0) {
+		*data = NULL;
+		return ERROR_OK;
+	}
+
+#ifdef _WIN32
+	void *map = NULL;
+	HANDLE mapping = CreateFileMapping((HANDLE)_get_osfhandle(fileno(fileio->file)),
+			NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping != NULL) {
+		map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+	}
+	if (map != NULL) {
+#else
+	void *map = mmap(NULL, fileio->size, PROT_READ, MAP_PRIVATE, fileno(fileio->file), 0);
+	if (map != MAP_FAILED) {
+#endif
+		fileio->map = map;
+		fileio->map_is_mmap = true;
+		*data = fileio->map;
+		return ERROR_OK;
+	}
+	LOG_DEBUG("couldn't map %s, reading it instead", fileio->url);
+
+	uint8_t *buffer = malloc(fileio->size);
+	if (buffer == NULL) {
+		LOG_ERROR("couldn't allocate %zu bytes for %s", fileio->size, fileio->url);
+		return ERROR_FAIL;
+	}
+
+	long position = ftell(fileio->file);
+	size_t size_read = 0;
+	int retval = fileio_seek(fileio, 0);
+	if (retval == ERROR_OK)
+		retval = fileio_local_read(fileio, fileio->size, buffer, &size_read);
+	if (position >= 0)
+		fseek(fileio->file, position, SEEK_SET);
+	if (retval == ERROR_OK && size_read != fileio->size) {
+		LOG_ERROR("couldn't read %s", fileio->url);
+		retval = ERROR_FILEIO_OPERATION_FAILED;
+	}
+	if (retval != ERROR_OK) {
+		free(buffer);
+		return retval;
+	}
+
+	fileio->map = buffer;
+	fileio->map_is_mmap = false;
+	*data = fileio->map;
+	return ERROR_OK;
+}
+
 /**
  * FIX!!!!
  *
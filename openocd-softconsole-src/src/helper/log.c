@@ -32,6 +32,10 @@
 
 #include <stdarg.h>
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #ifdef _DEBUG_FREE_SPACE_
 #ifdef HAVE_MALLOC_H
 #include <malloc.h>
@@ -61,6 +65,21 @@ static const char * const log_strings[6] = {
 
 static int count;
 
+#ifdef HAVE_PTHREAD_H
+static pthread_t log_main_thread;
+#endif
+
+/* Log callbacks write to connections and the Tcl interpreter, which only the
+ * main thread may touch. Helper threads get the log output only. */
+static bool log_on_main_thread(void)
+{
+#ifdef HAVE_PTHREAD_H
+	return pthread_equal(pthread_self(), log_main_thread);
+#else
+	return true;
+#endif
+}
+
 /* forward the log to the listeners */
 static void log_forward(const char *file, unsigned line, const char *function, const char *string)
 {
@@ -133,7 +152,7 @@ static void log_puts(enum log_levels level,
 	fflush(log_output);
 
 	/* Never forward LOG_LVL_DEBUG, too verbose and they can be found in the log if need be */
-	if (level <= LOG_LVL_INFO)
+	if (level <= LOG_LVL_INFO && log_on_main_thread())
 		log_forward(file, line, function, string);
 }
 
@@ -283,6 +302,10 @@ void log_init(void)
 		log_output = stderr;
 
 	start = last_time = timeval_ms();
+
+#ifdef HAVE_PTHREAD_H
+	log_main_thread = pthread_self();
+#endif
 }
 
 int set_log_output(struct command_context *cmd_ctx, FILE *output)
@@ -31,15 +31,6 @@
 
 #include <limits.h>
 #include <stdlib.h>
-#if IS_DARWIN
-#include <libproc.h>
-#endif
-/* sys/sysctl.h is deprecated on Linux from glibc 2.30 */
-#ifndef __linux__
-#ifdef HAVE_SYS_SYSCTL_H
-#include <sys/sysctl.h>
-#endif
-#endif
 #if IS_WIN32 && !IS_CYGWIN
 #include <windows.h>
 #endif
@@ -66,63 +57,10 @@ int configuration_output_handler(struct command_context *context, const char *li
 }
 
 /* Return the canonical path to the directory the openocd executable is in.
- * The path should be absolute, use / as path separator and have all symlinks
- * resolved. The returned string is malloc'd. */
+ * The returned string is malloc'd. */
 static char *find_exe_path(void)
 {
-	char *exepath = NULL;
-
-	do {
-#if IS_WIN32 && !IS_CYGWIN
-		exepath = malloc(MAX_PATH);
-		if (exepath == NULL)
-			break;
-		GetModuleFileName(NULL, exepath, MAX_PATH);
-
-		/* Convert path separators to UNIX style, should work on Windows also. */
-		for (char *p = exepath; *p; p++) {
-			if (*p == '\\')
-				*p = '/';
-		}
-
-#elif IS_DARWIN
-		exepath = malloc(PROC_PIDPATHINFO_MAXSIZE);
-		if (exepath == NULL)
-			break;
-		if (proc_pidpath(getpid(), exepath, PROC_PIDPATHINFO_MAXSIZE) <= 0) {
-			free(exepath);
-			exepath = NULL;
-		}
-
-#elif defined(CTL_KERN) && defined(KERN_PROC) && defined(KERN_PROC_PATHNAME) /* *BSD */
-#ifndef PATH_MAX
-#define PATH_MAX 1024
-#endif
-		char *path = malloc(PATH_MAX);
-		if (path == NULL)
-			break;
-		int mib[] = { CTL_KERN, KERN_PROC, KERN_PROC_PATHNAME, -1 };
-		size_t size = PATH_MAX;
-
-		if (sysctl(mib, (u_int)ARRAY_SIZE(mib), path, &size, NULL, 0) != 0)
-			break;
-
-#ifdef HAVE_REALPATH
-		exepath = realpath(path, NULL);
-		free(path);
-#else
-		exepath = path;
-#endif
-
-#elif defined(HAVE_REALPATH) /* Assume POSIX.1-2008 */
-		/* Try Unices in order of likelihood. */
-		exepath = realpath("/proc/self/exe", NULL); /* Linux/Cygwin */
-		if (exepath == NULL)
-			exepath = realpath("/proc/self/path/a.out", NULL); /* Solaris */
-		if (exepath == NULL)
-			exepath = realpath("/proc/curproc/file", NULL); /* FreeBSD (Should be covered above) */
-#endif
-	} while (0);
+	char *exepath = find_exe_file();
 
 	if (exepath != NULL) {
 		/* Strip executable file name, leaving path */
@@ -411,6 +411,55 @@ COMMAND_HANDLER(handle_adapter_khz_command)
 	return retval;
 }
 
+/* Run the Tcl check of "adapter speed_autotune" at the speed being tried */
+static int adapter_speed_check_script(void *priv)
+{
+	struct command_invocation *cmd = priv;
+
+	if (Jim_Eval_Named(CMD_CTX->interp, CMD_ARGV[3], __FILE__, __LINE__) != JIM_OK)
+		return ERROR_FAIL;
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_adapter_speed_autotune_command)
+{
+	if (CMD_ARGC < 2 || CMD_ARGC > 4)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	unsigned min_khz, max_khz, iterations = 8;
+	COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], min_khz);
+	COMMAND_PARSE_NUMBER(uint, CMD_ARGV[1], max_khz);
+	if (CMD_ARGC > 2)
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[2], iterations);
+	if (min_khz == 0 || min_khz > max_khz || iterations == 0)
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+
+	unsigned khz;
+	int retval = jtag_speed_autotune(min_khz, max_khz, iterations,
+			CMD_ARGC > 3 ? adapter_speed_check_script : NULL, CMD, &khz);
+	if (retval != ERROR_OK)
+		return retval;
+
+	command_print(CMD, "adapter speed: %u kHz", khz);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_adapter_speed_retune_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		bool enable;
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], enable);
+		jtag_set_speed_retune(enable);
+	}
+
+	command_print(CMD, "adapter speed retune: %s",
+			jtag_get_speed_retune() ? "on" : "off");
+	return ERROR_OK;
+}
+
 #ifndef HAVE_JTAG_MINIDRIVER_H
 #ifdef HAVE_LIBUSB_GET_PORT_NUMBERS
 COMMAND_HANDLER(handle_usb_location_command)
@@ -439,6 +488,21 @@ static const struct command_registration adapter_usb_command_handlers[] = {
 #endif /* MINIDRIVER */
 
 static const struct command_registration adapter_command_handlers[] = {
+	{
+		.name = "speed_autotune",
+		.handler = handle_adapter_speed_autotune_command,
+		.mode = COMMAND_EXEC,
+		.help = "find and use the fastest adapter speed at which the "
+			"JTAG chain, and the optional Tcl check, keep working",
+		.usage = "min_khz max_khz [iterations [check_script]]",
+	},
+	{
+		.name = "speed_retune",
+		.handler = handle_adapter_speed_retune_command,
+		.mode = COMMAND_ANY,
+		.help = "lower the adapter speed after a burst of JTAG errors",
+		.usage = "['on'|'off']",
+	},
 #ifndef HAVE_JTAG_MINIDRIVER_H
 	{
 		.name = "usb",
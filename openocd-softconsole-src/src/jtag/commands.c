@@ -31,18 +31,34 @@
 #endif
 
 #include <jtag/jtag.h>
+#include <helper/time_support.h>
 #include "commands.h"
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
 struct cmd_queue_page {
 	struct cmd_queue_page *next;
 	void *address;
+	size_t size;
 	size_t used;
 };
 
 #define CMD_QUEUE_PAGE_SIZE (1024 * 1024)
+
+/* Pages are kept across flushes and only rewound, so the arena stays at the
+ * high-water mark of the largest queue seen so far. cmd_queue_pages_tail is
+ * the page currently being filled; all pages after it are empty. */
 static struct cmd_queue_page *cmd_queue_pages;
 static struct cmd_queue_page *cmd_queue_pages_tail;
 
+static struct cmd_queue_stats cmd_queue_stats;
+static size_t cmd_queue_used;
+static int cmd_queue_trim_delay = 10000;
+static int64_t cmd_queue_last_busy;
+static bool cmd_queue_trimmed;
+
 struct jtag_command *jtag_command_queue;
 static struct jtag_command **next_command_pointer = &jtag_command_queue;
 
@@ -98,42 +114,88 @@ void *cmd_queue_alloc(size_t size)
 	size = (size + ALIGN_SIZE - 1) & (~(ALIGN_SIZE - 1));
 	/* Done... */
 
-	if (*p_page) {
+	if (cmd_queue_pages_tail) {
 		p_page = &cmd_queue_pages_tail;
-		if (CMD_QUEUE_PAGE_SIZE - (*p_page)->used < size)
+		if ((*p_page)->size - (*p_page)->used < size)
 			p_page = &((*p_page)->next);
 	}
 
+	if (*p_page && (*p_page)->size < size) {
+		/* Only an oversized request can miss the next retained page;
+		 * give it a page of its own in front of that one. */
+		struct cmd_queue_page *page = malloc(sizeof(struct cmd_queue_page));
+		page->next = *p_page;
+		page->address = NULL;
+		*p_page = page;
+	}
+
 	if (!*p_page) {
 		*p_page = malloc(sizeof(struct cmd_queue_page));
+		(*p_page)->address = NULL;
+		(*p_page)->next = NULL;
+	}
+
+	if (!(*p_page)->address) {
 		(*p_page)->used = 0;
 		size_t alloc_size = (size < CMD_QUEUE_PAGE_SIZE) ?
 					CMD_QUEUE_PAGE_SIZE : size;
 		(*p_page)->address = malloc(alloc_size);
-		(*p_page)->next = NULL;
-		cmd_queue_pages_tail = *p_page;
+		(*p_page)->size = alloc_size;
+		cmd_queue_stats.page_allocs++;
+		cmd_queue_stats.pages++;
+		cmd_queue_stats.bytes_reserved += alloc_size;
+	}
+
+	if (*p_page != cmd_queue_pages) {
+		/* Spilling over the first page counts as activity for trimming */
+		cmd_queue_last_busy = timeval_ms();
+		cmd_queue_trimmed = false;
 	}
+	cmd_queue_pages_tail = *p_page;
 
 	offset = (*p_page)->used;
 	(*p_page)->used += size;
 
+	cmd_queue_stats.allocs++;
+	cmd_queue_used += size;
+	if (cmd_queue_used > cmd_queue_stats.high_water)
+		cmd_queue_stats.high_water = cmd_queue_used;
+
 	t = (*p_page)->address;
 	return t + offset;
 }
 
-static void cmd_queue_free(void)
+/* Hand the memory of all pages but the first back to the OS, keeping the
+ * pages themselves. They are faulted back in when the queue grows again. */
+static void cmd_queue_trim(void)
 {
-	struct cmd_queue_page *page = cmd_queue_pages;
-
-	while (page) {
-		struct cmd_queue_page *last = page;
-		free(page->address);
-		page = page->next;
-		free(last);
+#ifdef MADV_DONTNEED
+	uintptr_t page_size = sysconf(_SC_PAGESIZE);
+
+	for (struct cmd_queue_page *page = cmd_queue_pages->next; page; page = page->next) {
+		uintptr_t start = ((uintptr_t)page->address + page_size - 1) & ~(page_size - 1);
+		uintptr_t end = ((uintptr_t)page->address + page->size) & ~(page_size - 1);
+		if (end > start)
+			madvise((void *)start, end - start, MADV_DONTNEED);
 	}
+	cmd_queue_stats.trims++;
+#endif
+	cmd_queue_trimmed = true;
+}
+
+static void cmd_queue_free(void)
+{
+	for (struct cmd_queue_page *page = cmd_queue_pages; page; page = page->next)
+		page->used = 0;
 
-	cmd_queue_pages = NULL;
 	cmd_queue_pages_tail = NULL;
+	cmd_queue_used = 0;
+	cmd_queue_stats.rewinds++;
+
+	if (cmd_queue_trim_delay > 0 && cmd_queue_pages && cmd_queue_pages->next &&
+			!cmd_queue_trimmed &&
+			timeval_ms() - cmd_queue_last_busy > cmd_queue_trim_delay)
+		cmd_queue_trim();
 }
 
 void jtag_command_queue_reset(void)
@@ -144,6 +206,21 @@ void jtag_command_queue_reset(void)
 	next_command_pointer = &jtag_command_queue;
 }
 
+void cmd_queue_get_stats(struct cmd_queue_stats *stats)
+{
+	*stats = cmd_queue_stats;
+}
+
+void cmd_queue_set_trim_delay(int delay_ms)
+{
+	cmd_queue_trim_delay = delay_ms;
+}
+
+int cmd_queue_get_trim_delay(void)
+{
+	return cmd_queue_trim_delay;
+}
+
 /**
  * Copy a struct scan_field for insertion into the queue.
  *
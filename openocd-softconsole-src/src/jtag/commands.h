@@ -165,6 +165,29 @@ extern struct jtag_command *jtag_command_queue;
 
 void *cmd_queue_alloc(size_t size);
 
+/** Counters for the command queue arena, see cmd_queue_get_stats(). */
+struct cmd_queue_stats {
+	/** cmd_queue_alloc() calls */
+	uint64_t allocs;
+	/** times the queue was rewound after a flush */
+	uint64_t rewinds;
+	/** pages obtained from malloc() */
+	uint64_t page_allocs;
+	/** times idle pages were handed back to the OS */
+	uint64_t trims;
+	/** pages and bytes currently held by the arena */
+	unsigned pages;
+	size_t bytes_reserved;
+	/** largest number of bytes used by a single queue */
+	size_t high_water;
+};
+
+void cmd_queue_get_stats(struct cmd_queue_stats *stats);
+/** Set how long (ms) the arena must stay within its first page before the
+ * others are trimmed; 0 disables trimming. */
+void cmd_queue_set_trim_delay(int delay_ms);
+int cmd_queue_get_trim_delay(void);
+
 void jtag_queue_command(struct jtag_command *cmd);
 void jtag_command_queue_reset(void);
 
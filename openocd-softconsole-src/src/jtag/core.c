@@ -35,6 +35,8 @@
 #include "interface.h"
 #include <transport/transport.h>
 #include <helper/jep106.h>
+#include <helper/time_support.h>
+#include "commands.h"
 
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
@@ -50,6 +52,49 @@ static int jtag_flush_queue_count;
 /* Sleep this # of ms after flushing the queue */
 static int jtag_flush_queue_sleep;
 
+/* Flush statistics reported by the jtag_stats command. Latencies go into
+ * power-of-two histogram buckets: bucket n counts flushes that took less
+ * than 2^n microseconds, the last one catches everything slower. */
+#define JTAG_STATS_BUCKETS 24
+#define JTAG_STATS_ORIGINS 32
+#define JTAG_STATS_ORIGIN_DEPTH 4
+#define JTAG_STATS_ORIGIN_LEN 80
+
+struct jtag_stats_origin {
+	char name[JTAG_STATS_ORIGIN_LEN];
+	uint64_t flushes;
+	uint64_t usec;
+	uint64_t commands;
+	uint64_t ir_bits;
+	uint64_t dr_bits;
+};
+
+static struct {
+	uint64_t flushes;
+	uint64_t usec;
+	uint64_t max_usec;
+	uint64_t commands;
+	uint64_t ir_bits;
+	uint64_t dr_bits;
+	uint64_t clocks;
+	uint64_t transport_out;
+	uint64_t transport_in;
+	uint64_t histogram[JTAG_STATS_BUCKETS];
+	struct jtag_stats_origin origin[JTAG_STATS_ORIGINS];
+	unsigned origins;
+} jtag_stats;
+
+/* Stack of subsystems currently issuing JTAG operations. Each level keeps
+ * the full path ("flash/riscv dmi"), which is what flushes are booked to. */
+static struct {
+	const char *name;
+	char path[JTAG_STATS_ORIGIN_LEN];
+} jtag_flush_origins[JTAG_STATS_ORIGIN_DEPTH];
+static unsigned jtag_flush_origin_depth;
+
+static int jtag_stats_log_interval;
+static int64_t jtag_stats_last_log;
+
 static void jtag_add_scan_check(struct jtag_tap *active,
 		void (*jtag_add_scan)(struct jtag_tap *active,
 		int in_num_fields,
@@ -839,11 +884,186 @@ int default_interface_jtag_execute_queue(void)
 	return jtag->execute_queue();
 }
 
+void jtag_flush_origin_push(const char *origin)
+{
+	unsigned depth = jtag_flush_origin_depth++;
+	if (depth >= JTAG_STATS_ORIGIN_DEPTH)
+		return;
+
+	char path[JTAG_STATS_ORIGIN_LEN];
+	if (depth == 0)
+		snprintf(path, sizeof(path), "%s", origin);
+	else if (strcmp(jtag_flush_origins[depth - 1].name, origin) == 0)
+		snprintf(path, sizeof(path), "%s", jtag_flush_origins[depth - 1].path);
+	else
+		snprintf(path, sizeof(path), "%s/%s", jtag_flush_origins[depth - 1].path, origin);
+
+	jtag_flush_origins[depth].name = origin;
+	strcpy(jtag_flush_origins[depth].path, path);
+}
+
+void jtag_flush_origin_pop(void)
+{
+	assert(jtag_flush_origin_depth > 0);
+	jtag_flush_origin_depth--;
+}
+
+void jtag_stats_add_transport_bytes(size_t out, size_t in)
+{
+	jtag_stats.transport_out += out;
+	jtag_stats.transport_in += in;
+}
+
+static struct jtag_stats_origin *jtag_stats_get_origin(void)
+{
+	const char *name = "other";
+	if (jtag_flush_origin_depth > 0) {
+		unsigned depth = MIN(jtag_flush_origin_depth, JTAG_STATS_ORIGIN_DEPTH);
+		name = jtag_flush_origins[depth - 1].path;
+	}
+
+	for (unsigned i = 0; i < jtag_stats.origins; i++)
+		if (strcmp(jtag_stats.origin[i].name, name) == 0)
+			return &jtag_stats.origin[i];
+
+	/* Once the table is full, the last slot collects the rest */
+	if (jtag_stats.origins == JTAG_STATS_ORIGINS)
+		return &jtag_stats.origin[JTAG_STATS_ORIGINS - 1];
+
+	struct jtag_stats_origin *origin = &jtag_stats.origin[jtag_stats.origins++];
+	snprintf(origin->name, sizeof(origin->name), "%s", name);
+	return origin;
+}
+
+static void jtag_stats_line(struct command_invocation *cmd, const char *format, ...)
+{
+	char line[160];
+	va_list ap;
+
+	va_start(ap, format);
+	vsnprintf(line, sizeof(line), format, ap);
+	va_end(ap);
+
+	if (cmd)
+		command_print(cmd, "%s", line);
+	else
+		LOG_INFO("%s", line);
+}
+
+void jtag_stats_report(struct command_invocation *cmd)
+{
+	jtag_stats_line(cmd, "%" PRIu64 " flushes, %" PRIu64 " us total, %" PRIu64 " us max",
+			jtag_stats.flushes, jtag_stats.usec, jtag_stats.max_usec);
+	jtag_stats_line(cmd, "%" PRIu64 " commands, %" PRIu64 " IR bits, %" PRIu64 " DR bits, "
+			"%" PRIu64 " idle clocks",
+			jtag_stats.commands, jtag_stats.ir_bits, jtag_stats.dr_bits,
+			jtag_stats.clocks);
+	if (jtag_stats.transport_out || jtag_stats.transport_in)
+		jtag_stats_line(cmd, "%s: %" PRIu64 " bytes out, %" PRIu64 " bytes in",
+				jtag ? jtag->name : "adapter",
+				jtag_stats.transport_out, jtag_stats.transport_in);
+
+	/* The log only gets the summary and the breakdown by origin */
+	if (cmd) {
+		command_print(cmd, "flush latency:");
+		for (unsigned i = 0; i < JTAG_STATS_BUCKETS; i++) {
+			if (!jtag_stats.histogram[i])
+				continue;
+			if (i == JTAG_STATS_BUCKETS - 1)
+				command_print(cmd, "  >= %8u us: %" PRIu64, 1u << (i - 1),
+						jtag_stats.histogram[i]);
+			else
+				command_print(cmd, "  <  %8u us: %" PRIu64, 1u << i,
+						jtag_stats.histogram[i]);
+		}
+	}
+
+	for (unsigned i = 0; i < jtag_stats.origins; i++) {
+		struct jtag_stats_origin *origin = &jtag_stats.origin[i];
+		jtag_stats_line(cmd, "%s: %" PRIu64 " flushes, %" PRIu64 " us, %" PRIu64
+				" commands, %" PRIu64 " IR bits, %" PRIu64 " DR bits",
+				origin->name, origin->flushes, origin->usec, origin->commands,
+				origin->ir_bits, origin->dr_bits);
+	}
+}
+
+void jtag_stats_reset(void)
+{
+	memset(&jtag_stats, 0, sizeof(jtag_stats));
+}
+
+void jtag_stats_set_log_interval(int seconds)
+{
+	jtag_stats_log_interval = seconds;
+	jtag_stats_last_log = timeval_ms();
+}
+
+static void jtag_stats_flush_done(const struct timeval *start, uint64_t commands,
+		uint64_t ir_bits, uint64_t dr_bits, uint64_t clocks)
+{
+	struct timeval end;
+	gettimeofday(&end, NULL);
+	uint64_t usec = (end.tv_sec - start->tv_sec) * 1000000LL + end.tv_usec - start->tv_usec;
+
+	unsigned bucket = 0;
+	while (bucket < JTAG_STATS_BUCKETS - 1 && usec >= (1ULL << bucket))
+		bucket++;
+
+	jtag_stats.flushes++;
+	jtag_stats.usec += usec;
+	if (usec > jtag_stats.max_usec)
+		jtag_stats.max_usec = usec;
+	jtag_stats.histogram[bucket]++;
+	jtag_stats.commands += commands;
+	jtag_stats.ir_bits += ir_bits;
+	jtag_stats.dr_bits += dr_bits;
+	jtag_stats.clocks += clocks;
+
+	struct jtag_stats_origin *origin = jtag_stats_get_origin();
+	origin->flushes++;
+	origin->usec += usec;
+	origin->commands += commands;
+	origin->ir_bits += ir_bits;
+	origin->dr_bits += dr_bits;
+
+	if (jtag_stats_log_interval > 0 &&
+			timeval_ms() - jtag_stats_last_log >= jtag_stats_log_interval * 1000LL) {
+		jtag_stats_last_log = timeval_ms();
+		jtag_stats_report(NULL);
+	}
+}
+
 void jtag_execute_queue_noclear(void)
 {
+	uint64_t commands = 0, ir_bits = 0, dr_bits = 0, clocks = 0;
+	for (struct jtag_command *cmd = jtag_command_queue; cmd; cmd = cmd->next) {
+		commands++;
+		switch (cmd->type) {
+			case JTAG_SCAN:
+				if (cmd->cmd.scan->ir_scan)
+					ir_bits += jtag_scan_size(cmd->cmd.scan);
+				else
+					dr_bits += jtag_scan_size(cmd->cmd.scan);
+				break;
+			case JTAG_RUNTEST:
+				clocks += cmd->cmd.runtest->num_cycles;
+				break;
+			case JTAG_STABLECLOCKS:
+				clocks += cmd->cmd.stableclocks->num_cycles;
+				break;
+			default:
+				break;
+		}
+	}
+
+	struct timeval start;
+	gettimeofday(&start, NULL);
+
 	jtag_flush_queue_count++;
 	jtag_set_error(interface_jtag_execute_queue());
 
+	jtag_stats_flush_done(&start, commands, ir_bits, dr_bits, clocks);
+
 	if (jtag_flush_queue_sleep > 0) {
 		/* For debug purposes it can be useful to test performance
 		 * or behavior when delaying after flushing the queue,
@@ -858,10 +1078,15 @@ int jtag_get_flush_queue_count(void)
 	return jtag_flush_queue_count;
 }
 
+static void jtag_speed_note_error(void);
+
 int jtag_execute_queue(void)
 {
 	jtag_execute_queue_noclear();
-	return jtag_error_clear();
+	int retval = jtag_error_clear();
+	if (retval != ERROR_OK)
+		jtag_speed_note_error();
+	return retval;
 }
 
 static int jtag_reset_callback(enum jtag_event event, void *priv)
@@ -1684,6 +1909,273 @@ int jtag_get_speed_readable(int *khz)
 	return jtag->speed_div(jtag_speed_var, khz);
 }
 
+/* Bits shifted through the chain behind the TAPs by a link check */
+#define JTAG_LINK_PATTERN_BITS	128
+
+/* Errors within JTAG_RETUNE_WINDOW_MS which lower the speed when retuning */
+#define JTAG_RETUNE_ERRORS		8
+#define JTAG_RETUNE_WINDOW_MS	1000
+
+static bool jtag_retune;
+static unsigned jtag_retune_min_khz;
+static bool jtag_autotuning;
+
+static uint32_t jtag_link_random(uint32_t *state)
+{
+	/* xorshift32 */
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/* Whether @a num_bits of @a in starting at @a offset are the pattern in @a out */
+static bool jtag_link_pattern_ok(const uint8_t *in, unsigned offset,
+		const uint8_t *out, unsigned num_bits)
+{
+	for (unsigned i = 0; i < num_bits; i++)
+		if (buf_get_u32(in, offset + i, 1) != buf_get_u32(out, i, 1))
+			return false;
+	return true;
+}
+
+/**
+ * Check the integrity of the scan chain once: the IDCODEs found by the
+ * chain examination must read back, and a random pattern must come back
+ * unchanged after passing the IDCODE registers and then all BYPASS
+ * registers. The TAPs are left reset.
+ */
+static int jtag_link_check_once(uint32_t *seed)
+{
+	unsigned num_taps = 0, ir_bits = 0, dr_bits = 0;
+	struct jtag_tap *tap;
+
+	for (tap = jtag_tap_next_enabled(NULL); tap; tap = jtag_tap_next_enabled(tap)) {
+		num_taps++;
+		ir_bits += tap->ir_length;
+		dr_bits += tap->hasidcode ? 32 : 1;
+	}
+	if (num_taps == 0) {
+		LOG_ERROR("no enabled TAP to check the JTAG link with");
+		return ERROR_JTAG_INIT_FAILED;
+	}
+
+	unsigned idcode_bits = dr_bits + JTAG_LINK_PATTERN_BITS;
+	unsigned bypass_bits = num_taps + JTAG_LINK_PATTERN_BITS;
+	uint8_t *idcode_out = calloc(DIV_ROUND_UP(idcode_bits, 32), 4);
+	uint8_t *idcode_in = calloc(DIV_ROUND_UP(idcode_bits, 32), 4);
+	uint8_t *bypass_out = calloc(DIV_ROUND_UP(bypass_bits, 32), 4);
+	uint8_t *bypass_in = calloc(DIV_ROUND_UP(bypass_bits, 32), 4);
+	uint8_t *ir = calloc(DIV_ROUND_UP(ir_bits, 8), 1);
+	int retval = ERROR_FAIL;
+
+	if (!idcode_out || !idcode_in || !bypass_out || !bypass_in || !ir)
+		goto out;
+
+	for (unsigned i = 0; i < DIV_ROUND_UP(idcode_bits, 32); i++)
+		buf_set_u32(idcode_out, i * 32, 32, jtag_link_random(seed));
+	for (unsigned i = 0; i < DIV_ROUND_UP(bypass_bits, 32); i++)
+		buf_set_u32(bypass_out, i * 32, 32, jtag_link_random(seed));
+	buf_set_ones(ir, ir_bits);
+
+	jtag_add_tlr();
+	jtag_add_plain_dr_scan(idcode_bits, idcode_out, idcode_in, TAP_IDLE);
+	jtag_add_plain_ir_scan(ir_bits, ir, NULL, TAP_IDLE);
+	jtag_add_plain_dr_scan(bypass_bits, bypass_out, bypass_in, TAP_IDLE);
+	jtag_add_tlr();
+	retval = jtag_execute_queue();
+	if (retval != ERROR_OK)
+		goto out;
+
+	retval = ERROR_JTAG_QUEUE_FAILED;
+	unsigned offset = 0;
+	for (tap = jtag_tap_next_enabled(NULL); tap; tap = jtag_tap_next_enabled(tap)) {
+		if (tap->hasidcode) {
+			uint32_t idcode = buf_get_u32(idcode_in, offset, 32);
+			if (idcode != tap->idcode) {
+				LOG_DEBUG("%s: IDCODE 0x%08" PRIx32 " instead of 0x%08" PRIx32,
+						tap->dotted_name, idcode, tap->idcode);
+				goto out;
+			}
+			offset += 32;
+		} else {
+			if (buf_get_u32(idcode_in, offset, 1) != 0) {
+				LOG_DEBUG("%s: BYPASS did not capture 0", tap->dotted_name);
+				goto out;
+			}
+			offset++;
+		}
+	}
+	if (!jtag_link_pattern_ok(idcode_in, dr_bits, idcode_out, JTAG_LINK_PATTERN_BITS)) {
+		LOG_DEBUG("pattern corrupted behind the IDCODE registers");
+		goto out;
+	}
+	if (buf_get_u32(bypass_in, 0, num_taps) != 0 ||
+			!jtag_link_pattern_ok(bypass_in, num_taps, bypass_out, JTAG_LINK_PATTERN_BITS)) {
+		LOG_DEBUG("pattern corrupted through the BYPASS registers");
+		goto out;
+	}
+	retval = ERROR_OK;
+
+out:
+	free(ir);
+	free(bypass_in);
+	free(bypass_out);
+	free(idcode_in);
+	free(idcode_out);
+	return retval;
+}
+
+int jtag_link_check(unsigned iterations, unsigned *failures)
+{
+	static uint32_t seed = 0x2545f491;
+
+	*failures = 0;
+	for (unsigned i = 0; i < iterations; i++) {
+		int retval = jtag_link_check_once(&seed);
+		if (retval == ERROR_JTAG_INIT_FAILED)
+			return retval;
+		if (retval != ERROR_OK)
+			(*failures)++;
+	}
+
+	return ERROR_OK;
+}
+
+/* Whether the link works at @a khz, with @a check on top of the chain check */
+static bool jtag_speed_try(unsigned khz, unsigned iterations,
+		int (*check)(void *priv), void *priv)
+{
+	unsigned failures;
+	int actual_khz = khz;
+
+	if (jtag_config_khz(khz) != ERROR_OK)
+		return false;
+	jtag_get_speed_readable(&actual_khz);
+
+	if (jtag_link_check(iterations, &failures) != ERROR_OK || failures > 0) {
+		LOG_DEBUG("JTAG link at %d kHz: %u of %u checks failed",
+				actual_khz, failures, iterations);
+		return false;
+	}
+	if (check && check(priv) != ERROR_OK) {
+		LOG_DEBUG("JTAG link at %d kHz: check failed", actual_khz);
+		return false;
+	}
+
+	LOG_DEBUG("JTAG link at %d kHz: ok", actual_khz);
+	return true;
+}
+
+int jtag_speed_autotune(unsigned min_khz, unsigned max_khz, unsigned iterations,
+		int (*check)(void *priv), void *priv, unsigned *result_khz)
+{
+	if (!transport_is_jtag()) {
+		LOG_ERROR("speed tuning needs the JTAG transport");
+		return ERROR_FAIL;
+	}
+	if (clock_mode != CLOCK_MODE_KHZ) {
+		LOG_ERROR("speed tuning needs a fixed adapter speed, not RCLK");
+		return ERROR_FAIL;
+	}
+	if (min_khz == 0 || min_khz > max_khz || iterations == 0)
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+
+	unsigned original_khz = speed_khz;
+	unsigned good = 0, bad = max_khz + 1;
+	int retval = ERROR_OK;
+
+	jtag_autotuning = true;
+
+	/* halve the speed until the link works */
+	for (unsigned khz = max_khz; khz >= min_khz; khz /= 2) {
+		if (jtag_speed_try(khz, iterations, check, priv)) {
+			good = khz;
+			break;
+		}
+		bad = khz;
+	}
+	if (good == 0 && min_khz < max_khz && jtag_speed_try(min_khz, iterations, check, priv))
+		good = min_khz;
+	if (good == 0) {
+		LOG_ERROR("no reliable JTAG speed between %u and %u kHz", min_khz, max_khz);
+		jtag_config_khz(original_khz);
+		retval = ERROR_JTAG_INIT_FAILED;
+		goto out;
+	}
+
+	/* then bisect up to the fastest that works, within about 6% */
+	while (bad - good > good / 16 + 1) {
+		unsigned khz = good + (bad - good) / 2;
+		if (jtag_speed_try(khz, iterations, check, priv))
+			good = khz;
+		else
+			bad = khz;
+	}
+
+	/* a single pass may be luck near the limit, confirm with more checks
+	 * and back off until that works */
+	while (!jtag_speed_try(good, iterations * 4, check, priv)) {
+		good -= good / 8 + 1;
+		if (good < min_khz) {
+			LOG_ERROR("no reliable JTAG speed between %u and %u kHz", min_khz, max_khz);
+			jtag_config_khz(original_khz);
+			retval = ERROR_JTAG_INIT_FAILED;
+			goto out;
+		}
+	}
+
+	int actual_khz = good;
+	jtag_get_speed_readable(&actual_khz);
+	LOG_INFO("JTAG speed tuned to %d kHz", actual_khz);
+	jtag_retune_min_khz = min_khz;
+	*result_khz = actual_khz;
+
+out:
+	jtag_autotuning = false;
+	return retval;
+}
+
+void jtag_set_speed_retune(bool enable)
+{
+	jtag_retune = enable;
+}
+
+bool jtag_get_speed_retune(void)
+{
+	return jtag_retune;
+}
+
+/* Lower the speed by a quarter after a burst of queue errors */
+static void jtag_speed_note_error(void)
+{
+	static int64_t window_start;
+	static unsigned errors;
+
+	if (!jtag_retune || jtag_autotuning || clock_mode != CLOCK_MODE_KHZ)
+		return;
+
+	int64_t now = timeval_ms();
+	if (now - window_start > JTAG_RETUNE_WINDOW_MS) {
+		window_start = now;
+		errors = 0;
+	}
+	if (++errors < JTAG_RETUNE_ERRORS)
+		return;
+	errors = 0;
+	window_start = now;
+
+	unsigned khz = speed_khz - speed_khz / 4;
+	if (khz < MAX(jtag_retune_min_khz, 1u) || khz == (unsigned)speed_khz)
+		return;
+
+	LOG_WARNING("%d JTAG errors within %d ms, lowering the adapter speed to %u kHz",
+			JTAG_RETUNE_ERRORS, JTAG_RETUNE_WINDOW_MS, khz);
+	jtag_config_khz(khz);
+}
+
 void jtag_set_verify(bool enable)
 {
 	jtag_verify = enable;
@@ -611,12 +611,10 @@ static int armjtagew_tap_execute(void)
 		buf_set_u32(usb_out_buffer + 1, 0, 16, byte_length);
 
 		tms_offset = 3;
-		for (i = 0; i < byte_length; i++)
-			usb_out_buffer[tms_offset + i] = flip_u32(tms_buffer[i], 8);
+		buf_bit_reverse(usb_out_buffer + tms_offset, tms_buffer, byte_length);
 
 		tdi_offset = tms_offset + byte_length;
-		for (i = 0; i < byte_length; i++)
-			usb_out_buffer[tdi_offset + i] = flip_u32(tdi_buffer[i], 8);
+		buf_bit_reverse(usb_out_buffer + tdi_offset, tdi_buffer, byte_length);
 
 		result = armjtagew_usb_message(armjtagew_handle,
 				3 + 2 * byte_length,
@@ -633,8 +631,7 @@ static int armjtagew_tap_execute(void)
 				return ERROR_JTAG_QUEUE_FAILED;
 			}
 
-			for (i = 0; i < byte_length; i++)
-				tdo_buffer[i] = flip_u32(usb_in_buffer[i], 8);
+			buf_bit_reverse(tdo_buffer, usb_in_buffer, byte_length);
 
 			for (i = 0; i < pending_scan_results_length; i++) {
 				struct pending_scan_result *pending_scan_result =
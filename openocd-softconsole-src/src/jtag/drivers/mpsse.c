@@ -22,6 +22,7 @@
 
 #include "mpsse.h"
 #include "helper/log.h"
+#include "jtag/jtag.h"
 #include "helper/time_support.h"
 #include <libusb.h>
 
@@ -61,6 +62,25 @@
 #define SIO_RESET_PURGE_RX 1
 #define SIO_RESET_PURGE_TX 2
 
+/* Number of queue segments that may be on the wire at the same time */
+#define MPSSE_SEGMENTS 4
+/* Number of bulk IN transfers kept queued while read data is outstanding */
+#define MPSSE_READ_TRANSFERS 2
+
+/* A slice of the command queue, sent with one bulk OUT transfer. While one
+ * segment is being filled, the previous ones may still be in flight. */
+struct mpsse_segment {
+	struct libusb_transfer *write_transfer;
+	uint8_t *write_buffer;
+	unsigned write_count;
+	unsigned write_transferred;
+	bool write_done;
+	uint8_t *read_buffer;
+	unsigned read_count;
+	unsigned read_transferred;
+	struct bit_copy_queue read_queue;
+};
+
 struct mpsse_ctx {
 	libusb_context *usb_ctx;
 	libusb_device_handle *usb_dev;
@@ -72,18 +92,24 @@ struct mpsse_ctx {
 	uint16_t index;
 	uint8_t interface;
 	enum ftdi_chip_type type;
-	uint8_t *write_buffer;
 	unsigned write_size;
-	unsigned write_count;
-	uint8_t *read_buffer;
 	unsigned read_size;
-	unsigned read_count;
-	uint8_t *read_chunk;
+	struct mpsse_segment segment[MPSSE_SEGMENTS];
+	unsigned segment_head;	/* oldest segment in flight */
+	unsigned segments_busy;	/* number of segments in flight */
+	struct libusb_transfer *read_transfer[MPSSE_READ_TRANSFERS];
+	uint8_t *read_chunk[MPSSE_READ_TRANSFERS];
 	unsigned read_chunk_size;
-	struct bit_copy_queue read_queue;
+	unsigned read_next;	/* next read transfer to submit */
+	unsigned reads_busy;	/* number of read transfers in flight */
+	unsigned read_pending;	/* bytes the device still owes us */
+	bool usb_failed;
 	int retval;
 };
 
+static int mpsse_submit(struct mpsse_ctx *ctx);
+static void mpsse_cancel(struct mpsse_ctx *ctx);
+
 /* Returns true if the string descriptor indexed by str_index in device matches string */
 static bool string_descriptor_equal(libusb_device_handle *device, uint8_t str_index,
 	const char *string)
@@ -326,21 +352,34 @@ struct mpsse_ctx *mpsse_open(const uint16_t *vid, const uint16_t *pid, const cha
 	if (!ctx)
 		return 0;
 
-	bit_copy_queue_init(&ctx->read_queue);
 	ctx->read_chunk_size = 16384;
 	ctx->read_size = 16384;
 	ctx->write_size = 16384;
-	ctx->read_chunk = malloc(ctx->read_chunk_size);
-	ctx->read_buffer = malloc(ctx->read_size);
 
-	/* Use calloc to make valgrind happy: buffer_write() sets payload
-	 * on bit basis, so some bits can be left uninitialized in write_buffer.
-	 * Although this is perfectly ok with MPSSE, valgrind reports
-	 * Syscall param ioctl(USBDEVFS_SUBMITURB).buffer points to uninitialised byte(s) */
-	ctx->write_buffer = calloc(1, ctx->write_size);
+	/* Transfers and buffers for all segments are set up once here and
+	 * reused by every flush */
+	for (unsigned i = 0; i < MPSSE_SEGMENTS; i++) {
+		struct mpsse_segment *seg = &ctx->segment[i];
+		bit_copy_queue_init(&seg->read_queue);
+		seg->write_transfer = libusb_alloc_transfer(0);
+		seg->read_buffer = malloc(ctx->read_size);
+
+		/* Use calloc to make valgrind happy: buffer_write() sets payload
+		 * on bit basis, so some bits can be left uninitialized in write_buffer.
+		 * Although this is perfectly ok with MPSSE, valgrind reports
+		 * Syscall param ioctl(USBDEVFS_SUBMITURB).buffer points to uninitialised byte(s) */
+		seg->write_buffer = calloc(1, ctx->write_size);
+
+		if (!seg->write_transfer || !seg->read_buffer || !seg->write_buffer)
+			goto error;
+	}
 
-	if (!ctx->read_chunk || !ctx->read_buffer || !ctx->write_buffer)
-		goto error;
+	for (unsigned i = 0; i < MPSSE_READ_TRANSFERS; i++) {
+		ctx->read_transfer[i] = libusb_alloc_transfer(0);
+		ctx->read_chunk[i] = malloc(ctx->read_chunk_size);
+		if (!ctx->read_transfer[i] || !ctx->read_chunk[i])
+			goto error;
+	}
 
 	ctx->interface = channel;
 	ctx->index = channel + 1;
@@ -399,17 +438,28 @@ error:
 
 void mpsse_close(struct mpsse_ctx *ctx)
 {
-	if (ctx->usb_dev)
+	if (ctx->usb_dev) {
+		mpsse_cancel(ctx);
 		libusb_close(ctx->usb_dev);
+	}
 	if (ctx->usb_ctx)
 		libusb_exit(ctx->usb_ctx);
-	bit_copy_discard(&ctx->read_queue);
-	if (ctx->write_buffer)
-		free(ctx->write_buffer);
-	if (ctx->read_buffer)
-		free(ctx->read_buffer);
-	if (ctx->read_chunk)
-		free(ctx->read_chunk);
+	for (unsigned i = 0; i < MPSSE_SEGMENTS; i++) {
+		struct mpsse_segment *seg = &ctx->segment[i];
+		bit_copy_discard(&seg->read_queue);
+		if (seg->write_transfer)
+			libusb_free_transfer(seg->write_transfer);
+		if (seg->write_buffer)
+			free(seg->write_buffer);
+		if (seg->read_buffer)
+			free(seg->read_buffer);
+	}
+	for (unsigned i = 0; i < MPSSE_READ_TRANSFERS; i++) {
+		if (ctx->read_transfer[i])
+			libusb_free_transfer(ctx->read_transfer[i]);
+		if (ctx->read_chunk[i])
+			free(ctx->read_chunk[i]);
+	}
 
 	free(ctx);
 }
@@ -423,10 +473,8 @@ void mpsse_purge(struct mpsse_ctx *ctx)
 {
 	int err;
 	LOG_DEBUG("-");
-	ctx->write_count = 0;
-	ctx->read_count = 0;
+	mpsse_cancel(ctx);
 	ctx->retval = ERROR_OK;
-	bit_copy_discard(&ctx->read_queue);
 	err = libusb_control_transfer(ctx->usb_dev, FTDI_DEVICE_OUT_REQTYPE, SIO_RESET_REQUEST,
 			SIO_RESET_PURGE_RX, ctx->index, NULL, 0, ctx->usb_write_timeout);
 	if (err < 0) {
@@ -442,42 +490,52 @@ void mpsse_purge(struct mpsse_ctx *ctx)
 	}
 }
 
+/* The segment currently being filled with commands */
+static struct mpsse_segment *buffer_segment(struct mpsse_ctx *ctx)
+{
+	assert(ctx->segments_busy < MPSSE_SEGMENTS);
+	return &ctx->segment[(ctx->segment_head + ctx->segments_busy) % MPSSE_SEGMENTS];
+}
+
 static unsigned buffer_write_space(struct mpsse_ctx *ctx)
 {
 	/* Reserve one byte for SEND_IMMEDIATE */
-	return ctx->write_size - ctx->write_count - 1;
+	return ctx->write_size - buffer_segment(ctx)->write_count - 1;
 }
 
 static unsigned buffer_read_space(struct mpsse_ctx *ctx)
 {
-	return ctx->read_size - ctx->read_count;
+	return ctx->read_size - buffer_segment(ctx)->read_count;
 }
 
 static void buffer_write_byte(struct mpsse_ctx *ctx, uint8_t data)
 {
+	struct mpsse_segment *seg = buffer_segment(ctx);
 	LOG_DEBUG_IO("%02x", data);
-	assert(ctx->write_count < ctx->write_size);
-	ctx->write_buffer[ctx->write_count++] = data;
+	assert(seg->write_count < ctx->write_size);
+	seg->write_buffer[seg->write_count++] = data;
 }
 
 static unsigned buffer_write(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_offset,
 	unsigned bit_count)
 {
+	struct mpsse_segment *seg = buffer_segment(ctx);
 	LOG_DEBUG_IO("%d bits", bit_count);
-	assert(ctx->write_count + DIV_ROUND_UP(bit_count, 8) <= ctx->write_size);
-	bit_copy(ctx->write_buffer + ctx->write_count, 0, out, out_offset, bit_count);
-	ctx->write_count += DIV_ROUND_UP(bit_count, 8);
+	assert(seg->write_count + DIV_ROUND_UP(bit_count, 8) <= ctx->write_size);
+	bit_copy(seg->write_buffer + seg->write_count, 0, out, out_offset, bit_count);
+	seg->write_count += DIV_ROUND_UP(bit_count, 8);
 	return bit_count;
 }
 
 static unsigned buffer_add_read(struct mpsse_ctx *ctx, uint8_t *in, unsigned in_offset,
 	unsigned bit_count, unsigned offset)
 {
+	struct mpsse_segment *seg = buffer_segment(ctx);
 	LOG_DEBUG_IO("%d bits, offset %d", bit_count, offset);
-	assert(ctx->read_count + DIV_ROUND_UP(bit_count, 8) <= ctx->read_size);
-	bit_copy_queued(&ctx->read_queue, in, in_offset, ctx->read_buffer + ctx->read_count, offset,
+	assert(seg->read_count + DIV_ROUND_UP(bit_count, 8) <= ctx->read_size);
+	bit_copy_queued(&seg->read_queue, in, in_offset, seg->read_buffer + seg->read_count, offset,
 		bit_count);
-	ctx->read_count += DIV_ROUND_UP(bit_count, 8);
+	seg->read_count += DIV_ROUND_UP(bit_count, 8);
 	return bit_count;
 }
 
@@ -514,7 +572,7 @@ void mpsse_clock_data(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_of
 		/* Guarantee buffer space enough for a minimum size transfer */
 		if (buffer_write_space(ctx) + (length < 8) < (out || (!out && !in) ? 4 : 3)
 				|| (in && buffer_read_space(ctx) < 1))
-			ctx->retval = mpsse_flush(ctx);
+			ctx->retval = mpsse_submit(ctx);
 
 		if (length < 8) {
 			/* Transfer remaining bits in bit mode */
@@ -588,7 +646,7 @@ void mpsse_clock_tms_cs(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_
 	while (length > 0) {
 		/* Guarantee buffer space enough for a minimum size transfer */
 		if (buffer_write_space(ctx) < 3 || (in && buffer_read_space(ctx) < 1))
-			ctx->retval = mpsse_flush(ctx);
+			ctx->retval = mpsse_submit(ctx);
 
 		/* Byte transfer */
 		unsigned this_bits = length;
@@ -631,7 +689,7 @@ void mpsse_set_data_bits_low_byte(struct mpsse_ctx *ctx, uint8_t data, uint8_t d
 	}
 
 	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_submit(ctx);
 
 	buffer_write_byte(ctx, 0x80);
 	buffer_write_byte(ctx, data);
@@ -648,7 +706,7 @@ void mpsse_set_data_bits_high_byte(struct mpsse_ctx *ctx, uint8_t data, uint8_t
 	}
 
 	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_submit(ctx);
 
 	buffer_write_byte(ctx, 0x82);
 	buffer_write_byte(ctx, data);
@@ -665,7 +723,7 @@ void mpsse_read_data_bits_low_byte(struct mpsse_ctx *ctx, uint8_t *data)
 	}
 
 	if (buffer_write_space(ctx) < 1 || buffer_read_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_submit(ctx);
 
 	buffer_write_byte(ctx, 0x81);
 	buffer_add_read(ctx, data, 0, 8, 0);
@@ -681,7 +739,7 @@ void mpsse_read_data_bits_high_byte(struct mpsse_ctx *ctx, uint8_t *data)
 	}
 
 	if (buffer_write_space(ctx) < 1 || buffer_read_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_submit(ctx);
 
 	buffer_write_byte(ctx, 0x83);
 	buffer_add_read(ctx, data, 0, 8, 0);
@@ -696,7 +754,7 @@ static void single_byte_boolean_helper(struct mpsse_ctx *ctx, bool var, uint8_t
 	}
 
 	if (buffer_write_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_submit(ctx);
 
 	buffer_write_byte(ctx, var ? val_if_true : val_if_false);
 }
@@ -717,7 +775,7 @@ void mpsse_set_divisor(struct mpsse_ctx *ctx, uint16_t divisor)
 	}
 
 	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_submit(ctx);
 
 	buffer_write_byte(ctx, 0x86);
 	buffer_write_byte(ctx, divisor & 0xff);
@@ -777,120 +835,171 @@ int mpsse_set_frequency(struct mpsse_ctx *ctx, int frequency)
 	return frequency;
 }
 
-/* Context needed by the callbacks */
-struct transfer_result {
-	struct mpsse_ctx *ctx;
-	bool done;
-	unsigned transferred;
-};
+/* Hand read payload to the segments in flight, in the order they were sent */
+static void mpsse_deliver(struct mpsse_ctx *ctx, const uint8_t *data, unsigned size)
+{
+	for (unsigned i = 0; i < ctx->segments_busy && size > 0; i++) {
+		struct mpsse_segment *seg = &ctx->segment[(ctx->segment_head + i) % MPSSE_SEGMENTS];
+		unsigned this_size = seg->read_count - seg->read_transferred;
+		if (this_size > size)
+			this_size = size;
+		memcpy(seg->read_buffer + seg->read_transferred, data, this_size);
+		seg->read_transferred += this_size;
+		ctx->read_pending -= this_size;
+		data += this_size;
+		size -= this_size;
+	}
+
+	if (size > 0)
+		LOG_DEBUG_IO("discarding %d unexpected bytes", size);
+}
+
+static LIBUSB_CALL void read_cb(struct libusb_transfer *transfer);
+
+/* Keep enough read transfers queued to cover all outstanding read data */
+static void mpsse_submit_reads(struct mpsse_ctx *ctx)
+{
+	unsigned packet_size = ctx->max_packet_size;
+	unsigned chunk_payload = ctx->read_chunk_size / packet_size * (packet_size - 2);
+
+	if (ctx->usb_failed)
+		return;
+
+	while (ctx->reads_busy < MPSSE_READ_TRANSFERS
+			&& ctx->reads_busy * chunk_payload < ctx->read_pending) {
+		/* Transfers on one endpoint complete in submission order, so the
+		 * next one in turn is always the one that's free */
+		unsigned i = ctx->read_next;
+		libusb_fill_bulk_transfer(ctx->read_transfer[i], ctx->usb_dev, ctx->in_ep,
+			ctx->read_chunk[i], ctx->read_chunk_size, read_cb, ctx,
+			ctx->usb_read_timeout);
+		int retval = libusb_submit_transfer(ctx->read_transfer[i]);
+		if (retval != LIBUSB_SUCCESS) {
+			LOG_ERROR("libusb_submit_transfer() failed with %s", libusb_error_name(retval));
+			ctx->usb_failed = true;
+			return;
+		}
+		ctx->read_next = (i + 1) % MPSSE_READ_TRANSFERS;
+		ctx->reads_busy++;
+	}
+}
 
 static LIBUSB_CALL void read_cb(struct libusb_transfer *transfer)
 {
-	struct transfer_result *res = transfer->user_data;
-	struct mpsse_ctx *ctx = res->ctx;
+	struct mpsse_ctx *ctx = transfer->user_data;
 
 	unsigned packet_size = ctx->max_packet_size;
 
+	ctx->reads_busy--;
+	jtag_stats_add_transport_bytes(0, transfer->actual_length);
+
+	if (transfer->status == LIBUSB_TRANSFER_CANCELLED)
+		return;
+
 	DEBUG_PRINT_BUF(transfer->buffer, transfer->actual_length);
 
 	/* Strip the two status bytes sent at the beginning of each USB packet
-	 * while copying the chunk buffer to the read buffer */
+	 * while copying the chunk buffer to the read buffers */
 	unsigned num_packets = DIV_ROUND_UP(transfer->actual_length, packet_size);
 	unsigned chunk_remains = transfer->actual_length;
 	for (unsigned i = 0; i < num_packets && chunk_remains > 2; i++) {
 		unsigned this_size = packet_size - 2;
 		if (this_size > chunk_remains - 2)
 			this_size = chunk_remains - 2;
-		if (this_size > ctx->read_count - res->transferred)
-			this_size = ctx->read_count - res->transferred;
-		memcpy(ctx->read_buffer + res->transferred,
-			ctx->read_chunk + packet_size * i + 2,
-			this_size);
-		res->transferred += this_size;
+		mpsse_deliver(ctx, transfer->buffer + packet_size * i + 2, this_size);
 		chunk_remains -= this_size + 2;
-		if (res->transferred == ctx->read_count) {
-			res->done = true;
-			break;
-		}
 	}
 
-	LOG_DEBUG_IO("raw chunk %d, transferred %d of %d", transfer->actual_length, res->transferred,
-		ctx->read_count);
+	LOG_DEBUG_IO("raw chunk %d, %d bytes outstanding", transfer->actual_length,
+		ctx->read_pending);
 
-	if (!res->done)
-		if (libusb_submit_transfer(transfer) != LIBUSB_SUCCESS)
-			res->done = true;
+	if (transfer->status != LIBUSB_TRANSFER_COMPLETED
+			&& transfer->status != LIBUSB_TRANSFER_TIMED_OUT) {
+		LOG_ERROR("ftdi read transfer failed with status %d", transfer->status);
+		ctx->usb_failed = true;
+		return;
+	}
+
+	mpsse_submit_reads(ctx);
 }
 
 static LIBUSB_CALL void write_cb(struct libusb_transfer *transfer)
 {
-	struct transfer_result *res = transfer->user_data;
-	struct mpsse_ctx *ctx = res->ctx;
+	struct mpsse_segment *seg = transfer->user_data;
 
-	res->transferred += transfer->actual_length;
+	seg->write_transferred += transfer->actual_length;
+	jtag_stats_add_transport_bytes(transfer->actual_length, 0);
 
-	LOG_DEBUG_IO("transferred %d of %d", res->transferred, ctx->write_count);
+	LOG_DEBUG_IO("transferred %d of %d", seg->write_transferred, seg->write_count);
 
 	DEBUG_PRINT_BUF(transfer->buffer, transfer->actual_length);
 
-	if (res->transferred == ctx->write_count)
-		res->done = true;
+	if (seg->write_transferred == seg->write_count
+			|| transfer->status == LIBUSB_TRANSFER_CANCELLED)
+		seg->write_done = true;
 	else {
-		transfer->length = ctx->write_count - res->transferred;
-		transfer->buffer = ctx->write_buffer + res->transferred;
+		transfer->length = seg->write_count - seg->write_transferred;
+		transfer->buffer = seg->write_buffer + seg->write_transferred;
 		if (libusb_submit_transfer(transfer) != LIBUSB_SUCCESS)
-			res->done = true;
+			seg->write_done = true;
 	}
 }
 
-int mpsse_flush(struct mpsse_ctx *ctx)
+/* Complete the segments at the head of the queue that are fully transferred,
+ * making their read data available to the callers */
+static int mpsse_retire(struct mpsse_ctx *ctx)
 {
-	int retval = ctx->retval;
+	while (ctx->segments_busy > 0) {
+		struct mpsse_segment *seg = &ctx->segment[ctx->segment_head];
 
-	if (retval != ERROR_OK) {
-		LOG_DEBUG_IO("Ignoring flush due to previous error");
-		assert(ctx->write_count == 0 && ctx->read_count == 0);
-		ctx->retval = ERROR_OK;
-		return retval;
-	}
-
-	LOG_DEBUG_IO("write %d%s, read %d", ctx->write_count, ctx->read_count ? "+1" : "",
-			ctx->read_count);
-	assert(ctx->write_count > 0 || ctx->read_count == 0); /* No read data without write data */
-
-	if (ctx->write_count == 0)
-		return retval;
+		if (!seg->write_done)
+			break;
+		if (seg->write_transferred < seg->write_count) {
+			LOG_ERROR("ftdi device did not accept all data: %d, tried %d",
+				seg->write_transferred,
+				seg->write_count);
+			return ERROR_FAIL;
+		}
+		if (seg->read_transferred < seg->read_count)
+			break;
 
-	struct libusb_transfer *read_transfer = 0;
-	struct transfer_result read_result = { .ctx = ctx, .done = true };
-	if (ctx->read_count) {
-		buffer_write_byte(ctx, 0x87); /* SEND_IMMEDIATE */
-		read_result.done = false;
-		/* delay read transaction to ensure the FTDI chip can support us with data
-		   immediately after processing the MPSSE commands in the write transaction */
-	}
-
-	struct transfer_result write_result = { .ctx = ctx, .done = false };
-	struct libusb_transfer *write_transfer = libusb_alloc_transfer(0);
-	libusb_fill_bulk_transfer(write_transfer, ctx->usb_dev, ctx->out_ep, ctx->write_buffer,
-		ctx->write_count, write_cb, &write_result, ctx->usb_write_timeout);
-	retval = libusb_submit_transfer(write_transfer);
-	if (retval != LIBUSB_SUCCESS)
-		goto error_check;
-
-	if (ctx->read_count) {
-		read_transfer = libusb_alloc_transfer(0);
-		libusb_fill_bulk_transfer(read_transfer, ctx->usb_dev, ctx->in_ep, ctx->read_chunk,
-			ctx->read_chunk_size, read_cb, &read_result,
-			ctx->usb_read_timeout);
-		retval = libusb_submit_transfer(read_transfer);
-		if (retval != LIBUSB_SUCCESS)
-			goto error_check;
+		bit_copy_execute(&seg->read_queue);
+		seg->write_count = 0;
+		seg->read_count = 0;
+		ctx->segment_head = (ctx->segment_head + 1) % MPSSE_SEGMENTS;
+		ctx->segments_busy--;
 	}
 
+	return ERROR_OK;
+}
+
+/* Handle USB events until at most max_busy segments remain in flight */
+static int mpsse_wait(struct mpsse_ctx *ctx, unsigned max_busy)
+{
 	/* Polling loop, more or less taken from libftdi */
 	int64_t start = timeval_ms();
-	while (!write_result.done || !read_result.done) {
+	for (;;) {
+		unsigned busy = ctx->segments_busy;
+		int retval = mpsse_retire(ctx);
+		if (retval != ERROR_OK)
+			return retval;
+		if (ctx->usb_failed)
+			return ERROR_FAIL;
+		if (ctx->segments_busy <= max_busy)
+			return ERROR_OK;
+
+		if (ctx->segments_busy < busy) {
+			start = timeval_ms();
+		} else if (timeval_ms() - start > 2000) {
+			struct mpsse_segment *seg = &ctx->segment[ctx->segment_head];
+			LOG_ERROR("Timed out handling USB events in mpsse_flush().");
+			if (seg->write_done)
+				LOG_ERROR("ftdi device did not return all data: %d, expected %d",
+					seg->read_transferred,
+					seg->read_count);
+			return ERROR_FAIL;
+		}
+
 		struct timeval timeout_usb;
 
 		timeout_usb.tv_sec = 1;
@@ -898,56 +1007,124 @@ int mpsse_flush(struct mpsse_ctx *ctx)
 
 		retval = libusb_handle_events_timeout_completed(ctx->usb_ctx, &timeout_usb, NULL);
 		keep_alive();
-		if (retval == LIBUSB_ERROR_NO_DEVICE || retval == LIBUSB_ERROR_INTERRUPTED)
-			break;
-
 		if (retval != LIBUSB_SUCCESS) {
-			libusb_cancel_transfer(write_transfer);
-			if (read_transfer)
-				libusb_cancel_transfer(read_transfer);
-			while (!write_result.done || !read_result.done) {
-				retval = libusb_handle_events_timeout_completed(ctx->usb_ctx,
-								&timeout_usb, NULL);
-				if (retval != LIBUSB_SUCCESS)
-					break;
-			}
+			LOG_ERROR("libusb_handle_events() failed with %s", libusb_error_name(retval));
+			return ERROR_FAIL;
 		}
+	}
+}
 
-		if (timeval_ms() - start > 2000) {
-			LOG_ERROR("Timed out handling USB events in mpsse_flush().");
-			break;
+/* Cancel all transfers in flight and drop every queued segment */
+static void mpsse_cancel(struct mpsse_ctx *ctx)
+{
+	bool pending = ctx->reads_busy > 0;
+
+	/* Keep the read callback from queuing new transfers meanwhile */
+	ctx->usb_failed = true;
+
+	for (unsigned i = 0; i < ctx->segments_busy; i++) {
+		struct mpsse_segment *seg = &ctx->segment[(ctx->segment_head + i) % MPSSE_SEGMENTS];
+		if (!seg->write_done) {
+			libusb_cancel_transfer(seg->write_transfer);
+			pending = true;
 		}
 	}
+	if (ctx->reads_busy > 0)
+		for (unsigned i = 0; i < MPSSE_READ_TRANSFERS; i++)
+			libusb_cancel_transfer(ctx->read_transfer[i]);
+
+	int64_t start = timeval_ms();
+	while (pending && timeval_ms() - start < 2000) {
+		struct timeval timeout_usb;
+
+		timeout_usb.tv_sec = 0;
+		timeout_usb.tv_usec = 100000;
+
+		if (libusb_handle_events_timeout_completed(ctx->usb_ctx, &timeout_usb, NULL)
+				!= LIBUSB_SUCCESS)
+			break;
+
+		pending = ctx->reads_busy > 0;
+		for (unsigned i = 0; i < ctx->segments_busy; i++)
+			if (!ctx->segment[(ctx->segment_head + i) % MPSSE_SEGMENTS].write_done)
+				pending = true;
+	}
+
+	for (unsigned i = 0; i < MPSSE_SEGMENTS; i++) {
+		struct mpsse_segment *seg = &ctx->segment[i];
+		seg->write_count = 0;
+		seg->read_count = 0;
+		bit_copy_discard(&seg->read_queue);
+	}
+	ctx->segment_head = 0;
+	ctx->segments_busy = 0;
+	ctx->read_pending = 0;
+	ctx->usb_failed = false;
+}
 
-error_check:
+/* Put the segment being filled on the wire and move on to the next one. Only
+ * blocks when all segments are in flight, until the oldest one completes. */
+static int mpsse_submit(struct mpsse_ctx *ctx)
+{
+	struct mpsse_segment *seg = buffer_segment(ctx);
+	int retval;
+
+	LOG_DEBUG_IO("write %d%s, read %d", seg->write_count, seg->read_count ? "+1" : "",
+			seg->read_count);
+	assert(seg->write_count > 0 || seg->read_count == 0); /* No read data without write data */
+
+	if (seg->write_count == 0)
+		return ERROR_OK;
+
+	if (seg->read_count)
+		buffer_write_byte(ctx, 0x87); /* SEND_IMMEDIATE */
+
+	seg->write_transferred = 0;
+	seg->read_transferred = 0;
+	seg->write_done = false;
+	libusb_fill_bulk_transfer(seg->write_transfer, ctx->usb_dev, ctx->out_ep, seg->write_buffer,
+		seg->write_count, write_cb, seg, ctx->usb_write_timeout);
+	retval = libusb_submit_transfer(seg->write_transfer);
 	if (retval != LIBUSB_SUCCESS) {
-		LOG_ERROR("libusb_handle_events() failed with %s", libusb_error_name(retval));
-		retval = ERROR_FAIL;
-	} else if (write_result.transferred < ctx->write_count) {
-		LOG_ERROR("ftdi device did not accept all data: %d, tried %d",
-			write_result.transferred,
-			ctx->write_count);
-		retval = ERROR_FAIL;
-	} else if (read_result.transferred < ctx->read_count) {
-		LOG_ERROR("ftdi device did not return all data: %d, expected %d",
-			read_result.transferred,
-			ctx->read_count);
-		retval = ERROR_FAIL;
-	} else if (ctx->read_count) {
-		ctx->write_count = 0;
-		ctx->read_count = 0;
-		bit_copy_execute(&ctx->read_queue);
-		retval = ERROR_OK;
-	} else {
-		ctx->write_count = 0;
-		bit_copy_discard(&ctx->read_queue);
-		retval = ERROR_OK;
+		LOG_ERROR("libusb_submit_transfer() failed with %s", libusb_error_name(retval));
+		goto error;
+	}
+	ctx->segments_busy++;
+
+	/* Queue the reads after the write to ensure the FTDI chip can support us with
+	 * data immediately after processing the MPSSE commands in the write transaction */
+	ctx->read_pending += seg->read_count;
+	mpsse_submit_reads(ctx);
+
+	if (ctx->segments_busy == MPSSE_SEGMENTS) {
+		retval = mpsse_wait(ctx, MPSSE_SEGMENTS - 1);
+		if (retval != ERROR_OK)
+			goto error;
 	}
 
-	libusb_free_transfer(write_transfer);
-	if (read_transfer)
-		libusb_free_transfer(read_transfer);
+	return ERROR_OK;
+
+error:
+	mpsse_purge(ctx);
+	return ERROR_FAIL;
+}
+
+int mpsse_flush(struct mpsse_ctx *ctx)
+{
+	int retval = ctx->retval;
+
+	if (retval != ERROR_OK) {
+		LOG_DEBUG_IO("Ignoring flush due to previous error");
+		assert(buffer_segment(ctx)->write_count == 0 && buffer_segment(ctx)->read_count == 0);
+		ctx->retval = ERROR_OK;
+		return retval;
+	}
+
+	retval = mpsse_submit(ctx);
+	if (retval != ERROR_OK)
+		return retval;
 
+	retval = mpsse_wait(ctx, 0);
 	if (retval != ERROR_OK)
 		mpsse_purge(ctx);
 
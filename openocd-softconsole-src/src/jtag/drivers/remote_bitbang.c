@@ -67,6 +67,7 @@ static int remote_bitbang_fill_buf(void)
 				remote_bitbang_buf + remote_bitbang_end,
 				contiguous_available_space);
 		if (count > 0) {
+			jtag_stats_add_transport_bytes(0, count);
 			remote_bitbang_end += count;
 			if (remote_bitbang_end == sizeof(remote_bitbang_buf))
 				remote_bitbang_end = 0;
@@ -92,6 +93,7 @@ static int remote_bitbang_putc(int c)
 		LOG_ERROR("remote_bitbang_putc: %s", strerror(errno));
 		return ERROR_FAIL;
 	}
+	jtag_stats_add_transport_bytes(1, 0);
 	return ERROR_OK;
 }
 
@@ -149,6 +151,7 @@ static bb_value_t remote_bitbang_rread(void)
 	char c;
 	ssize_t count = read(remote_bitbang_fd, &c, 1);
 	if (count == 1) {
+		jtag_stats_add_transport_bytes(0, 1);
 		return char_to_int(c);
 	} else {
 		remote_bitbang_quit();
@@ -244,6 +244,28 @@ int jtag_config_rclk(unsigned fallback_speed_khz);
 /** Retreives the clock speed of the JTAG interface in KHz. */
 unsigned jtag_get_speed_khz(void);
 
+/**
+ * Check the scan chain @a iterations times by reading back the IDCODEs
+ * and shifting random patterns through it, leaving the TAPs reset.
+ * @a failures is set to the number of failed checks.
+ */
+int jtag_link_check(unsigned iterations, unsigned *failures);
+
+/**
+ * Find the fastest speed between @a min_khz and @a max_khz at which
+ * jtag_link_check() and the optional @a check, e.g. a throughput probe of
+ * the target, keep passing, and switch to it.
+ */
+int jtag_speed_autotune(unsigned min_khz, unsigned max_khz, unsigned iterations,
+		int (*check)(void *priv), void *priv, unsigned *result_khz);
+
+/**
+ * With retuning enabled, a burst of failed queue executions lowers the
+ * speed by a quarter, down to the minimum of the last tuning.
+ */
+void jtag_set_speed_retune(bool enable);
+bool jtag_get_speed_retune(void);
+
 enum reset_types {
 	RESET_NONE            = 0x0,
 	RESET_HAS_TRST        = 0x1,
@@ -562,6 +584,24 @@ void jtag_execute_queue_noclear(void);
 /** @returns the number of times the scan queue has been flushed */
 int jtag_get_flush_queue_count(void);
 
+/**
+ * Book the queue flushes that follow to @a origin (e.g. "riscv dmi"), until
+ * the matching jtag_flush_origin_pop(). Origins nest, so a flash driver
+ * going through the DMI shows up as "flash/riscv dmi" in jtag_stats.
+ */
+void jtag_flush_origin_push(const char *origin);
+void jtag_flush_origin_pop(void);
+
+/** Account bytes an adapter driver moved over USB or a socket. */
+void jtag_stats_add_transport_bytes(size_t out, size_t in);
+
+struct command_invocation;
+/** Print the flush statistics to @a cmd, or to the log if it is NULL. */
+void jtag_stats_report(struct command_invocation *cmd);
+void jtag_stats_reset(void);
+/** Log a statistics summary at most every @a seconds; 0 disables it. */
+void jtag_stats_set_log_interval(int seconds);
+
 /** Report Tcl event to all TAPs */
 void jtag_notify_event(enum jtag_event);
 
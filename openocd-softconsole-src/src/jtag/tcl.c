@@ -1256,6 +1256,60 @@ COMMAND_HANDLER(handle_jtag_flush_queue_sleep)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_jtag_queue_arena_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		int delay_ms;
+		COMMAND_PARSE_NUMBER(int, CMD_ARGV[0], delay_ms);
+		if (delay_ms < 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		cmd_queue_set_trim_delay(delay_ms);
+	}
+
+	struct cmd_queue_stats stats;
+	cmd_queue_get_stats(&stats);
+
+	command_print(CMD, "%u pages, %zu bytes reserved, high-water mark %zu bytes",
+			stats.pages, stats.bytes_reserved, stats.high_water);
+	command_print(CMD, "%" PRIu64 " allocations, %" PRIu64 " rewinds, "
+			"%" PRIu64 " page mallocs, %" PRIu64 " trims",
+			stats.allocs, stats.rewinds, stats.page_allocs, stats.trims);
+	int delay_ms = cmd_queue_get_trim_delay();
+	if (delay_ms > 0)
+		command_print(CMD, "idle pages trimmed after %d ms", delay_ms);
+	else
+		command_print(CMD, "trimming disabled");
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_jtag_stats_command)
+{
+	if (CMD_ARGC == 0) {
+		jtag_stats_report(CMD);
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC == 1 && strcmp(CMD_ARGV[0], "reset") == 0) {
+		jtag_stats_reset();
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC == 2 && strcmp(CMD_ARGV[0], "log") == 0) {
+		int seconds;
+		COMMAND_PARSE_NUMBER(int, CMD_ARGV[1], seconds);
+		if (seconds < 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		jtag_stats_set_log_interval(seconds);
+		return ERROR_OK;
+	}
+
+	return ERROR_COMMAND_SYNTAX_ERROR;
+}
+
 COMMAND_HANDLER(handle_wait_srst_deassert)
 {
 	if (CMD_ARGC != 1)
@@ -1301,6 +1355,26 @@ static const struct command_registration jtag_command_handlers[] = {
 			"to test performance or change in behavior. Default 0ms.",
 		.usage = "[sleep in ms]",
 	},
+	{
+		.name = "jtag_queue_arena",
+		.handler = handle_jtag_queue_arena_command,
+		.mode = COMMAND_ANY,
+		.help = "Display command queue memory counters. With an "
+			"argument, set how long (ms) extra queue pages may sit "
+			"unused before their memory is trimmed; 0 disables "
+			"trimming. Default 10000ms.",
+		.usage = "[trim_delay_ms]",
+	},
+	{
+		.name = "jtag_stats",
+		.handler = handle_jtag_stats_command,
+		.mode = COMMAND_ANY,
+		.help = "Display JTAG queue flush statistics: latency histogram, "
+			"commands, IR/DR bits shifted, adapter traffic and the "
+			"subsystems causing the flushes. 'reset' clears them, "
+			"'log' prints a summary every few seconds (0 to stop).",
+		.usage = "['reset' | 'log' seconds]",
+	},
 	{
 		.name = "jtag_rclk",
 		.handler = handle_jtag_rclk_command,
@@ -23,6 +23,7 @@
 #include "virtex2.h"
 #include "xilinx_bit.h"
 #include "pld.h"
+#include <helper/time_support.h>
 
 static int virtex2_set_instr(struct jtag_tap *tap, uint32_t new_instr)
 {
@@ -125,35 +126,116 @@ static int virtex2_read_stat(struct pld_device *pld_device, uint32_t *status)
 	return ERROR_OK;
 }
 
+/* IR capture value of the configuration logic */
+#define VIRTEX2_IR_CAPTURE_INIT	(1 << 4)
+#define VIRTEX2_IR_CAPTURE_DONE	(1 << 5)
+
+/* bitstream shifted per DR scan while loading */
+#define VIRTEX2_LOAD_CHUNK_SIZE	(64 * 1024)
+
+/* time allowed for clearing the configuration memory and for startup */
+#define VIRTEX2_POLL_TIMEOUT_MS	1000
+
+static int virtex2_read_ir_capture(struct jtag_tap *tap, uint32_t *capture)
+{
+	struct scan_field field;
+	uint8_t *in = calloc(DIV_ROUND_UP(tap->ir_length, 8), 1);
+	uint8_t *out = calloc(DIV_ROUND_UP(tap->ir_length, 8), 1);
+	int retval = ERROR_FAIL;
+
+	if (in && out) {
+		buf_set_ones(out, tap->ir_length);	/* BYPASS */
+		field.num_bits = tap->ir_length;
+		field.out_value = out;
+		field.in_value = in;
+		jtag_add_ir_scan(tap, &field, TAP_IDLE);
+
+		retval = jtag_execute_queue();
+		*capture = buf_get_u32(in, 0, MIN(tap->ir_length, 32));
+	}
+
+	free(in);
+	free(out);
+	return retval;
+}
+
+/* Poll the IR capture value until (capture & mask) == value */
+static int virtex2_poll_ir_capture(struct jtag_tap *tap, uint32_t mask, uint32_t value,
+	const char *what)
+{
+	int64_t then = timeval_ms();
+	uint32_t capture;
+
+	for (;;) {
+		int retval = virtex2_read_ir_capture(tap, &capture);
+		if (retval != ERROR_OK)
+			return retval;
+		if ((capture & mask) == value)
+			break;
+
+		if (timeval_ms() - then > VIRTEX2_POLL_TIMEOUT_MS) {
+			LOG_ERROR("timeout waiting for %s, IR capture 0x%" PRIx32, what, capture);
+			return ERROR_PLD_FILE_LOAD_FAILED;
+		}
+		keep_alive();
+	}
+
+	LOG_DEBUG("%s after %" PRId64 " ms", what, timeval_ms() - then);
+
+	return ERROR_OK;
+}
+
 static int virtex2_load(struct pld_device *pld_device, const char *filename)
 {
 	struct virtex2_pld_device *virtex2_info = pld_device->driver_priv;
 	struct xilinx_bit_file bit_file;
+	uint8_t *buffer[2] = { NULL, NULL };
+	uint32_t count;
 	int retval;
-	unsigned int i;
 	struct scan_field field;
 
 	field.in_value = NULL;
 
-	retval = xilinx_read_bit_file(&bit_file, filename);
+	retval = xilinx_open_bit_file(&bit_file, filename);
 	if (retval != ERROR_OK)
 		return retval;
 
-	virtex2_set_instr(virtex2_info->tap, 0xb);	/* JPROG_B */
-	jtag_execute_queue();
-	jtag_add_sleep(1000);
+	buffer[0] = malloc(VIRTEX2_LOAD_CHUNK_SIZE);
+	buffer[1] = malloc(VIRTEX2_LOAD_CHUNK_SIZE);
+	if (buffer[0] == NULL || buffer[1] == NULL) {
+		retval = ERROR_FAIL;
+		goto done;
+	}
 
-	virtex2_set_instr(virtex2_info->tap, 0x5);	/* CFG_IN */
+	virtex2_set_instr(virtex2_info->tap, 0xb);	/* JPROG_B */
 	jtag_execute_queue();
 
-	for (i = 0; i < bit_file.length; i++)
-		bit_file.data[i] = flip_u32(bit_file.data[i], 8);
+	/* INIT goes high once the configuration memory is cleared */
+	retval = virtex2_poll_ir_capture(virtex2_info->tap,
+			VIRTEX2_IR_CAPTURE_INIT | VIRTEX2_IR_CAPTURE_DONE,
+			VIRTEX2_IR_CAPTURE_INIT, "configuration memory clear");
+	if (retval != ERROR_OK)
+		goto done;
 
-	field.num_bits = bit_file.length * 8;
-	field.out_value = bit_file.data;
+	virtex2_set_instr(virtex2_info->tap, 0x5);	/* CFG_IN */
 
-	jtag_add_dr_scan(virtex2_info->tap, 1, &field, TAP_DRPAUSE);
-	jtag_execute_queue();
+	/* Shift the bitstream in chunks, pausing in between. The next chunk
+	 * is read and bit reversed while the previous one is still queued,
+	 * so the file is never held in memory as a whole. */
+	retval = xilinx_read_bit_data(&bit_file, buffer[0], VIRTEX2_LOAD_CHUNK_SIZE, &count);
+	for (int i = 0; retval == ERROR_OK && count; i ^= 1) {
+		buf_bit_reverse(buffer[i], buffer[i], count);
+		field.num_bits = count * 8;
+		field.out_value = buffer[i];
+		jtag_add_dr_scan(virtex2_info->tap, 1, &field, TAP_DRPAUSE);
+
+		retval = xilinx_read_bit_data(&bit_file, buffer[i ^ 1],
+				VIRTEX2_LOAD_CHUNK_SIZE, &count);
+		if (retval == ERROR_OK)
+			retval = jtag_execute_queue();
+	}
+	if (retval != ERROR_OK)
+		goto done;
 
 	jtag_add_tlr();
 
@@ -166,9 +248,21 @@ static int virtex2_load(struct pld_device *pld_device, const char *filename)
 		virtex2_set_instr(virtex2_info->tap, 0xc);	/* JSTART */
 	jtag_add_runtest(13, TAP_IDLE);
 	virtex2_set_instr(virtex2_info->tap, 0x3f);		/* BYPASS */
-	jtag_execute_queue();
+	retval = jtag_execute_queue();
+	if (retval != ERROR_OK)
+		goto done;
 
-	return ERROR_OK;
+	/* without JSTART, startup is clocked by CCLK and DONE may follow later */
+	if (!(virtex2_info->no_jstart))
+		retval = virtex2_poll_ir_capture(virtex2_info->tap,
+				VIRTEX2_IR_CAPTURE_DONE, VIRTEX2_IR_CAPTURE_DONE, "DONE");
+
+done:
+	free(buffer[0]);
+	free(buffer[1]);
+	xilinx_free_bit_file(&bit_file);
+
+	return retval;
 }
 
 COMMAND_HANDLER(virtex2_handle_read_stat_command)
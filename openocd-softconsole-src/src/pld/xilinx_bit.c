@@ -27,11 +27,10 @@
 #include <sys/stat.h>
 
 
-static int read_section(FILE *input_file, int length_size, char section,
-	uint32_t *buffer_length, uint8_t **buffer)
+static int read_section_length(FILE *input_file, int length_size, char section,
+	uint32_t *length)
 {
 	uint8_t length_buffer[4];
-	int length;
 	char section_char;
 	int read_count;
 
@@ -52,23 +51,33 @@ static int read_section(FILE *input_file, int length_size, char section,
 		return ERROR_PLD_FILE_LOAD_FAILED;
 
 	if (length_size == 4)
-		length = be_to_h_u32(length_buffer);
+		*length = be_to_h_u32(length_buffer);
 	else	/* (length_size == 2) */
-		length = be_to_h_u16(length_buffer);
+		*length = be_to_h_u16(length_buffer);
+
+	return ERROR_OK;
+}
+
+static int read_section(FILE *input_file, int length_size, char section,
+	uint8_t **buffer)
+{
+	uint32_t length;
 
-	if (buffer_length)
-		*buffer_length = length;
+	if (read_section_length(input_file, length_size, section, &length) != ERROR_OK)
+		return ERROR_PLD_FILE_LOAD_FAILED;
 
-	*buffer = malloc(length);
+	/* the header strings are terminated in the file, but don't rely on it */
+	*buffer = calloc(length + 1, 1);
+	if (*buffer == NULL)
+		return ERROR_PLD_FILE_LOAD_FAILED;
 
-	read_count = fread(*buffer, 1, length, input_file);
-	if (read_count != length)
+	if (fread(*buffer, 1, length, input_file) != length)
 		return ERROR_PLD_FILE_LOAD_FAILED;
 
 	return ERROR_OK;
 }
 
-int xilinx_read_bit_file(struct xilinx_bit_file *bit_file, const char *filename)
+int xilinx_open_bit_file(struct xilinx_bit_file *bit_file, const char *filename)
 {
 	FILE *input_file;
 	struct stat input_stat;
@@ -77,6 +86,8 @@ int xilinx_read_bit_file(struct xilinx_bit_file *bit_file, const char *filename)
 	if (!filename || !bit_file)
 		return ERROR_COMMAND_SYNTAX_ERROR;
 
+	memset(bit_file, 0, sizeof(*bit_file));
+
 	if (stat(filename, &input_stat) == -1) {
 		LOG_ERROR("couldn't stat() %s: %s", filename, strerror(errno));
 		return ERROR_PLD_FILE_LOAD_FAILED;
@@ -97,32 +108,105 @@ int xilinx_read_bit_file(struct xilinx_bit_file *bit_file, const char *filename)
 		LOG_ERROR("couldn't open %s: %s", filename, strerror(errno));
 		return ERROR_PLD_FILE_LOAD_FAILED;
 	}
+	bit_file->input_file = input_file;
 
 	read_count = fread(bit_file->unknown_header, 1, 13, input_file);
 	if (read_count != 13) {
 		LOG_ERROR("couldn't read unknown_header from file '%s'", filename);
-		return ERROR_PLD_FILE_LOAD_FAILED;
+		goto error;
 	}
 
-	if (read_section(input_file, 2, 'a', NULL, &bit_file->source_file) != ERROR_OK)
-		return ERROR_PLD_FILE_LOAD_FAILED;
+	if (read_section(input_file, 2, 'a', &bit_file->source_file) != ERROR_OK)
+		goto error;
 
-	if (read_section(input_file, 2, 'b', NULL, &bit_file->part_name) != ERROR_OK)
-		return ERROR_PLD_FILE_LOAD_FAILED;
+	if (read_section(input_file, 2, 'b', &bit_file->part_name) != ERROR_OK)
+		goto error;
 
-	if (read_section(input_file, 2, 'c', NULL, &bit_file->date) != ERROR_OK)
-		return ERROR_PLD_FILE_LOAD_FAILED;
+	if (read_section(input_file, 2, 'c', &bit_file->date) != ERROR_OK)
+		goto error;
 
-	if (read_section(input_file, 2, 'd', NULL, &bit_file->time) != ERROR_OK)
-		return ERROR_PLD_FILE_LOAD_FAILED;
+	if (read_section(input_file, 2, 'd', &bit_file->time) != ERROR_OK)
+		goto error;
 
-	if (read_section(input_file, 4, 'e', &bit_file->length, &bit_file->data) != ERROR_OK)
-		return ERROR_PLD_FILE_LOAD_FAILED;
+	if (read_section_length(input_file, 4, 'e', &bit_file->length) != ERROR_OK)
+		goto error;
+
+	if (bit_file->length > input_stat.st_size - ftell(input_file)) {
+		LOG_ERROR("bitstream of %s is truncated", filename);
+		goto error;
+	}
+	bit_file->remaining = bit_file->length;
 
 	LOG_DEBUG("bit_file: %s %s %s,%s %" PRIi32 "", bit_file->source_file, bit_file->part_name,
 		bit_file->date, bit_file->time, bit_file->length);
 
-	fclose(input_file);
+	return ERROR_OK;
+
+error:
+	xilinx_free_bit_file(bit_file);
+	return ERROR_PLD_FILE_LOAD_FAILED;
+}
+
+int xilinx_read_bit_data(struct xilinx_bit_file *bit_file, uint8_t *buffer,
+	uint32_t size, uint32_t *read)
+{
+	uint32_t count = MIN(size, bit_file->remaining);
+
+	*read = 0;
+	if (count == 0)
+		return ERROR_OK;
+
+	if (fread(buffer, 1, count, bit_file->input_file) != count) {
+		LOG_ERROR("couldn't read bitstream");
+		return ERROR_PLD_FILE_LOAD_FAILED;
+	}
+
+	bit_file->remaining -= count;
+	*read = count;
+
+	return ERROR_OK;
+}
+
+int xilinx_read_bit_file(struct xilinx_bit_file *bit_file, const char *filename)
+{
+	uint32_t read;
+
+	int retval = xilinx_open_bit_file(bit_file, filename);
+	if (retval != ERROR_OK)
+		return retval;
+
+	bit_file->data = malloc(bit_file->length);
+	if (bit_file->data == NULL && bit_file->length) {
+		xilinx_free_bit_file(bit_file);
+		return ERROR_PLD_FILE_LOAD_FAILED;
+	}
+
+	retval = xilinx_read_bit_data(bit_file, bit_file->data, bit_file->length, &read);
+	if (retval != ERROR_OK) {
+		xilinx_free_bit_file(bit_file);
+		return retval;
+	}
+
+	fclose(bit_file->input_file);
+	bit_file->input_file = NULL;
 
 	return ERROR_OK;
 }
+
+void xilinx_free_bit_file(struct xilinx_bit_file *bit_file)
+{
+	if (bit_file->input_file)
+		fclose(bit_file->input_file);
+	bit_file->input_file = NULL;
+
+	free(bit_file->source_file);
+	free(bit_file->part_name);
+	free(bit_file->date);
+	free(bit_file->time);
+	free(bit_file->data);
+	bit_file->source_file = NULL;
+	bit_file->part_name = NULL;
+	bit_file->date = NULL;
+	bit_file->time = NULL;
+	bit_file->data = NULL;
+}
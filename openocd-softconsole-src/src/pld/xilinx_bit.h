@@ -19,6 +19,8 @@
 #ifndef OPENOCD_PLD_XILINX_BIT_H
 #define OPENOCD_PLD_XILINX_BIT_H
 
+#include <stdio.h>
+
 struct xilinx_bit_file {
 	uint8_t unknown_header[13];
 	uint8_t *source_file;
@@ -27,8 +29,17 @@ struct xilinx_bit_file {
 	uint8_t *time;
 	uint32_t length;
 	uint8_t *data;
+	/* bitstream left to read by xilinx_read_bit_data() */
+	FILE *input_file;
+	uint32_t remaining;
 };
 
+/* read the header and the whole bitstream into bit_file->data */
 int xilinx_read_bit_file(struct xilinx_bit_file *bit_file, const char *filename);
+/* read the header only, the bitstream is then read with xilinx_read_bit_data() */
+int xilinx_open_bit_file(struct xilinx_bit_file *bit_file, const char *filename);
+int xilinx_read_bit_data(struct xilinx_bit_file *bit_file, uint8_t *buffer,
+		uint32_t size, uint32_t *read);
+void xilinx_free_bit_file(struct xilinx_bit_file *bit_file);
 
 #endif /* OPENOCD_PLD_XILINX_BIT_H */
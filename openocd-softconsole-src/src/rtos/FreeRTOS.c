@@ -105,6 +105,8 @@ static int FreeRTOS_update_threads(struct rtos *rtos);
 static int FreeRTOS_get_thread_reg_list(struct rtos *rtos, int64_t thread_id,
 		struct rtos_reg **reg_list, int *num_regs);
 static int FreeRTOS_get_symbol_list_to_lookup(symbol_table_elem_t *symbol_list[]);
+static int FreeRTOS_clean(struct target *target);
+static void FreeRTOS_free_params(struct rtos *rtos);
 
 struct rtos_type FreeRTOS_rtos = {
 	.name = "FreeRTOS",
@@ -114,6 +116,8 @@ struct rtos_type FreeRTOS_rtos = {
 	.update_threads = FreeRTOS_update_threads,
 	.get_thread_reg_list = FreeRTOS_get_thread_reg_list,
 	.get_symbol_list_to_lookup = FreeRTOS_get_symbol_list_to_lookup,
+	.clean = FreeRTOS_clean,
+	.free_params = FreeRTOS_free_params,
 };
 
 enum FreeRTOS_symbol_values {
@@ -128,6 +132,7 @@ enum FreeRTOS_symbol_values {
 	FreeRTOS_VAL_xSuspendedTaskList = 8,
 	FreeRTOS_VAL_uxCurrentNumberOfTasks = 9,
 	FreeRTOS_VAL_uxTopUsedPriority = 10,
+	FreeRTOS_VAL_uxTaskNumber = 11,
 };
 
 struct symbols {
@@ -147,25 +152,307 @@ static const struct symbols FreeRTOS_symbol_list[] = {
 	{ "xSuspendedTaskList", true }, /* Only if INCLUDE_vTaskSuspend */
 	{ "uxCurrentNumberOfTasks", false },
 	{ "uxTopUsedPriority", true }, /* Unavailable since v7.5.3 */
+	{ "uxTaskNumber", true },
 	{ NULL, false }
 };
 
-/* TODO: */
-/* this is not safe for little endian yet */
-/* may be problems reading if sizes are not 32 bit long integers. */
-/* test mallocs for failure */
+/* Ranges of memory closer than this are read in one access */
+#define FREERTOS_READ_GAP	32
+/* Bytes of a thread name read at first, enough for the default
+ * configMAX_TASK_NAME_LEN */
+#define FREERTOS_NAME_CHUNK	32
+#define FREERTOS_THREAD_NAME_STR_SIZE (200)
+/* ready lists of all priorities and five more */
+#define FREERTOS_MAX_LISTS	(FREERTOS_MAX_PRIORITIES + 1 + 5)
+#define FREERTOS_MAX_LIST_WIDTH	32
+
+struct FreeRTOS_read {
+	target_addr_t address;
+	uint32_t size;
+	uint8_t *buffer;
+};
+
+/* Name of a TCB, valid until a task gets created */
+struct FreeRTOS_tcb {
+	threadid_t address;
+	char *name;
+};
+
+/* A task list as found by the last update */
+struct FreeRTOS_list {
+	uint8_t header[FREERTOS_MAX_LIST_WIDTH];
+	bool walked;
+	threadid_t *tcbs;
+	unsigned int num_tcbs;
+};
+
+struct FreeRTOS {
+	const struct FreeRTOS_params *param;
+	/* no target event since the thread list was built */
+	bool up_to_date;
+	/* FPU state of the core since the last target event, -1 if unknown */
+	int fpu_enabled;
+	uint64_t task_number;
+	struct FreeRTOS_tcb *tcbs;
+	unsigned int num_tcbs;
+	struct FreeRTOS_list lists[FREERTOS_MAX_LISTS];
+};
+
+static uint64_t FreeRTOS_get_value(struct target *target, const uint8_t *buffer,
+		unsigned int width)
+{
+	switch (width) {
+		case 8:
+			return target_buffer_get_u64(target, buffer);
+		case 4:
+			return target_buffer_get_u32(target, buffer);
+		case 2:
+			return target_buffer_get_u16(target, buffer);
+		default:
+			return buffer[0];
+	}
+}
+
+static int FreeRTOS_compare_reads(const void *a, const void *b)
+{
+	const struct FreeRTOS_read *ra = *(const struct FreeRTOS_read * const *)a;
+	const struct FreeRTOS_read *rb = *(const struct FreeRTOS_read * const *)b;
+
+	if (ra->address < rb->address)
+		return -1;
+	return ra->address > rb->address;
+}
+
+/* Read several small ranges, merging those close to each other, in one
+ * multi-region read of aligned words */
+static int FreeRTOS_read_batch(struct target *target, struct FreeRTOS_read *reads,
+		unsigned int count)
+{
+	struct FreeRTOS_read **sorted;
+	struct target_memory_region *regions;
+	unsigned int num_regions = 0;
+	int retval = ERROR_OK;
+
+	if (count == 0)
+		return ERROR_OK;
+
+	sorted = malloc(count * sizeof(*sorted));
+	regions = calloc(count, sizeof(*regions));
+	if (sorted == NULL || regions == NULL) {
+		retval = ERROR_FAIL;
+		goto out;
+	}
+	for (unsigned int i = 0; i < count; i++)
+		sorted[i] = &reads[i];
+	qsort(sorted, count, sizeof(*sorted), FreeRTOS_compare_reads);
+
+	for (unsigned int i = 0, j; i < count; i = j) {
+		target_addr_t start = sorted[i]->address & ~(target_addr_t)3;
+		target_addr_t end = sorted[i]->address + sorted[i]->size;
+
+		for (j = i + 1; j < count && sorted[j]->address <= end + FREERTOS_READ_GAP; j++)
+			end = MAX(end, sorted[j]->address + sorted[j]->size);
+		end = (end + 3) & ~(target_addr_t)3;
+
+		struct target_memory_region *region = &regions[num_regions++];
+		region->address = start;
+		region->size = 4;
+		region->count = (end - start) / 4;
+		region->buffer = malloc(end - start);
+		if (region->buffer == NULL) {
+			retval = ERROR_FAIL;
+			goto out;
+		}
+	}
+
+	retval = target_read_memory_multi(target, regions, num_regions);
+	if (retval != ERROR_OK)
+		goto out;
+
+	for (unsigned int i = 0, n = 0; i < count; i++) {
+		while (sorted[i]->address >= regions[n].address + regions[n].count * 4)
+			n++;
+		memcpy(sorted[i]->buffer, regions[n].buffer + (sorted[i]->address - regions[n].address),
+				sorted[i]->size);
+	}
+
+out:
+	if (regions != NULL)
+		for (unsigned int i = 0; i < num_regions; i++)
+			free(regions[i].buffer);
+	free(regions);
+	free(sorted);
+	return retval;
+}
+
+static void FreeRTOS_free_tcbs(struct FreeRTOS *freertos)
+{
+	for (unsigned int i = 0; i < freertos->num_tcbs; i++)
+		free(freertos->tcbs[i].name);
+	free(freertos->tcbs);
+	freertos->tcbs = NULL;
+	freertos->num_tcbs = 0;
+}
+
+static const char *FreeRTOS_find_name(struct FreeRTOS *freertos, threadid_t tcb)
+{
+	for (unsigned int i = 0; i < freertos->num_tcbs; i++)
+		if (freertos->tcbs[i].address == tcb)
+			return freertos->tcbs[i].name;
+
+	return NULL;
+}
 
+static int FreeRTOS_add_name(struct FreeRTOS *freertos, threadid_t tcb, const char *name)
+{
+	struct FreeRTOS_tcb *tcbs = realloc(freertos->tcbs,
+			(freertos->num_tcbs + 1) * sizeof(*tcbs));
+	if (tcbs == NULL)
+		return ERROR_FAIL;
+	freertos->tcbs = tcbs;
+
+	tcbs[freertos->num_tcbs].address = tcb;
+	tcbs[freertos->num_tcbs].name = strdup(name[0] ? name : "No Name");
+	if (tcbs[freertos->num_tcbs].name == NULL)
+		return ERROR_FAIL;
+	freertos->num_tcbs++;
+
+	return ERROR_OK;
+}
+
+/* Read the names of the TCBs not in the cache yet, short names in one
+ * batch */
+static int FreeRTOS_read_names(struct rtos *rtos, threadid_t *tcbs, unsigned int count)
+{
+	struct FreeRTOS *freertos = rtos->rtos_specific_params;
+	const struct FreeRTOS_params *param = freertos->param;
+	struct FreeRTOS_read *reads;
+	char (*names)[FREERTOS_NAME_CHUNK];
+	unsigned int num_reads = 0;
+	int retval = ERROR_FAIL;
+
+	if (count == 0)
+		return ERROR_OK;
+
+	reads = calloc(count, sizeof(*reads));
+	names = calloc(count, FREERTOS_NAME_CHUNK);
+	if (reads == NULL || names == NULL)
+		goto out;
+
+	for (unsigned int i = 0; i < count; i++) {
+		if (FreeRTOS_find_name(freertos, tcbs[i]))
+			continue;
+		reads[num_reads].address = tcbs[i] + param->thread_name_offset;
+		reads[num_reads].size = FREERTOS_NAME_CHUNK;
+		reads[num_reads].buffer = (uint8_t *)names[num_reads];
+		num_reads++;
+	}
+
+	retval = FreeRTOS_read_batch(rtos->target, reads, num_reads);
+	if (retval != ERROR_OK) {
+		LOG_ERROR("Error reading thread names in FreeRTOS thread list");
+		goto out;
+	}
+
+	for (unsigned int i = 0; i < num_reads; i++) {
+		threadid_t tcb = reads[i].address - param->thread_name_offset;
+		char tmp_str[FREERTOS_THREAD_NAME_STR_SIZE];
+
+		if (memchr(names[i], '\0', FREERTOS_NAME_CHUNK)) {
+			strcpy(tmp_str, names[i]);
+		} else {
+			/* a long name */
+			retval = target_read_buffer(rtos->target, reads[i].address,
+					FREERTOS_THREAD_NAME_STR_SIZE, (uint8_t *)tmp_str);
+			if (retval != ERROR_OK) {
+				LOG_ERROR("Error reading thread name in FreeRTOS thread list");
+				goto out;
+			}
+			tmp_str[FREERTOS_THREAD_NAME_STR_SIZE-1] = '\x00';
+		}
+		LOG_DEBUG("FreeRTOS: Read Thread Name at 0x%" PRIx64 ", value \"%s\"",
+				reads[i].address, tmp_str);
+
+		retval = FreeRTOS_add_name(freertos, tcb, tmp_str);
+		if (retval != ERROR_OK)
+			goto out;
+	}
+
+out:
+	free(names);
+	free(reads);
+	return retval;
+}
+
+/* Collect the TCBs of a list, one read per list item */
+static int FreeRTOS_walk_list(struct rtos *rtos, struct FreeRTOS_list *list,
+		unsigned int max_tcbs)
+{
+	struct FreeRTOS *freertos = rtos->rtos_specific_params;
+	const struct FreeRTOS_params *param = freertos->param;
+	unsigned int lo = MIN(param->list_elem_next_offset, param->list_elem_content_offset);
+	unsigned int hi = MAX(param->list_elem_next_offset, param->list_elem_content_offset)
+		+ param->pointer_width;
+	uint8_t item[FREERTOS_MAX_LIST_WIDTH];
+
+	uint64_t list_thread_count = FreeRTOS_get_value(rtos->target, list->header,
+			param->thread_count_width);
+	uint64_t list_elem_ptr = FreeRTOS_get_value(rtos->target,
+			list->header + param->list_next_offset, param->pointer_width);
+	uint64_t prev_list_elem_ptr = -1;
+
+	threadid_t *tcbs = realloc(list->tcbs, (MIN(list_thread_count, max_tcbs) + 1) * sizeof(*tcbs));
+	if (tcbs == NULL)
+		return ERROR_FAIL;
+	list->tcbs = tcbs;
+	list->num_tcbs = 0;
+	list->walked = false;
+
+	while ((list_thread_count > 0) && (list_elem_ptr != 0) &&
+			(list_elem_ptr != prev_list_elem_ptr) &&
+			(list->num_tcbs < max_tcbs)) {
+		int retval = target_read_buffer(rtos->target, list_elem_ptr + lo, hi - lo, item);
+		if (retval != ERROR_OK) {
+			LOG_ERROR("Error reading thread list item in FreeRTOS thread list");
+			return retval;
+		}
+
+		tcbs[list->num_tcbs] = FreeRTOS_get_value(rtos->target,
+				item + param->list_elem_content_offset - lo, param->pointer_width);
+		LOG_DEBUG("FreeRTOS: Read Thread ID at 0x%" PRIx64 ", value 0x%" PRIx64,
+				list_elem_ptr + param->list_elem_content_offset, tcbs[list->num_tcbs]);
+		list->num_tcbs++;
+		list_thread_count--;
+
+		prev_list_elem_ptr = list_elem_ptr;
+		list_elem_ptr = FreeRTOS_get_value(rtos->target,
+				item + param->list_elem_next_offset - lo, param->pointer_width);
+	}
+
+	list->walked = true;
+	return ERROR_OK;
+}
+
+/*
+ * The thread list is rebuilt only after a target event, when the target
+ * may have run. The scalars and all list headers are then read in a few
+ * batched accesses; lists which are empty, or unchanged and too short for
+ * their header not to tell, are not walked again, and thread names are
+ * cached by TCB address until uxTaskNumber says a task was created.
+ */
 static int FreeRTOS_update_threads(struct rtos *rtos)
 {
 	int i = 0;
 	int retval;
 	int tasks_found = 0;
+	struct FreeRTOS *freertos;
 	const struct FreeRTOS_params *param;
 
 	if (rtos->rtos_specific_params == NULL)
 		return -1;
 
-	param = (const struct FreeRTOS_params *) rtos->rtos_specific_params;
+	freertos = rtos->rtos_specific_params;
+	param = freertos->param;
 
 	if (rtos->symbols == NULL) {
 		LOG_ERROR("No symbols for FreeRTOS");
@@ -177,35 +464,69 @@ static int FreeRTOS_update_threads(struct rtos *rtos)
 		return -2;
 	}
 
-	int thread_list_size = 0;
-	retval = target_read_buffer(rtos->target,
-			rtos->symbols[FreeRTOS_VAL_uxCurrentNumberOfTasks].address,
-			param->thread_count_width,
-			(uint8_t *)&thread_list_size);
-	LOG_DEBUG("FreeRTOS: Read uxCurrentNumberOfTasks at 0x%" PRIx64 ", value %d\r\n",
-										rtos->symbols[FreeRTOS_VAL_uxCurrentNumberOfTasks].address,
-										thread_list_size);
+	if (freertos->up_to_date && rtos->thread_details)
+		return ERROR_OK;
+
+	/* Everything at a fixed address in one batch: the scalars and the
+	 * lists other than the ready lists */
+	symbol_address_t list_of_lists[FREERTOS_MAX_LISTS];
+	uint8_t thread_count_buf[8] = { 0 };
+	uint8_t current_buf[8] = { 0 };
+	uint8_t top_priority_buf[8] = { 0 };
+	uint8_t task_number_buf[8] = { 0 };
+	struct FreeRTOS_read reads[FREERTOS_MAX_LISTS + 4];
+	unsigned int num_reads = 0;
+
+	reads[num_reads++] = (struct FreeRTOS_read) {
+		rtos->symbols[FreeRTOS_VAL_uxCurrentNumberOfTasks].address,
+		param->thread_count_width, thread_count_buf };
+	reads[num_reads++] = (struct FreeRTOS_read) {
+		rtos->symbols[FreeRTOS_VAL_pxCurrentTCB].address,
+		param->pointer_width, current_buf };
+	if (rtos->symbols[FreeRTOS_VAL_uxTopUsedPriority].address)
+		reads[num_reads++] = (struct FreeRTOS_read) {
+			rtos->symbols[FreeRTOS_VAL_uxTopUsedPriority].address,
+			param->pointer_width, top_priority_buf };
+	if (rtos->symbols[FreeRTOS_VAL_uxTaskNumber].address)
+		reads[num_reads++] = (struct FreeRTOS_read) {
+			rtos->symbols[FreeRTOS_VAL_uxTaskNumber].address,
+			param->thread_count_width, task_number_buf };
+
+	list_of_lists[0] = rtos->symbols[FreeRTOS_VAL_xDelayedTaskList1].address;
+	list_of_lists[1] = rtos->symbols[FreeRTOS_VAL_xDelayedTaskList2].address;
+	list_of_lists[2] = rtos->symbols[FreeRTOS_VAL_xPendingReadyList].address;
+	list_of_lists[3] = rtos->symbols[FreeRTOS_VAL_xSuspendedTaskList].address;
+	list_of_lists[4] = rtos->symbols[FreeRTOS_VAL_xTasksWaitingTermination].address;
+
+	uint8_t headers[FREERTOS_MAX_LISTS][FREERTOS_MAX_LIST_WIDTH];
+	for (i = 0; i < 5; i++) {
+		if (list_of_lists[i] == 0)
+			continue;
+		reads[num_reads++] = (struct FreeRTOS_read) {
+			list_of_lists[i], param->list_width, headers[i] };
+	}
 
+	retval = FreeRTOS_read_batch(rtos->target, reads, num_reads);
 	if (retval != ERROR_OK) {
 		LOG_ERROR("Could not read FreeRTOS thread count from target");
 		return retval;
 	}
 
+	int thread_list_size = FreeRTOS_get_value(rtos->target, thread_count_buf,
+			param->thread_count_width);
+	LOG_DEBUG("FreeRTOS: Read uxCurrentNumberOfTasks at 0x%" PRIx64 ", value %d",
+			rtos->symbols[FreeRTOS_VAL_uxCurrentNumberOfTasks].address,
+			thread_list_size);
+
 	/* wipe out previous thread details if any */
 	rtos_free_threadlist(rtos);
 
 	/* read the current thread */
-	retval = target_read_buffer(rtos->target,
+	rtos->current_thread = FreeRTOS_get_value(rtos->target, current_buf,
+			param->pointer_width);
+	LOG_DEBUG("FreeRTOS: Read pxCurrentTCB at 0x%" PRIx64 ", value 0x%" PRIx64,
 			rtos->symbols[FreeRTOS_VAL_pxCurrentTCB].address,
-			param->pointer_width,
-			(uint8_t *)&rtos->current_thread);
-	if (retval != ERROR_OK) {
-		LOG_ERROR("Error reading current thread in FreeRTOS thread list");
-		return retval;
-	}
-	LOG_DEBUG("FreeRTOS: Read pxCurrentTCB at 0x%" PRIx64 ", value 0x%" PRIx64 "\r\n",
-										rtos->symbols[FreeRTOS_VAL_pxCurrentTCB].address,
-										rtos->current_thread);
+			rtos->current_thread);
 
 	if ((thread_list_size  == 0) || (rtos->current_thread == 0)) {
 		/* Either : No RTOS threads - there is always at least the current execution though */
@@ -228,6 +549,7 @@ static int FreeRTOS_update_threads(struct rtos *rtos)
 
 		if (thread_list_size == 1) {
 			rtos->thread_count = 1;
+			freertos->up_to_date = true;
 			return ERROR_OK;
 		}
 	} else {
@@ -245,154 +567,109 @@ static int FreeRTOS_update_threads(struct rtos *rtos)
 		LOG_ERROR("FreeRTOS: uxTopUsedPriority is not defined, consult the OpenOCD manual for a work-around");
 		return ERROR_FAIL;
 	}
-	int64_t max_used_priority = 0;
-	retval = target_read_buffer(rtos->target,
+	int64_t max_used_priority = FreeRTOS_get_value(rtos->target, top_priority_buf,
+			param->pointer_width);
+	LOG_DEBUG("FreeRTOS: Read uxTopUsedPriority at 0x%" PRIx64 ", value %" PRId64,
 			rtos->symbols[FreeRTOS_VAL_uxTopUsedPriority].address,
-			param->pointer_width,
-			(uint8_t *)&max_used_priority);
-	if (retval != ERROR_OK)
-		return retval;
-	LOG_DEBUG("FreeRTOS: Read uxTopUsedPriority at 0x%" PRIx64 ", value %" PRId64 "\r\n",
-										rtos->symbols[FreeRTOS_VAL_uxTopUsedPriority].address,
-										max_used_priority);
+			max_used_priority);
 	if (max_used_priority > FREERTOS_MAX_PRIORITIES) {
 		LOG_ERROR("FreeRTOS maximum used priority is unreasonably big, not proceeding: %" PRId64 "",
 			max_used_priority);
 		return ERROR_FAIL;
 	}
 
-	symbol_address_t *list_of_lists =
-		malloc(sizeof(symbol_address_t) *
-			(max_used_priority+1 + 5));
-	if (!list_of_lists) {
-		LOG_ERROR("Error allocating memory for %" PRId64 " priorities", max_used_priority);
-		return ERROR_FAIL;
+	/* the ready lists are an array, read in one access */
+	int num_lists = 5;
+	for (i = 0; i <= max_used_priority; i++)
+		list_of_lists[num_lists++] = rtos->symbols[FreeRTOS_VAL_pxReadyTasksLists].address +
+			i * param->list_width;
+	num_reads = 0;
+	for (i = 5; i < num_lists; i++)
+		reads[num_reads++] = (struct FreeRTOS_read) {
+			list_of_lists[i], param->list_width, headers[i] };
+	retval = FreeRTOS_read_batch(rtos->target, reads, num_reads);
+	if (retval != ERROR_OK) {
+		LOG_ERROR("Error reading FreeRTOS ready lists");
+		return retval;
 	}
 
-	int num_lists;
-	for (num_lists = 0; num_lists <= max_used_priority; num_lists++)
-		list_of_lists[num_lists] = rtos->symbols[FreeRTOS_VAL_pxReadyTasksLists].address +
-			num_lists * param->list_width;
+	/* A TCB address is reused only by a newly created task */
+	uint64_t task_number = FreeRTOS_get_value(rtos->target, task_number_buf,
+			param->thread_count_width);
+	if (rtos->symbols[FreeRTOS_VAL_uxTaskNumber].address == 0
+			|| task_number != freertos->task_number)
+		FreeRTOS_free_tcbs(freertos);
+	freertos->task_number = task_number;
+
+	/* keep the order of the original walk: ready lists first */
+	threadid_t *tcbs = malloc(thread_list_size * sizeof(*tcbs));
+	unsigned int num_tcbs = 0;
+	if (tcbs == NULL)
+		return ERROR_FAIL;
 
-	list_of_lists[num_lists++] = rtos->symbols[FreeRTOS_VAL_xDelayedTaskList1].address;
-	list_of_lists[num_lists++] = rtos->symbols[FreeRTOS_VAL_xDelayedTaskList2].address;
-	list_of_lists[num_lists++] = rtos->symbols[FreeRTOS_VAL_xPendingReadyList].address;
-	list_of_lists[num_lists++] = rtos->symbols[FreeRTOS_VAL_xSuspendedTaskList].address;
-	list_of_lists[num_lists++] = rtos->symbols[FreeRTOS_VAL_xTasksWaitingTermination].address;
+	for (int n = 0; n < num_lists; n++) {
+		int index = n <= max_used_priority ? n + 5 : n - max_used_priority - 1;
+		struct FreeRTOS_list *list = &freertos->lists[index];
 
-	for (i = 0; i < num_lists; i++) {
-		if (list_of_lists[i] == 0)
+		if (list_of_lists[index] == 0) {
+			list->walked = false;
 			continue;
+		}
 
-		/* Read the number of threads in this list */
-		int64_t list_thread_count = 0;
-		retval = target_read_buffer(rtos->target,
-				list_of_lists[i],
-				param->thread_count_width,
-				(uint8_t *)&list_thread_count);
-		if (retval != ERROR_OK) {
-			LOG_ERROR("Error reading number of threads in FreeRTOS thread list");
-			free(list_of_lists);
-			return retval;
+		uint64_t list_thread_count = FreeRTOS_get_value(rtos->target, headers[index],
+				param->thread_count_width);
+		LOG_DEBUG("FreeRTOS: Read thread count for list %d at 0x%" PRIx64 ", value %" PRId64,
+				index, list_of_lists[index], list_thread_count);
+
+		/* with at most two items, the first and last item in the header
+		 * give the whole list */
+		if (!list->walked || list_thread_count > 2
+				|| list->num_tcbs != list_thread_count
+				|| memcmp(list->header, headers[index], param->list_width) != 0) {
+			memcpy(list->header, headers[index], param->list_width);
+			if (list_thread_count == 0) {
+				list->num_tcbs = 0;
+				list->walked = true;
+			} else {
+				retval = FreeRTOS_walk_list(rtos, list, thread_list_size - tasks_found - num_tcbs);
+				if (retval != ERROR_OK) {
+					free(tcbs);
+					return retval;
+				}
+			}
 		}
-		LOG_DEBUG("FreeRTOS: Read thread count for list %d at 0x%" PRIx64 ", value %" PRId64 "\r\n",
-										i, list_of_lists[i], list_thread_count);
 
-		if (list_thread_count == 0)
-			continue;
+		for (unsigned int k = 0; k < list->num_tcbs
+				&& tasks_found + num_tcbs < (unsigned int)thread_list_size; k++)
+			tcbs[num_tcbs++] = list->tcbs[k];
+	}
 
-		/* Read the location of first list item */
-		uint64_t prev_list_elem_ptr = -1;
-		uint64_t list_elem_ptr = 0;
-		retval = target_read_buffer(rtos->target,
-				list_of_lists[i] + param->list_next_offset,
-				param->pointer_width,
-				(uint8_t *)&list_elem_ptr);
-		if (retval != ERROR_OK) {
-			LOG_ERROR("Error reading first thread item location in FreeRTOS thread list");
-			free(list_of_lists);
-			return retval;
-		}
-		LOG_DEBUG("FreeRTOS: Read first item for list %d at 0x%" PRIx64 ", value 0x%" PRIx64 "\r\n",
-										i, list_of_lists[i] + param->list_next_offset, list_elem_ptr);
-
-		while ((list_thread_count > 0) && (list_elem_ptr != 0) &&
-				(list_elem_ptr != prev_list_elem_ptr) &&
-				(tasks_found < thread_list_size)) {
-			/* Get the location of the thread structure. */
-			rtos->thread_details[tasks_found].threadid = 0;
-			retval = target_read_buffer(rtos->target,
-					list_elem_ptr + param->list_elem_content_offset,
-					param->pointer_width,
-					(uint8_t *)&(rtos->thread_details[tasks_found].threadid));
-			if (retval != ERROR_OK) {
-				LOG_ERROR("Error reading thread list item object in FreeRTOS thread list");
-				free(list_of_lists);
-				return retval;
-			}
-			LOG_DEBUG("FreeRTOS: Read Thread ID at 0x%" PRIx64 ", value 0x%" PRIx64 "\r\n",
-										list_elem_ptr + param->list_elem_content_offset,
-										rtos->thread_details[tasks_found].threadid);
+	retval = FreeRTOS_read_names(rtos, tcbs, num_tcbs);
+	if (retval != ERROR_OK) {
+		free(tcbs);
+		return retval;
+	}
 
-			/* get thread name */
+	for (unsigned int k = 0; k < num_tcbs; k++) {
+		struct thread_detail *detail = &rtos->thread_details[tasks_found];
 
-			#define FREERTOS_THREAD_NAME_STR_SIZE (200)
-			char tmp_str[FREERTOS_THREAD_NAME_STR_SIZE];
+		detail->threadid = tcbs[k];
+		detail->thread_name_str = strdup(FreeRTOS_find_name(freertos, tcbs[k]));
+		detail->exists = true;
 
-			/* Read the thread name */
-			retval = target_read_buffer(rtos->target,
-					rtos->thread_details[tasks_found].threadid + param->thread_name_offset,
-					FREERTOS_THREAD_NAME_STR_SIZE,
-					(uint8_t *)&tmp_str);
-			if (retval != ERROR_OK) {
-				LOG_ERROR("Error reading first thread item location in FreeRTOS thread list");
-				free(list_of_lists);
-				return retval;
-			}
-			tmp_str[FREERTOS_THREAD_NAME_STR_SIZE-1] = '\x00';
-			LOG_DEBUG("FreeRTOS: Read Thread Name at 0x%" PRIx64 ", value \"%s\"\r\n",
-										rtos->thread_details[tasks_found].threadid + param->thread_name_offset,
-										tmp_str);
-
-			if (tmp_str[0] == '\x00')
-				strcpy(tmp_str, "No Name");
-
-			rtos->thread_details[tasks_found].thread_name_str =
-				malloc(strlen(tmp_str)+1);
-			strcpy(rtos->thread_details[tasks_found].thread_name_str, tmp_str);
-			rtos->thread_details[tasks_found].exists = true;
-
-			if (rtos->thread_details[tasks_found].threadid == rtos->current_thread) {
-				char running_str[] = "State: Running";
-				rtos->thread_details[tasks_found].extra_info_str = malloc(
-						sizeof(running_str));
-				strcpy(rtos->thread_details[tasks_found].extra_info_str,
-					running_str);
-			} else
-				rtos->thread_details[tasks_found].extra_info_str = NULL;
-
-			tasks_found++;
-			list_thread_count--;
-
-			prev_list_elem_ptr = list_elem_ptr;
-			list_elem_ptr = 0;
-			retval = target_read_buffer(rtos->target,
-					prev_list_elem_ptr + param->list_elem_next_offset,
-					param->pointer_width,
-					(uint8_t *)&list_elem_ptr);
-			if (retval != ERROR_OK) {
-				LOG_ERROR("Error reading next thread item location in FreeRTOS thread list");
-				free(list_of_lists);
-				return retval;
-			}
-			LOG_DEBUG("FreeRTOS: Read next thread location at 0x%" PRIx64 ", value 0x%" PRIx64 "\r\n",
-										prev_list_elem_ptr + param->list_elem_next_offset,
-										list_elem_ptr);
-		}
+		if (detail->threadid == rtos->current_thread) {
+			char running_str[] = "State: Running";
+			detail->extra_info_str = malloc(sizeof(running_str));
+			strcpy(detail->extra_info_str, running_str);
+		} else
+			detail->extra_info_str = NULL;
+
+		tasks_found++;
 	}
 
-	free(list_of_lists);
+	free(tcbs);
 	rtos->thread_count = tasks_found;
+	freertos->up_to_date = true;
 	return 0;
 }
 
@@ -400,6 +677,7 @@ static int FreeRTOS_get_thread_reg_list(struct rtos *rtos, int64_t thread_id,
 		struct rtos_reg **reg_list, int *num_regs)
 {
 	int retval;
+	struct FreeRTOS *freertos;
 	const struct FreeRTOS_params *param;
 	int64_t stack_ptr = 0;
 
@@ -412,58 +690,72 @@ static int FreeRTOS_get_thread_reg_list(struct rtos *rtos, int64_t thread_id,
 	if (rtos->rtos_specific_params == NULL)
 		return -1;
 
-	param = (const struct FreeRTOS_params *) rtos->rtos_specific_params;
+	freertos = rtos->rtos_specific_params;
+	param = freertos->param;
 
 	/* Read the stack pointer */
+	uint8_t stack_ptr_buf[8];
 	retval = target_read_buffer(rtos->target,
 			thread_id + param->thread_stack_offset,
 			param->pointer_width,
-			(uint8_t *)&stack_ptr);
+			stack_ptr_buf);
 	if (retval != ERROR_OK) {
 		LOG_ERROR("Error reading stack frame from FreeRTOS thread");
 		return retval;
 	}
+	stack_ptr = FreeRTOS_get_value(rtos->target, stack_ptr_buf, param->pointer_width);
 	LOG_DEBUG("FreeRTOS: Read stack pointer at 0x%" PRIx64 ", value 0x%" PRIx64 "\r\n",
 										thread_id + param->thread_stack_offset,
 										stack_ptr);
 
-	/* Check for armv7m with *enabled* FPU, i.e. a Cortex-M4F */
-	int cm4_fpu_enabled = 0;
-	struct armv7m_common *armv7m_target = target_to_armv7m(rtos->target);
-	if (is_armv7m(armv7m_target)) {
-		if (armv7m_target->fp_feature == FPv4_SP) {
-			/* Found ARM v7m target which includes a FPU */
-			uint32_t cpacr;
-
-			retval = target_read_u32(rtos->target, FPU_CPACR, &cpacr);
-			if (retval != ERROR_OK) {
-				LOG_ERROR("Could not read CPACR register to check FPU state");
-				return -1;
-			}
-
-			/* Check if CP10 and CP11 are set to full access. */
-			if (cpacr & 0x00F00000) {
-				/* Found target with enabled FPU */
-				cm4_fpu_enabled = 1;
+	/* Check for armv7m with *enabled* FPU, i.e. a Cortex-M4F, once per stop */
+	if (freertos->fpu_enabled < 0) {
+		freertos->fpu_enabled = 0;
+		struct armv7m_common *armv7m_target = target_to_armv7m(rtos->target);
+		if (is_armv7m(armv7m_target)) {
+			if (armv7m_target->fp_feature == FPv4_SP) {
+				/* Found ARM v7m target which includes a FPU */
+				uint32_t cpacr;
+
+				retval = target_read_u32(rtos->target, FPU_CPACR, &cpacr);
+				if (retval != ERROR_OK) {
+					freertos->fpu_enabled = -1;
+					LOG_ERROR("Could not read CPACR register to check FPU state");
+					return -1;
+				}
+
+				/* Check if CP10 and CP11 are set to full access. */
+				if (cpacr & 0x00F00000) {
+					/* Found target with enabled FPU */
+					freertos->fpu_enabled = 1;
+				}
 			}
 		}
 	}
 
-	if (cm4_fpu_enabled == 1) {
-		/* Read the LR to decide between stacking with or without FPU */
-		uint32_t LR_svc = 0;
-		retval = target_read_buffer(rtos->target,
-				stack_ptr + 0x20,
-				param->pointer_width,
-				(uint8_t *)&LR_svc);
+	if (freertos->fpu_enabled == 1) {
+		/* The LR deciding between stacking with or without FPU is part of
+		 * the frame, read the larger frame at once */
+		const struct rtos_register_stacking *stacking = param->stacking_info_cm4f_fpu;
+		uint8_t *stack_data = malloc(stacking->stack_registers_size);
+		if (stack_data == NULL)
+			return ERROR_FAIL;
+
+		retval = target_read_buffer(rtos->target, stack_ptr,
+				stacking->stack_registers_size, stack_data);
 		if (retval != ERROR_OK) {
+			free(stack_data);
 			LOG_OUTPUT("Error reading stack frame from FreeRTOS thread\r\n");
 			return retval;
 		}
-		if ((LR_svc & 0x10) == 0)
-			return rtos_generic_stack_read(rtos->target, param->stacking_info_cm4f_fpu, stack_ptr, reg_list, num_regs);
-		else
-			return rtos_generic_stack_read(rtos->target, param->stacking_info_cm4f, stack_ptr, reg_list, num_regs);
+
+		uint32_t LR_svc = target_buffer_get_u32(rtos->target, stack_data + 0x20);
+		if ((LR_svc & 0x10) != 0)
+			stacking = param->stacking_info_cm4f;
+		retval = rtos_generic_stack_regs(rtos->target, stacking, stack_ptr, stack_data,
+				reg_list, num_regs);
+		free(stack_data);
+		return retval;
 	} else
 		return rtos_generic_stack_read(rtos->target, param->stacking_info_cm3, stack_ptr, reg_list, num_regs);
 }
@@ -529,6 +821,47 @@ static int FreeRTOS_get_thread_ascii_info(struct rtos *rtos, threadid_t thread_i
 
 #endif
 
+static int FreeRTOS_target_event(struct target *target, enum target_event event, void *priv)
+{
+	if (target->rtos && target->rtos->type == &FreeRTOS_rtos
+			&& target->rtos->rtos_specific_params) {
+		struct FreeRTOS *freertos = target->rtos->rtos_specific_params;
+		freertos->up_to_date = false;
+		freertos->fpu_enabled = -1;
+	}
+
+	return ERROR_OK;
+}
+
+/* A new debug session, possibly with another program */
+static int FreeRTOS_clean(struct target *target)
+{
+	struct FreeRTOS *freertos = target->rtos->rtos_specific_params;
+	if (freertos == NULL)
+		return ERROR_OK;
+
+	freertos->up_to_date = false;
+	freertos->fpu_enabled = -1;
+	FreeRTOS_free_tcbs(freertos);
+	for (int i = 0; i < FREERTOS_MAX_LISTS; i++)
+		freertos->lists[i].walked = false;
+
+	return ERROR_OK;
+}
+
+static void FreeRTOS_free_params(struct rtos *rtos)
+{
+	struct FreeRTOS *freertos = rtos->rtos_specific_params;
+	if (freertos == NULL)
+		return;
+
+	FreeRTOS_free_tcbs(freertos);
+	for (int i = 0; i < FREERTOS_MAX_LISTS; i++)
+		free(freertos->lists[i].tcbs);
+	free(freertos);
+	rtos->rtos_specific_params = NULL;
+}
+
 static bool FreeRTOS_detect_rtos(struct target *target)
 {
 	if ((target->rtos->symbols != NULL) &&
@@ -551,6 +884,21 @@ static int FreeRTOS_create(struct target *target)
 		return -1;
 	}
 
-	target->rtos->rtos_specific_params = (void *) &FreeRTOS_params_list[i];
+	/* creating it again starts over */
+	FreeRTOS_free_params(target->rtos);
+
+	struct FreeRTOS *freertos = calloc(1, sizeof(*freertos));
+	if (freertos == NULL) {
+		LOG_ERROR("Error allocating memory for FreeRTOS");
+		return -1;
+	}
+	freertos->param = &FreeRTOS_params_list[i];
+	freertos->fpu_enabled = -1;
+	target->rtos->rtos_specific_params = freertos;
+
+	/* anything the target does may change the thread list */
+	target_unregister_event_callback(FreeRTOS_target_event, NULL);
+	target_register_event_callback(FreeRTOS_target_event, NULL);
+
 	return 0;
 }
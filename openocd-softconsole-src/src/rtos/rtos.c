@@ -74,6 +74,15 @@ static int rtos_target_for_threadid(struct connection *connection, int64_t threa
 	return ERROR_OK;
 }
 
+/* Anything the target does may change the registers saved on the stacks */
+static int rtos_target_event(struct target *target, enum target_event event, void *priv)
+{
+	if (target->rtos)
+		rtos_free_thread_regs(target->rtos);
+
+	return ERROR_OK;
+}
+
 static int os_alloc(struct target *target, struct rtos_type *ostype)
 {
 	struct rtos *os = target->rtos = calloc(1, sizeof(struct rtos));
@@ -92,6 +101,9 @@ static int os_alloc(struct target *target, struct rtos_type *ostype)
 	os->gdb_v_packet = NULL;
 	os->gdb_target_for_threadid = rtos_target_for_threadid;
 
+	target_unregister_event_callback(rtos_target_event, NULL);
+	target_register_event_callback(rtos_target_event, NULL);
+
 	return JIM_OK;
 }
 
@@ -103,6 +115,9 @@ static void os_free(struct target *target)
 	if (target->rtos->symbols)
 		free(target->rtos->symbols);
 
+	if (target->rtos->type->free_params)
+		target->rtos->type->free_params(target->rtos);
+	rtos_free_thread_regs(target->rtos);
 	free(target->rtos);
 	target->rtos = NULL;
 }
@@ -465,6 +480,60 @@ static int rtos_put_gdb_reg_list(struct connection *connection,
 	return ERROR_OK;
 }
 
+static struct rtos_thread_regs *rtos_find_thread_regs(struct rtos *rtos, threadid_t threadid)
+{
+	for (int i = 0; i < rtos->thread_regs_count; i++)
+		if (rtos->thread_regs[i].threadid == threadid)
+			return &rtos->thread_regs[i];
+
+	return NULL;
+}
+
+/**
+ * The registers of a thread, read from the target the first time they are
+ * asked for after the target stopped. gdb reads them several times per stop,
+ * e.g. for "info threads" and then for a backtrace.
+ */
+static int rtos_get_thread_regs(struct rtos *rtos, threadid_t threadid,
+		struct rtos_reg **reg_list, int *num_regs)
+{
+	struct rtos_thread_regs *regs = rtos_find_thread_regs(rtos, threadid);
+
+	if (regs == NULL) {
+		struct rtos_reg *list;
+		int count;
+
+		int retval = rtos->type->get_thread_reg_list(rtos, threadid, &list, &count);
+		if (retval != ERROR_OK)
+			return retval;
+
+		regs = realloc(rtos->thread_regs,
+				(rtos->thread_regs_count + 1) * sizeof(*regs));
+		if (regs == NULL) {
+			free(list);
+			return ERROR_FAIL;
+		}
+		rtos->thread_regs = regs;
+		regs = &rtos->thread_regs[rtos->thread_regs_count++];
+		regs->threadid = threadid;
+		regs->reg_list = list;
+		regs->num_regs = count;
+	}
+
+	*reg_list = regs->reg_list;
+	*num_regs = regs->num_regs;
+	return ERROR_OK;
+}
+
+void rtos_free_thread_regs(struct rtos *rtos)
+{
+	for (int i = 0; i < rtos->thread_regs_count; i++)
+		free(rtos->thread_regs[i].reg_list);
+	free(rtos->thread_regs);
+	rtos->thread_regs = NULL;
+	rtos->thread_regs_count = 0;
+}
+
 /** Look through all registers to find this register. */
 int rtos_get_gdb_reg(struct connection *connection, int reg_num)
 {
@@ -484,35 +553,35 @@ int rtos_get_gdb_reg(struct connection *connection, int reg_num)
 										target->rtos->current_thread);
 
 		int retval;
-		if (target->rtos->type->get_thread_reg) {
-			reg_list = calloc(1, sizeof(*reg_list));
-			num_regs = 1;
+		if (target->rtos->type->get_thread_reg &&
+				rtos_find_thread_regs(target->rtos, current_threadid) == NULL) {
+			struct rtos_reg reg = { 0 };
 			retval = target->rtos->type->get_thread_reg(target->rtos,
-					current_threadid, reg_num, &reg_list[0]);
+					current_threadid, reg_num, &reg);
 			if (retval != ERROR_OK) {
 				LOG_ERROR("RTOS: failed to get register %d", reg_num);
 				return retval;
 			}
+
+			if (reg.number == (uint32_t)reg_num) {
+				rtos_put_gdb_reg_list(connection, &reg, 1);
+				return ERROR_OK;
+			}
 		} else {
-			retval = target->rtos->type->get_thread_reg_list(target->rtos,
-					current_threadid,
-					&reg_list,
-					&num_regs);
+			retval = rtos_get_thread_regs(target->rtos, current_threadid,
+					&reg_list, &num_regs);
 			if (retval != ERROR_OK) {
 				LOG_ERROR("RTOS: failed to get register list");
 				return retval;
 			}
-		}
 
-		for (int i = 0; i < num_regs; ++i) {
-			if (reg_list[i].number == (uint32_t)reg_num) {
-				rtos_put_gdb_reg_list(connection, reg_list + i, 1);
-				free(reg_list);
-				return ERROR_OK;
+			for (int i = 0; i < num_regs; ++i) {
+				if (reg_list[i].number == (uint32_t)reg_num) {
+					rtos_put_gdb_reg_list(connection, reg_list + i, 1);
+					return ERROR_OK;
+				}
 			}
 		}
-
-		free(reg_list);
 	}
 	return ERROR_FAIL;
 }
@@ -534,17 +603,14 @@ int rtos_get_gdb_reg_list(struct connection *connection)
 										current_threadid,
 										target->rtos->current_thread);
 
-		int retval = target->rtos->type->get_thread_reg_list(target->rtos,
-				current_threadid,
-				&reg_list,
-				&num_regs);
+		int retval = rtos_get_thread_regs(target->rtos, current_threadid,
+				&reg_list, &num_regs);
 		if (retval != ERROR_OK) {
 			LOG_ERROR("RTOS: failed to get register list");
 			return retval;
 		}
 
 		rtos_put_gdb_reg_list(connection, reg_list, num_regs);
-		free(reg_list);
 
 		return ERROR_OK;
 	}
@@ -560,6 +626,7 @@ int rtos_set_reg(struct connection *connection, int reg_num,
 			(target->rtos->type->set_reg != NULL) &&
 			(current_threadid != -1) &&
 			(current_threadid != 0)) {
+		rtos_free_thread_regs(target->rtos);
 		return target->rtos->type->set_reg(target->rtos, reg_num, reg_value);
 	}
 	return ERROR_FAIL;
@@ -598,6 +665,23 @@ int rtos_generic_stack_read(struct target *target,
 		LOG_OUTPUT("\r\n");
 #endif
 
+	retval = rtos_generic_stack_regs(target, stacking, stack_ptr, stack_data,
+			reg_list, num_regs);
+	free(stack_data);
+	return retval;
+}
+
+/**
+ * Build the register list from a stack frame the caller already read, for
+ * RTOSes which read more of the stack anyway, e.g. to pick the stacking.
+ */
+int rtos_generic_stack_regs(struct target *target,
+	const struct rtos_register_stacking *stacking,
+	int64_t stack_ptr,
+	const uint8_t *stack_data,
+	struct rtos_reg **reg_list,
+	int *num_regs)
+{
 	int64_t new_stack_ptr;
 	if (stacking->calculate_process_stack != NULL) {
 		new_stack_ptr = stacking->calculate_process_stack(target,
@@ -608,6 +692,8 @@ int rtos_generic_stack_read(struct target *target,
 	}
 
 	*reg_list = calloc(stacking->num_output_registers, sizeof(struct rtos_reg));
+	if (*reg_list == NULL)
+		return ERROR_FAIL;
 	*num_regs = stacking->num_output_registers;
 
 	for (int i = 0; i < stacking->num_output_registers; ++i) {
@@ -621,7 +707,6 @@ int rtos_generic_stack_read(struct target *target,
 			buf_cpy(stack_data + offset, (*reg_list)[i].value, (*reg_list)[i].size);
 	}
 
-	free(stack_data);
 /*	LOG_OUTPUT("Output register string: %s\r\n", *hex_reg_list); */
 	return ERROR_OK;
 }
@@ -668,6 +753,7 @@ void rtos_free_threadlist(struct rtos *rtos)
 		}
 		free(rtos->thread_details);
 		rtos->thread_details = NULL;
+		rtos_free_thread_regs(rtos);
 		rtos->thread_count = 0;
 		rtos->current_threadid = -1;
 		rtos->current_thread = 0;
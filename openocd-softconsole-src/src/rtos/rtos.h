@@ -44,6 +44,13 @@ struct thread_detail {
 	char *extra_info_str;
 };
 
+/* Registers of a thread, valid until the target runs */
+struct rtos_thread_regs {
+	threadid_t threadid;
+	struct rtos_reg *reg_list;
+	int num_regs;
+};
+
 struct rtos {
 	const struct rtos_type *type;
 
@@ -60,6 +67,8 @@ struct rtos {
 	int (*gdb_v_packet)(struct connection *connection, char const *packet, int packet_size);
 	int (*gdb_target_for_threadid)(struct connection *connection, int64_t thread_id, struct target **p_target);
 	void *rtos_specific_params;
+	struct rtos_thread_regs *thread_regs;
+	int thread_regs_count;
 };
 
 struct rtos_reg {
@@ -97,6 +106,8 @@ struct rtos_type {
 			uint8_t *buffer);
 	int (*write_buffer)(struct rtos *rtos, target_addr_t address, uint32_t size,
 			const uint8_t *buffer);
+	/* Free rtos_specific_params, if create() allocated them. */
+	void (*free_params)(struct rtos *rtos);
 };
 
 struct stack_register_offset {
@@ -133,6 +144,13 @@ int rtos_generic_stack_read(struct target *target,
 		int64_t stack_ptr,
 		struct rtos_reg **reg_list,
 		int *num_regs);
+int rtos_generic_stack_regs(struct target *target,
+		const struct rtos_register_stacking *stacking,
+		int64_t stack_ptr,
+		const uint8_t *stack_data,
+		struct rtos_reg **reg_list,
+		int *num_regs);
+void rtos_free_thread_regs(struct rtos *rtos);
 int rtos_try_next(struct target *target);
 int gdb_thread_packet(struct connection *connection, char const *packet, int packet_size);
 int rtos_get_gdb_reg(struct connection *connection, int reg_num);
@@ -65,14 +65,33 @@ struct target_desc_format {
 	uint32_t tdesc_length;
 };
 
+/* flash range gdb asked to erase, see vFlashDone */
+struct gdb_vflash_erase {
+	target_addr_t address;
+	uint32_t length;
+};
+
 /* private connection data for GDB */
 struct gdb_connection {
-	char buffer[GDB_BUFFER_SIZE + 1]; /* Extra byte for nul-termination */
+	char *buffer; /* buffer_size + 1 bytes, extra byte for nul-termination */
 	char *buf_p;
 	int buf_cnt;
+	int buffer_size;
+	/* received packet, buffer_size + 1 bytes */
+	char *packet_buffer;
+	/* Output arena reused by every reply that does not fit on the stack. It
+	 * only ever grows, so steady-state traffic does no allocation at all.
+	 * Payloads are assembled at out_buf + 1 which leaves room to frame them
+	 * in place with '$' and "#xx". */
+	char *out_buf;
+	size_t out_size;
 	int ctrl_c;
 	enum target_state frontend_state;
 	struct image *vflash_image;
+	/* erases held back until the image is known, when the flash sector
+	 * cache allows unchanged sectors to be skipped */
+	struct gdb_vflash_erase *vflash_erase;
+	unsigned vflash_erase_count;
 	bool closed;
 	bool busy;
 	int noack_mode;
@@ -139,6 +158,9 @@ static int gdb_report_register_access_error;
 /* enabled by default */
 static int gdb_use_target_description = 1;
 
+/* PacketSize advertised to gdb, applies to new connections */
+static int gdb_packet_size = GDB_BUFFER_SIZE;
+
 /* current processing free-run type, used by file-I/O */
 static char gdb_running_type;
 
@@ -209,16 +231,25 @@ static int gdb_get_char_inner(struct connection *connection, int *next_char)
 #ifdef _DEBUG_GDB_IO_
 	char *debug_buffer;
 #endif
+	/* gdb will not answer before it has seen everything we queued */
+	if (connection_output_pending(connection)) {
+		retval = connection_flush(connection, -1);
+		if (retval != ERROR_OK) {
+			gdb_con->closed = true;
+			return retval;
+		}
+	}
+
 	for (;; ) {
 		if (connection->service->type != CONNECTION_TCP)
-			gdb_con->buf_cnt = read(connection->fd, gdb_con->buffer, GDB_BUFFER_SIZE);
+			gdb_con->buf_cnt = read(connection->fd, gdb_con->buffer, gdb_con->buffer_size);
 		else {
 			retval = check_pending(connection, 1, NULL);
 			if (retval != ERROR_OK)
 				return retval;
 			gdb_con->buf_cnt = read_socket(connection->fd,
 					gdb_con->buffer,
-					GDB_BUFFER_SIZE);
+					gdb_con->buffer_size);
 		}
 
 		if (gdb_con->buf_cnt > 0)
@@ -354,18 +385,45 @@ static int gdb_write(struct connection *connection, void *data, int len)
 	return ERROR_SERVER_REMOTE_CLOSED;
 }
 
+static int gdb_writev(struct connection *connection, const struct iovec *iov, int iovcnt)
+{
+	struct gdb_connection *gdb_con = connection->priv;
+	if (gdb_con->closed)
+		return ERROR_SERVER_REMOTE_CLOSED;
+
+	if (connection_writev(connection, iov, iovcnt) >= 0)
+		return ERROR_OK;
+	gdb_con->closed = true;
+	return ERROR_SERVER_REMOTE_CLOSED;
+}
+
+/* Make sure the output arena can hold a payload of @a size bytes plus
+ * the packet framing and return where the payload starts. */
+static char *gdb_out_reserve(struct gdb_connection *gdb_con, size_t size)
+{
+	/* '$' + payload + "#xx" + nul written by snprintf() */
+	size_t needed = size + 5;
+
+	if (needed > gdb_con->out_size) {
+		char *out_buf = realloc(gdb_con->out_buf, needed);
+		if (out_buf == NULL)
+			return NULL;
+		gdb_con->out_buf = out_buf;
+		gdb_con->out_size = needed;
+	}
+	return gdb_con->out_buf + 1;
+}
+
 static int gdb_put_packet_inner(struct connection *connection,
 		char *buffer, int len)
 {
-	int i;
 	unsigned char my_checksum = 0;
 	char *debug_buffer;
 	int reply;
 	int retval;
 	struct gdb_connection *gdb_con = connection->priv;
 
-	for (i = 0; i < len; i++)
-		my_checksum += buffer[i];
+	my_checksum = buf_checksum(buffer, len);
 
 #ifdef _DEBUG_GDB_IO_
 	/*
@@ -397,30 +455,42 @@ static int gdb_put_packet_inner(struct connection *connection,
 #endif
 
 	while (1) {
-		debug_buffer = strndup(buffer, len);
-		LOG_DEBUG("sending packet '$%s#%2.2x'", debug_buffer, my_checksum);
-		free(debug_buffer);
+		if (LOG_LEVEL_IS(LOG_LVL_DEBUG)) {
+			debug_buffer = strndup(buffer, len);
+			LOG_DEBUG("sending packet '$%s#%2.2x'", debug_buffer, my_checksum);
+			free(debug_buffer);
+		}
 
 		char local_buffer[1024];
 		local_buffer[0] = '$';
-		if ((size_t)len + 4 <= sizeof(local_buffer)) {
+		if (gdb_con->out_buf && buffer == gdb_con->out_buf + 1) {
+			/* payload was assembled in the output arena, frame it in place
+			 * and send the whole packet with a single call to gdb_write() */
+			char *frame = buffer;
+			frame[-1] = '$';
+			snprintf(frame + len, 4, "#%02x", my_checksum);
+			retval = gdb_write(connection, frame - 1, len + 4);
+			if (retval != ERROR_OK)
+				return retval;
+		} else if ((size_t)len + 4 <= sizeof(local_buffer)) {
 			/* performance gain on smaller packets by only a single call to gdb_write() */
-			memcpy(local_buffer + 1, buffer, len++);
-			len += snprintf(local_buffer + len, sizeof(local_buffer) - len, "#%02x", my_checksum);
-			retval = gdb_write(connection, local_buffer, len);
+			memcpy(local_buffer + 1, buffer, len);
+			int frame_len = len + 1;
+			frame_len += snprintf(local_buffer + frame_len, sizeof(local_buffer) - frame_len,
+					"#%02x", my_checksum);
+			retval = gdb_write(connection, local_buffer, frame_len);
 			if (retval != ERROR_OK)
 				return retval;
 		} else {
 			/* larger packets are transmitted directly from caller supplied buffer
-			 * by several calls to gdb_write() to avoid dynamic allocation */
+			 * with a single gather write to avoid dynamic allocation */
 			snprintf(local_buffer + 1, sizeof(local_buffer) - 1, "#%02x", my_checksum);
-			retval = gdb_write(connection, local_buffer, 1);
-			if (retval != ERROR_OK)
-				return retval;
-			retval = gdb_write(connection, buffer, len);
-			if (retval != ERROR_OK)
-				return retval;
-			retval = gdb_write(connection, local_buffer + 1, 3);
+			struct iovec iov[3] = {
+				{ .iov_base = local_buffer, .iov_len = 1 },
+				{ .iov_base = buffer, .iov_len = len },
+				{ .iov_base = local_buffer + 1, .iov_len = 3 },
+			};
+			retval = gdb_writev(connection, iov, ARRAY_SIZE(iov));
 			if (retval != ERROR_OK)
 				return retval;
 		}
@@ -930,16 +1000,36 @@ static int gdb_new_connection(struct connection *connection)
 	int retval;
 	int initial_ack;
 
+	if (!gdb_connection) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	/* initialize gdb connection information */
+	gdb_connection->buffer_size = gdb_packet_size;
+	gdb_connection->buffer = malloc(gdb_packet_size + 1);
+	gdb_connection->packet_buffer = malloc(gdb_packet_size + 1);
+	if (!gdb_connection->buffer || !gdb_connection->packet_buffer) {
+		LOG_ERROR("Out of memory");
+		free(gdb_connection->buffer);
+		free(gdb_connection->packet_buffer);
+		free(gdb_connection);
+		return ERROR_FAIL;
+	}
+
 	target = get_target_from_connection(connection);
 	connection->priv = gdb_connection;
 	connection->cmd_ctx->current_target = target;
 
-	/* initialize gdb connection information */
+	gdb_connection->out_buf = NULL;
+	gdb_connection->out_size = 0;
 	gdb_connection->buf_p = gdb_connection->buffer;
 	gdb_connection->buf_cnt = 0;
 	gdb_connection->ctrl_c = 0;
 	gdb_connection->frontend_state = TARGET_HALTED;
 	gdb_connection->vflash_image = NULL;
+	gdb_connection->vflash_erase = NULL;
+	gdb_connection->vflash_erase_count = 0;
 	gdb_connection->closed = false;
 	gdb_connection->busy = false;
 	gdb_connection->noack_mode = 0;
@@ -1047,11 +1137,16 @@ static int gdb_connection_closed(struct connection *connection)
 		free(gdb_connection->vflash_image);
 		gdb_connection->vflash_image = NULL;
 	}
+	free(gdb_connection->vflash_erase);
+	gdb_connection->vflash_erase = NULL;
 
 	/* if this connection registered a debug-message receiver delete it */
 	delete_debug_msg_receiver(connection->cmd_ctx, target);
 
 	if (connection->priv) {
+		free(gdb_connection->buffer);
+		free(gdb_connection->packet_buffer);
+		free(gdb_connection->out_buf);
 		free(connection->priv);
 		connection->priv = NULL;
 	} else
@@ -1438,19 +1533,67 @@ static int gdb_error(struct connection *connection, int retval)
 	return ERROR_OK;
 }
 
+/* Copy @a len bytes of binary data to @a out, escaping the characters
+ * that have a meaning in the remote protocol, and return the number of
+ * bytes written (at most 2 * len). Runs of eight bytes that need no
+ * escaping are detected with word-wide compares and copied in one go. */
+static size_t gdb_escape_binary(char *out, const uint8_t *data, size_t len)
+{
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t highs = 0x8080808080808080ULL;
+	size_t o = 0;
+	size_t i = 0;
+
+	while (i < len) {
+		if (len - i >= 8) {
+			uint64_t w, x1, x2, x3, x4;
+			memcpy(&w, data + i, sizeof(w));
+			x1 = w ^ (ones * '#');
+			x2 = w ^ (ones * '$');
+			x3 = w ^ (ones * '}');
+			x4 = w ^ (ones * '*');
+			/* nonzero if any byte of any xN is zero */
+			uint64_t hit = ((x1 - ones) & ~x1) | ((x2 - ones) & ~x2) |
+					((x3 - ones) & ~x3) | ((x4 - ones) & ~x4);
+			if ((hit & highs) == 0) {
+				memcpy(out + o, data + i, 8);
+				o += 8;
+				i += 8;
+				continue;
+			}
+		}
+
+		uint8_t c = data[i++];
+		if (c == '#' || c == '$' || c == '}' || c == '*') {
+			out[o++] = '}';
+			out[o++] = c ^ 0x20;
+		} else
+			out[o++] = c;
+	}
+
+	return o;
+}
+
 /* We don't have to worry about the default 2 second timeout for GDB packets,
  * because GDB breaks up large memory reads into smaller reads.
+ *
+ * Serves both the hex encoded 'm' packet and the binary 'x' packet. The
+ * reply is assembled in the connection's output arena: the target data is
+ * read into its tail and encoded towards the front, so no per-request
+ * allocation is needed.
  */
 static int gdb_read_memory_packet(struct connection *connection,
 		char const *packet, int packet_size)
 {
 	struct target *target = get_target_from_connection(connection);
+	struct gdb_connection *gdb_con = connection->priv;
+	bool binary = packet[0] == 'x';
 	char *separator;
 	uint64_t addr = 0;
 	uint32_t len = 0;
 
 	uint8_t *buffer;
-	char *hex_buffer;
+	char *reply;
 
 	int retval;
 
@@ -1458,21 +1601,6 @@ static int gdb_read_memory_packet(struct connection *connection,
 	packet++;
 
 	addr = strtoull(packet, &separator, 16);
-  // printf("Got request to read from %016lx \r\n", addr);
-
-// Anton ugly hacks, delete this
-// Skipping reads from 0 to 62 (and bit further as well because the addr + len)
-  // if (addr <= 0x62) {
-	// 	// printf("Got request to read from %d (len=%d), i'm responding with fake read ---------------------------- \r\n", addr, len);
-	// 	printf("Got request to read from %ld, i'm responding with fake (and bad) read response ---------------------------- \r\n", addr);
-	// 	memset(buffer, 0, len);
-	// 	hex_buffer = malloc(len * 2 + 1);
-	// 	size_t pkt_len = hexify(hex_buffer, buffer, len, len * 2 + 1);
-	// 	gdb_put_packet(connection, hex_buffer, pkt_len);
-	// 	free(hex_buffer);
-	// 	return ERROR_OK;
-	// }
-
 
 	if (*separator != ',') {
 		LOG_ERROR("incomplete read memory packet received, dropping connection");
@@ -1482,13 +1610,24 @@ static int gdb_read_memory_packet(struct connection *connection,
 	len = strtoul(separator + 1, NULL, 16);
 
 	if (!len) {
+		if (binary) {
+			/* a zero length 'x' probes for support of the packet */
+			gdb_put_packet(connection, "b", 1);
+			return ERROR_OK;
+		}
 		LOG_WARNING("invalid read memory packet received (len == 0)");
 		gdb_put_packet(connection, "", 0);
 		return ERROR_OK;
 	}
 
-
-	buffer = malloc(len);
+	/* encoded reply (at most 2 * len + 1) followed by the raw data */
+	reply = gdb_out_reserve(gdb_con, 3 * (size_t)len + 1);
+	if (reply == NULL) {
+		LOG_ERROR("Unable to allocate %" PRIu32 " bytes for memory read", len);
+		gdb_send_error(connection, ENOMEM);
+		return ERROR_OK;
+	}
+	buffer = (uint8_t *)reply + 2 * (size_t)len + 1;
 
 	LOG_DEBUG("addr: 0x%16.16" PRIx64 ", len: 0x%8.8" PRIx32 "", addr, len);
 
@@ -1517,18 +1656,18 @@ static int gdb_read_memory_packet(struct connection *connection,
 	}
 
 	if (retval == ERROR_OK) {
-		hex_buffer = malloc(len * 2 + 1);
-
-		size_t pkt_len = hexify(hex_buffer, buffer, len, len * 2 + 1);
+		size_t pkt_len;
 
-		gdb_put_packet(connection, hex_buffer, pkt_len);
+		if (binary) {
+			reply[0] = 'b';
+			pkt_len = 1 + gdb_escape_binary(reply + 1, buffer, len);
+		} else
+			pkt_len = hexify(reply, buffer, len, 2 * (size_t)len + 1);
 
-		free(hex_buffer);
+		gdb_put_packet(connection, reply, pkt_len);
 	} else
 		retval = gdb_error(connection, retval);
 
-	free(buffer);
-
 	return retval;
 }
 
@@ -2747,8 +2886,9 @@ static int gdb_query_packet(struct connection *connection,
 			&buffer,
 			&pos,
 			&size,
-			"PacketSize=%x;qXfer:memory-map:read%c;qXfer:features:read%c;qXfer:threads:read+;QStartNoAckMode+;vContSupported+",
-			GDB_BUFFER_SIZE,
+			"PacketSize=%x;qXfer:memory-map:read%c;qXfer:features:read%c;qXfer:threads:read+;"
+			"QStartNoAckMode+;vContSupported+;binary-upload+",
+			gdb_connection->buffer_size,
 			((gdb_use_memory_map == 1) && (flash_get_bank_count() > 0)) ? '+' : '-',
 			(gdb_target_desc_supported == 1) ? '+' : '-');
 
@@ -3086,6 +3226,23 @@ static int gdb_v_packet(struct connection *connection,
 		 * when flash_write is called multiple times */
 		flash_set_dirty();
 
+		/* with the sector cache, only erase at vFlashDone what the image
+		 * doesn't rewrite anyway */
+		if (flash_sector_cache_enabled()) {
+			struct gdb_vflash_erase *erase = realloc(gdb_connection->vflash_erase,
+					(gdb_connection->vflash_erase_count + 1) * sizeof(*erase));
+			if (erase == NULL) {
+				gdb_send_error(connection, ENOMEM);
+				return ERROR_OK;
+			}
+			erase[gdb_connection->vflash_erase_count].address = addr;
+			erase[gdb_connection->vflash_erase_count].length = length;
+			gdb_connection->vflash_erase = erase;
+			gdb_connection->vflash_erase_count++;
+			gdb_put_packet(connection, "OK", 2);
+			return ERROR_OK;
+		}
+
 		/* perform any target specific operations before the erase */
 		target_call_event_callbacks(target,
 			TARGET_EVENT_GDB_FLASH_ERASE_START);
@@ -3149,16 +3306,46 @@ static int gdb_v_packet(struct connection *connection,
 	}
 
 	if (strncmp(packet, "vFlashDone", 10) == 0) {
-		uint32_t written;
+		uint32_t written = 0;
+
+		result = ERROR_OK;
+		if (gdb_connection->vflash_erase_count) {
+			/* erase the deferred ranges the image leaves blank, the
+			 * rest is erased only where the image differs */
+			target_call_event_callbacks(target,
+				TARGET_EVENT_GDB_FLASH_ERASE_START);
+			for (unsigned i = 0; i < gdb_connection->vflash_erase_count; i++) {
+				result = flash_erase_unwritten(target, gdb_connection->vflash_image,
+						gdb_connection->vflash_erase[i].address,
+						gdb_connection->vflash_erase[i].length);
+				if (result != ERROR_OK)
+					break;
+			}
+			target_call_event_callbacks(target,
+				TARGET_EVENT_GDB_FLASH_ERASE_END);
+
+			if (result == ERROR_OK && gdb_connection->vflash_image) {
+				target_call_event_callbacks(target,
+						TARGET_EVENT_GDB_FLASH_WRITE_START);
+				result = flash_write_changed(target, gdb_connection->vflash_image,
+					&written, 1);
+				target_call_event_callbacks(target,
+					TARGET_EVENT_GDB_FLASH_WRITE_END);
+			}
 
-		/* process the flashing buffer. No need to erase as GDB
-		 * always issues a vFlashErase first. */
-		target_call_event_callbacks(target,
-				TARGET_EVENT_GDB_FLASH_WRITE_START);
-		result = flash_write(target, gdb_connection->vflash_image,
-			&written, 0);
-		target_call_event_callbacks(target,
-			TARGET_EVENT_GDB_FLASH_WRITE_END);
+			free(gdb_connection->vflash_erase);
+			gdb_connection->vflash_erase = NULL;
+			gdb_connection->vflash_erase_count = 0;
+		} else {
+			/* process the flashing buffer. No need to erase as GDB
+			 * always issues a vFlashErase first. */
+			target_call_event_callbacks(target,
+					TARGET_EVENT_GDB_FLASH_WRITE_START);
+			result = flash_write(target, gdb_connection->vflash_image,
+				&written, 0);
+			target_call_event_callbacks(target,
+				TARGET_EVENT_GDB_FLASH_WRITE_END);
+		}
 		if (result != ERROR_OK) {
 			if (result == ERROR_FLASH_DST_OUT_OF_BANK)
 				gdb_put_packet(connection, "E.memtype", 9);
@@ -3169,9 +3356,11 @@ static int gdb_v_packet(struct connection *connection,
 			gdb_put_packet(connection, "OK", 2);
 		}
 
-		image_close(gdb_connection->vflash_image);
-		free(gdb_connection->vflash_image);
-		gdb_connection->vflash_image = NULL;
+		if (gdb_connection->vflash_image) {
+			image_close(gdb_connection->vflash_image);
+			free(gdb_connection->vflash_image);
+			gdb_connection->vflash_image = NULL;
+		}
 
 		return ERROR_OK;
 	}
@@ -3250,6 +3439,17 @@ static void gdb_log_callback(void *priv, const char *file, unsigned line,
 		return;
 	}
 
+	/* do not let a slow gdb hold up the main loop for log output */
+	if (connection_log_backpressure(connection))
+		return;
+	if (connection->log_dropped) {
+		char *msg = alloc_printf("%u log messages dropped\n", connection->log_dropped);
+		connection->log_dropped = 0;
+		if (msg)
+			gdb_output_con(connection, msg);
+		free(msg);
+	}
+
 	gdb_output_con(connection, string);
 }
 
@@ -3262,14 +3462,13 @@ static void gdb_sig_halted(struct connection *connection)
 
 static int gdb_input_inner(struct connection *connection)
 {
-	/* Do not allocate this on the stack */
-	static char gdb_packet_buffer[GDB_BUFFER_SIZE + 1]; /* Extra byte for nul-termination */
-
 	struct target *target;
+	struct gdb_connection *gdb_con = connection->priv;
+	/* Do not allocate this on the stack */
+	char *gdb_packet_buffer = gdb_con->packet_buffer;
 	char const *packet = gdb_packet_buffer;
 	int packet_size;
 	int retval;
-	struct gdb_connection *gdb_con = connection->priv;
 	static int extended_protocol;
 
 	target = get_target_from_connection(connection);
@@ -3286,7 +3485,7 @@ static int gdb_input_inner(struct connection *connection)
 	 * drain the rest of the buffer.
 	 */
 	do {
-		packet_size = GDB_BUFFER_SIZE;
+		packet_size = gdb_con->buffer_size;
 		retval = gdb_get_packet(connection, gdb_packet_buffer, &packet_size);
 		if (retval != ERROR_OK)
 			return retval;
@@ -3343,6 +3542,7 @@ static int gdb_input_inner(struct connection *connection)
 					retval = gdb_set_register_packet(connection, packet, packet_size);
 					break;
 				case 'm':
+				case 'x':
 					retval = gdb_read_memory_packet(connection, packet, packet_size);
 					break;
 				case 'M':
@@ -3728,6 +3928,27 @@ COMMAND_HANDLER(handle_gdb_breakpoint_override_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_gdb_packet_size_command)
+{
+	if (CMD_ARGC == 0) {
+		command_print(CMD, "%d", gdb_packet_size);
+		return ERROR_OK;
+	}
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	int size;
+	COMMAND_PARSE_NUMBER(int, CMD_ARGV[0], size);
+	/* gdb itself never sends packets larger than 16 MiB */
+	if (size < GDB_BUFFER_SIZE || size > 16 * 1024 * 1024) {
+		command_print(CMD, "packet size must be between %d and %d",
+				GDB_BUFFER_SIZE, 16 * 1024 * 1024);
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+	gdb_packet_size = size;
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_gdb_target_description_command)
 {
 	if (CMD_ARGC != 1)
@@ -3840,6 +4061,14 @@ static const struct command_registration gdb_command_handlers[] = {
 			"to be used by gdb 'break' commands.",
 		.usage = "('hard'|'soft'|'disable')"
 	},
+	{
+		.name = "gdb_packet_size",
+		.handler = handle_gdb_packet_size_command,
+		.mode = COMMAND_ANY,
+		.help = "Display or set the maximum packet size advertised "
+			"to gdb. Applies to new connections.",
+		.usage = "[size]"
+	},
 	{
 		.name = "gdb_target_description",
 		.handler = handle_gdb_target_description_command,
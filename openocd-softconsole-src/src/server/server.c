@@ -27,6 +27,7 @@
 #endif
 
 #include "server.h"
+#include <helper/time_support.h>
 #include <target/target.h>
 #include <target/target_request.h>
 #include <target/openrisc/jsp_server.h>
@@ -44,6 +45,12 @@
 #include <netinet/tcp.h>
 #endif
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#elif !defined(_WIN32)
+#include <poll.h>
+#endif
+
 static struct service *services;
 
 enum shutdown_reason {
@@ -63,6 +70,236 @@ static int polling_period = 100;
 /* address by name on which to listen for incoming TCP/IP connections */
 static char *bindto_name;
 
+/*
+ * Event engine for server_loop().
+ *
+ * The file descriptors of services and connections are registered once,
+ * when they are opened, and unregistered when they are closed. After
+ * server_events_wait() the readiness of each descriptor is found in the
+ * 'events' field of its owner. Linux uses epoll, other POSIX hosts poll()
+ * on a persistent pollfd array and Windows select().
+ */
+struct server_watch {
+	int fd;
+	int wanted;
+	int *events;
+	/* fd the kernel cannot wait for (e.g. a regular file), always ready */
+	bool always_ready;
+};
+
+static struct server_watch *server_watches;
+static unsigned int server_watch_count;
+static unsigned int server_watch_size;
+
+#ifdef __linux__
+static int server_epoll_fd = -1;
+#elif !defined(_WIN32)
+static struct pollfd *server_pollfds;
+#endif
+
+static struct server_watch *server_watch_find(int fd)
+{
+	for (unsigned int i = 0; i < server_watch_count; i++)
+		if (server_watches[i].fd == fd)
+			return &server_watches[i];
+	return NULL;
+}
+
+#ifdef __linux__
+static int server_epoll_ctl(int op, struct server_watch *w)
+{
+	struct epoll_event ev = {
+		.events = ((w->wanted & SERVER_EVENT_READ) ? EPOLLIN : 0) |
+			((w->wanted & SERVER_EVENT_WRITE) ? EPOLLOUT : 0),
+		.data.ptr = w->events,
+	};
+	return epoll_ctl(server_epoll_fd, op, w->fd, &ev);
+}
+#endif
+
+/* Register @a fd, or update its registration, to report @a wanted events
+ * in @a *events. */
+static int server_watch(int fd, int wanted, int *events)
+{
+	struct server_watch *w = server_watch_find(fd);
+	bool added = false;
+
+	if (w == NULL) {
+		if (server_watch_count == server_watch_size) {
+			unsigned int size = server_watch_size ? 2 * server_watch_size : 16;
+			struct server_watch *watches = realloc(server_watches, size * sizeof(*watches));
+			if (watches == NULL)
+				return ERROR_FAIL;
+			server_watches = watches;
+#if !defined(__linux__) && !defined(_WIN32)
+			struct pollfd *pollfds = realloc(server_pollfds, size * sizeof(*pollfds));
+			if (pollfds == NULL)
+				return ERROR_FAIL;
+			server_pollfds = pollfds;
+#endif
+			server_watch_size = size;
+		}
+		w = &server_watches[server_watch_count++];
+		w->fd = fd;
+		w->always_ready = false;
+		added = true;
+	} else if (w->wanted == wanted && w->events == events)
+		return ERROR_OK;
+
+	w->wanted = wanted;
+	w->events = events;
+	*events = 0;
+
+#ifdef __linux__
+	if (server_epoll_fd == -1) {
+		server_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (server_epoll_fd == -1) {
+			LOG_ERROR("epoll_create1 failed: %s", strerror(errno));
+			return ERROR_FAIL;
+		}
+	}
+	if (!w->always_ready &&
+			server_epoll_ctl(added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, w) == -1) {
+		if (errno == EPERM) {
+			/* regular files are always readable, as with select() */
+			w->always_ready = true;
+		} else {
+			LOG_ERROR("epoll_ctl failed for fd %d: %s", fd, strerror(errno));
+			return ERROR_FAIL;
+		}
+	}
+#elif !defined(_WIN32)
+	struct pollfd *pfd = &server_pollfds[w - server_watches];
+	pfd->fd = fd;
+	pfd->events = ((wanted & SERVER_EVENT_READ) ? POLLIN : 0) |
+		((wanted & SERVER_EVENT_WRITE) ? POLLOUT : 0);
+	pfd->revents = 0;
+#endif
+
+	return ERROR_OK;
+}
+
+static void server_unwatch(int fd)
+{
+	struct server_watch *w = server_watch_find(fd);
+	if (w == NULL)
+		return;
+
+#ifdef __linux__
+	if (!w->always_ready)
+		epoll_ctl(server_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#elif !defined(_WIN32)
+	server_pollfds[w - server_watches] = server_pollfds[server_watch_count - 1];
+#endif
+	*w = server_watches[--server_watch_count];
+}
+
+/* Only connections with queued output wait for the socket to be writable. */
+static void connection_watch_output(struct connection *connection)
+{
+	if (connection->service->type != CONNECTION_TCP)
+		return;
+
+	int wanted = SERVER_EVENT_READ;
+	if (connection_output_pending(connection))
+		wanted |= SERVER_EVENT_WRITE;
+	server_watch(connection->fd, wanted, &connection->events);
+}
+
+/* Wait up to @a timeout_ms for events, returns the number of ready fds or -1. */
+static int server_events_wait(int timeout_ms)
+{
+	int ready = 0;
+
+	for (unsigned int i = 0; i < server_watch_count; i++) {
+		struct server_watch *w = &server_watches[i];
+		*w->events = 0;
+		if (w->always_ready) {
+			*w->events = w->wanted & SERVER_EVENT_READ;
+			ready++;
+		}
+	}
+	if (ready)
+		timeout_ms = 0;
+
+#ifdef __linux__
+	struct epoll_event evs[32];
+	int n = server_epoll_fd == -1 ? 0 :
+		epoll_wait(server_epoll_fd, evs, ARRAY_SIZE(evs), timeout_ms);
+	if (server_epoll_fd == -1 && timeout_ms > 0)
+		usleep(timeout_ms * 1000);
+	if (n < 0)
+		return n;
+	for (int i = 0; i < n; i++) {
+		int *events = evs[i].data.ptr;
+		if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			*events |= SERVER_EVENT_READ;
+		if (evs[i].events & EPOLLOUT)
+			*events |= SERVER_EVENT_WRITE;
+	}
+	return ready + n;
+#elif !defined(_WIN32)
+	int n = poll(server_pollfds, server_watch_count, timeout_ms);
+	if (n <= 0)
+		return n;
+	for (unsigned int i = 0; i < server_watch_count; i++) {
+		short revents = server_pollfds[i].revents;
+		if (revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL))
+			*server_watches[i].events |= SERVER_EVENT_READ;
+		if (revents & POLLOUT)
+			*server_watches[i].events |= SERVER_EVENT_WRITE;
+	}
+	return ready + n;
+#else
+	fd_set read_fds, write_fds;
+	int fd_max = 0;
+
+	FD_ZERO(&read_fds);
+	FD_ZERO(&write_fds);
+	for (unsigned int i = 0; i < server_watch_count; i++) {
+		struct server_watch *w = &server_watches[i];
+		if (w->wanted & SERVER_EVENT_READ)
+			FD_SET(w->fd, &read_fds);
+		if (w->wanted & SERVER_EVENT_WRITE)
+			FD_SET(w->fd, &write_fds);
+		if (w->fd > fd_max)
+			fd_max = w->fd;
+	}
+
+	struct timeval tv = {
+		.tv_sec = timeout_ms / 1000,
+		.tv_usec = (timeout_ms % 1000) * 1000,
+	};
+	int n = socket_select(fd_max + 1, &read_fds, &write_fds, NULL, &tv);
+	if (n <= 0)
+		return n;
+	for (unsigned int i = 0; i < server_watch_count; i++) {
+		struct server_watch *w = &server_watches[i];
+		if (FD_ISSET(w->fd, &read_fds))
+			*w->events |= SERVER_EVENT_READ;
+		if (FD_ISSET(w->fd, &write_fds))
+			*w->events |= SERVER_EVENT_WRITE;
+	}
+	return ready + n;
+#endif
+}
+
+static void server_events_free(void)
+{
+#ifdef __linux__
+	if (server_epoll_fd != -1)
+		close(server_epoll_fd);
+	server_epoll_fd = -1;
+#elif !defined(_WIN32)
+	free(server_pollfds);
+	server_pollfds = NULL;
+#endif
+	free(server_watches);
+	server_watches = NULL;
+	server_watch_count = 0;
+	server_watch_size = 0;
+}
+
 static int add_connection(struct service *service, struct command_context *cmd_ctx)
 {
 	socklen_t address_size;
@@ -77,6 +314,12 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 	c->cmd_ctx = copy_command_context(cmd_ctx);
 	c->service = service;
 	c->input_pending = 0;
+	c->out_buf = NULL;
+	c->out_head = 0;
+	c->out_tail = 0;
+	c->out_size = 0;
+	c->log_dropped = 0;
+	c->events = 0;
 	c->priv = NULL;
 	c->next = NULL;
 
@@ -86,6 +329,9 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 		c->fd = accept(service->fd, (struct sockaddr *)&service->sin, &address_size);
 		c->fd_out = c->fd;
 
+		/* writes that would block are queued, see connection_writev() */
+		socket_nonblock(c->fd);
+
 		/* This increases performance dramatically for e.g. GDB load which
 		 * does not have a sliding window protocol.
 		 *
@@ -100,9 +346,11 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 		LOG_INFO("accepting '%s' connection on tcp/%s", service->name, service->port);
 		retval = service->new_connection(c);
 		if (retval != ERROR_OK) {
+			server_unwatch(c->fd);
 			close_socket(c->fd);
 			LOG_ERROR("attempted '%s' connection rejected", service->name);
 			command_done(c->cmd_ctx);
+			free(c->out_buf);
 			free(c);
 			return retval;
 		}
@@ -151,6 +399,11 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 		}
 	}
 
+	if (service->fd == -1)
+		server_unwatch(c->fd);
+	server_watch(c->fd, SERVER_EVENT_READ, &c->events);
+	connection_watch_output(c);
+
 	/* add to the end of linked list */
 	for (p = &service->connections; *p; p = &(*p)->next)
 		;
@@ -171,12 +424,19 @@ static int remove_connection(struct service *service, struct connection *connect
 	while ((c = *p)) {
 		if (c->fd == connection->fd) {
 			service->connection_closed(c);
+			/* give queued output, e.g. a final reply, a chance to go out;
+			 * before unwatching, as flushing watches the fd again */
 			if (service->type == CONNECTION_TCP)
+				connection_flush(c, 1000);
+			server_unwatch(c->fd);
+			if (service->type == CONNECTION_TCP) {
 				close_socket(c->fd);
-			else if (service->type == CONNECTION_PIPE) {
+			} else if (service->type == CONNECTION_PIPE) {
 				/* The service will listen to the pipe again */
 				c->service->fd = c->fd;
+				server_watch(c->fd, SERVER_EVENT_READ, &service->events);
 			}
+			free(c->out_buf);
 
 			command_done(c->cmd_ctx);
 
@@ -341,6 +601,14 @@ int add_service(char *name,
 #endif
 	}
 
+	c->events = 0;
+	if (c->fd != -1 && server_watch(c->fd, SERVER_EVENT_READ, &c->events) != ERROR_OK) {
+		if (c->type != CONNECTION_STDINOUT)
+			close_socket(c->fd);
+		free_service(c);
+		return ERROR_FAIL;
+	}
+
 	/* add to the end of linked list */
 	for (p = &services; *p; p = &(*p)->next)
 		;
@@ -380,6 +648,8 @@ int remove_service(const char *name, const char *port)
 			else
 				prev->next = tmp->next;
 
+			if (tmp->fd != -1)
+				server_unwatch(tmp->fd);
 			if (tmp->type != CONNECTION_STDINOUT)
 				close_socket(tmp->fd);
 
@@ -403,6 +673,9 @@ static int remove_services(void)
 
 		remove_connections(c);
 
+		if (c->fd != -1)
+			server_unwatch(c->fd);
+
 		if (c->name)
 			free(c->name);
 
@@ -424,6 +697,7 @@ static int remove_services(void)
 	}
 
 	services = NULL;
+	server_events_free();
 
 	return ERROR_OK;
 }
@@ -434,10 +708,6 @@ int server_loop(struct command_context *command_context)
 
 	bool poll_ok = true;
 
-	/* used in select() */
-	fd_set read_fds;
-	int fd_max;
-
 	/* used in accept() */
 	int retval;
 
@@ -447,85 +717,54 @@ int server_loop(struct command_context *command_context)
 #endif
 
 	while (shutdown_openocd == CONTINUE_MAIN_LOOP) {
-		/* monitor sockets for activity */
-		fd_max = 0;
-		FD_ZERO(&read_fds);
-
-		/* add service and connection fds to read_fds */
-		for (service = services; service; service = service->next) {
-			if (service->fd != -1) {
-				/* listen for new connections */
-				FD_SET(service->fd, &read_fds);
-
-				if (service->fd > fd_max)
-					fd_max = service->fd;
-			}
-
-			if (service->connections) {
-				struct connection *c;
-
-				for (c = service->connections; c; c = c->next) {
-					/* check for activity on the connection */
-					FD_SET(c->fd, &read_fds);
-					if (c->fd > fd_max)
-						fd_max = c->fd;
-				}
-			}
-		}
-
-		struct timeval tv;
-		tv.tv_sec = 0;
-		if (poll_ok) {
-			/* we're just polling this iteration, this is faster on embedded
-			 * hosts */
-			tv.tv_usec = 0;
-			retval = socket_select(fd_max + 1, &read_fds, NULL, NULL, &tv);
-		} else {
-			/* Every 100ms, can be changed with "poll_period" command */
-			tv.tv_usec = polling_period * 1000;
+		/* Sleep until the next timer callback is due, but no longer than the
+		 * polling period (100ms by default, see "poll_period"). Right after
+		 * some activity, or while a connection has buffered input, only poll. */
+		int timeout_ms = polling_period;
+		int due_ms = target_timer_next_due_ms();
+		if (due_ms >= 0 && due_ms < timeout_ms)
+			timeout_ms = due_ms;
+
+		for (service = services; service && !poll_ok; service = service->next)
+			for (struct connection *c = service->connections; c; c = c->next)
+				if (c->input_pending)
+					poll_ok = true;
+		if (poll_ok)
+			timeout_ms = 0;
+
+		if (timeout_ms > 0) {
 			/* Only while we're sleeping we'll let others run */
 			openocd_sleep_prelude();
 			kept_alive();
-			retval = socket_select(fd_max + 1, &read_fds, NULL, NULL, &tv);
+			retval = server_events_wait(timeout_ms);
 			openocd_sleep_postlude();
-		}
+		} else
+			retval = server_events_wait(0);
 
 		if (retval == -1) {
 #ifdef _WIN32
 
 			errno = WSAGetLastError();
 
-			if (errno == WSAEINTR)
-				FD_ZERO(&read_fds);
-			else {
+			if (errno != WSAEINTR) {
 				LOG_ERROR("error during select: %s", strerror(errno));
 				return ERROR_FAIL;
 			}
 #else
 
-			if (errno == EINTR)
-				FD_ZERO(&read_fds);
-			else {
-				LOG_ERROR("error during select: %s", strerror(errno));
+			if (errno != EINTR) {
+				LOG_ERROR("error waiting for events: %s", strerror(errno));
 				return ERROR_FAIL;
 			}
 #endif
+			retval = 0;
 		}
 
-		if (retval == 0) {
-			/* We only execute these callbacks when there was nothing to do or we timed
-			 *out */
+		/* Timer callbacks (e.g. target polling) run whenever they are due, so
+		 * the poll interval does not depend on the traffic on connections. */
+		if (target_timer_next_due_ms() == 0) {
 			target_call_timer_callbacks();
 			process_jim_events(command_context);
-
-			FD_ZERO(&read_fds);	/* eCos leaves read_fds unchanged in this case!  */
-
-			/* We timed out/there was nothing to do, timeout rather than poll next time
-			 **/
-			poll_ok = false;
-		} else {
-			/* There was something to do, next time we'll just poll */
-			poll_ok = true;
 		}
 
 		/* This is a simple back-off algorithm where we immediately
@@ -533,12 +772,15 @@ int server_loop(struct command_context *command_context)
 		 *
 		 * This greatly improves performance of DCC.
 		 */
-		poll_ok = poll_ok || target_got_message();
+		poll_ok = retval > 0 || target_got_message();
+		if (retval == 0 && timeout_ms > 0)
+			process_jim_events(command_context);
 
 		for (service = services; service; service = service->next) {
 			/* handle new connections on listeners */
 			if ((service->fd != -1)
-				&& (FD_ISSET(service->fd, &read_fds))) {
+				&& (service->events & SERVER_EVENT_READ)) {
+				service->events = 0;
 				if (service->max_connections != 0)
 					add_connection(service, command_context);
 				else {
@@ -562,22 +804,28 @@ int server_loop(struct command_context *command_context)
 				struct connection *c;
 
 				for (c = service->connections; c; ) {
-					if ((FD_ISSET(c->fd, &read_fds)) || c->input_pending) {
+					int events = c->events;
+					c->events = 0;
+
+					retval = ERROR_OK;
+					if (events & SERVER_EVENT_WRITE)
+						retval = connection_flush(c, 0);
+					if (retval == ERROR_OK &&
+							((events & SERVER_EVENT_READ) || c->input_pending))
 						retval = service->input(c);
-						if (retval != ERROR_OK) {
-							struct connection *next = c->next;
-							if (service->type == CONNECTION_PIPE ||
-									service->type == CONNECTION_STDINOUT) {
-								/* if connection uses a pipe then
-								 * shutdown openocd on error */
-								shutdown_openocd = SHUTDOWN_REQUESTED;
-							}
-							remove_connection(service, c);
-							LOG_INFO("dropped '%s' connection",
-								service->name);
-							c = next;
-							continue;
+					if (retval != ERROR_OK) {
+						struct connection *next = c->next;
+						if (service->type == CONNECTION_PIPE ||
+								service->type == CONNECTION_STDINOUT) {
+							/* if connection uses a pipe then
+							 * shutdown openocd on error */
+							shutdown_openocd = SHUTDOWN_REQUESTED;
 						}
+						remove_connection(service, c);
+						LOG_INFO("dropped '%s' connection",
+							service->name);
+						c = next;
+						continue;
 					}
 					c = c->next;
 				}
@@ -716,16 +964,212 @@ void exit_on_signal(int sig)
 #endif
 }
 
-int connection_write(struct connection *connection, const void *data, int len)
+/* Hand as much of @a iov to the socket as it takes without blocking.
+ * Returns the number of bytes written, 0 if the socket is full or -1 on
+ * a real error. */
+static ssize_t connection_send(struct connection *connection,
+		const struct iovec *iov, int iovcnt)
+{
+#ifdef _WIN32
+	ssize_t total = 0;
+	for (int i = 0; i < iovcnt; i++) {
+		int n = send(connection->fd_out, iov[i].iov_base, iov[i].iov_len, 0);
+		if (n < 0) {
+			if (WSAGetLastError() == WSAEWOULDBLOCK)
+				break;
+			return total ? total : -1;
+		}
+		total += n;
+		if ((size_t)n < iov[i].iov_len)
+			break;
+	}
+	return total;
+#else
+	ssize_t n = writev(connection->fd_out, iov, iovcnt);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return 0;
+	return n;
+#endif
+}
+
+static int connection_queue(struct connection *connection, const void *data, size_t len)
+{
+	if (connection->out_tail + len > connection->out_size) {
+		size_t pending = connection_output_pending(connection);
+
+		/* move pending data to the front before growing the buffer */
+		memmove(connection->out_buf, connection->out_buf + connection->out_head, pending);
+		connection->out_head = 0;
+		connection->out_tail = pending;
+
+		if (pending + len > connection->out_size) {
+			size_t size = MAX(2 * connection->out_size, pending + len);
+			char *out_buf = realloc(connection->out_buf, size);
+			if (out_buf == NULL) {
+				LOG_ERROR("Out of memory queueing output for '%s' connection",
+						connection->service->name);
+				return ERROR_FAIL;
+			}
+			connection->out_buf = out_buf;
+			connection->out_size = size;
+		}
+	}
+
+	memcpy(connection->out_buf + connection->out_tail, data, len);
+	connection->out_tail += len;
+	return ERROR_OK;
+}
+
+/**
+ * Write queued output to the connection.
+ *
+ * @param timeout_ms 0 to write only what the socket takes right now,
+ * a positive value to wait up to that long for the queue to drain,
+ * or a negative value to wait until it is empty.
+ * @returns ERROR_OK, or ERROR_SERVER_REMOTE_CLOSED if the client is gone
+ * or did not take the data in time.
+ */
+int connection_flush(struct connection *connection, int timeout_ms)
 {
+	int64_t then = timeval_ms();
+
+	while (connection_output_pending(connection)) {
+		struct iovec iov = {
+			.iov_base = connection->out_buf + connection->out_head,
+			.iov_len = connection_output_pending(connection),
+		};
+		ssize_t n = connection_send(connection, &iov, 1);
+		if (n < 0) {
+			LOG_ERROR("error writing '%s' connection: %s",
+					connection->service->name, strerror(errno));
+			return ERROR_SERVER_REMOTE_CLOSED;
+		}
+		connection->out_head += n;
+		if (connection_output_pending(connection) == 0)
+			break;
+
+		if (timeout_ms == 0)
+			return ERROR_OK;
+
+		int64_t left = timeout_ms < 0 ? 1000 : timeout_ms - (timeval_ms() - then);
+		if (left <= 0)
+			return ERROR_SERVER_REMOTE_CLOSED;
+
+		fd_set write_fds;
+		FD_ZERO(&write_fds);
+		FD_SET(connection->fd_out, &write_fds);
+		struct timeval tv = {
+			.tv_sec = left / 1000,
+			.tv_usec = (left % 1000) * 1000,
+		};
+		socket_select(connection->fd_out + 1, NULL, &write_fds, NULL, &tv);
+		keep_alive();
+	}
+
+	connection->out_head = 0;
+	connection->out_tail = 0;
+	connection_watch_output(connection);
+	return ERROR_OK;
+}
+
+/**
+ * Write @a iovcnt buffers to the connection as one unit.
+ *
+ * For TCP connections data the socket does not take immediately is queued
+ * and written by server_loop() once the socket is writable, so the call
+ * does not block on a slow client. Only when more than
+ * CONNECTION_OUTPUT_LIMIT bytes are queued does it wait for the client.
+ * Pipes are written synchronously.
+ *
+ * @returns the number of bytes written or queued, or -1 on error.
+ */
+int connection_writev(struct connection *connection, const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+	for (int i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
 	if (len == 0) {
 		/* successful no-op. Sockets and pipes behave differently here... */
 		return 0;
 	}
-	if (connection->service->type == CONNECTION_TCP)
-		return write_socket(connection->fd_out, data, len);
-	else
-		return write(connection->fd_out, data, len);
+
+	if (connection->service->type != CONNECTION_TCP) {
+		for (int i = 0; i < iovcnt; i++) {
+			ssize_t n = write(connection->fd_out, iov[i].iov_base, iov[i].iov_len);
+			if (n != (ssize_t)iov[i].iov_len)
+				return -1;
+		}
+		return len;
+	}
+
+	/* queued data goes first, coalesced with the new buffers */
+	struct iovec vec[16];
+	int cnt = 0;
+	if (connection_output_pending(connection)) {
+		vec[cnt].iov_base = connection->out_buf + connection->out_head;
+		vec[cnt].iov_len = connection_output_pending(connection);
+		cnt++;
+	}
+	for (int i = 0; i < iovcnt && cnt < (int)ARRAY_SIZE(vec); i++)
+		vec[cnt++] = iov[i];
+	int direct = cnt - (connection_output_pending(connection) ? 1 : 0);
+
+	ssize_t n = connection_send(connection, vec, cnt);
+	if (n < 0)
+		return -1;
+
+	size_t written = n;
+	size_t pending = connection_output_pending(connection);
+	if (pending) {
+		size_t done = MIN(written, pending);
+		connection->out_head += done;
+		written -= done;
+	}
+
+	/* queue whatever of the new data the socket did not take */
+	for (int i = 0; i < iovcnt; i++) {
+		const char *data = iov[i].iov_base;
+		size_t size = iov[i].iov_len;
+
+		if (i < direct) {
+			size_t done = MIN(written, size);
+			written -= done;
+			data += done;
+			size -= done;
+		}
+		if (size && connection_queue(connection, data, size) != ERROR_OK)
+			return -1;
+	}
+
+	if (connection_output_pending(connection) > CONNECTION_OUTPUT_LIMIT &&
+			connection_flush(connection, -1) != ERROR_OK)
+		return -1;
+
+	connection_watch_output(connection);
+	return len;
+}
+
+int connection_write(struct connection *connection, const void *data, int len)
+{
+	struct iovec iov = {
+		.iov_base = (void *)data,
+		.iov_len = len,
+	};
+	return connection_writev(connection, &iov, 1);
+}
+
+/**
+ * Log forwarding must not stall the main loop on a slow client. When too
+ * much output is already queued the message is dropped and counted;
+ * callers should report connection->log_dropped once they forward again.
+ * @returns true if the message should be dropped.
+ */
+bool connection_log_backpressure(struct connection *connection)
+{
+	if (connection_output_pending(connection) <= CONNECTION_OUTPUT_LOG_LIMIT)
+		return false;
+	connection->log_dropped++;
+	return true;
 }
 
 int connection_read(struct connection *connection, void *data, int len)
@@ -35,6 +35,15 @@
 #include <netinet/in.h>
 #endif
 
+#ifdef _WIN32
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
+
 enum connection_type {
 	CONNECTION_TCP,
 	CONNECTION_PIPE,
@@ -43,6 +52,15 @@ enum connection_type {
 
 #define CONNECTION_LIMIT_UNLIMITED		(-1)
 
+/* readiness reported by the server event engine */
+#define SERVER_EVENT_READ		1
+#define SERVER_EVENT_WRITE		2
+
+/* Queued output above which log messages are no longer forwarded */
+#define CONNECTION_OUTPUT_LOG_LIMIT		(64 * 1024)
+/* Queued output above which connection_write() waits for the client */
+#define CONNECTION_OUTPUT_LIMIT			(1024 * 1024)
+
 struct connection {
 	int fd;
 	int fd_out;	/* When using pipes we're writing to a different fd */
@@ -50,6 +68,17 @@ struct connection {
 	struct command_context *cmd_ctx;
 	struct service *service;
 	int input_pending;
+	/* SERVER_EVENT_* reported for fd by the last wait */
+	int events;
+	/* Output the socket did not accept yet. It is written out by
+	 * server_loop() when the socket becomes writable, so a slow client
+	 * does not stall the main loop. Valid data is out_buf[out_head..out_tail). */
+	char *out_buf;
+	size_t out_head;
+	size_t out_tail;
+	size_t out_size;
+	/* number of log messages dropped because of queued output */
+	unsigned int log_dropped;
 	void *priv;
 	struct connection *next;
 };
@@ -64,6 +93,8 @@ struct service {
 	char *port;
 	unsigned short portnumber;
 	int fd;
+	/* SERVER_EVENT_* reported for fd by the last wait */
+	int events;
 	struct sockaddr_in sin;
 	int max_connections;
 	struct connection *connections;
@@ -91,7 +122,15 @@ int server_loop(struct command_context *command_context);
 int server_register_commands(struct command_context *context);
 
 int connection_write(struct connection *connection, const void *data, int len);
+int connection_writev(struct connection *connection, const struct iovec *iov, int iovcnt);
 int connection_read(struct connection *connection, void *data, int len);
+int connection_flush(struct connection *connection, int timeout_ms);
+bool connection_log_backpressure(struct connection *connection);
+
+static inline size_t connection_output_pending(struct connection *connection)
+{
+	return connection->out_tail - connection->out_head;
+}
 
 /**
  * Used by server_loop(), defined in server_stubs.c
@@ -104,6 +104,17 @@ static void telnet_log_callback(void *priv, const char *file, unsigned line,
 	size_t i;
 	size_t tmp;
 
+	/* do not let a slow client hold up the main loop for log output */
+	if (connection_log_backpressure(connection))
+		return;
+	if (connection->log_dropped) {
+		char *msg = alloc_printf("%u log messages dropped", connection->log_dropped);
+		connection->log_dropped = 0;
+		if (msg)
+			telnet_outputline(connection, msg);
+		free(msg);
+	}
+
 	/* If the prompt is not visible, simply output the message. */
 	if (!t_con->prompt_visible) {
 		telnet_outputline(connection, string);
@@ -496,6 +496,7 @@ COMMAND_HANDLER(handle_svf_command)
 		}
 		rewind(svf_fd);
 	}
+	jtag_flush_origin_push("svf");
 	while (ERROR_OK == svf_read_command_from_file(svf_fd)) {
 		/* Log Output */
 		if (svf_quiet) {
@@ -526,6 +527,7 @@ COMMAND_HANDLER(handle_svf_command)
 		ret = ERROR_FAIL;
 	else if (ERROR_OK != svf_check_tdo())
 		ret = ERROR_FAIL;
+	jtag_flush_origin_pop();
 
 	/* print time */
 	time_measure_ms = timeval_ms() - time_measure_ms;
@@ -443,35 +443,17 @@ static int mem_ap_write(struct adiv5_ap *ap, const uint8_t *buffer, uint32_t siz
 	return retval;
 }
 
-/**
- * Synchronous read of a block of memory, using a specific access size.
- *
- * @param ap The MEM-AP to access.
- * @param buffer The data buffer to receive the data. No particular alignment is assumed.
- * @param size Which access size to use, in bytes. 1, 2 or 4.
- * @param count The number of reads to do (in size units, not bytes).
- * @param address Address to be read; it must be readable by the currently selected MEM-AP.
- * @param addrinc Whether the target address should be increased after each read or not. This
- *  should normally be true, except when reading from e.g. a FIFO.
- * @return ERROR_OK on success, otherwise an error code.
- */
-static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint32_t count,
-		uint32_t adr, bool addrinc)
+/* Queue the DRW reads of a block, one word of @a read_buf per read */
+static int mem_ap_read_queue(struct adiv5_ap *ap, uint32_t *read_buf, uint32_t size,
+		uint32_t count, uint32_t adr, bool addrinc)
 {
-	struct adiv5_dap *dap = ap->dap;
 	size_t nbytes = size * count;
 	const uint32_t csw_addrincr = addrinc ? CSW_ADDRINC_SINGLE : CSW_ADDRINC_OFF;
 	uint32_t csw_size;
 	uint32_t address = adr;
+	uint32_t *read_ptr = read_buf;
 	int retval = ERROR_OK;
 
-	/* TI BE-32 Quirks mode:
-	 * Reads on big-endian TMS570 behave strangely differently than writes.
-	 * They read from the physical address requested, but with DRW byte-reversed.
-	 * For example, a byte read from address 0 will place the result in the high bytes of DRW.
-	 * Also, packed 8-bit and 16-bit transfers seem to sometimes return garbage in some bytes,
-	 * so avoid them. */
-
 	if (size == 4)
 		csw_size = CSW_32BIT;
 	else if (size == 2)
@@ -484,17 +466,6 @@ static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint
 	if (ap->unaligned_access_bad && (adr % size != 0))
 		return ERROR_TARGET_UNALIGNED_ACCESS;
 
-	/* Allocate buffer to hold the sequence of DRW reads that will be made. This is a significant
-	 * over-allocation if packed transfers are going to be used, but determining the real need at
-	 * this point would be messy. */
-	uint32_t *read_buf = calloc(count, sizeof(uint32_t));
-	/* Multiplication count * sizeof(uint32_t) may overflow, calloc() is safe */
-	uint32_t *read_ptr = read_buf;
-	if (read_buf == NULL) {
-		LOG_ERROR("Failed to allocate read buffer");
-		return ERROR_FAIL;
-	}
-
 	/* Queue up all reads. Each read will store the entire DRW word in the read buffer. How many
 	 * useful bytes it contains, and their location in the word, depends on the type of transfer
 	 * and alignment. */
@@ -527,30 +498,17 @@ static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint
 		mem_ap_update_tar_cache(ap);
 	}
 
-	if (retval == ERROR_OK)
-		retval = dap_run(dap);
-
-	/* Restore state */
-	address = adr;
-	nbytes = size * count;
-	read_ptr = read_buf;
+	return retval;
+}
 
-	/* If something failed, read TAR to find out how much data was successfully read, so we can
-	 * at least give the caller what we have. */
-	if (retval != ERROR_OK) {
-		uint32_t tar;
-		if (mem_ap_read_tar(ap, &tar) == ERROR_OK) {
-			/* TAR is incremented after failed transfer on some devices (eg Cortex-M4) */
-			LOG_ERROR("Failed to read memory at 0x%08"PRIx32, tar);
-			if (nbytes > tar - address)
-				nbytes = tar - address;
-		} else {
-			LOG_ERROR("Failed to read memory and, additionally, failed to find out where");
-			nbytes = 0;
-		}
-	}
+/* Copy @a nbytes of a block read by mem_ap_read_queue() to the caller's buffer, from the
+ * correct word and byte lane */
+static void mem_ap_read_replay(struct adiv5_ap *ap, uint8_t *buffer, const uint32_t *read_buf,
+		uint32_t size, size_t nbytes, uint32_t address, bool addrinc)
+{
+	struct adiv5_dap *dap = ap->dap;
+	const uint32_t *read_ptr = read_buf;
 
-	/* Replay loop to populate caller's buffer from the correct word and byte lane */
 	while (nbytes > 0) {
 		uint32_t this_size = size;
 
@@ -588,6 +546,126 @@ static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint
 		read_ptr++;
 		nbytes -= this_size;
 	}
+}
+
+/**
+ * Synchronous read of a block of memory, using a specific access size.
+ *
+ * @param ap The MEM-AP to access.
+ * @param buffer The data buffer to receive the data. No particular alignment is assumed.
+ * @param size Which access size to use, in bytes. 1, 2 or 4.
+ * @param count The number of reads to do (in size units, not bytes).
+ * @param address Address to be read; it must be readable by the currently selected MEM-AP.
+ * @param addrinc Whether the target address should be increased after each read or not. This
+ *  should normally be true, except when reading from e.g. a FIFO.
+ * @return ERROR_OK on success, otherwise an error code.
+ */
+static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint32_t count,
+		uint32_t adr, bool addrinc)
+{
+	struct adiv5_dap *dap = ap->dap;
+	size_t nbytes = size * count;
+	int retval;
+
+	/* TI BE-32 Quirks mode:
+	 * Reads on big-endian TMS570 behave strangely differently than writes.
+	 * They read from the physical address requested, but with DRW byte-reversed.
+	 * For example, a byte read from address 0 will place the result in the high bytes of DRW.
+	 * Also, packed 8-bit and 16-bit transfers seem to sometimes return garbage in some bytes,
+	 * so avoid them. */
+
+	/* Allocate buffer to hold the sequence of DRW reads that will be made. This is a significant
+	 * over-allocation if packed transfers are going to be used, but determining the real need at
+	 * this point would be messy. */
+	uint32_t *read_buf = calloc(count, sizeof(uint32_t));
+	/* Multiplication count * sizeof(uint32_t) may overflow, calloc() is safe */
+	if (read_buf == NULL) {
+		LOG_ERROR("Failed to allocate read buffer");
+		return ERROR_FAIL;
+	}
+
+	retval = mem_ap_read_queue(ap, read_buf, size, count, adr, addrinc);
+	if (retval == ERROR_TARGET_UNALIGNED_ACCESS) {
+		free(read_buf);
+		return retval;
+	}
+
+	if (retval == ERROR_OK)
+		retval = dap_run(dap);
+
+	/* If something failed, read TAR to find out how much data was successfully read, so we can
+	 * at least give the caller what we have. */
+	if (retval != ERROR_OK) {
+		uint32_t tar;
+		if (mem_ap_read_tar(ap, &tar) == ERROR_OK) {
+			/* TAR is incremented after failed transfer on some devices (eg Cortex-M4) */
+			LOG_ERROR("Failed to read memory at 0x%08"PRIx32, tar);
+			if (nbytes > tar - adr)
+				nbytes = tar - adr;
+		} else {
+			LOG_ERROR("Failed to read memory and, additionally, failed to find out where");
+			nbytes = 0;
+		}
+	}
+
+	mem_ap_read_replay(ap, buffer, read_buf, size, nbytes, adr, addrinc);
+
+	free(read_buf);
+	return retval;
+}
+
+/**
+ * Read several blocks of memory with a single run of the DAP queue.
+ *
+ * If the run fails, the blocks are read again one by one, so that the error
+ * is reported for the block it belongs to.
+ */
+int mem_ap_read_buf_multi(struct adiv5_ap *ap,
+		struct target_memory_region *regions, unsigned int num_regions)
+{
+	size_t num_words = 0;
+	int retval = ERROR_OK;
+
+	for (unsigned int i = 0; i < num_regions; i++)
+		num_words += regions[i].count;
+
+	uint32_t *read_buf = calloc(num_words ? num_words : 1, sizeof(uint32_t));
+	if (read_buf == NULL) {
+		LOG_ERROR("Failed to allocate read buffer");
+		return ERROR_FAIL;
+	}
+
+	uint32_t *read_ptr = read_buf;
+	for (unsigned int i = 0; i < num_regions && retval == ERROR_OK; i++) {
+		retval = mem_ap_read_queue(ap, read_ptr, regions[i].size, regions[i].count,
+				regions[i].address, true);
+		read_ptr += regions[i].count;
+	}
+
+	if (retval == ERROR_OK) {
+		retval = dap_run(ap->dap);
+	} else {
+		/* drop what was queued before the failure */
+		dap_run(ap->dap);
+	}
+
+	if (retval == ERROR_OK) {
+		read_ptr = read_buf;
+		for (unsigned int i = 0; i < num_regions; i++) {
+			mem_ap_read_replay(ap, regions[i].buffer, read_ptr, regions[i].size,
+					regions[i].size * regions[i].count, regions[i].address, true);
+			read_ptr += regions[i].count;
+		}
+	} else {
+		ap->tar_valid = false;
+		retval = ERROR_OK;
+		for (unsigned int i = 0; i < num_regions; i++) {
+			int r = mem_ap_read(ap, regions[i].buffer, regions[i].size, regions[i].count,
+					regions[i].address, true);
+			if (r != ERROR_OK && retval == ERROR_OK)
+				retval = r;
+		}
+	}
 
 	free(read_buf);
 	return retval;
@@ -32,6 +32,8 @@
 #include <helper/list.h>
 #include "arm_jtag.h"
 
+struct target_memory_region;
+
 /* three-bit ACK values for SWD access (sent LSB first) */
 #define SWD_ACK_OK    0x1
 #define SWD_ACK_WAIT  0x2
@@ -432,7 +434,10 @@ static inline int dap_queue_ap_abort(struct adiv5_dap *dap, uint8_t *ack)
 static inline int dap_run(struct adiv5_dap *dap)
 {
 	assert(dap->ops != NULL);
-	return dap->ops->run(dap);
+	jtag_flush_origin_push("adiv5");
+	int retval = dap->ops->run(dap);
+	jtag_flush_origin_pop();
+	return retval;
 }
 
 static inline int dap_sync(struct adiv5_dap *dap)
@@ -501,6 +506,8 @@ int mem_ap_read_buf(struct adiv5_ap *ap,
 		uint8_t *buffer, uint32_t size, uint32_t count, uint32_t address);
 int mem_ap_write_buf(struct adiv5_ap *ap,
 		const uint8_t *buffer, uint32_t size, uint32_t count, uint32_t address);
+int mem_ap_read_buf_multi(struct adiv5_ap *ap,
+		struct target_memory_region *regions, unsigned int num_regions);
 
 /* Synchronous, non-incrementing buffer functions for accessing fifos. */
 int mem_ap_read_buf_noincr(struct adiv5_ap *ap,
@@ -294,6 +294,8 @@ int arm_semihosting(struct target *target, int *retval)
 		return 0;
 	}
 
+	semihosting_call_begin(target);
+
 	/* Perform semihosting if we are not waiting on a fileio
 	 * operation to complete.
 	 */
@@ -327,8 +329,11 @@ int arm_semihosting(struct target *target, int *retval)
 	/* Resume if target it is resumable and we are not waiting on a fileio
 	 * operation to complete:
 	 */
-	if (semihosting->is_resumable && !semihosting->hit_fileio)
-		return arm_semihosting_resume(target, retval);
+	if (semihosting->is_resumable && !semihosting->hit_fileio) {
+		int resumed = arm_semihosting_resume(target, retval);
+		semihosting_call_end(target);
+		return resumed;
+	}
 
 	return 0;
 }
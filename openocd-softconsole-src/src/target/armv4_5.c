@@ -1102,6 +1102,9 @@ extern __COMMAND_HANDLER(handle_common_semihosting_command);
 extern __COMMAND_HANDLER(handle_common_semihosting_fileio_command);
 extern __COMMAND_HANDLER(handle_common_semihosting_resumable_exit_command);
 extern __COMMAND_HANDLER(handle_common_semihosting_cmdline);
+extern __COMMAND_HANDLER(handle_common_semihosting_async_command);
+extern __COMMAND_HANDLER(handle_common_semihosting_port_command);
+extern __COMMAND_HANDLER(handle_common_semihosting_stats_command);
 
 static const struct command_registration arm_exec_command_handlers[] = {
 	{
@@ -1167,6 +1170,27 @@ static const struct command_registration arm_exec_command_handlers[] = {
 		.usage = "['enable'|'disable']",
 		.help = "activate support for semihosting resumable exit",
 	},
+	{
+		.name = "semihosting_async",
+		.handler = handle_common_semihosting_async_command,
+		.mode = COMMAND_EXEC,
+		.usage = "['enable'|'disable']",
+		.help = "buffer semihosting console output and resume at once",
+	},
+	{
+		.name = "semihosting_port",
+		.handler = handle_common_semihosting_port_command,
+		.mode = COMMAND_ANY,
+		.usage = "[port|'disabled']",
+		.help = "serve a copy of semihosting console output on a TCP port",
+	},
+	{
+		.name = "semihosting_stats",
+		.handler = handle_common_semihosting_stats_command,
+		.mode = COMMAND_EXEC,
+		.usage = "['reset']",
+		.help = "display semihosting call rate and time spent halted",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 const struct command_registration arm_command_handlers[] = {
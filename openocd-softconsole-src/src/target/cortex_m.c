@@ -469,6 +469,154 @@ static int cortex_m_examine_exception_reason(struct target *target)
 	return retval;
 }
 
+/* Debug Core Register Selector of the register with armv7m number @a num,
+ * -1 if it has to be read by armv7m->load_core_reg_u32() */
+static int cortex_m_regsel(unsigned num)
+{
+	switch (num) {
+		case ARMV7M_R0 ... ARMV7M_PSP:
+			return num;
+		case ARMV7M_PRIMASK ... ARMV7M_CONTROL:
+			return 20;
+		case ARMV7M_FPSCR:
+			return 0x21;
+		case ARMV7M_S0 ... ARMV7M_S31:
+			return num - ARMV7M_S0 + 0x40;
+		case ARMV7M_D0 ... ARMV7M_D15:
+			return 2 * (num - ARMV7M_D0) + 0x40;
+		default:
+			return -1;
+	}
+}
+
+/* Reading DHCSR clears S_RESET_ST and S_RETIRE_ST; keep them for the
+ * next poll when the value read is not stored to dcb_dhcsr */
+static void cortex_m_cumulate_dhcsr_sticky(struct cortex_m_common *cortex_m,
+		uint32_t dhcsr)
+{
+	cortex_m->dcb_dhcsr_cumulated_sticky |= dhcsr & (S_RESET_ST | S_RETIRE_ST);
+}
+
+/**
+ * Read all invalid core registers in a single DAP transaction. Each
+ * register takes a DCRSR write, a DHCSR read giving the core time to
+ * fetch it and a DCRDR read; afterwards S_REGRDY is checked in every
+ * DHCSR value. If any transfer was not complete, nothing is marked
+ * valid and the caller reads the registers one by one.
+ */
+static int cortex_m_fast_read_all_regs(struct target *target)
+{
+	struct cortex_m_common *cortex_m = target_to_cm(target);
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	struct reg_cache *cache = armv7m->arm.core_cache;
+	/* D registers take two transfers */
+	uint32_t regsel[2 * ARMV7M_LAST_REG];
+	uint32_t dhcsr[2 * ARMV7M_LAST_REG];
+	uint32_t values[2 * ARMV7M_LAST_REG];
+	int slot[ARMV7M_LAST_REG];
+	int special = -1;
+	unsigned int count = 0;
+	uint32_t dcrdr;
+	int retval;
+
+	if (cache->num_regs > ARMV7M_LAST_REG)
+		return ERROR_FAIL;
+
+	/* the emulated dcc channel uses DCB_DCRDR */
+	if (target->dbg_msg_enabled) {
+		retval = mem_ap_read_u32(armv7m->debug_ap, DCB_DCRDR, &dcrdr);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	for (unsigned int i = 0; i < cache->num_regs; i++) {
+		struct reg *r = &cache->reg_list[i];
+		unsigned num = ((struct arm_reg *)r->arch_info)->num;
+		int sel = cortex_m_regsel(num);
+
+		slot[i] = -1;
+		if (r->valid || sel < 0)
+			continue;
+
+		/* PRIMASK, BASEPRI, FAULTMASK and CONTROL share one register */
+		if (sel == 20 && special >= 0) {
+			slot[i] = special;
+			continue;
+		}
+		if (sel == 20)
+			special = count;
+
+		slot[i] = count;
+		int words = (num >= ARMV7M_D0 && num <= ARMV7M_D15) ? 2 : 1;
+		for (int w = 0; w < words; w++, count++) {
+			regsel[count] = sel + w;
+			retval = mem_ap_write_u32(armv7m->debug_ap, DCB_DCRSR, regsel[count]);
+			if (retval == ERROR_OK)
+				retval = mem_ap_read_u32(armv7m->debug_ap, DCB_DHCSR, &dhcsr[count]);
+			if (retval == ERROR_OK)
+				retval = mem_ap_read_u32(armv7m->debug_ap, DCB_DCRDR, &values[count]);
+			if (retval != ERROR_OK) {
+				/* don't leave the transfers queued so far pending */
+				dap_run(armv7m->debug_ap->dap);
+				return retval;
+			}
+		}
+	}
+
+	retval = dap_run(armv7m->debug_ap->dap);
+	if (retval == ERROR_OK)
+		for (unsigned int k = 0; k < count; k++)
+			cortex_m_cumulate_dhcsr_sticky(cortex_m, dhcsr[k]);
+
+	/* restore DCB_DCRDR - this needs to be in a separate
+	 * transaction otherwise the emulated DCC channel breaks */
+	if (target->dbg_msg_enabled && retval == ERROR_OK)
+		retval = mem_ap_write_atomic_u32(armv7m->debug_ap, DCB_DCRDR, dcrdr);
+	if (retval != ERROR_OK)
+		return retval;
+
+	for (unsigned int k = 0; k < count; k++) {
+		if (!(dhcsr[k] & S_REGRDY)) {
+			LOG_DEBUG("core register 0x%" PRIx32 " not ready, reading one by one",
+					regsel[k]);
+			return ERROR_TARGET_TIMEOUT;
+		}
+	}
+
+	for (unsigned int i = 0; i < cache->num_regs; i++) {
+		struct reg *r = &cache->reg_list[i];
+		unsigned num = ((struct arm_reg *)r->arch_info)->num;
+		uint32_t value;
+
+		if (slot[i] < 0)
+			continue;
+
+		value = values[slot[i]];
+		switch (num) {
+			case ARMV7M_PRIMASK:
+				value = value & 0x1;
+				break;
+			case ARMV7M_BASEPRI:
+				value = (value >> 8) & 0xff;
+				break;
+			case ARMV7M_FAULTMASK:
+				value = (value >> 16) & 0x1;
+				break;
+			case ARMV7M_CONTROL:
+				value = (value >> 24) & 0x3;
+				break;
+			case ARMV7M_D0 ... ARMV7M_D15:
+				buf_set_u32(r->value + 4, 0, 32, values[slot[i] + 1]);
+				break;
+		}
+		buf_set_u32(r->value, 0, 32, value);
+		r->valid = true;
+		r->dirty = false;
+	}
+
+	return ERROR_OK;
+}
+
 static int cortex_m_debug_entry(struct target *target)
 {
 	int i;
@@ -498,6 +646,8 @@ static int cortex_m_debug_entry(struct target *target)
 	 * First load register accessible through core debug port */
 	int num_regs = arm->core_cache->num_regs;
 
+	/* whatever the queued snapshot could not read is read one by one */
+	cortex_m_fast_read_all_regs(target);
 	for (i = 0; i < num_regs; i++) {
 		r = &armv7m->arm.core_cache->reg_list[i];
 		if (!r->valid)
@@ -568,6 +718,8 @@ static int cortex_m_poll(struct target *target)
 		target->state = TARGET_UNKNOWN;
 		return retval;
 	}
+	cortex_m->dcb_dhcsr |= cortex_m->dcb_dhcsr_cumulated_sticky;
+	cortex_m->dcb_dhcsr_cumulated_sticky = 0;
 
 	/* Recover from lockup.  See ARMv7-M architecture spec,
 	 * section B1.5.15 "Unrecoverable exception cases".
@@ -1774,6 +1926,31 @@ static int cortex_m_read_memory(struct target *target, target_addr_t address,
 	return mem_ap_read_buf(armv7m->debug_ap, buffer, size, count, address);
 }
 
+static int cortex_m_read_memory_multi(struct target *target,
+	struct target_memory_region *regions, unsigned int num_regions)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+
+	if (armv7m->arm.is_armv6m) {
+		/* let the unaligned ranges fail on their own */
+		for (unsigned int i = 0; i < num_regions; i++) {
+			if (regions[i].address % regions[i].size == 0)
+				continue;
+
+			int retval = ERROR_OK;
+			for (i = 0; i < num_regions; i++) {
+				int r = cortex_m_read_memory(target, regions[i].address,
+						regions[i].size, regions[i].count, regions[i].buffer);
+				if (r != ERROR_OK && retval == ERROR_OK)
+					retval = r;
+			}
+			return retval;
+		}
+	}
+
+	return mem_ap_read_buf_multi(armv7m->debug_ap, regions, num_regions);
+}
+
 static int cortex_m_write_memory(struct target *target, target_addr_t address,
 	uint32_t size, uint32_t count, const uint8_t *buffer)
 {
@@ -2341,8 +2518,15 @@ static int cortex_m_handle_target_request(void *priv)
 	if (target->state == TARGET_RUNNING) {
 		uint8_t data;
 		uint8_t ctrl;
+		bool mailbox;
 		int retval;
 
+		retval = target_request_mailbox_poll(target, &mailbox);
+		if (retval != ERROR_OK)
+			return retval;
+		if (mailbox)
+			return ERROR_OK;
+
 		retval = cortex_m_dcc_read(target, &data, &ctrl);
 		if (retval != ERROR_OK)
 			return retval;
@@ -2665,6 +2849,7 @@ struct target_type cortexm_target = {
 	.get_gdb_reg_list = armv7m_get_gdb_reg_list,
 
 	.read_memory = cortex_m_read_memory,
+	.read_memory_multi = cortex_m_read_memory_multi,
 	.write_memory = cortex_m_write_memory,
 	.checksum_memory = armv7m_checksum_memory,
 	.blank_check_memory = armv7m_blank_check_memory,
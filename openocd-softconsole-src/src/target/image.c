@@ -115,239 +115,448 @@ static int identify_image_type(struct image *image, const char *type_string, con
 	return ERROR_OK;
 }
 
-static int image_ihex_buffer_complete_inner(struct image *image,
-	char *lpszLine,
-	struct imagesection *section)
+enum image_record_type {
+	IMAGE_RECORD_NONE,	/* blank line, comment or record without meaning here */
+	IMAGE_RECORD_DATA,
+	IMAGE_RECORD_ADDRESS,	/* IHEX segment/linear base address */
+	IMAGE_RECORD_START,	/* IHEX start linear address */
+	IMAGE_RECORD_END,
+};
+
+/* A validated record of an IHEX or S19 file */
+struct image_record {
+	enum image_record_type type;
+	unsigned ihex_type;
+	uint32_t address;
+	uint32_t count;
+	const uint8_t *data;
+	const char *line;
+	size_t line_len;
+	/* all bytes of the record, IHEX length byte or S19 count byte first */
+	uint8_t bytes[1 + 255];
+};
+
+static int image_hex_digit(char c)
 {
-	struct image_ihex *ihex = image->type_private;
-	struct fileio *fileio = ihex->fileio;
-	uint32_t full_address;
-	uint32_t cooked_bytes;
-	bool end_rec = false;
-	int i;
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
 
-	/* we can't determine the number of sections that we'll have to create ahead of time,
-	 * so we locally hold them until parsing is finished */
+/* Convert count bytes of hex text, the text must hold at least 2 * count characters */
+static bool image_hex_decode(const char *hex, unsigned count, uint8_t *out)
+{
+	for (unsigned i = 0; i < count; i++) {
+		int high = image_hex_digit(hex[2 * i]);
+		int low = image_hex_digit(hex[2 * i + 1]);
+		if (high < 0 || low < 0)
+			return false;
+		out[i] = (high << 4) | low;
+	}
+	return true;
+}
 
-	size_t filesize;
-	int retval;
-	retval = fileio_size(fileio, &filesize);
-	if (retval != ERROR_OK)
-		return retval;
+static int image_ihex_parse_record(struct image_record *record)
+{
+	const char *line = record->line;
+	size_t len = record->line_len;
+
+	if (len < 11 || line[0] != ':' || !image_hex_decode(line + 1, 1, record->bytes))
+		goto malformed;
+
+	/* length, address, type, data and checksum */
+	unsigned count = 5 + record->bytes[0];
+	if (len < 1 + 2 * count || !image_hex_decode(line + 3, count - 1, record->bytes + 1))
+		goto malformed;
+
+	uint8_t cal_checksum = 0;
+	for (unsigned i = 0; i < count; i++)
+		cal_checksum += record->bytes[i];
+	if (cal_checksum != 0) {
+		LOG_ERROR("incorrect record checksum found in IHEX file");
+		return ERROR_IMAGE_CHECKSUM;
+	}
+
+	record->ihex_type = record->bytes[3];
+	record->count = record->bytes[0];
+	record->data = record->bytes + 4;
+
+	switch (record->ihex_type) {
+		case 0:	/* Data Record */
+			record->type = IMAGE_RECORD_DATA;
+			record->address = (record->bytes[1] << 8) | record->bytes[2];
+			break;
+		case 1:	/* End of File Record */
+			record->type = IMAGE_RECORD_END;
+			break;
+		case 2:	/* Linear Address Record */
+		case 4:	/* Extended Linear Address Record */
+			if (record->count < 2)
+				goto malformed;
+			record->type = IMAGE_RECORD_ADDRESS;
+			record->address = (record->data[0] << 8) | record->data[1];
+			break;
+		case 3:	/* Start Segment Address Record */
+			/* "Start Segment Address Record" will not be supported
+			 * but we must consume it, and do not create an error.  */
+			record->type = IMAGE_RECORD_NONE;
+			break;
+		case 5:	/* Start Linear Address Record */
+			if (record->count < 4)
+				goto malformed;
+			record->type = IMAGE_RECORD_START;
+			record->address = be_to_h_u32(record->data);
+			break;
+		default:
+			LOG_ERROR("unhandled IHEX record type: %i", (int)record->ihex_type);
+			return ERROR_IMAGE_FORMAT_ERROR;
+	}
+
+	return ERROR_OK;
+
+malformed:
+	LOG_ERROR("malformed record in IHEX file: %.*s", (int)MIN(record->line_len, 40), line);
+	return ERROR_IMAGE_FORMAT_ERROR;
+}
+
+static int image_mot_parse_record(struct image_record *record)
+{
+	const char *line = record->line;
+	size_t len = record->line_len;
+
+	int record_type = len >= 4 && line[0] == 'S' ? image_hex_digit(line[1]) : -1;
+	if (record_type < 0 || !image_hex_decode(line + 2, 1, record->bytes))
+		goto malformed;
+
+	/* count covers address, data and checksum */
+	unsigned count = record->bytes[0];
+	if (count < 1 || len < 4 + 2 * count
+			|| !image_hex_decode(line + 4, count, record->bytes + 1))
+		goto malformed;
+
+	/* account for checksum, will always be 0xFF */
+	uint8_t cal_checksum = 0;
+	for (unsigned i = 0; i <= count; i++)
+		cal_checksum += record->bytes[i];
+	if (cal_checksum != 0xFF) {
+		LOG_ERROR("incorrect record checksum found in S19 file");
+		return ERROR_IMAGE_CHECKSUM;
+	}
+
+	if (record_type >= 1 && record_type <= 3) {
+		/* S1, S2, S3 - data records with 16, 24 and 32 bit addresses */
+		unsigned address_size = record_type + 1;
+		if (count < 1 + address_size)
+			goto malformed;
+
+		record->type = IMAGE_RECORD_DATA;
+		record->address = 0;
+		for (unsigned i = 0; i < address_size; i++)
+			record->address = (record->address << 8) | record->bytes[1 + i];
+		record->data = record->bytes + 1 + address_size;
+		record->count = count - 1 - address_size;
+	} else if (record_type == 0 || record_type == 5 || record_type == 6) {
+		/* S0 is the optional starting record, S5 and S6 are the data count
+		 * records, we ignore them */
+		record->type = IMAGE_RECORD_NONE;
+	} else if (record_type >= 7 && record_type <= 9) {
+		/* S7, S8, S9 - ending records for 32, 24 and 16bit */
+		record->type = IMAGE_RECORD_END;
+	} else {
+		LOG_ERROR("unhandled S19 record type: %i", record_type);
+		return ERROR_IMAGE_FORMAT_ERROR;
+	}
+
+	return ERROR_OK;
+
+malformed:
+	LOG_ERROR("malformed record in S19 file: %.*s", (int)MIN(record->line_len, 40), line);
+	return ERROR_IMAGE_FORMAT_ERROR;
+}
+
+static bool image_text_is_blank(const struct image_record *record)
+{
+	return record->line_len == 0 || record->line[0] == '#';
+}
+
+/* Parse the line at *position and move past it */
+static int image_text_next_record(struct image *image, size_t *position,
+		struct image_record *record)
+{
+	struct image_text *text = image->type_private;
+	const char *line = text->text + *position;
+	size_t remaining = text->text_size - *position;
+
+	const char *eol = memchr(line, '\n', remaining);
+	size_t len = eol ? (size_t)(eol - line) : remaining;
+	*position += eol ? len + 1 : len;
+
+	while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == '\t' || line[len - 1] == ' '))
+		len--;
+	record->type = IMAGE_RECORD_NONE;
+	record->line = line;
+	record->line_len = len;
+
+	/* skip comments and blank lines */
+	if (image_text_is_blank(record))
+		return ERROR_OK;
+
+	if (image->type == IMAGE_IHEX)
+		return image_ihex_parse_record(record);
+	return image_mot_parse_record(record);
+}
+
+static void image_text_start_section(struct imagesection *section, size_t *section_start,
+		size_t position)
+{
+	section->base_address = 0x0;
+	section->size = 0x0;
+	section->flags = 0;
+	section->private = NULL;
+	*section_start = position;
+}
+
+/* Find the sections of an IHEX or S19 file, without keeping their data */
+static int image_text_scan_inner(struct image *image, struct imagesection *section,
+		size_t *section_start)
+{
+	struct image_text *text = image->type_private;
+	const char *format = image->type == IMAGE_IHEX ? "IHEX" : "S19";
+	struct image_record *record;
+	uint32_t full_address = 0x0;
+	bool end_rec = false;
+	size_t position = 0;
+	int retval = ERROR_OK;
+
+	record = malloc(sizeof(*record));
+	if (record == NULL) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
 
-	ihex->buffer = malloc(filesize >> 1);
-	cooked_bytes = 0x0;
 	image->num_sections = 0;
+	image_text_start_section(&section[0], &section_start[0], position);
 
-	while (!fileio_feof(fileio)) {
-		full_address = 0x0;
-		section[image->num_sections].private = &ihex->buffer[cooked_bytes];
-		section[image->num_sections].base_address = 0x0;
-		section[image->num_sections].size = 0x0;
-		section[image->num_sections].flags = 0;
-
-		while (fileio_fgets(fileio, 1023, lpszLine) == ERROR_OK) {
-			uint32_t count;
-			uint32_t address;
-			uint32_t record_type;
-			uint32_t checksum;
-			uint8_t cal_checksum = 0;
-			size_t bytes_read = 0;
-
-			/* skip comments and blank lines */
-			if ((lpszLine[0] == '#') || (strlen(lpszLine + strspn(lpszLine, "\n\t\r ")) == 0))
-				continue;
-
-			if (sscanf(&lpszLine[bytes_read], ":%2" SCNx32 "%4" SCNx32 "%2" SCNx32, &count,
-				&address, &record_type) != 3)
-				return ERROR_IMAGE_FORMAT_ERROR;
-			bytes_read += 9;
-
-			cal_checksum += (uint8_t)count;
-			cal_checksum += (uint8_t)(address >> 8);
-			cal_checksum += (uint8_t)address;
-			cal_checksum += (uint8_t)record_type;
-
-			if (record_type == 0) {	/* Data Record */
-				if ((full_address & 0xffff) != address) {
-					/* we encountered a nonconsecutive location, create a new section,
-					 * unless the current section has zero size, in which case this specifies
-					 * the current section's base address
-					 */
-					if (section[image->num_sections].size != 0) {
-						image->num_sections++;
-						if (image->num_sections >= IMAGE_MAX_SECTIONS) {
-							/* too many sections */
-							LOG_ERROR("Too many sections found in IHEX file");
-							return ERROR_IMAGE_FORMAT_ERROR;
-						}
-						section[image->num_sections].size = 0x0;
-						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&ihex->buffer[cooked_bytes];
-					}
-					section[image->num_sections].base_address =
-						(full_address & 0xffff0000) | address;
-					full_address = (full_address & 0xffff0000) | address;
-				}
+	while (position < text->text_size) {
+		size_t line_position = position;
+		retval = image_text_next_record(image, &position, record);
+		if (retval != ERROR_OK)
+			break;
+		if (image_text_is_blank(record))
+			continue;
 
-				while (count-- > 0) {
-					unsigned value;
-					sscanf(&lpszLine[bytes_read], "%2x", &value);
-					ihex->buffer[cooked_bytes] = (uint8_t)value;
-					cal_checksum += (uint8_t)ihex->buffer[cooked_bytes];
-					bytes_read += 2;
-					cooked_bytes += 1;
-					section[image->num_sections].size += 1;
-					full_address++;
-				}
-			} else if (record_type == 1) {	/* End of File Record */
-				/* finish the current section */
-				image->num_sections++;
+		if (end_rec) {
+			end_rec = false;
+			LOG_WARNING("continuing after end-of-file record: %.*s",
+					(int)MIN(record->line_len, 40), record->line);
+		}
 
-				/* copy section information */
-				image->sections = malloc(sizeof(struct imagesection) * image->num_sections);
-				for (i = 0; i < image->num_sections; i++) {
-					image->sections[i].private = section[i].private;
-					image->sections[i].base_address = section[i].base_address;
-					image->sections[i].size = section[i].size;
-					image->sections[i].flags = section[i].flags;
-				}
+		struct imagesection *current = &section[image->num_sections];
+		uint32_t base_address = full_address;
 
-				end_rec = true;
+		if (record->type == IMAGE_RECORD_DATA) {
+			if (image->type == IMAGE_IHEX)
+				base_address = (full_address & 0xffff0000) | record->address;
+			else
+				base_address = record->address;
+		} else if (record->type == IMAGE_RECORD_ADDRESS) {
+			uint32_t upper_address = record->address;
+			if (record->ihex_type == 2 && (full_address >> 4) != upper_address)
+				base_address = (full_address & 0xffff) | (upper_address << 4);
+			else if (record->ihex_type == 4 && (full_address >> 16) != upper_address)
+				base_address = (full_address & 0xffff) | (upper_address << 16);
+		} else if (record->type == IMAGE_RECORD_START) {
+			image->start_address_set = 1;
+			image->start_address = record->address;
+			continue;
+		} else if (record->type == IMAGE_RECORD_END) {
+			/* finish the current section, anything after the end record
+			 * starts over in a new one */
+			image->num_sections++;
+			if (image->num_sections > IMAGE_MAX_SECTIONS) {
+				LOG_ERROR("Too many sections found in %s file", format);
+				retval = ERROR_IMAGE_FORMAT_ERROR;
 				break;
-			} else if (record_type == 2) {	/* Linear Address Record */
-				uint16_t upper_address;
-
-				sscanf(&lpszLine[bytes_read], "%4hx", &upper_address);
-				cal_checksum += (uint8_t)(upper_address >> 8);
-				cal_checksum += (uint8_t)upper_address;
-				bytes_read += 4;
-
-				if ((full_address >> 4) != upper_address) {
-					/* we encountered a nonconsecutive location, create a new section,
-					 * unless the current section has zero size, in which case this specifies
-					 * the current section's base address
-					 */
-					if (section[image->num_sections].size != 0) {
-						image->num_sections++;
-						if (image->num_sections >= IMAGE_MAX_SECTIONS) {
-							/* too many sections */
-							LOG_ERROR("Too many sections found in IHEX file");
-							return ERROR_IMAGE_FORMAT_ERROR;
-						}
-						section[image->num_sections].size = 0x0;
-						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&ihex->buffer[cooked_bytes];
-					}
-					section[image->num_sections].base_address =
-						(full_address & 0xffff) | (upper_address << 4);
-					full_address = (full_address & 0xffff) | (upper_address << 4);
-				}
-			} else if (record_type == 3) {	/* Start Segment Address Record */
-				uint32_t dummy;
-
-				/* "Start Segment Address Record" will not be supported
-				 * but we must consume it, and do not create an error.  */
-				while (count-- > 0) {
-					sscanf(&lpszLine[bytes_read], "%2" SCNx32, &dummy);
-					cal_checksum += (uint8_t)dummy;
-					bytes_read += 2;
-				}
-			} else if (record_type == 4) {	/* Extended Linear Address Record */
-				uint16_t upper_address;
-
-				sscanf(&lpszLine[bytes_read], "%4hx", &upper_address);
-				cal_checksum += (uint8_t)(upper_address >> 8);
-				cal_checksum += (uint8_t)upper_address;
-				bytes_read += 4;
-
-				if ((full_address >> 16) != upper_address) {
-					/* we encountered a nonconsecutive location, create a new section,
-					 * unless the current section has zero size, in which case this specifies
-					 * the current section's base address
-					 */
-					if (section[image->num_sections].size != 0) {
-						image->num_sections++;
-						if (image->num_sections >= IMAGE_MAX_SECTIONS) {
-							/* too many sections */
-							LOG_ERROR("Too many sections found in IHEX file");
-							return ERROR_IMAGE_FORMAT_ERROR;
-						}
-						section[image->num_sections].size = 0x0;
-						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&ihex->buffer[cooked_bytes];
-					}
-					section[image->num_sections].base_address =
-						(full_address & 0xffff) | (upper_address << 16);
-					full_address = (full_address & 0xffff) | (upper_address << 16);
-				}
-			} else if (record_type == 5) {	/* Start Linear Address Record */
-				uint32_t start_address;
-
-				sscanf(&lpszLine[bytes_read], "%8" SCNx32, &start_address);
-				cal_checksum += (uint8_t)(start_address >> 24);
-				cal_checksum += (uint8_t)(start_address >> 16);
-				cal_checksum += (uint8_t)(start_address >> 8);
-				cal_checksum += (uint8_t)start_address;
-				bytes_read += 8;
-
-				image->start_address_set = 1;
-				image->start_address = be_to_h_u32((uint8_t *)&start_address);
-			} else {
-				LOG_ERROR("unhandled IHEX record type: %i", (int)record_type);
-				return ERROR_IMAGE_FORMAT_ERROR;
 			}
-
-			sscanf(&lpszLine[bytes_read], "%2" SCNx32, &checksum);
-
-			if ((uint8_t)checksum != (uint8_t)(~cal_checksum + 1)) {
-				/* checksum failed */
-				LOG_ERROR("incorrect record checksum found in IHEX file");
-				return ERROR_IMAGE_CHECKSUM;
+			image_text_start_section(&section[image->num_sections],
+					&section_start[image->num_sections], position);
+			full_address = 0x0;
+			end_rec = true;
+			continue;
+		} else
+			continue;
+
+		if (base_address != full_address) {
+			/* we encountered a nonconsecutive location, create a new section,
+			 * unless the current section has zero size, in which case this specifies
+			 * the current section's base address
+			 */
+			if (current->size != 0) {
+				image->num_sections++;
+				if (image->num_sections >= IMAGE_MAX_SECTIONS) {
+					/* too many sections */
+					LOG_ERROR("Too many sections found in %s file", format);
+					retval = ERROR_IMAGE_FORMAT_ERROR;
+					break;
+				}
+				current = &section[image->num_sections];
+				image_text_start_section(current, &section_start[image->num_sections],
+						line_position);
 			}
+			current->base_address = base_address;
+			full_address = base_address;
+		}
 
-			if (end_rec) {
-				end_rec = false;
-				LOG_WARNING("continuing after end-of-file record: %.40s", lpszLine);
-			}
+		if (record->type == IMAGE_RECORD_DATA) {
+			current->size += record->count;
+			full_address += record->count;
 		}
 	}
 
-	if (end_rec)
-		return ERROR_OK;
-	else {
-		LOG_ERROR("premature end of IHEX file, no matching end-of-file record found");
+	free(record);
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (!end_rec) {
+		LOG_ERROR("premature end of %s file, no matching end-of-file record found", format);
 		return ERROR_IMAGE_FORMAT_ERROR;
 	}
+
+	/* copy section information */
+	image->sections = malloc(sizeof(struct imagesection) * image->num_sections);
+	text->section_start = malloc(sizeof(size_t) * image->num_sections);
+	if (image->sections == NULL || text->section_start == NULL) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+	memcpy(image->sections, section, sizeof(struct imagesection) * image->num_sections);
+	memcpy(text->section_start, section_start, sizeof(size_t) * image->num_sections);
+	text->cursor_section = -1;
+
+	return ERROR_OK;
 }
 
 /**
  * Allocate memory dynamically instead of on the stack. This
  * is important w/embedded hosts.
  */
-static int image_ihex_buffer_complete(struct image *image)
+static int image_text_scan(struct image *image)
 {
-	char *lpszLine = malloc(1023);
-	if (lpszLine == NULL) {
+	/* we can't determine the number of sections that we'll have to create ahead of time,
+	 * so we locally hold them until parsing is finished; one more than allowed
+	 * is needed for the section following a last end-of-file record */
+	struct imagesection *section = malloc(sizeof(struct imagesection) * (IMAGE_MAX_SECTIONS + 1));
+	size_t *section_start = malloc(sizeof(size_t) * (IMAGE_MAX_SECTIONS + 1));
+	int retval;
+
+	if (section == NULL || section_start == NULL) {
 		LOG_ERROR("Out of memory");
-		return ERROR_FAIL;
+		retval = ERROR_FAIL;
+	} else
+		retval = image_text_scan_inner(image, section, section_start);
+
+	free(section_start);
+	free(section);
+
+	return retval;
+}
+
+static int image_text_open(struct image *image, const char *url)
+{
+	struct image_text *text = image->type_private;
+	int retval;
+
+	text->section_start = NULL;
+
+	retval = fileio_open(&text->fileio, url, FILEIO_READ, FILEIO_TEXT);
+	if (retval != ERROR_OK)
+		return retval;
+
+	const uint8_t *data;
+	retval = fileio_map(text->fileio, &data);
+	if (retval == ERROR_OK) {
+		text->text = (const char *)data;
+		retval = fileio_size(text->fileio, &text->text_size);
+	}
+	if (retval == ERROR_OK)
+		retval = image_text_scan(image);
+
+	if (retval != ERROR_OK) {
+		LOG_ERROR("failed buffering %s image, check server output for additional information",
+				image->type == IMAGE_IHEX ? "IHEX" : "S19");
+		fileio_close(text->fileio);
+		free(text->section_start);
+		text->section_start = NULL;
+		free(image->sections);
+		image->sections = NULL;
 	}
-	struct imagesection *section = malloc(sizeof(struct imagesection) * IMAGE_MAX_SECTIONS);
-	if (section == NULL) {
-		free(lpszLine);
+
+	return retval;
+}
+
+static int image_text_read_section(struct image *image,
+	int section,
+	uint32_t offset,
+	uint32_t size,
+	uint8_t *buffer,
+	size_t *size_read)
+{
+	struct image_text *text = image->type_private;
+	struct image_record *record;
+	size_t position;
+	uint32_t record_offset;
+	int retval = ERROR_OK;
+
+	/* continue from where the last read stopped, if it was in front of this one */
+	if (text->cursor_section == section && text->cursor_offset <= offset) {
+		position = text->cursor_position;
+		record_offset = text->cursor_offset;
+	} else {
+		position = text->section_start[section];
+		record_offset = 0;
+	}
+
+	record = malloc(sizeof(*record));
+	if (record == NULL) {
 		LOG_ERROR("Out of memory");
 		return ERROR_FAIL;
 	}
-	int retval;
 
-	retval = image_ihex_buffer_complete_inner(image, lpszLine, section);
+	*size_read = 0;
+	while (*size_read < size) {
+		size_t line_position = position;
 
-	free(section);
-	free(lpszLine);
+		if (position >= text->text_size) {
+			LOG_ERROR("image section %d ends unexpectedly", section);
+			retval = ERROR_IMAGE_FORMAT_ERROR;
+			break;
+		}
 
+		retval = image_text_next_record(image, &position, record);
+		if (retval != ERROR_OK)
+			break;
+		if (record->type != IMAGE_RECORD_DATA)
+			continue;
+
+		uint32_t wanted = offset + *size_read;
+		if (record_offset + record->count > wanted) {
+			uint32_t skip = wanted - record_offset;
+			uint32_t count = MIN(record->count - skip, size - *size_read);
+			memcpy(buffer + *size_read, record->data + skip, count);
+			*size_read += count;
+
+			text->cursor_section = section;
+			text->cursor_offset = record_offset;
+			text->cursor_position = line_position;
+		}
+		record_offset += record->count;
+	}
+
+	free(record);
 	return retval;
 }
 
@@ -452,6 +661,26 @@ static int image_elf_read_headers(struct image *image)
 	if (i >= elf->segment_count && nload > 1)
 		load_to_vaddr = 1;
 
+	/* segment contents must lie within the file */
+	size_t filesize;
+	retval = fileio_size(elf->fileio, &filesize);
+	if (retval != ERROR_OK)
+		return retval;
+	for (i = 0; i < elf->segment_count; i++) {
+		if ((field32(elf, elf->segments[i].p_type) == PT_LOAD) &&
+			(field32(elf, elf->segments[i].p_filesz) != 0) &&
+			((uint64_t)field32(elf, elf->segments[i].p_offset) +
+			 field32(elf, elf->segments[i].p_filesz) > filesize)) {
+			LOG_ERROR("invalid ELF file, segment %" PRIu32 " extends past the end of the file", i);
+			return ERROR_IMAGE_FORMAT_ERROR;
+		}
+	}
+
+	/* segment contents are used straight from the file when it can be
+	 * mapped, and read from it otherwise */
+	if (fileio_map(elf->fileio, &elf->data) != ERROR_OK)
+		elf->data = NULL;
+
 	/* alloc and fill sections array with loadable segments */
 	image->sections = malloc(image->num_sections * sizeof(struct imagesection));
 	for (i = 0, j = 0; i < elf->segment_count; i++) {
@@ -499,6 +728,11 @@ static int image_elf_read_section(struct image *image,
 		read_size = MIN(size, field32(elf, segment->p_filesz) - offset);
 		LOG_DEBUG("read elf: size = 0x%zu at 0x%" PRIx32 "", read_size,
 			field32(elf, segment->p_offset) + offset);
+		if (elf->data) {
+			memcpy(buffer, elf->data + field32(elf, segment->p_offset) + offset, read_size);
+			*size_read += read_size;
+			return ERROR_OK;
+		}
 		/* read initialized area of the segment */
 		retval = fileio_seek(elf->fileio, field32(elf, segment->p_offset) + offset);
 		if (retval != ERROR_OK) {
@@ -520,210 +754,6 @@ static int image_elf_read_section(struct image *image,
 	return ERROR_OK;
 }
 
-static int image_mot_buffer_complete_inner(struct image *image,
-	char *lpszLine,
-	struct imagesection *section)
-{
-	struct image_mot *mot = image->type_private;
-	struct fileio *fileio = mot->fileio;
-	uint32_t full_address;
-	uint32_t cooked_bytes;
-	bool end_rec = false;
-	int i;
-
-	/* we can't determine the number of sections that we'll have to create ahead of time,
-	 * so we locally hold them until parsing is finished */
-
-	int retval;
-	size_t filesize;
-	retval = fileio_size(fileio, &filesize);
-	if (retval != ERROR_OK)
-		return retval;
-
-	mot->buffer = malloc(filesize >> 1);
-	cooked_bytes = 0x0;
-	image->num_sections = 0;
-
-	while (!fileio_feof(fileio)) {
-		full_address = 0x0;
-		section[image->num_sections].private = &mot->buffer[cooked_bytes];
-		section[image->num_sections].base_address = 0x0;
-		section[image->num_sections].size = 0x0;
-		section[image->num_sections].flags = 0;
-
-		while (fileio_fgets(fileio, 1023, lpszLine) == ERROR_OK) {
-			uint32_t count;
-			uint32_t address;
-			uint32_t record_type;
-			uint32_t checksum;
-			uint8_t cal_checksum = 0;
-			uint32_t bytes_read = 0;
-
-			/* skip comments and blank lines */
-			if ((lpszLine[0] == '#') || (strlen(lpszLine + strspn(lpszLine, "\n\t\r ")) == 0))
-				continue;
-
-			/* get record type and record length */
-			if (sscanf(&lpszLine[bytes_read], "S%1" SCNx32 "%2" SCNx32, &record_type,
-				&count) != 2)
-				return ERROR_IMAGE_FORMAT_ERROR;
-
-			bytes_read += 4;
-			cal_checksum += (uint8_t)count;
-
-			/* skip checksum byte */
-			count -= 1;
-
-			if (record_type == 0) {
-				/* S0 - starting record (optional) */
-				int iValue;
-
-				while (count-- > 0) {
-					sscanf(&lpszLine[bytes_read], "%2x", &iValue);
-					cal_checksum += (uint8_t)iValue;
-					bytes_read += 2;
-				}
-			} else if (record_type >= 1 && record_type <= 3) {
-				switch (record_type) {
-					case 1:
-						/* S1 - 16 bit address data record */
-						sscanf(&lpszLine[bytes_read], "%4" SCNx32, &address);
-						cal_checksum += (uint8_t)(address >> 8);
-						cal_checksum += (uint8_t)address;
-						bytes_read += 4;
-						count -= 2;
-						break;
-
-					case 2:
-						/* S2 - 24 bit address data record */
-						sscanf(&lpszLine[bytes_read], "%6" SCNx32, &address);
-						cal_checksum += (uint8_t)(address >> 16);
-						cal_checksum += (uint8_t)(address >> 8);
-						cal_checksum += (uint8_t)address;
-						bytes_read += 6;
-						count -= 3;
-						break;
-
-					case 3:
-						/* S3 - 32 bit address data record */
-						sscanf(&lpszLine[bytes_read], "%8" SCNx32, &address);
-						cal_checksum += (uint8_t)(address >> 24);
-						cal_checksum += (uint8_t)(address >> 16);
-						cal_checksum += (uint8_t)(address >> 8);
-						cal_checksum += (uint8_t)address;
-						bytes_read += 8;
-						count -= 4;
-						break;
-
-				}
-
-				if (full_address != address) {
-					/* we encountered a nonconsecutive location, create a new section,
-					 * unless the current section has zero size, in which case this specifies
-					 * the current section's base address
-					 */
-					if (section[image->num_sections].size != 0) {
-						image->num_sections++;
-						section[image->num_sections].size = 0x0;
-						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&mot->buffer[cooked_bytes];
-					}
-					section[image->num_sections].base_address = address;
-					full_address = address;
-				}
-
-				while (count-- > 0) {
-					unsigned value;
-					sscanf(&lpszLine[bytes_read], "%2x", &value);
-					mot->buffer[cooked_bytes] = (uint8_t)value;
-					cal_checksum += (uint8_t)mot->buffer[cooked_bytes];
-					bytes_read += 2;
-					cooked_bytes += 1;
-					section[image->num_sections].size += 1;
-					full_address++;
-				}
-			} else if (record_type == 5 || record_type == 6) {
-				/* S5 and S6 are the data count records, we ignore them */
-				uint32_t dummy;
-
-				while (count-- > 0) {
-					sscanf(&lpszLine[bytes_read], "%2" SCNx32, &dummy);
-					cal_checksum += (uint8_t)dummy;
-					bytes_read += 2;
-				}
-			} else if (record_type >= 7 && record_type <= 9) {
-				/* S7, S8, S9 - ending records for 32, 24 and 16bit */
-				image->num_sections++;
-
-				/* copy section information */
-				image->sections = malloc(sizeof(struct imagesection) * image->num_sections);
-				for (i = 0; i < image->num_sections; i++) {
-					image->sections[i].private = section[i].private;
-					image->sections[i].base_address = section[i].base_address;
-					image->sections[i].size = section[i].size;
-					image->sections[i].flags = section[i].flags;
-				}
-
-				end_rec = true;
-				break;
-			} else {
-				LOG_ERROR("unhandled S19 record type: %i", (int)(record_type));
-				return ERROR_IMAGE_FORMAT_ERROR;
-			}
-
-			/* account for checksum, will always be 0xFF */
-			sscanf(&lpszLine[bytes_read], "%2" SCNx32, &checksum);
-			cal_checksum += (uint8_t)checksum;
-
-			if (cal_checksum != 0xFF) {
-				/* checksum failed */
-				LOG_ERROR("incorrect record checksum found in S19 file");
-				return ERROR_IMAGE_CHECKSUM;
-			}
-
-			if (end_rec) {
-				end_rec = false;
-				LOG_WARNING("continuing after end-of-file record: %.40s", lpszLine);
-			}
-		}
-	}
-
-	if (end_rec)
-		return ERROR_OK;
-	else {
-		LOG_ERROR("premature end of S19 file, no matching end-of-file record found");
-		return ERROR_IMAGE_FORMAT_ERROR;
-	}
-}
-
-/**
- * Allocate memory dynamically instead of on the stack. This
- * is important w/embedded hosts.
- */
-static int image_mot_buffer_complete(struct image *image)
-{
-	char *lpszLine = malloc(1023);
-	if (lpszLine == NULL) {
-		LOG_ERROR("Out of memory");
-		return ERROR_FAIL;
-	}
-	struct imagesection *section = malloc(sizeof(struct imagesection) * IMAGE_MAX_SECTIONS);
-	if (section == NULL) {
-		free(lpszLine);
-		LOG_ERROR("Out of memory");
-		return ERROR_FAIL;
-	}
-	int retval;
-
-	retval = image_mot_buffer_complete_inner(image, lpszLine, section);
-
-	free(section);
-	free(lpszLine);
-
-	return retval;
-}
-
 int image_open(struct image *image, const char *url, const char *type_string)
 {
 	int retval = ERROR_OK;
@@ -747,27 +777,21 @@ int image_open(struct image *image, const char *url, const char *type_string)
 			return retval;
 		}
 
+		/* without a mapping, sections are read from the file */
+		if (fileio_map(image_binary->fileio, &image_binary->data) != ERROR_OK)
+			image_binary->data = NULL;
+
 		image->num_sections = 1;
 		image->sections = malloc(sizeof(struct imagesection));
 		image->sections[0].base_address = 0x0;
 		image->sections[0].size = filesize;
 		image->sections[0].flags = 0;
 	} else if (image->type == IMAGE_IHEX) {
-		struct image_ihex *image_ihex;
-
-		image_ihex = image->type_private = malloc(sizeof(struct image_ihex));
+		image->type_private = malloc(sizeof(struct image_text));
 
-		retval = fileio_open(&image_ihex->fileio, url, FILEIO_READ, FILEIO_TEXT);
+		retval = image_text_open(image, url);
 		if (retval != ERROR_OK)
 			return retval;
-
-		retval = image_ihex_buffer_complete(image);
-		if (retval != ERROR_OK) {
-			LOG_ERROR(
-				"failed buffering IHEX image, check server output for additional information");
-			fileio_close(image_ihex->fileio);
-			return retval;
-		}
 	} else if (image->type == IMAGE_ELF) {
 		struct image_elf *image_elf;
 
@@ -804,21 +828,11 @@ int image_open(struct image *image, const char *url, const char *type_string)
 		image_memory->cache = NULL;
 		image_memory->cache_address = 0x0;
 	} else if (image->type == IMAGE_SRECORD) {
-		struct image_mot *image_mot;
+		image->type_private = malloc(sizeof(struct image_text));
 
-		image_mot = image->type_private = malloc(sizeof(struct image_mot));
-
-		retval = fileio_open(&image_mot->fileio, url, FILEIO_READ, FILEIO_TEXT);
+		retval = image_text_open(image, url);
 		if (retval != ERROR_OK)
 			return retval;
-
-		retval = image_mot_buffer_complete(image);
-		if (retval != ERROR_OK) {
-			LOG_ERROR(
-				"failed buffering S19 image, check server output for additional information");
-			fileio_close(image_mot->fileio);
-			return retval;
-		}
 	} else if (image->type == IMAGE_BUILDER) {
 		image->num_sections = 0;
 		image->base_address_set = 0;
@@ -867,6 +881,12 @@ int image_read_section(struct image *image,
 		if (section != 0)
 			return ERROR_COMMAND_SYNTAX_ERROR;
 
+		if (image_binary->data) {
+			memcpy(buffer, image_binary->data + offset, size);
+			*size_read = size;
+			return ERROR_OK;
+		}
+
 		/* seek to offset */
 		retval = fileio_seek(image_binary->fileio, offset);
 		if (retval != ERROR_OK)
@@ -876,12 +896,9 @@ int image_read_section(struct image *image,
 		retval = fileio_read(image_binary->fileio, size, buffer, size_read);
 		if (retval != ERROR_OK)
 			return retval;
-	} else if (image->type == IMAGE_IHEX) {
-		memcpy(buffer, (uint8_t *)image->sections[section].private + offset, size);
-		*size_read = size;
-
-		return ERROR_OK;
-	} else if (image->type == IMAGE_ELF)
+	} else if (image->type == IMAGE_IHEX)
+		return image_text_read_section(image, section, offset, size, buffer, size_read);
+	else if (image->type == IMAGE_ELF)
 		return image_elf_read_section(image, section, offset, size, buffer, size_read);
 	else if (image->type == IMAGE_MEMORY) {
 		struct image_memory *image_memory = image->type_private;
@@ -921,12 +938,9 @@ int image_read_section(struct image *image,
 			*size_read += (size_in_cache > size) ? size : size_in_cache;
 			address += (size_in_cache > size) ? size : size_in_cache;
 		}
-	} else if (image->type == IMAGE_SRECORD) {
-		memcpy(buffer, (uint8_t *)image->sections[section].private + offset, size);
-		*size_read = size;
-
-		return ERROR_OK;
-	} else if (image->type == IMAGE_BUILDER) {
+	} else if (image->type == IMAGE_SRECORD)
+		return image_text_read_section(image, section, offset, size, buffer, size_read);
+	else if (image->type == IMAGE_BUILDER) {
 		memcpy(buffer, (uint8_t *)image->sections[section].private + offset, size);
 		*size_read = size;
 
@@ -936,6 +950,31 @@ int image_read_section(struct image *image,
 	return ERROR_OK;
 }
 
+/**
+ * Returns the contents of a section if the image holds them in memory,
+ * mapped from the file or built up by the caller, so that they can be
+ * used without copying. Returns NULL if the section has to be fetched
+ * with image_read_section().
+ */
+const uint8_t *image_section_data(struct image *image, int section)
+{
+	if (image->type == IMAGE_BINARY) {
+		struct image_binary *image_binary = image->type_private;
+
+		return image_binary->data;
+	} else if (image->type == IMAGE_ELF) {
+		struct image_elf *elf = image->type_private;
+		Elf32_Phdr *segment = image->sections[section].private;
+
+		if (!elf->data)
+			return NULL;
+		return elf->data + field32(elf, segment->p_offset);
+	} else if (image->type == IMAGE_BUILDER)
+		return image->sections[section].private;
+
+	return NULL;
+}
+
 int image_add_section(struct image *image, uint32_t base, uint32_t size, int flags, uint8_t const *data)
 {
 	struct imagesection *section;
@@ -979,14 +1018,14 @@ void image_close(struct image *image)
 		struct image_binary *image_binary = image->type_private;
 
 		fileio_close(image_binary->fileio);
-	} else if (image->type == IMAGE_IHEX) {
-		struct image_ihex *image_ihex = image->type_private;
+	} else if (image->type == IMAGE_IHEX || image->type == IMAGE_SRECORD) {
+		struct image_text *image_text = image->type_private;
 
-		fileio_close(image_ihex->fileio);
+		fileio_close(image_text->fileio);
 
-		if (image_ihex->buffer) {
-			free(image_ihex->buffer);
-			image_ihex->buffer = NULL;
+		if (image_text->section_start) {
+			free(image_text->section_start);
+			image_text->section_start = NULL;
 		}
 	} else if (image->type == IMAGE_ELF) {
 		struct image_elf *image_elf = image->type_private;
@@ -1009,15 +1048,6 @@ void image_close(struct image *image)
 			free(image_memory->cache);
 			image_memory->cache = NULL;
 		}
-	} else if (image->type == IMAGE_SRECORD) {
-		struct image_mot *image_mot = image->type_private;
-
-		fileio_close(image_mot->fileio);
-
-		if (image_mot->buffer) {
-			free(image_mot->buffer);
-			image_mot->buffer = NULL;
-		}
 	} else if (image->type == IMAGE_BUILDER) {
 		int i;
 
@@ -1038,7 +1068,7 @@ void image_close(struct image *image)
 	}
 }
 
-int image_calculate_checksum(uint8_t *buffer, uint32_t nbytes, uint32_t *checksum)
+int image_calculate_checksum(const uint8_t *buffer, uint32_t nbytes, uint32_t *checksum)
 {
 	uint32_t crc = 0xffffffff;
 	LOG_DEBUG("Calculating checksum");
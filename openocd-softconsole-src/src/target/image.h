@@ -65,11 +65,20 @@ struct image {
 
 struct image_binary {
 	struct fileio *fileio;
+	const uint8_t *data;	/* file contents, NULL if not mapped */
 };
 
-struct image_ihex {
+/* IHEX and S19 images are decoded from the file contents when a section is
+ * read, opening the image only records where each section starts */
+struct image_text {
 	struct fileio *fileio;
-	uint8_t *buffer;
+	const char *text;
+	size_t text_size;
+	size_t *section_start;	/* text offset of the first record of each section */
+	/* where the last read stopped, so that sequential reads resume there */
+	int cursor_section;
+	uint32_t cursor_offset;	/* section offset of the record at cursor_position */
+	size_t cursor_position;
 };
 
 struct image_memory {
@@ -80,26 +89,23 @@ struct image_memory {
 
 struct image_elf {
 	struct fileio *fileio;
+	const uint8_t *data;	/* file contents, NULL if not mapped */
 	Elf32_Ehdr *header;
 	Elf32_Phdr *segments;
 	uint32_t segment_count;
 	uint8_t endianness;
 };
 
-struct image_mot {
-	struct fileio *fileio;
-	uint8_t *buffer;
-};
-
 int image_open(struct image *image, const char *url, const char *type_string);
 int image_read_section(struct image *image, int section, uint32_t offset,
 		uint32_t size, uint8_t *buffer, size_t *size_read);
+const uint8_t *image_section_data(struct image *image, int section);
 void image_close(struct image *image);
 
 int image_add_section(struct image *image, uint32_t base, uint32_t size,
 		int flags, uint8_t const *data);
 
-int image_calculate_checksum(uint8_t *buffer, uint32_t nbytes,
+int image_calculate_checksum(const uint8_t *buffer, uint32_t nbytes,
 		uint32_t *checksum);
 
 #define ERROR_IMAGE_FORMAT_ERROR	(-1400)
@@ -65,7 +65,10 @@ int riscv_batch_run(struct riscv_batch *batch)
 			jtag_add_runtest(batch->idle_count, TAP_IDLE);
 	}
 
-	if (jtag_execute_queue() != ERROR_OK) {
+	jtag_flush_origin_push("riscv dmi");
+	int retval = jtag_execute_queue();
+	jtag_flush_origin_pop();
+	if (retval != ERROR_OK) {
 		LOG_ERROR("Unable to execute JTAG queue");
 		return ERROR_FAIL;
 	}
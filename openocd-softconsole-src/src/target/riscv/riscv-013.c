@@ -522,7 +522,9 @@ static dmi_status_t dmi_scan(struct target *target, uint32_t *address_in,
 	if (idle_count)
 		jtag_add_runtest(idle_count, TAP_IDLE);
 
+	jtag_flush_origin_push("riscv dmi");
 	int retval = jtag_execute_queue();
+	jtag_flush_origin_pop();
 	if (retval != ERROR_OK) {
 		LOG_ERROR("dmi_scan failed jtag scan");
 		if (data_in)
@@ -2505,8 +2507,29 @@ static int read_memory_bus_v0(struct target *target, target_addr_t address,
 	return ERROR_OK;
 }
 
+static int batch_run(const struct target *target, struct riscv_batch *batch)
+{
+	RISCV013_INFO(info);
+	RISCV_INFO(r);
+	if (r->reset_delays_wait >= 0) {
+		r->reset_delays_wait -= batch->used_scans;
+		if (r->reset_delays_wait <= 0) {
+			batch->idle_count = 0;
+			info->dmi_busy_delay = 0;
+			info->ac_busy_delay = 0;
+		}
+	}
+	return riscv_batch_run(batch);
+}
+
 /**
  * Read the requested memory using the system bus interface.
+ *
+ * With sbreadondata set, every read of sbdata0 starts the bus access for the
+ * next word, so all but the last word are fetched with batches of DMI reads.
+ * DMI busy responses and sbbusyerror are only looked at once a batch has run;
+ * either one makes us slow down and resume from the first word that wasn't
+ * reliably received.
  */
 static int read_memory_bus_v1(struct target *target, target_addr_t address,
 		uint32_t size, uint32_t count, uint8_t *buffer)
@@ -2514,13 +2537,17 @@ static int read_memory_bus_v1(struct target *target, target_addr_t address,
 	RISCV013_INFO(info);
 	target_addr_t next_address = address;
 	target_addr_t end_address = address + count * size;
+	static int sbdata[4] = {DMI_SBDATA0, DMI_SBDATA1, DMI_SBDATA2, DMI_SBDATA3};
+	unsigned reads_per_word = (size + 3) / 4;
+
+	assert(size <= 16);
 
 	while (next_address < end_address) {
 		uint32_t sbcs_write = set_field(0, DMI_SBCS_SBREADONADDR, 1);
 		sbcs_write |= sb_sbaccess(size);
 		sbcs_write = set_field(sbcs_write, DMI_SBCS_SBAUTOINCREMENT, 1);
-		if (count > 1)
-			sbcs_write = set_field(sbcs_write, DMI_SBCS_SBREADONDATA, count > 1);
+		if (next_address + size < end_address)
+			sbcs_write = set_field(sbcs_write, DMI_SBCS_SBREADONDATA, 1);
 		if (dmi_write(target, DMI_SBCS, sbcs_write) != ERROR_OK)
 			return ERROR_FAIL;
 
@@ -2539,71 +2566,73 @@ static int read_memory_bus_v1(struct target *target, target_addr_t address,
 		/* First value has been read, and is waiting for us to issue a DMI read
 		 * to get it. */
 
-		static int sbdata[4] = {DMI_SBDATA0, DMI_SBDATA1, DMI_SBDATA2, DMI_SBDATA3};
-		assert(size <= 16);
-		target_addr_t next_read = address - 1;
-		for (uint32_t i = (next_address - address) / size; i < count - 1; i++) {
-			for (int j = (size - 1) / 4; j >= 0; j--) {
-				uint32_t value;
-				unsigned attempt = 0;
-				while (1) {
-					if (attempt++ > 100) {
-						LOG_ERROR("DMI keeps being busy in while reading memory just past " TARGET_ADDR_FMT,
-								  next_read);
-						return ERROR_FAIL;
-					}
-					dmi_status_t status = dmi_scan(target, NULL, &value,
-												   DMI_OP_READ, sbdata[j], 0, false);
-					if (status == DMI_STATUS_BUSY)
-						increase_dmi_busy_delay(target);
-					else if (status == DMI_STATUS_SUCCESS)
-						break;
-					else
-						return ERROR_FAIL;
-				}
-				if (next_read != address - 1) {
-					write_to_buf(buffer + next_read - address, value, MIN(size, 4));
-					log_memory_access(next_read, value, MIN(size, 4), true);
-				}
-				next_read = address + i * size + j * 4;
+		uint32_t sbcs_read = 0;
+		bool dmi_busy = false;
+		while (next_address + size < end_address) {
+			LOG_DEBUG("reading burst starting at address 0x%" TARGET_PRIxADDR,
+					next_address);
+
+			struct riscv_batch *batch = riscv_batch_alloc(
+					target,
+					128,
+					info->dmi_busy_delay + info->bus_master_read_delay);
+
+			uint32_t first = (next_address - address) / size;
+			uint32_t last = first;
+			while (last < count - 1 &&
+					riscv_batch_available_scans(batch) >= reads_per_word) {
+				/* sbdata0 goes last, since reading it starts the next access. */
+				for (int j = reads_per_word - 1; j >= 0; j--)
+					riscv_batch_add_dmi_read(batch, sbdata[j]);
+				last++;
 			}
-		}
 
-		uint32_t sbcs_read = 0;
-		if (count > 1) {
-			uint32_t value;
-			unsigned attempt = 0;
-			while (1) {
-				if (attempt++ > 100) {
-					LOG_ERROR("DMI keeps being busy in while reading memory just past " TARGET_ADDR_FMT,
-								next_read);
-					return ERROR_FAIL;
+			if (batch_run(target, batch) != ERROR_OK) {
+				riscv_batch_free(batch);
+				return ERROR_FAIL;
+			}
+
+			size_t key = 0;
+			for (uint32_t i = first; i < last && !dmi_busy; i++) {
+				for (int j = reads_per_word - 1; j >= 0; j--) {
+					uint64_t dmi_out = riscv_batch_get_dmi_read(batch, key++);
+					if (get_field(dmi_out, DTM_DMI_OP) != DMI_STATUS_SUCCESS) {
+						/* Everything from here on was ignored by the DM. */
+						dmi_busy = true;
+						break;
+					}
+					uint32_t value = get_field(dmi_out, DTM_DMI_DATA);
+					write_to_buf(buffer + i * size + j * 4, value, MIN(size, 4));
+					log_memory_access(address + i * size + j * 4, value, MIN(size, 4), true);
 				}
-				dmi_status_t status = dmi_scan(target, NULL, &value, DMI_OP_NOP, 0, 0, false);
-				if (status == DMI_STATUS_BUSY)
-					increase_dmi_busy_delay(target);
-				else if (status == DMI_STATUS_SUCCESS)
-					break;
-				else
-					return ERROR_FAIL;
+				if (!dmi_busy)
+					next_address += size;
 			}
-			write_to_buf(buffer + next_read - address, value, MIN(size, 4));
-			log_memory_access(next_read, value, MIN(size, 4), true);
+			riscv_batch_free(batch);
+
+			if (dmi_busy)
+				increase_dmi_busy_delay(target);
 
 			/* "Writes to sbcs while sbbusy is high result in undefined behavior.
 			 * A debugger must not write to sbcs until it reads sbbusy as 0." */
 			if (read_sbcs_nonbusy(target, &sbcs_read) != ERROR_OK)
 				return ERROR_FAIL;
 
-			sbcs_write = set_field(sbcs_write, DMI_SBCS_SBREADONDATA, 0);
-			if (dmi_write(target, DMI_SBCS, sbcs_write) != ERROR_OK)
-				return ERROR_FAIL;
+			if (dmi_busy || get_field(sbcs_read, DMI_SBCS_SBBUSYERROR) ||
+					get_field(sbcs_read, DMI_SBCS_SBERROR))
+				break;
 		}
 
 		/* Read the last word, after we disabled sbreadondata if necessary. */
-		if (!get_field(sbcs_read, DMI_SBCS_SBERROR) &&
+		if (!dmi_busy && !get_field(sbcs_read, DMI_SBCS_SBERROR) &&
 				!get_field(sbcs_read, DMI_SBCS_SBBUSYERROR)) {
-			if (read_memory_bus_word(target, address + (count - 1) * size, size,
+			if (get_field(sbcs_write, DMI_SBCS_SBREADONDATA)) {
+				sbcs_write = set_field(sbcs_write, DMI_SBCS_SBREADONDATA, 0);
+				if (dmi_write(target, DMI_SBCS, sbcs_write) != ERROR_OK)
+					return ERROR_FAIL;
+			}
+
+			if (read_memory_bus_word(target, end_address - size, size,
 						buffer + (count - 1) * size) != ERROR_OK)
 				return ERROR_FAIL;
 
@@ -2612,44 +2641,43 @@ static int read_memory_bus_v1(struct target *target, target_addr_t address,
 		}
 
 		if (get_field(sbcs_read, DMI_SBCS_SBBUSYERROR)) {
-			/* We read while the target was busy. Slow down and try again. */
+			/* We read while the target was busy. That read returned stale data
+			 * and started nothing, and the bus master stopped after finishing
+			 * the access it was working on. sbaddress points just past that
+			 * one, so it and everything after it has to be read again. Slow
+			 * down and try again. */
 			if (dmi_write(target, DMI_SBCS, DMI_SBCS_SBBUSYERROR) != ERROR_OK)
 				return ERROR_FAIL;
-			next_address = sb_read_address(target);
+			target_addr_t resume_address = sb_read_address(target) - size;
+			if (resume_address < address) {
+				/* This should never happen, probably buggy hardware. */
+				LOG_DEBUG("unexpected system bus address 0x%" TARGET_PRIxADDR,
+						resume_address + size);
+				return ERROR_FAIL;
+			}
+			if (resume_address < next_address)
+				next_address = resume_address;
 			info->bus_master_read_delay += info->bus_master_read_delay / 10 + 1;
 			continue;
 		}
 
 		unsigned error = get_field(sbcs_read, DMI_SBCS_SBERROR);
-		if (error == 0) {
-			next_address = end_address;
-		} else {
+		if (error != 0) {
 			/* Some error indicating the bus access failed, but not because of
 			 * something we did wrong. */
 			if (dmi_write(target, DMI_SBCS, DMI_SBCS_SBERROR) != ERROR_OK)
 				return ERROR_FAIL;
 			return ERROR_FAIL;
 		}
+
+		/* On a DMI busy, next_address already is the first word we didn't get. */
+		if (!dmi_busy)
+			next_address = end_address;
 	}
 
 	return ERROR_OK;
 }
 
-static int batch_run(const struct target *target, struct riscv_batch *batch)
-{
-	RISCV013_INFO(info);
-	RISCV_INFO(r);
-	if (r->reset_delays_wait >= 0) {
-		r->reset_delays_wait -= batch->used_scans;
-		if (r->reset_delays_wait <= 0) {
-			batch->idle_count = 0;
-			info->dmi_busy_delay = 0;
-			info->ac_busy_delay = 0;
-		}
-	}
-	return riscv_batch_run(batch);
-}
-
 /*
  * Performs a memory read using memory access abstract commands. The read sizes
  * supported are 1, 2, and 4 bytes despite the spec's support of 8 and 16 byte
@@ -3211,6 +3239,122 @@ static int read_memory(struct target *target, target_addr_t address,
 	return read_memory_abstract(target, address, size, count, buffer);
 }
 
+/* Scans in one batch of read_memory_multi() */
+#define READ_MULTI_BATCH_SCANS	128
+
+/**
+ * Read several small ranges through the system bus, with a single access
+ * started by an sbaddress write for every word, all in one batch of DMI
+ * scans. Ranges which don't fit in a batch, or when the system bus can't be
+ * used, are read with read_memory(). If anything goes wrong in a batch, its
+ * ranges are read again with read_memory(), which knows how to recover.
+ */
+static int read_memory_multi(struct target *target,
+		struct target_memory_region *regions, unsigned int num_regions)
+{
+	RISCV013_INFO(info);
+	static int sbdata[4] = {DMI_SBDATA0, DMI_SBDATA1, DMI_SBDATA2, DMI_SBDATA3};
+	unsigned sbasize = get_field(info->sbcs, DMI_SBCS_SBASIZE);
+	bool use_sba = !(info->progbufsize >= 2 && !riscv_prefer_sba) &&
+		get_field(info->sbcs, DMI_SBCS_SBVERSION) == 1 && sbasize <= 64;
+	int retval = ERROR_OK;
+	unsigned int i = 0;
+
+	while (i < num_regions) {
+		uint32_t size = regions[i].size;
+		unsigned reads_per_word = (size + 3) / 4;
+		unsigned scans_per_word = (sbasize > 32 ? 2 : 1) + reads_per_word;
+		bool sba_size = (get_field(info->sbcs, DMI_SBCS_SBACCESS8) && size == 1) ||
+			(get_field(info->sbcs, DMI_SBCS_SBACCESS16) && size == 2) ||
+			(get_field(info->sbcs, DMI_SBCS_SBACCESS32) && size == 4) ||
+			(get_field(info->sbcs, DMI_SBCS_SBACCESS64) && size == 8);
+
+		if (!use_sba || !sba_size ||
+				1 + regions[i].count * scans_per_word > READ_MULTI_BATCH_SCANS) {
+			int result = read_memory(target, regions[i].address, size,
+					regions[i].count, regions[i].buffer);
+			if (result != ERROR_OK && retval == ERROR_OK)
+				retval = result;
+			i++;
+			continue;
+		}
+
+		/* consecutive ranges with the same access size */
+		struct riscv_batch *batch = riscv_batch_alloc(target, READ_MULTI_BATCH_SCANS,
+				info->dmi_busy_delay + info->bus_master_read_delay);
+		if (batch == NULL)
+			return ERROR_FAIL;
+
+		uint32_t sbcs_write = set_field(0, DMI_SBCS_SBREADONADDR, 1);
+		sbcs_write |= sb_sbaccess(size);
+		riscv_batch_add_dmi_write(batch, DMI_SBCS, sbcs_write);
+
+		unsigned int first = i;
+		while (i < num_regions && regions[i].size == size &&
+				riscv_batch_available_scans(batch) >= regions[i].count * scans_per_word) {
+			for (uint32_t k = 0; k < regions[i].count; k++) {
+				target_addr_t address = regions[i].address + k * size;
+				if (sbasize > 32)
+#if BUILD_TARGET64
+					riscv_batch_add_dmi_write(batch, DMI_SBADDRESS1, address >> 32);
+#else
+					riscv_batch_add_dmi_write(batch, DMI_SBADDRESS1, 0);
+#endif
+				/* starts the access */
+				riscv_batch_add_dmi_write(batch, DMI_SBADDRESS0, address);
+				for (int j = reads_per_word - 1; j >= 0; j--)
+					riscv_batch_add_dmi_read(batch, sbdata[j]);
+			}
+			i++;
+		}
+
+		bool failed = batch_run(target, batch) != ERROR_OK;
+
+		size_t key = 0;
+		for (unsigned int n = first; n < i && !failed; n++) {
+			for (uint32_t k = 0; k < regions[n].count && !failed; k++) {
+				for (int j = reads_per_word - 1; j >= 0; j--) {
+					uint64_t dmi_out = riscv_batch_get_dmi_read(batch, key++);
+					if (get_field(dmi_out, DTM_DMI_OP) != DMI_STATUS_SUCCESS) {
+						increase_dmi_busy_delay(target);
+						failed = true;
+						break;
+					}
+					uint32_t value = get_field(dmi_out, DTM_DMI_DATA);
+					target_addr_t address = regions[n].address + k * size + j * 4;
+					write_to_buf(regions[n].buffer + k * size + j * 4, value, MIN(size, 4));
+					log_memory_access(address, value, MIN(size, 4), true);
+				}
+			}
+		}
+		riscv_batch_free(batch);
+
+		uint32_t sbcs_read = 0;
+		if (!failed) {
+			if (read_sbcs_nonbusy(target, &sbcs_read) != ERROR_OK)
+				return ERROR_FAIL;
+			if (get_field(sbcs_read, DMI_SBCS_SBBUSYERROR)) {
+				/* some reads returned stale data */
+				dmi_write(target, DMI_SBCS, DMI_SBCS_SBBUSYERROR);
+				info->bus_master_read_delay += info->bus_master_read_delay / 10 + 1;
+				failed = true;
+			} else if (get_field(sbcs_read, DMI_SBCS_SBERROR)) {
+				dmi_write(target, DMI_SBCS, DMI_SBCS_SBERROR);
+				failed = true;
+			}
+		}
+
+		for (unsigned int n = first; n < i && failed; n++) {
+			int result = read_memory(target, regions[n].address, size,
+					regions[n].count, regions[n].buffer);
+			if (result != ERROR_OK && retval == ERROR_OK)
+				retval = result;
+		}
+	}
+
+	return retval;
+}
+
 static int write_memory_bus_v0(struct target *target, target_addr_t address,
 		uint32_t size, uint32_t count, const uint8_t *buffer)
 {
@@ -3651,6 +3795,7 @@ struct target_type riscv013_target = {
 	.deassert_reset = deassert_reset,
 
 	.read_memory = read_memory,
+	.read_memory_multi = read_memory_multi,
 	.write_memory = write_memory,
 
 	.arch_state = arch_state,
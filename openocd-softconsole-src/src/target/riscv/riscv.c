@@ -13,8 +13,10 @@
 #include "jtag/jtag.h"
 #include "target/register.h"
 #include "target/breakpoints.h"
+#include "target/semihosting_common.h"
 #include "helper/time_support.h"
 #include "riscv.h"
+#include "debug_defines.h"
 #include "gdb_regs.h"
 #include "rtos/rtos.h"
 
@@ -1567,6 +1569,40 @@ static int riscv_read_memory(struct target *target, target_addr_t address,
 	return tt->read_memory(target, address, size, count, buffer);
 }
 
+static int riscv_read_memory_multi(struct target *target,
+		struct target_memory_region *regions, unsigned int num_regions)
+{
+	if (riscv_select_current_hart(target) != ERROR_OK)
+		return ERROR_FAIL;
+
+	struct target_memory_region *physical = malloc(num_regions * sizeof(*physical));
+	if (physical == NULL && num_regions > 0)
+		return ERROR_FAIL;
+
+	for (unsigned int i = 0; i < num_regions; i++) {
+		physical[i] = regions[i];
+		target_addr_t physical_addr;
+		if (target->type->virt2phys(target, regions[i].address, &physical_addr) == ERROR_OK)
+			physical[i].address = physical_addr;
+	}
+
+	int retval = ERROR_OK;
+	struct target_type *tt = get_target_type(target);
+	if (tt->read_memory_multi) {
+		retval = tt->read_memory_multi(target, physical, num_regions);
+	} else {
+		for (unsigned int i = 0; i < num_regions; i++) {
+			int result = tt->read_memory(target, physical[i].address, physical[i].size,
+					physical[i].count, physical[i].buffer);
+			if (result != ERROR_OK && retval == ERROR_OK)
+				retval = result;
+		}
+	}
+
+	free(physical);
+	return retval;
+}
+
 static int riscv_write_phys_memory(struct target *target, target_addr_t phys_address,
 			uint32_t size, uint32_t count, const uint8_t *buffer)
 {
@@ -2015,6 +2051,7 @@ int riscv_openocd_poll(struct target *target)
 		unsigned halts_discovered = 0;
 		unsigned total_targets = 0;
 		bool newly_halted[128] = {0};
+		bool semihosting_handled[128] = {0};
 		unsigned should_remain_halted = 0;
 		unsigned should_resume = 0;
 		unsigned i = 0;
@@ -2055,6 +2092,7 @@ int riscv_openocd_poll(struct target *target)
 						/* This hart should be resumed, along with any other
 							 * harts that halted due to haltgroups. */
 						should_resume++;
+						semihosting_handled[i] = true;
 						break;
 					case SEMI_ERROR:
 						return retval;
@@ -2081,6 +2119,11 @@ int riscv_openocd_poll(struct target *target)
 		} else if (should_resume) {
 			LOG_DEBUG("resume all");
 			riscv_resume(target, true, 0, 0, 0, false);
+			i = 0;
+			for (struct target_list *list = target->head; list != NULL;
+					list = list->next, i++)
+				if (semihosting_handled[i])
+					semihosting_call_end(list->target);
 		}
 		return ERROR_OK;
 
@@ -2111,6 +2154,7 @@ int riscv_openocd_poll(struct target *target)
 			case SEMI_HANDLED:
 				if (riscv_resume(target, true, 0, 0, 0, false) != ERROR_OK)
 					return ERROR_FAIL;
+				semihosting_call_end(target);
 				break;
 			case SEMI_ERROR:
 				return retval;
@@ -2473,6 +2517,54 @@ COMMAND_HANDLER(riscv_reset_delays)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(riscv_dmi_probe)
+{
+	unsigned count = 256;
+
+	if (CMD_ARGC > 1) {
+		LOG_ERROR("Command takes at most one argument");
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	if (CMD_ARGC == 1)
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], count);
+	if (count == 0)
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+
+	struct target *target = get_current_target(CMD_CTX);
+	RISCV_INFO(r);
+	if (!r->dmi_read) {
+		LOG_ERROR("dmi_read is not implemented for this target.");
+		return ERROR_FAIL;
+	}
+
+	/* The busy delays were learned at another clock, relearn them. */
+	r->reset_delays_wait = 0;
+
+	/* datacount and progbufsize never change, so any difference between
+	 * reads is a corrupted scan that slipped past the DMI status. */
+	const uint32_t mask = DMI_ABSTRACTCS_DATACOUNT | DMI_ABSTRACTCS_PROGBUFSIZE;
+	uint32_t first = 0;
+	int64_t start = timeval_ms();
+	for (unsigned i = 0; i < count; i++) {
+		uint32_t value;
+		if (r->dmi_read(target, &value, DMI_ABSTRACTCS) != ERROR_OK)
+			return ERROR_FAIL;
+		if (i == 0) {
+			first = value & mask;
+		} else if ((value & mask) != first) {
+			LOG_DEBUG("abstractcs read 0x%" PRIx32 ", expected fields 0x%" PRIx32,
+					value, first);
+			return ERROR_FAIL;
+		}
+	}
+	int64_t elapsed = timeval_ms() - start;
+
+	command_print(CMD, "%u DMI reads in %" PRId64 " ms (%" PRId64 " reads/s)",
+			count, elapsed, count * 1000 / MAX(elapsed, 1));
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(riscv_set_ir)
 {
 	if (CMD_ARGC != 2) {
@@ -2688,6 +2780,15 @@ static const struct command_registration riscv_exec_command_handlers[] = {
 			"command resets those learned values after `wait` scans. It's only "
 			"useful for testing OpenOCD itself."
 	},
+	{
+		.name = "dmi_probe",
+		.handler = riscv_dmi_probe,
+		.mode = COMMAND_EXEC,
+		.usage = "dmi_probe [count]",
+		.help = "Read abstractcs count times, checking that its fixed fields "
+			"stay the same, and report the DMI read throughput. Meant as the "
+			"check of `adapter speed_autotune`."
+	},
 	{
 		.name = "resume_order",
 		.handler = riscv_resume_order,
@@ -2754,6 +2855,9 @@ extern __COMMAND_HANDLER(handle_common_semihosting_command);
 extern __COMMAND_HANDLER(handle_common_semihosting_fileio_command);
 extern __COMMAND_HANDLER(handle_common_semihosting_resumable_exit_command);
 extern __COMMAND_HANDLER(handle_common_semihosting_cmdline);
+extern __COMMAND_HANDLER(handle_common_semihosting_async_command);
+extern __COMMAND_HANDLER(handle_common_semihosting_port_command);
+extern __COMMAND_HANDLER(handle_common_semihosting_stats_command);
 
 /*
  * To be noted that RISC-V targets use the same semihosting commands as
@@ -2797,6 +2901,27 @@ static const struct command_registration arm_exec_command_handlers[] = {
 		.usage = "['enable'|'disable']",
 		.help = "activate support for semihosting resumable exit",
 	},
+	{
+		.name = "semihosting_async",
+		.handler = handle_common_semihosting_async_command,
+		.mode = COMMAND_EXEC,
+		.usage = "['enable'|'disable']",
+		.help = "buffer semihosting console output and resume at once",
+	},
+	{
+		.name = "semihosting_port",
+		.handler = handle_common_semihosting_port_command,
+		.mode = COMMAND_ANY,
+		.usage = "[port|'disabled']",
+		.help = "serve a copy of semihosting console output on a TCP port",
+	},
+	{
+		.name = "semihosting_stats",
+		.handler = handle_common_semihosting_stats_command,
+		.mode = COMMAND_EXEC,
+		.usage = "['reset']",
+		.help = "display semihosting call rate and time spent halted",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -2849,6 +2974,7 @@ struct target_type riscv_target = {
 	.deassert_reset = riscv_deassert_reset,
 
 	.read_memory = riscv_read_memory,
+	.read_memory_multi = riscv_read_memory_multi,
 	.write_memory = riscv_write_memory,
 	.read_phys_memory = riscv_read_phys_memory,
 	.write_phys_memory = riscv_write_phys_memory,
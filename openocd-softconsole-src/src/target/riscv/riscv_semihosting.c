@@ -109,6 +109,8 @@ semihosting_result_t riscv_semihosting(struct target *target, int *retval)
 		return SEMI_NONE;
 	}
 
+	semihosting_call_begin(target);
+
 	/*
 	 * Perform semihosting call if we are not waiting on a fileio
 	 * operation to complete.
@@ -0,0 +1,586 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/**
+ * @file
+ * Real time transfer (RTT) channels, compatible with the SEGGER RTT
+ * target library. The target keeps a control block in RAM, holding ring
+ * buffers for up (target to host) and down (host to target) channels.
+ * OpenOCD locates it and polls the up buffers while the target runs, so
+ * the memory accesses have to work without halting the core, e.g. through
+ * a MEM-AP or the RISC-V system bus.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/log.h>
+#include <helper/time_support.h>
+
+#include "target.h"
+#include "rtt.h"
+
+/* The control block starts with an ID string, followed by the number of up
+ * and down buffers and their descriptors, up buffers first. */
+#define RTT_CB_ID_LENGTH		16
+#define RTT_CB_HEADER_SIZE		(RTT_CB_ID_LENGTH + 8)
+
+/* buffer descriptor: name, buffer, size, write offset, read offset, flags */
+#define RTT_DESC_SIZE			24
+#define RTT_DESC_WRITE_OFFSET	12
+#define RTT_DESC_READ_OFFSET	16
+
+/* more buffers than this mean the control block isn't valid */
+#define RTT_MAX_BUFFERS			32
+
+#define RTT_MAX_NAME_LENGTH		32
+
+/* part of the search range read at once when looking for the control block */
+#define RTT_SEARCH_CHUNK		1024
+/* while the control block wasn't found, search again this often */
+#define RTT_SEARCH_INTERVAL		1000
+
+#define RTT_DEFAULT_POLLING_INTERVAL	10
+
+struct rtt_buffer {
+	uint32_t name;
+	uint32_t address;
+	uint32_t size;
+	uint32_t write;
+	uint32_t read;
+	uint32_t flags;
+};
+
+struct rtt_sink {
+	unsigned int channel;
+	rtt_sink_read read;
+	void *user_data;
+	struct rtt_sink *next;
+};
+
+static struct {
+	struct target *target;
+	/* where to look for the control block, set by "rtt setup" */
+	bool configured;
+	target_addr_t search_address;
+	uint32_t search_size;
+	char id[RTT_CB_ID_LENGTH];
+	size_t id_length;
+
+	bool started;
+	unsigned int polling_interval;
+	int64_t last_search;
+
+	/* the control block, once found */
+	bool found;
+	target_addr_t address;
+	uint32_t num_up;
+	uint32_t num_down;
+
+	/* receives up channel data, grows as needed */
+	uint8_t *data;
+	uint32_t data_size;
+
+	struct rtt_sink *sinks;
+} rtt = {
+	.polling_interval = RTT_DEFAULT_POLLING_INTERVAL,
+};
+
+static target_addr_t rtt_descriptor_address(unsigned int index)
+{
+	return rtt.address + RTT_CB_HEADER_SIZE + index * RTT_DESC_SIZE;
+}
+
+/* Read count consecutive descriptors with a single memory access. Index 0
+ * is the first up buffer, index num_up the first down buffer. At most
+ * 2 * RTT_MAX_BUFFERS descriptors, all up and down buffers, are read. */
+static int rtt_read_descriptors(unsigned int index, unsigned int count,
+	struct rtt_buffer *buffers)
+{
+	uint8_t data[2 * RTT_MAX_BUFFERS * RTT_DESC_SIZE];
+	struct target *target = rtt.target;
+
+	if (count == 0)
+		return ERROR_OK;
+	if (count > 2 * RTT_MAX_BUFFERS) {
+		LOG_ERROR("rtt: too many descriptors (%u) to read at once", count);
+		return ERROR_FAIL;
+	}
+
+	int retval = target_read_buffer(target, rtt_descriptor_address(index),
+			count * RTT_DESC_SIZE, data);
+	if (retval != ERROR_OK)
+		return retval;
+
+	for (unsigned int i = 0; i < count; i++) {
+		const uint8_t *desc = data + i * RTT_DESC_SIZE;
+		buffers[i].name = target_buffer_get_u32(target, desc);
+		buffers[i].address = target_buffer_get_u32(target, desc + 4);
+		buffers[i].size = target_buffer_get_u32(target, desc + 8);
+		buffers[i].write = target_buffer_get_u32(target, desc + RTT_DESC_WRITE_OFFSET);
+		buffers[i].read = target_buffer_get_u32(target, desc + RTT_DESC_READ_OFFSET);
+		buffers[i].flags = target_buffer_get_u32(target, desc + 20);
+	}
+
+	return ERROR_OK;
+}
+
+static bool rtt_buffer_valid(const struct rtt_buffer *buffer)
+{
+	return buffer->size && buffer->write < buffer->size && buffer->read < buffer->size;
+}
+
+static int rtt_write_offset(unsigned int index, unsigned int offset, uint32_t value)
+{
+	uint8_t data[4];
+
+	target_buffer_set_u32(rtt.target, data, value);
+	return target_write_buffer(rtt.target, rtt_descriptor_address(index) + offset,
+			sizeof(data), data);
+}
+
+static int rtt_find_control_block(void)
+{
+	struct target *target = rtt.target;
+	uint32_t offset = 0;
+	int retval = ERROR_OK;
+
+	rtt.last_search = timeval_ms();
+
+	uint8_t *chunk = malloc(RTT_SEARCH_CHUNK);
+	if (chunk == NULL)
+		return ERROR_FAIL;
+
+	rtt.found = false;
+	while (!rtt.found && offset < rtt.search_size) {
+		uint32_t count = MIN(RTT_SEARCH_CHUNK, rtt.search_size - offset);
+
+		retval = target_read_buffer(target, rtt.search_address + offset, count, chunk);
+		if (retval != ERROR_OK)
+			break;
+
+		for (uint32_t i = 0; i + rtt.id_length <= count; i++) {
+			if (memcmp(chunk + i, rtt.id, rtt.id_length) == 0) {
+				rtt.address = rtt.search_address + offset + i;
+				rtt.found = true;
+				break;
+			}
+		}
+
+		if (offset + count == rtt.search_size)
+			break;
+		/* overlap the chunks so an ID crossing their border is found */
+		offset += count - (rtt.id_length - 1);
+	}
+	free(chunk);
+
+	if (retval != ERROR_OK || !rtt.found)
+		return retval;
+
+	uint8_t header[8];
+	retval = target_read_buffer(target, rtt.address + RTT_CB_ID_LENGTH,
+			sizeof(header), header);
+	if (retval != ERROR_OK) {
+		rtt.found = false;
+		return retval;
+	}
+
+	rtt.num_up = target_buffer_get_u32(target, header);
+	rtt.num_down = target_buffer_get_u32(target, header + 4);
+	if (rtt.num_up > RTT_MAX_BUFFERS || rtt.num_down > RTT_MAX_BUFFERS) {
+		LOG_WARNING("RTT control block at " TARGET_ADDR_FMT " has %" PRIu32
+				" up and %" PRIu32 " down buffers, ignoring it",
+				rtt.address, rtt.num_up, rtt.num_down);
+		rtt.found = false;
+		return ERROR_OK;
+	}
+
+	LOG_INFO("RTT control block found at " TARGET_ADDR_FMT ", %" PRIu32
+			" up and %" PRIu32 " down channels",
+			rtt.address, rtt.num_up, rtt.num_down);
+
+	return ERROR_OK;
+}
+
+static bool rtt_channel_has_sink(unsigned int channel)
+{
+	for (struct rtt_sink *sink = rtt.sinks; sink; sink = sink->next)
+		if (sink->channel == channel)
+			return true;
+
+	return false;
+}
+
+/* Read what the target wrote to an up buffer and release it to the target */
+static int rtt_read_channel(unsigned int channel, struct rtt_buffer *buffer,
+	uint32_t *length)
+{
+	struct target *target = rtt.target;
+
+	*length = (buffer->write + buffer->size - buffer->read) % buffer->size;
+	if (*length > rtt.data_size) {
+		uint8_t *data = realloc(rtt.data, *length);
+		if (data == NULL)
+			return ERROR_FAIL;
+		rtt.data = data;
+		rtt.data_size = *length;
+	}
+
+	/* at most two reads, the second one if the data wraps around */
+	uint32_t first = MIN(*length, buffer->size - buffer->read);
+	int retval = target_read_buffer(target, buffer->address + buffer->read,
+			first, rtt.data);
+	if (retval == ERROR_OK && first < *length)
+		retval = target_read_buffer(target, buffer->address, *length - first,
+				rtt.data + first);
+	if (retval != ERROR_OK)
+		return retval;
+
+	return rtt_write_offset(channel, RTT_DESC_READ_OFFSET, buffer->write);
+}
+
+static int rtt_poll(void *priv)
+{
+	struct rtt_buffer up[RTT_MAX_BUFFERS];
+
+	if (!rtt.found) {
+		if (timeval_ms() - rtt.last_search < RTT_SEARCH_INTERVAL)
+			return ERROR_OK;
+		if (rtt_find_control_block() != ERROR_OK || !rtt.found)
+			return ERROR_OK;
+	}
+
+	if (rtt.sinks == NULL)
+		return ERROR_OK;
+
+	/* the offsets of all up buffers are fetched at once */
+	if (rtt_read_descriptors(0, rtt.num_up, up) != ERROR_OK)
+		return ERROR_OK;
+
+	for (unsigned int channel = 0; channel < rtt.num_up; channel++) {
+		struct rtt_buffer *buffer = &up[channel];
+		uint32_t length;
+
+		if (buffer->read == buffer->write || !rtt_channel_has_sink(channel))
+			continue;
+
+		if (!rtt_buffer_valid(buffer)) {
+			LOG_DEBUG("RTT up channel %u has invalid offsets", channel);
+			continue;
+		}
+
+		if (rtt_read_channel(channel, buffer, &length) != ERROR_OK)
+			continue;
+
+		struct rtt_sink *sink = rtt.sinks;
+		while (sink) {
+			/* the sink may unregister itself */
+			struct rtt_sink *next = sink->next;
+			if (sink->channel == channel)
+				sink->read(channel, rtt.data, length, sink->user_data);
+			sink = next;
+		}
+	}
+
+	return ERROR_OK;
+}
+
+int rtt_register_sink(unsigned int channel, rtt_sink_read read, void *user_data)
+{
+	struct rtt_sink *sink = malloc(sizeof(*sink));
+	if (sink == NULL)
+		return ERROR_FAIL;
+
+	sink->channel = channel;
+	sink->read = read;
+	sink->user_data = user_data;
+	sink->next = rtt.sinks;
+	rtt.sinks = sink;
+
+	return ERROR_OK;
+}
+
+int rtt_unregister_sink(unsigned int channel, rtt_sink_read read, void *user_data)
+{
+	for (struct rtt_sink **p = &rtt.sinks; *p; p = &(*p)->next) {
+		struct rtt_sink *sink = *p;
+		if (sink->channel == channel && sink->read == read
+				&& sink->user_data == user_data) {
+			*p = sink->next;
+			free(sink);
+			return ERROR_OK;
+		}
+	}
+
+	return ERROR_OK;
+}
+
+int rtt_write_channel(unsigned int channel, const uint8_t *data, size_t *length)
+{
+	struct target *target = rtt.target;
+	struct rtt_buffer buffer;
+
+	size_t count = *length;
+	*length = 0;
+
+	if (!rtt.found) {
+		LOG_DEBUG("RTT control block not found, dropping %zu bytes", count);
+		return ERROR_FAIL;
+	}
+
+	if (channel >= rtt.num_down) {
+		LOG_ERROR("RTT down channel %u doesn't exist", channel);
+		return ERROR_FAIL;
+	}
+
+	int retval = rtt_read_descriptors(rtt.num_up + channel, 1, &buffer);
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (!rtt_buffer_valid(&buffer)) {
+		LOG_ERROR("RTT down channel %u has invalid offsets", channel);
+		return ERROR_FAIL;
+	}
+
+	/* one byte stays free to tell a full buffer from an empty one */
+	uint32_t space = (buffer.read + buffer.size - buffer.write - 1) % buffer.size;
+	count = MIN(count, space);
+	if (count == 0)
+		return ERROR_OK;
+
+	uint32_t first = MIN(count, buffer.size - buffer.write);
+	retval = target_write_buffer(target, buffer.address + buffer.write, first, data);
+	if (retval == ERROR_OK && first < count)
+		retval = target_write_buffer(target, buffer.address, count - first, data + first);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = rtt_write_offset(rtt.num_up + channel, RTT_DESC_WRITE_OFFSET,
+			(buffer.write + count) % buffer.size);
+	if (retval != ERROR_OK)
+		return retval;
+
+	*length = count;
+
+	return ERROR_OK;
+}
+
+static int rtt_read_name(uint32_t address, char *name)
+{
+	name[0] = '\0';
+	if (address == 0)
+		return ERROR_OK;
+
+	int retval = target_read_buffer(rtt.target, address, RTT_MAX_NAME_LENGTH,
+			(uint8_t *)name);
+	name[RTT_MAX_NAME_LENGTH] = '\0';
+
+	return retval;
+}
+
+static int rtt_start(void)
+{
+	int retval = rtt_find_control_block();
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (!rtt.found)
+		LOG_INFO("RTT control block not found, searching every %d ms",
+				RTT_SEARCH_INTERVAL);
+
+	return target_register_timer_callback(rtt_poll, rtt.polling_interval,
+			TARGET_TIMER_TYPE_PERIODIC, NULL);
+}
+
+COMMAND_HANDLER(handle_rtt_setup_command)
+{
+	target_addr_t address;
+	uint32_t size;
+
+	if (CMD_ARGC != 3)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	COMMAND_PARSE_ADDRESS(CMD_ARGV[0], address);
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], size);
+
+	size_t id_length = strlen(CMD_ARGV[2]);
+	if (id_length == 0 || id_length >= RTT_CB_ID_LENGTH) {
+		command_print(CMD, "the control block ID must have 1 to %d characters",
+				RTT_CB_ID_LENGTH - 1);
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	if (rtt.started) {
+		command_print(CMD, "stop RTT before changing its setup");
+		return ERROR_FAIL;
+	}
+
+	rtt.target = get_current_target(CMD_CTX);
+	rtt.search_address = address;
+	rtt.search_size = size;
+	memset(rtt.id, 0, sizeof(rtt.id));
+	memcpy(rtt.id, CMD_ARGV[2], id_length);
+	rtt.id_length = id_length;
+	rtt.configured = true;
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_rtt_start_command)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (!rtt.configured) {
+		command_print(CMD, "RTT isn't set up, use \"rtt setup\" first");
+		return ERROR_FAIL;
+	}
+
+	if (rtt.started)
+		return ERROR_OK;
+
+	int retval = rtt_start();
+	if (retval != ERROR_OK)
+		return retval;
+	rtt.started = true;
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_rtt_stop_command)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (!rtt.started)
+		return ERROR_OK;
+
+	target_unregister_timer_callback(rtt_poll, NULL);
+	rtt.started = false;
+	rtt.found = false;
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_rtt_polling_interval_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		unsigned int interval;
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], interval);
+		if (interval == 0)
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+
+		rtt.polling_interval = interval;
+		if (rtt.started) {
+			target_unregister_timer_callback(rtt_poll, NULL);
+			target_register_timer_callback(rtt_poll, rtt.polling_interval,
+					TARGET_TIMER_TYPE_PERIODIC, NULL);
+		}
+	}
+
+	command_print(CMD, "RTT polling interval: %u ms", rtt.polling_interval);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_rtt_channels_command)
+{
+	struct rtt_buffer buffers[2 * RTT_MAX_BUFFERS];
+	char name[RTT_MAX_NAME_LENGTH + 1];
+
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (!rtt.found) {
+		command_print(CMD, "RTT control block not found");
+		return ERROR_FAIL;
+	}
+
+	int retval = rtt_read_descriptors(0, rtt.num_up + rtt.num_down, buffers);
+	if (retval != ERROR_OK)
+		return retval;
+
+	for (unsigned int i = 0; i < rtt.num_up + rtt.num_down; i++) {
+		bool up = i < rtt.num_up;
+		if (i == 0 || i == rtt.num_up)
+			command_print(CMD, "%s channels:", up ? "up" : "down");
+
+		rtt_read_name(buffers[i].name, name);
+		command_print(CMD, "%u: %s size: %" PRIu32 " flags: 0x%" PRIx32,
+				up ? i : i - rtt.num_up, name, buffers[i].size, buffers[i].flags);
+	}
+
+	return ERROR_OK;
+}
+
+static const struct command_registration rtt_subcommand_handlers[] = {
+	{
+		.name = "setup",
+		.handler = handle_rtt_setup_command,
+		.mode = COMMAND_ANY,
+		.help = "Search the memory range for the RTT control block "
+			"starting with the given ID string.",
+		.usage = "address size ID",
+	},
+	{
+		.name = "start",
+		.handler = handle_rtt_start_command,
+		.mode = COMMAND_EXEC,
+		.help = "Locate the control block and start polling the channels.",
+		.usage = "",
+	},
+	{
+		.name = "stop",
+		.handler = handle_rtt_stop_command,
+		.mode = COMMAND_EXEC,
+		.help = "Stop polling the channels.",
+		.usage = "",
+	},
+	{
+		.name = "polling_interval",
+		.handler = handle_rtt_polling_interval_command,
+		.mode = COMMAND_ANY,
+		.help = "Display or set the polling interval in milliseconds.",
+		.usage = "[ms]",
+	},
+	{
+		.name = "channels",
+		.handler = handle_rtt_channels_command,
+		.mode = COMMAND_EXEC,
+		.help = "List the channels of the control block.",
+		.usage = "",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+static const struct command_registration rtt_command_handlers[] = {
+	{
+		.name = "rtt",
+		.mode = COMMAND_ANY,
+		.help = "Real time transfer channels",
+		.usage = "",
+		.chain = rtt_subcommand_handlers,
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+int rtt_register_commands(struct command_context *cmd_ctx)
+{
+	return register_commands(cmd_ctx, NULL, rtt_command_handlers);
+}
@@ -0,0 +1,41 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_TARGET_RTT_H
+#define OPENOCD_TARGET_RTT_H
+
+struct command_context;
+
+/**
+ * Receives the data the target wrote to an up channel (target to host).
+ * Called from the RTT polling timer.
+ */
+typedef int (*rtt_sink_read)(unsigned int channel, const uint8_t *buffer,
+		size_t length, void *user_data);
+
+/** Start delivering the data of up channel @a channel to @a read. */
+int rtt_register_sink(unsigned int channel, rtt_sink_read read, void *user_data);
+int rtt_unregister_sink(unsigned int channel, rtt_sink_read read, void *user_data);
+
+/**
+ * Write to down channel @a channel (host to target). @a length is the
+ * number of bytes to write on entry, the number written on return, which
+ * is less when the target buffer is full.
+ */
+int rtt_write_channel(unsigned int channel, const uint8_t *buffer, size_t *length);
+
+int rtt_register_commands(struct command_context *cmd_ctx);
+
+#endif /* OPENOCD_TARGET_RTT_H */
@@ -50,8 +50,43 @@
 
 #include <helper/binarybuffer.h>
 #include <helper/log.h>
+#include <server/server.h>
 #include <sys/stat.h>
 
+/* Interval at which buffered console output is written out */
+#define SEMIHOSTING_OUTPUT_INTERVAL 10
+/* Buffered console output above which a call waits for it to be written */
+#define SEMIHOSTING_OUTPUT_LIMIT (1024 * 1024)
+
+/*
+ * Console output of the targets in asynchronous mode, in the order it was
+ * written. Each chunk is a run of data for one host file descriptor.
+ */
+struct semihosting_output_chunk {
+	int fd;
+	size_t length;
+};
+
+static struct {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+	struct semihosting_output_chunk *chunks;
+	unsigned int num_chunks;
+	unsigned int max_chunks;
+	bool timer;
+} semihosting_output;
+
+/* Clients of the semihosting console service, which receive a copy of
+ * everything the targets write to stdout and stderr */
+struct semihosting_client {
+	struct connection *connection;
+	struct semihosting_client *next;
+};
+
+static struct semihosting_client *semihosting_clients;
+static char *semihosting_port;
+
 static const int open_modeflags[12] = {
 	O_RDONLY,
 	O_RDONLY | O_BINARY,
@@ -76,6 +111,10 @@ static int semihosting_read_fields(struct target *target, size_t number,
 	uint8_t *fields);
 static int semihosting_write_fields(struct target *target, size_t number,
 	uint8_t *fields);
+static int semihosting_read_buffer(struct target *target, uint64_t address,
+	size_t size, uint8_t *buffer);
+static int semihosting_read_string(struct target *target, uint64_t address,
+	char **string, size_t *length);
 static uint64_t semihosting_get_field(struct target *target, size_t index,
 	uint8_t *fields);
 static void semihosting_set_field(struct target *target, uint64_t value,
@@ -120,6 +159,13 @@ int semihosting_common_init(struct target *target, void *setup,
 	semihosting->param = 0;
 	semihosting->result = -1;
 	semihosting->sys_errno = -1;
+	semihosting->window_address = 0;
+	semihosting->window_size = 0;
+	semihosting->is_async = false;
+	semihosting->console_fds = 0;
+	semihosting->stats_calls = 0;
+	semihosting->stats_halted = 0;
+	semihosting->stats_start = 0;
 	semihosting->cmdline = NULL;
 
 	/* If possible, update it in setup(). */
@@ -136,6 +182,136 @@ int semihosting_common_init(struct target *target, void *setup,
 	return ERROR_OK;
 }
 
+static bool semihosting_is_console(struct semihosting *semihosting, int fd)
+{
+	if (fd == STDOUT_FILENO || fd == STDERR_FILENO)
+		return true;
+
+	return fd >= 0 && fd < 64 && (semihosting->console_fds & (1ull << fd));
+}
+
+static void semihosting_clients_write(const uint8_t *data, size_t size)
+{
+	for (struct semihosting_client *client = semihosting_clients; client;
+			client = client->next)
+		connection_write(client->connection, data, size);
+}
+
+/* Write out all buffered console output */
+static void semihosting_output_flush(void)
+{
+	const uint8_t *data = semihosting_output.data;
+
+	if (semihosting_output.num_chunks == 0)
+		return;
+
+	fflush(stdout);
+	for (unsigned int i = 0; i < semihosting_output.num_chunks; i++) {
+		struct semihosting_output_chunk *chunk = &semihosting_output.chunks[i];
+		size_t done = 0;
+
+		while (done < chunk->length) {
+			ssize_t written = write(chunk->fd, data + done, chunk->length - done);
+			if (written < 0) {
+				if (errno == EINTR)
+					continue;
+				LOG_WARNING("semihosting output to fd %d lost: %s",
+						chunk->fd, strerror(errno));
+				break;
+			}
+			done += written;
+		}
+		semihosting_clients_write(data, chunk->length);
+		data += chunk->length;
+	}
+
+	semihosting_output.size = 0;
+	semihosting_output.num_chunks = 0;
+}
+
+static int semihosting_output_timer(void *priv)
+{
+	semihosting_output_flush();
+	return ERROR_OK;
+}
+
+/*
+ * Write target output to a host file descriptor which is a console. In
+ * asynchronous mode the data is only buffered, the result is then the
+ * full size.
+ */
+static ssize_t semihosting_console_write(struct semihosting *semihosting, int fd,
+	const uint8_t *data, size_t size)
+{
+	if (!semihosting->is_async) {
+		semihosting_output_flush();
+		fflush(stdout);
+		ssize_t written = write(fd, data, size);
+		if (written > 0)
+			semihosting_clients_write(data, written);
+		return written;
+	}
+
+	if (semihosting_output.size + size > semihosting_output.capacity) {
+		size_t capacity = MAX(2 * semihosting_output.capacity,
+				semihosting_output.size + size);
+		uint8_t *buffer = realloc(semihosting_output.data, capacity);
+		if (buffer == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		semihosting_output.data = buffer;
+		semihosting_output.capacity = capacity;
+	}
+
+	struct semihosting_output_chunk *last = semihosting_output.num_chunks ?
+		&semihosting_output.chunks[semihosting_output.num_chunks - 1] : NULL;
+	if (last == NULL || last->fd != fd) {
+		if (semihosting_output.num_chunks == semihosting_output.max_chunks) {
+			unsigned int max_chunks = MAX(2 * semihosting_output.max_chunks, 16u);
+			struct semihosting_output_chunk *chunks = realloc(semihosting_output.chunks,
+					max_chunks * sizeof(*chunks));
+			if (chunks == NULL) {
+				errno = ENOMEM;
+				return -1;
+			}
+			semihosting_output.chunks = chunks;
+			semihosting_output.max_chunks = max_chunks;
+		}
+		last = &semihosting_output.chunks[semihosting_output.num_chunks++];
+		last->fd = fd;
+		last->length = 0;
+	}
+
+	memcpy(semihosting_output.data + semihosting_output.size, data, size);
+	semihosting_output.size += size;
+	last->length += size;
+
+	/* a target printing faster than the host can take it has to wait */
+	if (semihosting_output.size > SEMIHOSTING_OUTPUT_LIMIT)
+		semihosting_output_flush();
+
+	return size;
+}
+
+void semihosting_call_begin(struct target *target)
+{
+	struct semihosting *semihosting = target->semihosting;
+
+	if (semihosting->stats_calls == 0)
+		semihosting->stats_start = timeval_ms();
+	duration_start(&semihosting->stats_call);
+}
+
+void semihosting_call_end(struct target *target)
+{
+	struct semihosting *semihosting = target->semihosting;
+
+	if (duration_measure(&semihosting->stats_call) == ERROR_OK)
+		semihosting->stats_halted += duration_elapsed(&semihosting->stats_call);
+	semihosting->stats_calls++;
+}
+
 /**
  * Portable implementation of ARM semihosting calls.
  * Performs the currently pending semihosting operation
@@ -160,6 +336,9 @@ int semihosting_common(struct target *target)
 	/* Most operations are resumable, except the two exit calls. */
 	semihosting->is_resumable = true;
 
+	/* The target ran since the last call. */
+	semihosting->window_size = 0;
+
 	int retval;
 
 	/* Enough space to hold 4 long words. */
@@ -168,6 +347,13 @@ int semihosting_common(struct target *target)
 	LOG_DEBUG("op=0x%x, param=0x%" PRIx64, (int)semihosting->op,
 		semihosting->param);
 
+	/* Anything but console output may depend on what was printed before,
+	 * reading stdin after a prompt or exiting for example. */
+	if (semihosting->op != SEMIHOSTING_SYS_WRITEC
+			&& semihosting->op != SEMIHOSTING_SYS_WRITE0
+			&& semihosting->op != SEMIHOSTING_SYS_WRITE)
+		semihosting_output_flush();
+
 	switch (semihosting->op) {
 
 		case SEMIHOSTING_SYS_CLOCK:	/* 0x10 */
@@ -235,6 +421,8 @@ int semihosting_common(struct target *target)
 				} else {
 					semihosting->result = close(fd);
 					semihosting->sys_errno = errno;
+					if (semihosting->result == 0 && fd >= 0 && fd < 64)
+						semihosting->console_fds &= ~(1ull << fd);
 
 					LOG_DEBUG("close(%d)=%d", fd, (int)semihosting->result);
 				}
@@ -685,7 +873,7 @@ int semihosting_common(struct target *target)
 					semihosting->result = -1;
 					semihosting->sys_errno = ENOMEM;
 				} else {
-					retval = target_read_memory(target, addr, 1, len, fn);
+					retval = semihosting_read_buffer(target, addr, len, fn);
 					if (retval != ERROR_OK) {
 						free(fn);
 						return retval;
@@ -739,6 +927,10 @@ int semihosting_common(struct target *target)
 								LOG_DEBUG("dup(STDERR)=%d",
 									(int)semihosting->result);
 							}
+							if (mode >= 4 && semihosting->result >= 0
+									&& semihosting->result < 64)
+								semihosting->console_fds |=
+									1ull << semihosting->result;
 						} else {
 							/* cygwin requires the permission setting
 							 * otherwise it will fail to reopen a previously
@@ -888,9 +1080,7 @@ int semihosting_common(struct target *target)
 						semihosting->result = -1;
 						semihosting->sys_errno = ENOMEM;
 					} else {
-						retval =
-							target_read_memory(target, addr, 1, len,
-								fn);
+						retval = semihosting_read_buffer(target, addr, len, fn);
 						if (retval != ERROR_OK) {
 							free(fn);
 							return retval;
@@ -947,14 +1137,14 @@ int semihosting_common(struct target *target)
 						semihosting->result = -1;
 						semihosting->sys_errno = ENOMEM;
 					} else {
-						retval = target_read_memory(target, addr1, 1, len1,
+						retval = semihosting_read_buffer(target, addr1, len1,
 								fn1);
 						if (retval != ERROR_OK) {
 							free(fn1);
 							free(fn2);
 							return retval;
 						}
-						retval = target_read_memory(target, addr2, 1, len2,
+						retval = semihosting_read_buffer(target, addr2, len2,
 								fn2);
 						if (retval != ERROR_OK) {
 							free(fn1);
@@ -1061,9 +1251,8 @@ int semihosting_common(struct target *target)
 						semihosting->result = -1;
 						semihosting->sys_errno = ENOMEM;
 					} else {
-						retval = target_read_memory(target,
+						retval = semihosting_read_buffer(target,
 								addr,
-								1,
 								len,
 								cmd);
 						if (retval != ERROR_OK) {
@@ -1147,12 +1336,18 @@ int semihosting_common(struct target *target)
 						semihosting->result = -1;
 						semihosting->sys_errno = ENOMEM;
 					} else {
-						retval = target_read_buffer(target, addr, len, buf);
+						retval = semihosting_read_buffer(target, addr, len, buf);
 						if (retval != ERROR_OK) {
 							free(buf);
 							return retval;
 						}
-						semihosting->result = write(fd, buf, len);
+						if (semihosting_is_console(semihosting, fd)) {
+							semihosting->result = semihosting_console_write(
+									semihosting, fd, buf, len);
+						} else {
+							semihosting_output_flush();
+							semihosting->result = write(fd, buf, len);
+						}
 						semihosting->sys_errno = errno;
 						LOG_DEBUG("write(%d, 0x%" PRIx64 ", %zu)=%d",
 							fd,
@@ -1194,10 +1389,10 @@ int semihosting_common(struct target *target)
 			} else {
 				uint64_t addr = semihosting->param;
 				unsigned char c;
-				retval = target_read_memory(target, addr, 1, 1, &c);
+				retval = semihosting_read_buffer(target, addr, 1, &c);
 				if (retval != ERROR_OK)
 					return retval;
-				putchar(c);
+				semihosting_console_write(semihosting, STDOUT_FILENO, &c, 1);
 				semihosting->result = 0;
 			}
 			break;
@@ -1215,35 +1410,25 @@ int semihosting_common(struct target *target)
 			 * Return
 			 * None. The RETURN REGISTER is corrupted.
 			 */
-			if (semihosting->is_fileio) {
-				size_t count = 0;
-				uint64_t addr = semihosting->param;
-				for (;; addr++) {
-					unsigned char c;
-					retval = target_read_memory(target, addr, 1, 1, &c);
-					if (retval != ERROR_OK)
-						return retval;
-					if (c == '\0')
-						break;
-					count++;
+			{
+				char *str;
+				size_t count;
+				retval = semihosting_read_string(target, semihosting->param,
+						&str, &count);
+				if (retval != ERROR_OK)
+					return retval;
+				if (semihosting->is_fileio) {
+					semihosting->hit_fileio = true;
+					fileio_info->identifier = "write";
+					fileio_info->param_1 = 1;
+					fileio_info->param_2 = semihosting->param;
+					fileio_info->param_3 = count;
+				} else {
+					semihosting_console_write(semihosting, STDOUT_FILENO,
+							(uint8_t *)str, count);
+					semihosting->result = 0;
 				}
-				semihosting->hit_fileio = true;
-				fileio_info->identifier = "write";
-				fileio_info->param_1 = 1;
-				fileio_info->param_2 = semihosting->param;
-				fileio_info->param_3 = count;
-			} else {
-				uint64_t addr = semihosting->param;
-				do {
-					unsigned char c;
-					retval = target_read_memory(target, addr++, 1, 1, &c);
-					if (retval != ERROR_OK)
-						return retval;
-					if (!c)
-						break;
-					putchar(c);
-				} while (1);
-				semihosting->result = 0;
+				free(str);
 			}
 			break;
 
@@ -1406,16 +1591,107 @@ static int semihosting_common_fileio_end(struct target *target, int result,
 
 /**
  * Read all fields of a command from target to buffer.
+ *
+ * The rest of the aligned block holding the fields is read in the same
+ * access and kept in the window, for semihosting_read_buffer().
  */
 static int semihosting_read_fields(struct target *target, size_t number,
 	uint8_t *fields)
 {
 	struct semihosting *semihosting = target->semihosting;
+	uint64_t address = semihosting->param;
+	size_t size = number * semihosting->word_size_bytes;
+
+	semihosting->window_size = 0;
+	if (address % 4 == 0) {
+		uint64_t end = (address + size + SEMIHOSTING_WINDOW_ALIGN - 1)
+			& ~(uint64_t)(SEMIHOSTING_WINDOW_ALIGN - 1);
+		/* Use 4-byte multiples to trigger fast memory access. */
+		int retval = target_read_memory(target, address, 4,
+				(end - address) / 4, semihosting->window);
+		if (retval == ERROR_OK) {
+			semihosting->window_address = address;
+			semihosting->window_size = end - address;
+			memcpy(fields, semihosting->window, size);
+			return ERROR_OK;
+		}
+		/* The fields may end right before inaccessible memory, read
+		 * just them below. */
+		LOG_DEBUG("semihosting: reading past the fields at 0x%" PRIx64 " failed",
+				address);
+	}
+
 	/* Use 4-byte multiples to trigger fast memory access. */
-	return target_read_memory(target, semihosting->param, 4,
+	return target_read_memory(target, address, 4,
 			number * (semihosting->word_size_bytes / 4), fields);
 }
 
+/**
+ * Read the data a command points to, from the window read along with the
+ * fields when it is there, otherwise with as few target accesses as the
+ * alignment allows.
+ */
+static int semihosting_read_buffer(struct target *target, uint64_t address,
+	size_t size, uint8_t *buffer)
+{
+	struct semihosting *semihosting = target->semihosting;
+
+	if (address >= semihosting->window_address
+			&& address - semihosting->window_address <= semihosting->window_size
+			&& size <= semihosting->window_size - (address - semihosting->window_address)) {
+		memcpy(buffer, semihosting->window + (address - semihosting->window_address),
+				size);
+		return ERROR_OK;
+	}
+
+	return target_read_buffer(target, address, size, buffer);
+}
+
+/**
+ * Read a null-terminated string from the target, in chunks which never
+ * extend past the aligned block holding the next character, so no
+ * memory beyond the one the string occupies gets touched. Chunks grow
+ * from 64 to 256 bytes for long strings. The string returned must be
+ * freed by the caller.
+ */
+static int semihosting_read_string(struct target *target, uint64_t address,
+	char **string, size_t *length)
+{
+	char *buffer = NULL;
+	size_t size = 0;
+	uint64_t chunk = 64;
+
+	for (;;) {
+		uint64_t next = address + size;
+		size_t count = chunk - (next & (chunk - 1));
+
+		char *new_buffer = realloc(buffer, size + count + 1);
+		if (new_buffer == NULL) {
+			free(buffer);
+			LOG_ERROR("out of memory");
+			return ERROR_FAIL;
+		}
+		buffer = new_buffer;
+
+		int retval = semihosting_read_buffer(target, next, count,
+				(uint8_t *)buffer + size);
+		if (retval != ERROR_OK) {
+			free(buffer);
+			return retval;
+		}
+
+		char *end = memchr(buffer + size, '\0', count);
+		if (end) {
+			*string = buffer;
+			*length = end - buffer;
+			return ERROR_OK;
+		}
+
+		size += count;
+		chunk = 256;
+	}
+}
+
 /**
  * Write all fields of a command from buffer to target.
  */
@@ -1593,3 +1869,147 @@ __COMMAND_HANDLER(handle_common_semihosting_resumable_exit_command)
 
 	return ERROR_OK;
 }
+
+__COMMAND_HANDLER(handle_common_semihosting_async_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (target == NULL) {
+		LOG_ERROR("No target selected");
+		return ERROR_FAIL;
+	}
+
+	struct semihosting *semihosting = target->semihosting;
+	if (!semihosting) {
+		command_print(CMD, "semihosting not supported for current target");
+		return ERROR_FAIL;
+	}
+
+	if (CMD_ARGC > 0) {
+		COMMAND_PARSE_ENABLE(CMD_ARGV[0], semihosting->is_async);
+
+		if (semihosting->is_async && !semihosting_output.timer) {
+			int retval = target_register_timer_callback(semihosting_output_timer,
+					SEMIHOSTING_OUTPUT_INTERVAL, TARGET_TIMER_TYPE_PERIODIC, NULL);
+			if (retval != ERROR_OK)
+				return retval;
+			semihosting_output.timer = true;
+		}
+		if (!semihosting->is_async)
+			semihosting_output_flush();
+	}
+
+	command_print(CMD, "semihosting asynchronous console is %s",
+		semihosting->is_async
+		? "enabled" : "disabled");
+
+	return ERROR_OK;
+}
+
+static int semihosting_new_connection(struct connection *connection)
+{
+	struct semihosting_client *client = malloc(sizeof(*client));
+	if (client == NULL)
+		return ERROR_FAIL;
+
+	client->connection = connection;
+	client->next = semihosting_clients;
+	semihosting_clients = client;
+
+	return ERROR_OK;
+}
+
+static int semihosting_connection_closed(struct connection *connection)
+{
+	for (struct semihosting_client **p = &semihosting_clients; *p; p = &(*p)->next) {
+		struct semihosting_client *client = *p;
+		if (client->connection == connection) {
+			*p = client->next;
+			free(client);
+			break;
+		}
+	}
+
+	return ERROR_OK;
+}
+
+static int semihosting_input(struct connection *connection)
+{
+	uint8_t buffer[256];
+
+	/* the service is output only, input is discarded */
+	int bytes_read = connection_read(connection, buffer, sizeof(buffer));
+	if (bytes_read <= 0)
+		return ERROR_SERVER_REMOTE_CLOSED;
+
+	return ERROR_OK;
+}
+
+__COMMAND_HANDLER(handle_common_semihosting_port_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		if (semihosting_port) {
+			remove_service("semihosting", semihosting_port);
+			free(semihosting_port);
+			semihosting_port = NULL;
+		}
+
+		if (strcmp(CMD_ARGV[0], "disabled") != 0) {
+			int retval = add_service("semihosting", CMD_ARGV[0],
+					CONNECTION_LIMIT_UNLIMITED, semihosting_new_connection,
+					semihosting_input, semihosting_connection_closed, NULL);
+			if (retval != ERROR_OK)
+				return retval;
+			semihosting_port = strdup(CMD_ARGV[0]);
+		}
+	}
+
+	command_print(CMD, "semihosting console port is %s",
+		semihosting_port ? semihosting_port : "disabled");
+
+	return ERROR_OK;
+}
+
+__COMMAND_HANDLER(handle_common_semihosting_stats_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (target == NULL) {
+		LOG_ERROR("No target selected");
+		return ERROR_FAIL;
+	}
+
+	struct semihosting *semihosting = target->semihosting;
+	if (!semihosting) {
+		command_print(CMD, "semihosting not supported for current target");
+		return ERROR_FAIL;
+	}
+
+	if (CMD_ARGC > 1 || (CMD_ARGC == 1 && strcmp(CMD_ARGV[0], "reset") != 0))
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		semihosting->stats_calls = 0;
+		semihosting->stats_halted = 0;
+		return ERROR_OK;
+	}
+
+	if (semihosting->stats_calls == 0) {
+		command_print(CMD, "no semihosting calls");
+		return ERROR_OK;
+	}
+
+	float elapsed = (timeval_ms() - semihosting->stats_start) / 1000.0;
+	command_print(CMD, "%" PRIu64 " semihosting calls in %.3f s, %.1f calls/s",
+		semihosting->stats_calls, elapsed,
+		elapsed > 0 ? semihosting->stats_calls / elapsed : 0);
+	command_print(CMD, "halted %.3f s (%.1f%%), %.1f us per call",
+		semihosting->stats_halted,
+		elapsed > 0 ? 100 * semihosting->stats_halted / elapsed : 100,
+		1e6 * semihosting->stats_halted / semihosting->stats_calls);
+
+	return ERROR_OK;
+}
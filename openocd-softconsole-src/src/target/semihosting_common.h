@@ -25,6 +25,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <time.h>
+#include <helper/time_support.h>
 
 /*
  * According to:
@@ -76,6 +77,14 @@ enum semihosting_operation_numbers {
 	SEMIHOSTING_SYS_WRITE0 = 0x04,
 };
 
+/*
+ * The parameter block of a call is read together with the rest of its
+ * aligned block of this many bytes, so that small payloads stored next
+ * to it (typically on the stack) need no second target access.
+ */
+#define SEMIHOSTING_WINDOW_ALIGN 32
+#define SEMIHOSTING_WINDOW_SIZE (4 * 8 + SEMIHOSTING_WINDOW_ALIGN)
+
 /*
  * Codes used by SEMIHOSTING_SYS_EXIT (formerly
  * SEMIHOSTING_REPORT_EXCEPTION).
@@ -146,6 +155,26 @@ struct semihosting {
 	/** The value to be returned by semihosting SYS_ERRNO request. */
 	int sys_errno;
 
+	/** Target memory read with the parameter block of the current call. */
+	uint8_t window[SEMIHOSTING_WINDOW_SIZE];
+	uint64_t window_address;
+	size_t window_size;
+
+	/**
+	 * Console output is appended to a host side buffer and the target
+	 * resumed at once; the buffer is written out from the main loop.
+	 */
+	bool is_async;
+
+	/** Host file descriptors opened from ":tt", one bit each. */
+	uint64_t console_fds;
+
+	/** Statistics, reported by the semihosting_stats command. */
+	uint64_t stats_calls;
+	float stats_halted;
+	int64_t stats_start;
+	struct duration stats_call;
+
 	/** The semihosting command line to be passed to the target. */
 	char *cmdline;
 
@@ -160,4 +189,8 @@ int semihosting_common_init(struct target *target, void *setup,
 	void *post_result);
 int semihosting_common(struct target *target);
 
+/* Bracket the handling of a call while the target is halted. */
+void semihosting_call_begin(struct target *target);
+void semihosting_call_end(struct target *target);
+
 #endif	/* OPENOCD_TARGET_SEMIHOSTING_COMMON_H */
@@ -45,6 +45,10 @@
 #include <jtag/jtag.h>
 #include <flash/nor/core.h>
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #include "target.h"
 #include "target_type.h"
 #include "target_request.h"
@@ -619,6 +623,7 @@ int target_resume(struct target *target, int current, target_addr_t address,
 		return ERROR_FAIL;
 	}
 
+	target_memcache_invalidate(target);
 	target_call_event_callbacks(target, TARGET_EVENT_RESUME_START);
 
 	/* note that resume *must* be asynchronous. The CPU can halt before
@@ -805,6 +810,7 @@ int target_run_algorithm(struct target *target,
 		goto done;
 	}
 
+	target_memcache_invalidate(target);
 	target->running_alg = true;
 	retval = target->type->run_algorithm(target,
 			num_mem_params, mem_params,
@@ -844,6 +850,7 @@ int target_start_algorithm(struct target *target,
 		goto done;
 	}
 
+	target_memcache_invalidate(target);
 	target->running_alg = true;
 	retval = target->type->start_algorithm(target,
 			num_mem_params, mem_params,
@@ -884,6 +891,7 @@ int target_wait_algorithm(struct target *target,
 			exit_point, timeout_ms, arch_info);
 	if (retval != ERROR_TARGET_TIMEOUT)
 		target->running_alg = false;
+	target_memcache_invalidate(target);
 
 done:
 	return retval;
@@ -1080,6 +1088,208 @@ int target_run_flash_async_algorithm(struct target *target,
 	return retval;
 }
 
+/* Host side cache of target memory, see target_memcache_read() */
+#define MEMCACHE_LINE_SIZE	64
+#define MEMCACHE_NUM_LINES	256
+
+struct target_memcache_line {
+	target_addr_t address;
+	/* the line is valid if this is the generation of the cache */
+	unsigned int generation;
+	uint8_t data[MEMCACHE_LINE_SIZE];
+};
+
+struct target_memcache_region {
+	target_addr_t address;
+	uint32_t size;
+};
+
+struct target_memcache {
+	bool enabled;
+	unsigned int generation;
+	struct target_memcache_region *regions;
+	unsigned int num_regions;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t bypassed;
+	uint64_t invalidations;
+	struct target_memcache_line lines[MEMCACHE_NUM_LINES];
+};
+
+static struct target_memcache *target_memcache_get(struct target *target)
+{
+	if (target->memcache == NULL) {
+		target->memcache = calloc(1, sizeof(*target->memcache));
+		if (target->memcache)
+			target->memcache->generation = 1;
+	}
+
+	return target->memcache;
+}
+
+void target_memcache_invalidate(struct target *target)
+{
+	struct target_memcache *cache = target->memcache;
+
+	if (cache == NULL || !cache->enabled)
+		return;
+
+	cache->invalidations++;
+	if (++cache->generation == 0) {
+		for (unsigned int i = 0; i < MEMCACHE_NUM_LINES; i++)
+			cache->lines[i].generation = 0;
+		cache->generation = 1;
+	}
+}
+
+/* Drop the lines holding a range that is being written, in the caches of all
+ * targets but @a except since they may share memory */
+static void target_memcache_forget(struct target *except,
+		target_addr_t address, uint32_t size)
+{
+	target_addr_t first = address & ~(target_addr_t)(MEMCACHE_LINE_SIZE - 1);
+	target_addr_t last = (address + size - 1) & ~(target_addr_t)(MEMCACHE_LINE_SIZE - 1);
+
+	for (struct target *target = all_targets; target; target = target->next) {
+		struct target_memcache *cache = target->memcache;
+		if (cache == NULL || !cache->enabled || target == except)
+			continue;
+
+		if (size == 0 || size > MEMCACHE_NUM_LINES * MEMCACHE_LINE_SIZE) {
+			target_memcache_invalidate(target);
+			continue;
+		}
+
+		for (target_addr_t line = first; ; line += MEMCACHE_LINE_SIZE) {
+			struct target_memcache_line *l =
+				&cache->lines[(line / MEMCACHE_LINE_SIZE) % MEMCACHE_NUM_LINES];
+			if (l->address == line)
+				l->generation = 0;
+			if (line == last)
+				break;
+		}
+	}
+}
+
+/* Write through: after a write by @a target, update the valid lines of its
+ * cache holding the range, or drop them if the write failed */
+static void target_memcache_written(struct target *target, target_addr_t address,
+		uint32_t size, const uint8_t *buffer, int retval)
+{
+	struct target_memcache *cache = target->memcache;
+	if (cache == NULL || !cache->enabled)
+		return;
+
+	if (retval != ERROR_OK) {
+		target_memcache_forget(NULL, address, size);
+		return;
+	}
+
+	while (size > 0) {
+		target_addr_t line = address & ~(target_addr_t)(MEMCACHE_LINE_SIZE - 1);
+		uint32_t offset = address - line;
+		uint32_t chunk = MIN(size, MEMCACHE_LINE_SIZE - offset);
+		struct target_memcache_line *l =
+			&cache->lines[(line / MEMCACHE_LINE_SIZE) % MEMCACHE_NUM_LINES];
+
+		if (l->generation == cache->generation && l->address == line)
+			memcpy(l->data + offset, buffer, chunk);
+		buffer += chunk;
+		address += chunk;
+		size -= chunk;
+	}
+}
+
+/* Whether the whole lines around a range lie in a cacheable region */
+static bool target_memcache_cacheable(struct target_memcache *cache,
+		target_addr_t address, uint32_t size)
+{
+	target_addr_t first = address & ~(target_addr_t)(MEMCACHE_LINE_SIZE - 1);
+	target_addr_t end = (address + size + MEMCACHE_LINE_SIZE - 1)
+		& ~(target_addr_t)(MEMCACHE_LINE_SIZE - 1);
+
+	if (end <= first)
+		return false;
+
+	for (unsigned int i = 0; i < cache->num_regions; i++) {
+		struct target_memcache_region *region = &cache->regions[i];
+		if (first >= region->address && end - region->address <= region->size)
+			return true;
+	}
+
+	return false;
+}
+
+/* Whether a read goes through the cache, counting it as bypassed if not */
+static bool target_memcache_serves(struct target *target,
+		target_addr_t address, uint32_t length)
+{
+	struct target_memcache *cache = target->memcache;
+
+	if (target->state != TARGET_HALTED) {
+		target_memcache_invalidate(target);
+		cache->bypassed++;
+		return false;
+	}
+
+	if (length > MEMCACHE_NUM_LINES * MEMCACHE_LINE_SIZE / 2
+			|| !target_memcache_cacheable(cache, address, length)) {
+		cache->bypassed++;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Read memory through the cache. Lines are filled with word reads, so only
+ * memory in the configured regions is cached, never MMIO. The cache is used
+ * only while the target is halted, and dropped whenever it runs, is reset,
+ * runs an algorithm or flash is written. Memory writes update the lines
+ * of the writing target and drop those of the others.
+ */
+static int target_memcache_read(struct target *target,
+		target_addr_t address, uint32_t size, uint32_t count, uint8_t *buffer)
+{
+	struct target_memcache *cache = target->memcache;
+	uint32_t length = size * count;
+
+	if (!target_memcache_serves(target, address, length))
+		return target->type->read_memory(target, address, size, count, buffer);
+
+	bool hit = true;
+	while (length > 0) {
+		target_addr_t line = address & ~(target_addr_t)(MEMCACHE_LINE_SIZE - 1);
+		uint32_t offset = address - line;
+		uint32_t chunk = MIN(length, MEMCACHE_LINE_SIZE - offset);
+		struct target_memcache_line *l =
+			&cache->lines[(line / MEMCACHE_LINE_SIZE) % MEMCACHE_NUM_LINES];
+
+		if (l->generation != cache->generation || l->address != line) {
+			hit = false;
+			l->generation = 0;
+			int retval = target->type->read_memory(target, line, 4,
+					MEMCACHE_LINE_SIZE / 4, l->data);
+			if (retval != ERROR_OK)
+				return retval;
+			l->address = line;
+			l->generation = cache->generation;
+		}
+
+		memcpy(buffer, l->data + offset, chunk);
+		buffer += chunk;
+		address += chunk;
+		length -= chunk;
+	}
+
+	if (hit)
+		cache->hits++;
+	else
+		cache->misses++;
+
+	return ERROR_OK;
+}
+
 int target_read_memory(struct target *target,
 		target_addr_t address, uint32_t size, uint32_t count, uint8_t *buffer)
 {
@@ -1091,9 +1301,61 @@ int target_read_memory(struct target *target,
 		LOG_ERROR("Target %s doesn't support read_memory", target_name(target));
 		return ERROR_FAIL;
 	}
+	if (target->memcache && target->memcache->enabled)
+		return target_memcache_read(target, address, size, count, buffer);
 	return target->type->read_memory(target, address, size, count, buffer);
 }
 
+int target_read_memory_multi(struct target *target,
+		struct target_memory_region *regions, unsigned int num_regions)
+{
+	if (!target_was_examined(target)) {
+		LOG_ERROR("Target not examined yet");
+		return ERROR_FAIL;
+	}
+	if (!target->type->read_memory_multi) {
+		int retval = ERROR_OK;
+		for (unsigned int i = 0; i < num_regions; i++) {
+			int r = target_read_memory(target, regions[i].address, regions[i].size,
+					regions[i].count, regions[i].buffer);
+			if (r != ERROR_OK && retval == ERROR_OK)
+				retval = r;
+		}
+		return retval;
+	}
+	if (!(target->memcache && target->memcache->enabled))
+		return target->type->read_memory_multi(target, regions, num_regions);
+
+	/* the cache serves the regions it holds, the rest still go in one batch */
+	struct target_memory_region *uncached = malloc(num_regions * sizeof(*uncached));
+	unsigned int num_uncached = 0;
+	int retval = ERROR_OK;
+
+	if (uncached == NULL)
+		return ERROR_FAIL;
+
+	for (unsigned int i = 0; i < num_regions; i++) {
+		struct target_memory_region *region = &regions[i];
+		if (!target_memcache_serves(target, region->address, region->size * region->count)) {
+			uncached[num_uncached++] = *region;
+			continue;
+		}
+		int r = target_memcache_read(target, region->address, region->size,
+				region->count, region->buffer);
+		if (r != ERROR_OK && retval == ERROR_OK)
+			retval = r;
+	}
+
+	if (num_uncached > 0) {
+		int r = target->type->read_memory_multi(target, uncached, num_uncached);
+		if (r != ERROR_OK && retval == ERROR_OK)
+			retval = r;
+	}
+
+	free(uncached);
+	return retval;
+}
+
 int target_read_phys_memory(struct target *target,
 		target_addr_t address, uint32_t size, uint32_t count, uint8_t *buffer)
 {
@@ -1119,7 +1381,10 @@ int target_write_memory(struct target *target,
 		LOG_ERROR("Target %s doesn't support write_memory", target_name(target));
 		return ERROR_FAIL;
 	}
-	return target->type->write_memory(target, address, size, count, buffer);
+	target_memcache_forget(target, address, size * count);
+	int retval = target->type->write_memory(target, address, size, count, buffer);
+	target_memcache_written(target, address, size * count, buffer, retval);
+	return retval;
 }
 
 int target_write_phys_memory(struct target *target,
@@ -1133,6 +1398,9 @@ int target_write_phys_memory(struct target *target,
 		LOG_ERROR("Target %s doesn't support write_phys_memory", target_name(target));
 		return ERROR_FAIL;
 	}
+	/* the caches hold virtual addresses */
+	for (struct target *t = all_targets; t; t = t->next)
+		target_memcache_invalidate(t);
 	return target->type->write_phys_memory(target, address, size, count, buffer);
 }
 
@@ -1143,6 +1411,7 @@ int target_add_breakpoint(struct target *target,
 		LOG_WARNING("target %s is not halted (add breakpoint)", target_name(target));
 		return ERROR_TARGET_NOT_HALTED;
 	}
+	target_memcache_forget(NULL, breakpoint->address, breakpoint->length);
 	return target->type->add_breakpoint(target, breakpoint);
 }
 
@@ -1169,6 +1438,7 @@ int target_add_hybrid_breakpoint(struct target *target,
 int target_remove_breakpoint(struct target *target,
 		struct breakpoint *breakpoint)
 {
+	target_memcache_forget(NULL, breakpoint->address, breakpoint->length);
 	return target->type->remove_breakpoint(target, breakpoint);
 }
 
@@ -1247,6 +1517,7 @@ bool target_supports_gdb_connection(struct target *target)
 int target_step(struct target *target,
 		int current, target_addr_t address, int handle_breakpoints)
 {
+	target_memcache_invalidate(target);
 	return target->type->step(target, current, address, handle_breakpoints);
 }
 
@@ -1495,31 +1766,54 @@ int target_register_trace_callback(int (*callback)(struct target *target,
 	return ERROR_OK;
 }
 
+/* The timer callback list is kept sorted by expiry time, so dispatching
+ * only has to look at its head and the server loop can sleep exactly
+ * until the next callback is due. Callbacks with the same expiry time
+ * keep their registration order. */
+static void target_timer_callback_insert(struct target_timer_callback *cb)
+{
+	struct target_timer_callback **p = &target_timer_callbacks;
+
+	while (*p && timeval_compare(&(*p)->when, &cb->when) <= 0)
+		p = &(*p)->next;
+
+	cb->next = *p;
+	*p = cb;
+}
+
+static void target_timer_callback_unlink(struct target_timer_callback *cb)
+{
+	for (struct target_timer_callback **p = &target_timer_callbacks; *p; p = &(*p)->next) {
+		if (*p == cb) {
+			*p = cb->next;
+			cb->next = NULL;
+			return;
+		}
+	}
+}
+
 int target_register_timer_callback(int (*callback)(void *priv),
 		unsigned int time_ms, enum target_timer_type type, void *priv)
 {
-	struct target_timer_callback **callbacks_p = &target_timer_callbacks;
+	struct target_timer_callback *cb;
 
 	if (callback == NULL)
 		return ERROR_COMMAND_SYNTAX_ERROR;
 
-	if (*callbacks_p) {
-		while ((*callbacks_p)->next)
-			callbacks_p = &((*callbacks_p)->next);
-		callbacks_p = &((*callbacks_p)->next);
-	}
-
-	(*callbacks_p) = malloc(sizeof(struct target_timer_callback));
-	(*callbacks_p)->callback = callback;
-	(*callbacks_p)->type = type;
-	(*callbacks_p)->time_ms = time_ms;
-	(*callbacks_p)->removed = false;
+	cb = malloc(sizeof(struct target_timer_callback));
+	if (cb == NULL)
+		return ERROR_FAIL;
+	cb->callback = callback;
+	cb->type = type;
+	cb->time_ms = time_ms;
+	cb->removed = false;
+	cb->due = false;
 
-	gettimeofday(&(*callbacks_p)->when, NULL);
-	timeval_add_time(&(*callbacks_p)->when, 0, time_ms * 1000);
+	gettimeofday(&cb->when, NULL);
+	timeval_add_time(&cb->when, 0, time_ms * 1000);
 
-	(*callbacks_p)->priv = priv;
-	(*callbacks_p)->next = NULL;
+	cb->priv = priv;
+	target_timer_callback_insert(cb);
 
 	return ERROR_OK;
 }
@@ -1592,7 +1886,7 @@ int target_unregister_timer_callback(int (*callback)(void *priv), void *priv)
 
 	for (struct target_timer_callback *c = target_timer_callbacks;
 	     c; c = c->next) {
-		if ((c->callback == callback) && (c->priv == priv)) {
+		if ((c->callback == callback) && (c->priv == priv) && !c->removed) {
 			c->removed = true;
 			return ERROR_OK;
 		}
@@ -1615,6 +1909,9 @@ int target_call_event_callbacks(struct target *target, enum target_event event)
 			Jim_Nvp_value2name_simple(nvp_target_event, event)->name,
 			target_name(target));
 
+	/* resumed, halted, reset or flashed: memory may have changed */
+	target_memcache_invalidate(target);
+
 	target_handle_event(target, event);
 
 	while (callback) {
@@ -1654,6 +1951,10 @@ static int target_timer_callback_periodic_restart(
 {
 	cb->when = *now;
 	timeval_add_time(&cb->when, 0, cb->time_ms * 1000L);
+
+	/* move it to its new place in the expiry order */
+	target_timer_callback_unlink(cb);
+	target_timer_callback_insert(cb);
 	return ERROR_OK;
 }
 
@@ -1662,10 +1963,14 @@ static int target_call_timer_callback(struct target_timer_callback *cb,
 {
 	cb->callback(cb->priv);
 
+	if (cb->removed)
+		return ERROR_OK;
+
 	if (cb->type == TARGET_TIMER_TYPE_PERIODIC)
 		return target_timer_callback_periodic_restart(cb, now);
 
-	return target_unregister_timer_callback(cb->callback, cb->priv);
+	cb->removed = true;
+	return ERROR_OK;
 }
 
 static int target_call_timer_callbacks_check_time(int checktime)
@@ -1685,7 +1990,9 @@ static int target_call_timer_callbacks_check_time(int checktime)
 
 	/* Store an address of the place containing a pointer to the
 	 * next item; initially, that's a standalone "root of the
-	 * list" variable. */
+	 * list" variable. Removed callbacks are freed and the ones to call
+	 * are marked; the list is sorted, so with checktime the walk ends at
+	 * the first callback that is not due yet. */
 	struct target_timer_callback **callback = &target_timer_callbacks;
 	while (*callback) {
 		if ((*callback)->removed) {
@@ -1695,16 +2002,29 @@ static int target_call_timer_callbacks_check_time(int checktime)
 			continue;
 		}
 
-		bool call_it = (*callback)->callback &&
-			((!checktime && (*callback)->type == TARGET_TIMER_TYPE_PERIODIC) ||
-			 timeval_compare(&now, &(*callback)->when) >= 0);
+		bool due = timeval_compare(&now, &(*callback)->when) >= 0;
+		if (checktime && !due)
+			break;
 
-		if (call_it)
-			target_call_timer_callback(*callback, &now);
+		(*callback)->due = (*callback)->callback &&
+			(due || (*callback)->type == TARGET_TIMER_TYPE_PERIODIC);
 
 		callback = &(*callback)->next;
 	}
 
+	/* Calling a callback may re-queue it or register and remove others,
+	 * so look for the next marked one from the head every time. */
+	for (;;) {
+		struct target_timer_callback *cb = target_timer_callbacks;
+		while (cb && !(cb->due && !cb->removed))
+			cb = cb->next;
+		if (cb == NULL)
+			break;
+
+		cb->due = false;
+		target_call_timer_callback(cb, &now);
+	}
+
 	callback_processing = false;
 	return ERROR_OK;
 }
@@ -1714,6 +2034,25 @@ int target_call_timer_callbacks(void)
 	return target_call_timer_callbacks_check_time(1);
 }
 
+int target_timer_next_due_ms(void)
+{
+	struct target_timer_callback *cb = target_timer_callbacks;
+
+	while (cb && cb->removed)
+		cb = cb->next;
+	if (cb == NULL)
+		return -1;
+
+	struct timeval now, left;
+	gettimeofday(&now, NULL);
+	if (timeval_compare(&now, &cb->when) >= 0)
+		return 0;
+
+	timeval_subtract(&left, &cb->when, &now);
+	int64_t ms = (int64_t)left.tv_sec * 1000 + (left.tv_usec + 999) / 1000;
+	return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
 /* invoke periodic callbacks immediately */
 int target_call_timer_callbacks_now(void)
 {
@@ -2050,6 +2389,10 @@ static void target_destroy(struct target *target)
 	free(target->gdb_port_override);
 	free(target->type);
 	free(target->trace_info);
+	free(target->dbg_mailbox);
+	if (target->memcache)
+		free(target->memcache->regions);
+	free(target->memcache);
 	free(target->fileio_info);
 	free(target->cmd_name);
 	free(target);
@@ -2188,7 +2531,10 @@ int target_write_buffer(struct target *target, target_addr_t address, uint32_t s
 		return ERROR_FAIL;
 	}
 
-	return target->type->write_buffer(target, address, size, buffer);
+	target_memcache_forget(target, address, size);
+	int retval = target->type->write_buffer(target, address, size, buffer);
+	target_memcache_written(target, address, size, buffer, retval);
+	return retval;
 }
 
 static int target_write_buffer_default(struct target *target,
@@ -3442,14 +3788,227 @@ static COMMAND_HELPER(parse_load_image_command_CMD_ARGV, struct image *image,
 	return ERROR_OK;
 }
 
+/* load_image hands the image to the target in chunks of at most this size.
+ * Where threads are available, a worker decodes the image and may run this
+ * many chunks ahead of the target writes. */
+#define LOAD_IMAGE_CHUNK_SIZE (256 * 1024)
+#define LOAD_IMAGE_QUEUE_DEPTH 4
+
+struct load_image_chunk {
+	int section;
+	target_addr_t address;
+	/* zero marks the end of the image */
+	uint32_t length;
+	const uint8_t *data;
+	/* allocation holding data, NULL if it is used from the image directly */
+	uint8_t *buffer;
+};
+
+struct load_image_pipe {
+	struct image *image;
+	target_addr_t min_address;
+	target_addr_t max_address;
+	/* decoding position */
+	int section;
+	uint32_t offset;
+#ifdef HAVE_PTHREAD_H
+	bool threaded;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct load_image_chunk queue[LOAD_IMAGE_QUEUE_DEPTH];
+	unsigned head;
+	unsigned count;
+	/* the worker has queued its last chunk, or failed with retval */
+	bool done;
+	int retval;
+	/* the command gave up, the worker should stop */
+	bool cancel;
+#endif
+};
+
+/* Decode the next chunk of the image that falls within the address window. */
+static int load_image_read_chunk(struct load_image_pipe *pipe, struct load_image_chunk *chunk)
+{
+	struct image *image = pipe->image;
+
+	while (pipe->section < image->num_sections) {
+		struct imagesection *section = &image->sections[pipe->section];
+		uint32_t offset = pipe->offset;
+		if (offset >= section->size) {
+			pipe->section++;
+			pipe->offset = 0;
+			continue;
+		}
+
+		uint32_t size = MIN(section->size - offset, LOAD_IMAGE_CHUNK_SIZE);
+		pipe->offset += size;
+
+		/* DANGER!!! beware of unsigned comparision here!!! */
+		target_addr_t start = section->base_address + offset;
+		if (start + size <= pipe->min_address || start >= pipe->max_address)
+			continue;
+
+		/* mapped images need no copy */
+		const uint8_t *data = image_section_data(image, pipe->section);
+		uint8_t *buffer = NULL;
+		size_t buf_cnt = size;
+		if (data != NULL) {
+			data += offset;
+		} else {
+			buffer = malloc(size);
+			if (buffer == NULL) {
+				LOG_ERROR("error allocating buffer for section (%d bytes)", (int)size);
+				return ERROR_FAIL;
+			}
+
+			int retval = image_read_section(image, pipe->section, offset, size, buffer, &buf_cnt);
+			if (retval != ERROR_OK) {
+				free(buffer);
+				return retval;
+			}
+			data = buffer;
+		}
+
+		/* clip addresses below and above the window */
+		target_addr_t end = start + buf_cnt;
+		uint32_t skip = 0;
+		if (start < pipe->min_address)
+			skip = pipe->min_address - start;
+		if (end > pipe->max_address)
+			end = pipe->max_address;
+		if (end <= start + skip) {
+			free(buffer);
+			continue;
+		}
+
+		chunk->section = pipe->section;
+		chunk->address = start + skip;
+		chunk->length = end - start - skip;
+		chunk->data = data + skip;
+		chunk->buffer = buffer;
+		return ERROR_OK;
+	}
+
+	chunk->length = 0;
+	chunk->buffer = NULL;
+	return ERROR_OK;
+}
+
+#ifdef HAVE_PTHREAD_H
+static void *load_image_worker(void *arg)
+{
+	struct load_image_pipe *pipe = arg;
+
+	while (1) {
+		struct load_image_chunk chunk;
+		int retval = load_image_read_chunk(pipe, &chunk);
+
+		pthread_mutex_lock(&pipe->lock);
+		while (pipe->count == LOAD_IMAGE_QUEUE_DEPTH && !pipe->cancel)
+			pthread_cond_wait(&pipe->cond, &pipe->lock);
+
+		if (retval != ERROR_OK || chunk.length == 0 || pipe->cancel) {
+			if (retval == ERROR_OK)
+				free(chunk.buffer);
+			pipe->retval = retval;
+			pipe->done = true;
+			pthread_cond_broadcast(&pipe->cond);
+			pthread_mutex_unlock(&pipe->lock);
+			return NULL;
+		}
+
+		pipe->queue[(pipe->head + pipe->count) % LOAD_IMAGE_QUEUE_DEPTH] = chunk;
+		pipe->count++;
+		pthread_cond_broadcast(&pipe->cond);
+		pthread_mutex_unlock(&pipe->lock);
+	}
+}
+#endif
+
+static void load_image_pipe_open(struct load_image_pipe *pipe, struct image *image,
+		target_addr_t min_address, target_addr_t max_address)
+{
+	memset(pipe, 0, sizeof(*pipe));
+	pipe->image = image;
+	pipe->min_address = min_address;
+	pipe->max_address = max_address;
+
+#ifdef HAVE_PTHREAD_H
+	/* Memory images are read through the JTAG link themselves */
+	if (image->type == IMAGE_MEMORY)
+		return;
+
+	pthread_mutex_init(&pipe->lock, NULL);
+	pthread_cond_init(&pipe->cond, NULL);
+	if (pthread_create(&pipe->thread, NULL, load_image_worker, pipe) == 0) {
+		pipe->threaded = true;
+	} else {
+		LOG_DEBUG("no image decoding thread, loading sequentially");
+		pthread_cond_destroy(&pipe->cond);
+		pthread_mutex_destroy(&pipe->lock);
+	}
+#endif
+}
+
+/* Fetch the next chunk to write; chunk->length is zero at the end. */
+static int load_image_pipe_next(struct load_image_pipe *pipe, struct load_image_chunk *chunk)
+{
+#ifdef HAVE_PTHREAD_H
+	if (pipe->threaded) {
+		int retval = ERROR_OK;
+
+		pthread_mutex_lock(&pipe->lock);
+		while (pipe->count == 0 && !pipe->done)
+			pthread_cond_wait(&pipe->cond, &pipe->lock);
+
+		if (pipe->count > 0) {
+			*chunk = pipe->queue[pipe->head];
+			pipe->head = (pipe->head + 1) % LOAD_IMAGE_QUEUE_DEPTH;
+			pipe->count--;
+			pthread_cond_broadcast(&pipe->cond);
+		} else {
+			chunk->length = 0;
+			chunk->buffer = NULL;
+			retval = pipe->retval;
+		}
+		pthread_mutex_unlock(&pipe->lock);
+
+		return retval;
+	}
+#endif
+
+	return load_image_read_chunk(pipe, chunk);
+}
+
+static void load_image_pipe_close(struct load_image_pipe *pipe)
+{
+#ifdef HAVE_PTHREAD_H
+	if (!pipe->threaded)
+		return;
+
+	pthread_mutex_lock(&pipe->lock);
+	pipe->cancel = true;
+	pthread_cond_broadcast(&pipe->cond);
+	pthread_mutex_unlock(&pipe->lock);
+
+	pthread_join(pipe->thread, NULL);
+
+	for (; pipe->count > 0; pipe->count--) {
+		free(pipe->queue[pipe->head].buffer);
+		pipe->head = (pipe->head + 1) % LOAD_IMAGE_QUEUE_DEPTH;
+	}
+
+	pthread_cond_destroy(&pipe->cond);
+	pthread_mutex_destroy(&pipe->lock);
+#endif
+}
+
 COMMAND_HANDLER(handle_load_image_command)
 {
-	uint8_t *buffer;
-	size_t buf_cnt;
 	uint32_t image_size;
 	target_addr_t min_address = 0;
 	target_addr_t max_address = -1;
-	int i;
 	struct image image;
 
 	int retval = CALL_COMMAND_HANDLER(parse_load_image_command_CMD_ARGV,
@@ -3465,60 +4024,54 @@ COMMAND_HANDLER(handle_load_image_command)
 	if (image_open(&image, CMD_ARGV[0], (CMD_ARGC >= 3) ? CMD_ARGV[2] : NULL) != ERROR_OK)
 		return ERROR_FAIL;
 
+	struct load_image_pipe pipe;
+	load_image_pipe_open(&pipe, &image, min_address, max_address);
+
+	/* Decoding happens while the previous chunk is being written, so the
+	 * time spent waiting for image data is what the link sat idle. */
+	int64_t wait_ms = 0;
+	int section = -1;
+	target_addr_t section_address = 0;
+	uint32_t section_length = 0;
+
 	image_size = 0x0;
-	retval = ERROR_OK;
-	for (i = 0; i < image.num_sections; i++) {
-		buffer = malloc(image.sections[i].size);
-		if (buffer == NULL) {
-			command_print(CMD,
-						  "error allocating buffer for section (%d bytes)",
-						  (int)(image.sections[i].size));
-			retval = ERROR_FAIL;
+	while (1) {
+		struct load_image_chunk chunk;
+		int64_t then = timeval_ms();
+		retval = load_image_pipe_next(&pipe, &chunk);
+		wait_ms += timeval_ms() - then;
+		if (retval != ERROR_OK || chunk.length == 0)
 			break;
-		}
 
-		retval = image_read_section(&image, i, 0x0, image.sections[i].size, buffer, &buf_cnt);
-		if (retval != ERROR_OK) {
-			free(buffer);
-			break;
+		if (chunk.section != section) {
+			if (section_length)
+				command_print(CMD, "%u bytes written at address " TARGET_ADDR_FMT "",
+						(unsigned int)section_length, section_address);
+			section = chunk.section;
+			section_address = chunk.address;
+			section_length = 0;
 		}
 
-		uint32_t offset = 0;
-		uint32_t length = buf_cnt;
-
-		/* DANGER!!! beware of unsigned comparision here!!! */
+		retval = target_write_buffer(target, chunk.address, chunk.length, chunk.data);
+		free(chunk.buffer);
+		if (retval != ERROR_OK)
+			break;
 
-		if ((image.sections[i].base_address + buf_cnt >= min_address) &&
-				(image.sections[i].base_address < max_address)) {
+		section_length += chunk.length;
+		image_size += chunk.length;
+	}
 
-			if (image.sections[i].base_address < min_address) {
-				/* clip addresses below */
-				offset += min_address-image.sections[i].base_address;
-				length -= offset;
-			}
+	if (ERROR_OK == retval && section_length)
+		command_print(CMD, "%u bytes written at address " TARGET_ADDR_FMT "",
+				(unsigned int)section_length, section_address);
 
-			if (image.sections[i].base_address + buf_cnt > max_address)
-				length -= (image.sections[i].base_address + buf_cnt)-max_address;
-
-			retval = target_write_buffer(target,
-					image.sections[i].base_address + offset, length, buffer + offset);
-			if (retval != ERROR_OK) {
-				free(buffer);
-				break;
-			}
-			image_size += length;
-			command_print(CMD, "%u bytes written at address " TARGET_ADDR_FMT "",
-					(unsigned int)length,
-					image.sections[i].base_address + offset);
-		}
-
-		free(buffer);
-	}
+	load_image_pipe_close(&pipe);
 
 	if ((ERROR_OK == retval) && (duration_measure(&bench) == ERROR_OK)) {
 		command_print(CMD, "downloaded %" PRIu32 " bytes "
 				"in %fs (%0.3f KiB/s)", image_size,
 				duration_elapsed(&bench), duration_kbps(&bench, image_size));
+		command_print(CMD, "waited %0.3fs for image data", wait_ms / 1000.0);
 	}
 
 	image_close(&image);
@@ -4178,6 +4731,244 @@ COMMAND_HANDLER(handle_profile_command)
 	return retval;
 }
 
+/* Streamed profiling writes every sample to the output file as soon as it
+ * is taken, so the length of a session is no longer bounded by a sample
+ * buffer held in memory. */
+#define PROFILE_STREAM_CHUNK_SAMPLES	1000
+#define PROFILE_STREAM_MAX_DEPTH	64
+
+enum profile_stream_format {
+	PROFILE_STREAM_RAW,	/* one sample per line: pc [caller ...] */
+	PROFILE_STREAM_FOLDED,	/* collapsed stacks: "outermost;...;pc 1" */
+};
+
+static const Jim_Nvp nvp_profile_stream_format[] = {
+	{ .name = "raw",    .value = PROFILE_STREAM_RAW },
+	{ .name = "folded", .value = PROFILE_STREAM_FOLDED },
+	{ .name = NULL,     .value = -1 },
+};
+
+/* frames[0] is the sampled pc, frames[1..depth-1] the return addresses */
+static void profile_stream_write_sample(FILE *f, enum profile_stream_format format,
+		const target_addr_t *frames, unsigned int depth)
+{
+	if (format == PROFILE_STREAM_FOLDED) {
+		for (unsigned int i = depth; i > 0; i--)
+			fprintf(f, "0x%" PRIx64 "%s", (uint64_t)frames[i - 1], i > 1 ? ";" : " 1\n");
+	} else {
+		for (unsigned int i = 0; i < depth; i++)
+			fprintf(f, "0x%" PRIx64 "%s", (uint64_t)frames[i], i + 1 < depth ? " " : "\n");
+	}
+}
+
+static int profile_stream_reg_get(struct reg *reg, target_addr_t *value)
+{
+	if (!reg->valid) {
+		int retval = reg->type->get(reg);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+	*value = buf_get_u64(reg->value, 0, reg->size);
+	return ERROR_OK;
+}
+
+/* Walk the frame pointer chain of a halted target. The frame record layout
+ * is the one GCC emits for RISC-V with -fno-omit-frame-pointer: the return
+ * address is stored one word below the frame pointer and the caller's frame
+ * pointer two words below it. Both are fetched with a single memory read. */
+static unsigned int profile_stream_unwind(struct target *target, struct reg *fp_reg,
+		target_addr_t *frames, unsigned int max_depth)
+{
+	unsigned int word = fp_reg->size / 8;
+	unsigned int depth = 1;
+	uint8_t record[16];
+	target_addr_t fp;
+
+	if ((word != 4 && word != 8) || profile_stream_reg_get(fp_reg, &fp) != ERROR_OK)
+		return depth;
+
+	while (depth < max_depth && fp >= 2 * word && (fp % word) == 0) {
+		if (target_read_memory(target, fp - 2 * word, word, 2, record) != ERROR_OK)
+			break;
+
+		target_addr_t prev_fp, ra;
+		if (word == 8) {
+			prev_fp = target_buffer_get_u64(target, record);
+			ra = target_buffer_get_u64(target, record + 8);
+		} else {
+			prev_fp = target_buffer_get_u32(target, record);
+			ra = target_buffer_get_u32(target, record + 4);
+		}
+		if (ra == 0)
+			break;
+		frames[depth++] = ra;
+
+		/* the stack grows down, so each caller's frame must lie above */
+		if (prev_fp <= fp)
+			break;
+		fp = prev_fp;
+	}
+
+	return depth;
+}
+
+static int profile_stream_ensure_halted(struct target *target)
+{
+	int retval = target_poll(target);
+	if (retval != ERROR_OK)
+		return retval;
+	if (target->state == TARGET_RUNNING) {
+		retval = target_halt(target);
+		if (retval != ERROR_OK)
+			return retval;
+		retval = target_wait_state(target, TARGET_HALTED, 1000);
+	}
+	return retval;
+}
+
+/* Flat sampling reuses the target's own profiling method (e.g. DWT PCSR
+ * on Cortex-M) one second at a time and flushes every chunk to disk. */
+static int profile_stream_flat(struct target *target, FILE *f,
+		enum profile_stream_format format, uint32_t seconds, uint64_t *num_samples)
+{
+	uint32_t *samples = malloc(sizeof(uint32_t) * PROFILE_STREAM_CHUNK_SAMPLES);
+	if (samples == NULL) {
+		LOG_ERROR("No memory to store samples.");
+		return ERROR_FAIL;
+	}
+
+	/* target_profiling() returns once the chunk is full, which can be well
+	 * within its second, so stream until the deadline rather than for a
+	 * number of calls */
+	int64_t deadline = timeval_ms() + (int64_t)seconds * 1000;
+	int retval = ERROR_OK;
+	while (timeval_ms() < deadline) {
+		uint32_t count = 0;
+
+		retval = profile_stream_ensure_halted(target);
+		if (retval != ERROR_OK)
+			break;
+		retval = target_profiling(target, samples, PROFILE_STREAM_CHUNK_SAMPLES, &count, 1);
+		if (retval != ERROR_OK)
+			break;
+
+		for (uint32_t i = 0; i < count; i++) {
+			target_addr_t pc = samples[i];
+			profile_stream_write_sample(f, format, &pc, 1);
+		}
+		fflush(f);
+		*num_samples += count;
+	}
+
+	free(samples);
+	return retval;
+}
+
+/* Stack sampling needs the core halted to read fp and the frame records,
+ * so it always uses halt/resume sampling. */
+static int profile_stream_stacks(struct target *target, FILE *f,
+		enum profile_stream_format format, uint32_t seconds,
+		unsigned int max_depth, uint64_t *num_samples)
+{
+	struct reg *pc_reg = register_get_by_name(target->reg_cache, "pc", 1);
+	struct reg *fp_reg = register_get_by_name(target->reg_cache, "fp", 1);
+	if (pc_reg == NULL || fp_reg == NULL) {
+		LOG_ERROR("Stack sampling needs \"pc\" and \"fp\" registers");
+		return ERROR_FAIL;
+	}
+
+	target_addr_t frames[PROFILE_STREAM_MAX_DEPTH];
+	int64_t deadline = timeval_ms() + (int64_t)seconds * 1000;
+	int retval = ERROR_OK;
+
+	LOG_INFO("Starting stack profiling. Halting and resuming the"
+			" target as often as we can...");
+
+	while (timeval_ms() < deadline) {
+		retval = profile_stream_ensure_halted(target);
+		if (retval != ERROR_OK)
+			break;
+		if (target->state != TARGET_HALTED) {
+			LOG_INFO("Target not halted or running");
+			break;
+		}
+
+		retval = profile_stream_reg_get(pc_reg, &frames[0]);
+		if (retval != ERROR_OK)
+			break;
+		unsigned int depth = profile_stream_unwind(target, fp_reg, frames, max_depth);
+		profile_stream_write_sample(f, format, frames, depth);
+		(*num_samples)++;
+
+		/* current pc, addr = 0, do not handle breakpoints, not debugging */
+		retval = target_resume(target, 1, 0, 0, 0);
+		if (retval != ERROR_OK)
+			break;
+		keep_alive();
+	}
+
+	fflush(f);
+	return retval;
+}
+
+COMMAND_HANDLER(handle_profile_stream_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (CMD_ARGC < 2 || CMD_ARGC > 4)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	uint32_t seconds;
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[0], seconds);
+
+	enum profile_stream_format format = PROFILE_STREAM_FOLDED;
+	if (CMD_ARGC > 2) {
+		const Jim_Nvp *n = Jim_Nvp_name2value_simple(nvp_profile_stream_format, CMD_ARGV[2]);
+		if (n->name == NULL)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		format = n->value;
+	}
+
+	unsigned int depth = 1;
+	if (CMD_ARGC > 3) {
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[3], depth);
+		if (depth < 1 || depth > PROFILE_STREAM_MAX_DEPTH) {
+			command_print(CMD, "stack depth must be between 1 and %d",
+					PROFILE_STREAM_MAX_DEPTH);
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+	}
+
+	if (target->state != TARGET_HALTED) {
+		LOG_WARNING("target %s is not halted (profiling)", target_name(target));
+		return ERROR_TARGET_NOT_HALTED;
+	}
+
+	FILE *f = fopen(CMD_ARGV[1], "w");
+	if (f == NULL) {
+		LOG_ERROR("Cannot open %s: %s", CMD_ARGV[1], strerror(errno));
+		return ERROR_FAIL;
+	}
+
+	uint64_t num_samples = 0;
+	int64_t timestart_ms = timeval_ms();
+	int retval;
+	if (depth > 1)
+		retval = profile_stream_stacks(target, f, format, seconds, depth, &num_samples);
+	else
+		retval = profile_stream_flat(target, f, format, seconds, &num_samples);
+	int64_t duration_ms = timeval_ms() - timestart_ms;
+	fclose(f);
+
+	int retval2 = profile_stream_ensure_halted(target);
+	if (retval == ERROR_OK)
+		retval = retval2;
+
+	command_print(CMD, "Wrote %" PRIu64 " samples to %s in %" PRId64 " ms",
+			num_samples, CMD_ARGV[1], duration_ms);
+	return retval;
+}
+
 static int new_int_array_element(Jim_Interp *interp, const char *varname, int idx, uint32_t val)
 {
 	char *namebuf;
@@ -6019,6 +6810,148 @@ static void binprint(struct command_invocation *cmd, const char *text, const uin
 	command_print(cmd, " ");
 }
 
+COMMAND_HANDLER(handle_memcache_state_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct target_memcache *cache = target_memcache_get(target);
+	if (cache == NULL)
+		return ERROR_FAIL;
+
+	if (CMD_ARGC == 1) {
+		bool enable;
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], enable);
+		cache->enabled = enable;
+		/* start empty, lines may be stale from an earlier use */
+		target_memcache_invalidate(target);
+	}
+
+	command_print(CMD, "memory cache of %s is %s", target_name(target),
+			cache->enabled ? "enabled" : "disabled");
+	if (cache->enabled && cache->num_regions == 0)
+		command_print(CMD, "no cacheable region configured, see 'memcache region'");
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_memcache_region_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (CMD_ARGC != 0 && CMD_ARGC != 1 && CMD_ARGC != 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct target_memcache *cache = target_memcache_get(target);
+	if (cache == NULL)
+		return ERROR_FAIL;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "clear") != 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		free(cache->regions);
+		cache->regions = NULL;
+		cache->num_regions = 0;
+		target_memcache_invalidate(target);
+	} else if (CMD_ARGC == 2) {
+		struct target_memcache_region region;
+		COMMAND_PARSE_ADDRESS(CMD_ARGV[0], region.address);
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], region.size);
+		if (region.size == 0 || region.address + region.size - 1 < region.address) {
+			command_print(CMD, "invalid region");
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+
+		struct target_memcache_region *regions = realloc(cache->regions,
+				(cache->num_regions + 1) * sizeof(*regions));
+		if (regions == NULL)
+			return ERROR_FAIL;
+		regions[cache->num_regions++] = region;
+		cache->regions = regions;
+	}
+
+	for (unsigned int i = 0; i < cache->num_regions; i++)
+		command_print(CMD, "cacheable: " TARGET_ADDR_FMT " size 0x%08" PRIx32,
+				cache->regions[i].address, cache->regions[i].size);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_memcache_stats_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct target_memcache *cache = target->memcache;
+
+	if (CMD_ARGC > 1 || (CMD_ARGC == 1 && strcmp(CMD_ARGV[0], "reset") != 0))
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (cache == NULL) {
+		command_print(CMD, "memory cache of %s is not in use", target_name(target));
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC == 1) {
+		cache->hits = 0;
+		cache->misses = 0;
+		cache->bypassed = 0;
+		cache->invalidations = 0;
+		return ERROR_OK;
+	}
+
+	uint64_t cached = cache->hits + cache->misses;
+	command_print(CMD, "%" PRIu64 " hits, %" PRIu64 " misses (%u%% hit rate), "
+			"%" PRIu64 " uncached reads, %" PRIu64 " invalidations",
+			cache->hits, cache->misses,
+			cached ? (unsigned int)(cache->hits * 100 / cached) : 0,
+			cache->bypassed, cache->invalidations);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_memcache_invalidate_command)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	target_memcache_invalidate(get_current_target(CMD_CTX));
+	return ERROR_OK;
+}
+
+static const struct command_registration memcache_command_handlers[] = {
+	{
+		.name = "state",
+		.handler = handle_memcache_state_command,
+		.mode = COMMAND_ANY,
+		.help = "display or set whether memory reads of the current target "
+			"are cached while it is halted",
+		.usage = "['on'|'off']",
+	},
+	{
+		.name = "region",
+		.handler = handle_memcache_region_command,
+		.mode = COMMAND_ANY,
+		.help = "list, add or clear the memory regions which may be cached",
+		.usage = "[address size | 'clear']",
+	},
+	{
+		.name = "stats",
+		.handler = handle_memcache_stats_command,
+		.mode = COMMAND_EXEC,
+		.help = "display or reset the statistics of the memory cache",
+		.usage = "['reset']",
+	},
+	{
+		.name = "invalidate",
+		.handler = handle_memcache_invalidate_command,
+		.mode = COMMAND_EXEC,
+		.help = "drop the content of the memory cache",
+		.usage = "",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
 COMMAND_HANDLER(handle_test_mem_access_command)
 {
 	struct target *target = get_current_target(CMD_CTX);
@@ -6227,6 +7160,14 @@ static const struct command_registration target_exec_command_handlers[] = {
 		.usage = "seconds filename [start end]",
 		.help = "profiling samples the CPU PC",
 	},
+	{
+		.name = "profile_stream",
+		.handler = handle_profile_stream_command,
+		.mode = COMMAND_EXEC,
+		.usage = "seconds filename ['raw'|'folded'] [stack_depth]",
+		.help = "profiling that streams PC or call-stack samples "
+			"to a file as they are taken",
+	},
 	/** @todo don't register virt2phys() unless target supports it */
 	{
 		.name = "virt2phys",
@@ -6448,6 +7389,13 @@ static const struct command_registration target_exec_command_handlers[] = {
 		.help = "Test the target's memory access functions",
 		.usage = "size",
 	},
+	{
+		.name = "memcache",
+		.mode = COMMAND_ANY,
+		.help = "host side cache of target memory",
+		.usage = "",
+		.chain = memcache_command_handlers,
+	},
 
 	COMMAND_REGISTRATION_DONE
 };
@@ -43,6 +43,8 @@ struct mem_param;
 struct reg_param;
 struct target_list;
 struct gdb_fileio_info;
+struct target_request_mailbox;
+struct target_memcache;
 
 /*
  * TARGET_UNKNOWN = 0: we don't know anything about the target yet
@@ -174,6 +176,8 @@ struct target {
 	struct trace *trace_info;			/* generic trace information */
 	struct debug_msg_receiver *dbgmsg;	/* list of debug message receivers */
 	uint32_t dbg_msg_enabled;			/* debug message status */
+	struct target_request_mailbox *dbg_mailbox;	/* RAM mailbox for debug messages */
+	struct target_memcache *memcache;	/* host side cache of target memory */
 	void *arch_info;					/* architecture specific information */
 	void *private_config;				/* pointer to target specific config data (for jim_configure hook) */
 	struct target *next;				/* next target in list */
@@ -325,6 +329,8 @@ struct target_timer_callback {
 	unsigned int time_ms;
 	enum target_timer_type type;
 	bool removed;
+	/* marked for the dispatch in progress */
+	bool due;
 	struct timeval when;
 	void *priv;
 	struct target_timer_callback *next;
@@ -394,6 +400,11 @@ int target_register_timer_callback(int (*callback)(void *priv),
 		unsigned int time_ms, enum target_timer_type type, void *priv);
 int target_unregister_timer_callback(int (*callback)(void *priv), void *priv);
 int target_call_timer_callbacks(void);
+/**
+ * @returns the number of milliseconds until the next timer callback is
+ * due, 0 if one is overdue, or -1 if no timer callback is registered.
+ */
+int target_timer_next_due_ms(void);
 /**
  * Invoke this to ensure that e.g. polling timer callbacks happen before
  * a synchronous command completes.
@@ -579,8 +590,36 @@ int target_run_flash_async_algorithm(struct target *target,
  */
 int target_read_memory(struct target *target,
 		target_addr_t address, uint32_t size, uint32_t count, uint8_t *buffer);
+
+/**
+ * A range read by target_read_memory_multi(), @a count items of @a size
+ * bytes at @a address, like the arguments of target_read_memory().
+ */
+struct target_memory_region {
+	target_addr_t address;
+	uint32_t size;
+	uint32_t count;
+	uint8_t *buffer;
+};
+
+/**
+ * Read several unrelated ranges of memory, in as few adapter round trips
+ * as the target allows. Targets without target->type->read_memory_multi
+ * read the ranges one by one.
+ *
+ * Returns the error of the first range that failed; the other ranges are
+ * still read.
+ */
+int target_read_memory_multi(struct target *target,
+		struct target_memory_region *regions, unsigned int num_regions);
 int target_read_phys_memory(struct target *target,
 		target_addr_t address, uint32_t size, uint32_t count, uint8_t *buffer);
+
+/**
+ * Drop what the host side memory cache of @a target holds, for changes
+ * to the memory the target layer can't see, e.g. by a flash driver.
+ */
+void target_memcache_invalidate(struct target *target);
 /**
  * Write @a count items of @a size bytes to the memory of @a target at
  * the @a address given. @a address must be aligned to @a size
@@ -34,8 +34,34 @@
 #include "target_type.h"
 #include "trace.h"
 
+/*
+ * RAM mailbox layout, all fields are words in target byte order:
+ *  0: MAILBOX_MAGIC
+ *  4: size of the ring in bytes, a multiple of 4
+ *  8: write offset into the ring, advanced by the target
+ * 12: read offset into the ring, advanced by OpenOCD
+ * 16: the ring
+ * The ring holds the same records as sent over DCC: a request word
+ * followed by its payload padded to words. The target only advances the
+ * write offset past complete records.
+ */
+#define MAILBOX_MAGIC		0x4d474244	/* "DBGM" */
+#define MAILBOX_HEADER_SIZE	16
+#define MAILBOX_MAX_SIZE	(1024 * 1024)
+
+struct target_request_mailbox {
+	target_addr_t address;
+	uint32_t read_offset;
+	/* the header was found at the last poll */
+	bool valid;
+};
+
 static bool got_message;
 
+/* payload of the mailbox record being handled, NULL when it comes from
+ * the side-band channel of the target */
+static const uint8_t *mailbox_payload;
+
 bool target_got_message(void)
 {
 	bool t = got_message;
@@ -45,12 +71,22 @@ bool target_got_message(void)
 
 static int charmsg_mode;
 
+static int target_request_data(struct target *target, uint32_t size, uint8_t *buffer)
+{
+	if (mailbox_payload) {
+		memcpy(buffer, mailbox_payload, size * 4);
+		return ERROR_OK;
+	}
+
+	return target->type->target_request_data(target, size, buffer);
+}
+
 static int target_asciimsg(struct target *target, uint32_t length)
 {
 	char *msg = malloc(DIV_ROUND_UP(length + 1, 4) * 4);
 	struct debug_msg_receiver *c = target->dbgmsg;
 
-	target->type->target_request_data(target, DIV_ROUND_UP(length, 4), (uint8_t *)msg);
+	target_request_data(target, DIV_ROUND_UP(length, 4), (uint8_t *)msg);
 	msg[length] = 0;
 
 	LOG_DEBUG("%s", msg);
@@ -80,7 +116,7 @@ static int target_hexmsg(struct target *target, int size, uint32_t length)
 
 	LOG_DEBUG("size: %i, length: %i", (int)size, (int)length);
 
-	target->type->target_request_data(target, DIV_ROUND_UP(length * size, 4), (uint8_t *)data);
+	target_request_data(target, DIV_ROUND_UP(length * size, 4), (uint8_t *)data);
 
 	line_len = 0;
 	for (i = 0; i < length; i++) {
@@ -120,7 +156,7 @@ int target_request(struct target *target, uint32_t request)
 {
 	target_req_cmd_t target_req_cmd = request & 0xff;
 
-	assert(target->type->target_request_data);
+	assert(mailbox_payload || target->type->target_request_data);
 
 	/* Record that we got a target message for back-off algorithm */
 	got_message = true;
@@ -154,6 +190,108 @@ int target_request(struct target *target, uint32_t request)
 	return ERROR_OK;
 }
 
+/* Number of payload bytes following @a request */
+static uint32_t target_request_payload_size(uint32_t request)
+{
+	if (charmsg_mode || (request & 0xff) != TARGET_REQ_DEBUGMSG)
+		return 0;
+
+	uint32_t size = (request & 0xff00) >> 8;
+	uint32_t length = (request & 0xffff0000) >> 16;
+
+	return DIV_ROUND_UP(length * (size ? size : 1), 4) * 4;
+}
+
+/**
+ * Handle the records the target put in its RAM mailbox since the last
+ * poll, reading them in at most two block transfers. @a active is set
+ * when the target has a valid mailbox; otherwise the caller should poll
+ * the side-band channel instead.
+ */
+int target_request_mailbox_poll(struct target *target, bool *active)
+{
+	struct target_request_mailbox *mailbox = target->dbg_mailbox;
+	uint8_t header[12];
+	int retval;
+
+	*active = false;
+	if (mailbox == NULL)
+		return ERROR_OK;
+
+	retval = target_read_memory(target, mailbox->address, 4, 3, header);
+	if (retval != ERROR_OK)
+		return retval;
+
+	uint32_t magic = target_buffer_get_u32(target, header);
+	uint32_t size = target_buffer_get_u32(target, header + 4);
+	uint32_t write_offset = target_buffer_get_u32(target, header + 8);
+
+	if (magic != MAILBOX_MAGIC || size == 0 || size > MAILBOX_MAX_SIZE
+			|| size % 4 || write_offset >= size || write_offset % 4) {
+		if (mailbox->valid)
+			LOG_INFO("%s: debug message mailbox at " TARGET_ADDR_FMT
+					" is gone, using DCC", target_name(target), mailbox->address);
+		mailbox->valid = false;
+		return ERROR_OK;
+	}
+
+	if (!mailbox->valid) {
+		/* set up by the firmware since the last poll, continue from
+		 * where it expects us to be */
+		retval = target_read_u32(target, mailbox->address + 12, &mailbox->read_offset);
+		if (retval != ERROR_OK)
+			return retval;
+		if (mailbox->read_offset >= size || mailbox->read_offset % 4)
+			mailbox->read_offset = write_offset;
+		mailbox->valid = true;
+		LOG_INFO("%s: debug message mailbox found at " TARGET_ADDR_FMT
+				", %" PRIu32 " bytes", target_name(target), mailbox->address, size);
+	}
+
+	*active = true;
+
+	if (mailbox->read_offset >= size)
+		mailbox->read_offset = 0;
+	if (write_offset == mailbox->read_offset)
+		return ERROR_OK;
+
+	uint32_t count = (write_offset + size - mailbox->read_offset) % size;
+	uint8_t *buffer = malloc(count);
+	if (buffer == NULL)
+		return ERROR_FAIL;
+
+	target_addr_t ring = mailbox->address + MAILBOX_HEADER_SIZE;
+	uint32_t first = MIN(count, size - mailbox->read_offset);
+	retval = target_read_buffer(target, ring + mailbox->read_offset, first, buffer);
+	if (retval == ERROR_OK && first < count)
+		retval = target_read_buffer(target, ring, count - first, buffer + first);
+	if (retval != ERROR_OK) {
+		free(buffer);
+		return retval;
+	}
+
+	uint32_t done = 0;
+	while (count - done >= 4) {
+		uint32_t request = target_buffer_get_u32(target, buffer + done);
+		uint32_t payload = target_request_payload_size(request);
+		if (payload > count - done - 4) {
+			LOG_ERROR("%s: truncated debug message in mailbox, dropping %" PRIu32 " bytes",
+					target_name(target), count - done);
+			done = count;
+			break;
+		}
+
+		mailbox_payload = buffer + done + 4;
+		target_request(target, request);
+		mailbox_payload = NULL;
+		done += 4 + payload;
+	}
+	free(buffer);
+
+	mailbox->read_offset = (mailbox->read_offset + done) % size;
+	return target_write_u32(target, mailbox->address + 12, mailbox->read_offset);
+}
+
 static int add_debug_msg_receiver(struct command_context *cmd_ctx, struct target *target)
 {
 	struct debug_msg_receiver **p = &target->dbgmsg;
@@ -288,6 +426,42 @@ COMMAND_HANDLER(handle_target_request_debugmsgs_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_target_request_mailbox_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		free(target->dbg_mailbox);
+		target->dbg_mailbox = NULL;
+
+		if (strcmp(CMD_ARGV[0], "off") != 0) {
+			target_addr_t address;
+			COMMAND_PARSE_ADDRESS(CMD_ARGV[0], address);
+			if (address % 4) {
+				LOG_ERROR("mailbox address must be word aligned");
+				return ERROR_COMMAND_ARGUMENT_INVALID;
+			}
+
+			target->dbg_mailbox = calloc(1, sizeof(*target->dbg_mailbox));
+			if (target->dbg_mailbox == NULL)
+				return ERROR_FAIL;
+			target->dbg_mailbox->address = address;
+		}
+	}
+
+	if (target->dbg_mailbox == NULL)
+		command_print(CMD, "debug message mailbox disabled");
+	else
+		command_print(CMD, "debug message mailbox at " TARGET_ADDR_FMT "%s",
+				target->dbg_mailbox->address,
+				target->dbg_mailbox->valid ? "" : " (not found yet, using DCC)");
+
+	return ERROR_OK;
+}
+
 static const struct command_registration target_req_exec_command_handlers[] = {
 	{
 		.name = "debugmsgs",
@@ -296,6 +470,13 @@ static const struct command_registration target_req_exec_command_handlers[] = {
 		.help = "display and/or modify reception of debug messages from target",
 		.usage = "['enable'|'charmsg'|'disable']",
 	},
+	{
+		.name = "mailbox",
+		.handler = handle_target_request_mailbox_command,
+		.mode = COMMAND_ANY,
+		.help = "receive debug messages through a RAM mailbox at address",
+		.usage = "[address|'off']",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 static const struct command_registration target_req_command_handlers[] = {
@@ -41,6 +41,7 @@ struct debug_msg_receiver {
 };
 
 int target_request(struct target *target, uint32_t request);
+int target_request_mailbox_poll(struct target *target, bool *active);
 int delete_debug_msg_receiver(struct command_context *cmd_ctx,
 		struct target *target);
 int target_request_register_commands(struct command_context *cmd_ctx);
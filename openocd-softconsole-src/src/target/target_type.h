@@ -129,6 +129,12 @@ struct target_type {
 	 */
 	int (*read_memory)(struct target *target, target_addr_t address,
 			uint32_t size, uint32_t count, uint8_t *buffer);
+	/**
+	 * Read several ranges of memory at once, optional. Do @b not call
+	 * this function directly, use target_read_memory_multi() instead.
+	 */
+	int (*read_memory_multi)(struct target *target,
+			struct target_memory_region *regions, unsigned int num_regions);
 	/**
 	 * Target memory write callback.  Do @b not call this function
 	 * directly, use target_write_memory() instead.
@@ -0,0 +1,216 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/*
+ * Micro-benchmark of the binarybuffer kernels behind scan field assembly:
+ * unaligned bit copies, bit copy queues, buffer shifts, bit reversal, hex
+ * conversion and the gdb checksum. Each kernel is timed next to a bit or
+ * byte at a time reference, whose results it must match. Build and run
+ * from this directory, with BUILD the configured build directory holding
+ * config.h:
+ *
+ *   gcc -std=gnu99 -O2 -DHAVE_CONFIG_H -I$BUILD -I../../src -I../../src/helper \
+ *       -I../../jimtcl binarybuffer_bench.c ../../src/helper/binarybuffer.c \
+ *       -o binarybuffer_bench
+ *   ./binarybuffer_bench [bytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "binarybuffer.h"
+
+/* Time spent on each kernel, enough to smooth out the clock */
+#define BENCH_NS	200000000LL
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void ref_set_buf(const uint8_t *src, unsigned src_start,
+		uint8_t *dst, unsigned dst_start, unsigned len)
+{
+	for (unsigned i = 0; i < len; i++) {
+		unsigned s = src_start + i, d = dst_start + i;
+		if (src[s / 8] & (1 << (s % 8)))
+			dst[d / 8] |= 1 << (d % 8);
+		else
+			dst[d / 8] &= ~(1 << (d % 8));
+	}
+}
+
+/* buffer_shr() shifts a buffer of len bytes right by count bits */
+static void ref_shr(uint8_t *buf, unsigned len, unsigned count)
+{
+	for (unsigned i = 0; i < len * 8; i++) {
+		unsigned s = i + count;
+		if (s < len * 8 && (buf[s / 8] & (1 << (s % 8))))
+			buf[i / 8] |= 1 << (i % 8);
+		else
+			buf[i / 8] &= ~(1 << (i % 8));
+	}
+}
+
+static void ref_bit_reverse(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = flip_u32(src[i], 8);
+}
+
+static size_t ref_hexify(char *hex, const uint8_t *bin, size_t count, size_t length)
+{
+	size_t i;
+	for (i = 0; i < count && 2 * i + 2 < length; i++)
+		sprintf(hex + 2 * i, "%02x", bin[i]);
+	hex[2 * i] = '\0';
+	return 2 * i;
+}
+
+static size_t ref_unhexify(uint8_t *bin, const char *hex, size_t count)
+{
+	size_t i;
+	for (i = 0; i < count; i++) {
+		unsigned value;
+		if (sscanf(hex + 2 * i, "%2x", &value) != 1)
+			break;
+		bin[i] = value;
+	}
+	return i;
+}
+
+static uint8_t ref_checksum(const uint8_t *buf, size_t len)
+{
+	uint8_t sum = 0;
+	for (size_t i = 0; i < len; i++)
+		sum += buf[i];
+	return sum;
+}
+
+/* Prints the throughput of @a run, called until BENCH_NS passed */
+#define BENCH(name, bytes, run) do { \
+		int64_t start = now_ns(), elapsed; \
+		unsigned long iterations = 0; \
+		do { \
+			run; \
+			iterations++; \
+			elapsed = now_ns() - start; \
+		} while (elapsed < BENCH_NS); \
+		printf("%-28s %10.1f MB/s\n", name, \
+				(double)(bytes) * iterations * 1000.0 / elapsed); \
+	} while (0)
+
+static unsigned failures;
+
+static void check(const char *name, bool ok)
+{
+	if (!ok) {
+		printf("%s: result differs from the reference\n", name);
+		failures++;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	size_t size = argc > 1 ? strtoul(argv[1], NULL, 0) : 4096;
+	if (size < 16) {
+		fprintf(stderr, "use at least 16 bytes\n");
+		return 1;
+	}
+
+	uint8_t *src = malloc(size);
+	uint8_t *dst = malloc(size);
+	uint8_t *ref = malloc(size);
+	char *hex = malloc(2 * size + 1);
+	if (!src || !dst || !ref || !hex)
+		return 1;
+
+	srand(1);
+	for (size_t i = 0; i < size; i++)
+		src[i] = rand();
+
+	/* unaligned bit copy, a field at bit 3 into a chain position at bit 5 */
+	unsigned bits = (size - 1) * 8;
+	memset(dst, 0, size);
+	memset(ref, 0, size);
+	buf_set_buf(src, 3, dst, 5, bits - 8);
+	ref_set_buf(src, 3, ref, 5, bits - 8);
+	check("buf_set_buf", memcmp(dst, ref, size) == 0);
+	BENCH("buf_set_buf unaligned", size, buf_set_buf(src, 3, dst, 5, bits - 8));
+	BENCH("  bitwise reference", size, ref_set_buf(src, 3, ref, 5, bits - 8));
+	BENCH("buf_set_buf aligned", size, buf_set_buf(src, 0, dst, 0, bits));
+
+	/* a queue of 32 bit fields as used for multi-TAP scans */
+	struct bit_copy_queue queue;
+	unsigned fields = bits / 33;
+	BENCH("bit_copy_queued + execute", fields * 4, {
+		bit_copy_queue_init(&queue);
+		for (unsigned f = 0; f < fields; f++)
+			bit_copy_queued(&queue, dst, f * 32, src, f * 33 + 1, 32);
+		bit_copy_execute(&queue);
+	});
+
+	/* shift by whole bytes and bits */
+	memcpy(dst, src, size);
+	memcpy(ref, src, size);
+	buffer_shr(dst, size, 21);
+	ref_shr(ref, size, 21);
+	check("buffer_shr", memcmp(dst, ref, size) == 0);
+	BENCH("buffer_shr", size, buffer_shr(dst, size, 21));
+	BENCH("  bitwise reference", size, ref_shr(ref, size, 21));
+
+	buf_bit_reverse(dst, src, size);
+	ref_bit_reverse(ref, src, size);
+	check("buf_bit_reverse", memcmp(dst, ref, size) == 0);
+	BENCH("buf_bit_reverse", size, buf_bit_reverse(dst, src, size));
+	BENCH("  flip_u32 reference", size, ref_bit_reverse(ref, src, size));
+
+	char *ref_hex = malloc(2 * size + 1);
+	if (!ref_hex)
+		return 1;
+	hexify(hex, src, size, 2 * size + 1);
+	ref_hexify(ref_hex, src, size, 2 * size + 1);
+	check("hexify", strcmp(hex, ref_hex) == 0);
+	BENCH("hexify", size, hexify(hex, src, size, 2 * size + 1));
+	BENCH("  sprintf reference", size, ref_hexify(ref_hex, src, size, 2 * size + 1));
+
+	check("unhexify", unhexify(dst, hex, size) == size && memcmp(dst, src, size) == 0);
+	ref_unhexify(ref, hex, size);
+	check("unhexify reference", memcmp(ref, src, size) == 0);
+	BENCH("unhexify", size, unhexify(dst, hex, size));
+	BENCH("  sscanf reference", size, ref_unhexify(ref, hex, size));
+
+	volatile uint8_t sum;
+	check("buf_checksum", buf_checksum(src, size) == ref_checksum(src, size));
+	BENCH("buf_checksum", size, sum = buf_checksum(src, size));
+	BENCH("  bytewise reference", size, sum = ref_checksum(src, size));
+	(void)sum;
+
+	free(ref_hex);
+	free(hex);
+	free(ref);
+	free(dst);
+	free(src);
+
+	if (failures) {
+		printf("FAIL: %u kernels differ from their reference\n", failures);
+		return 1;
+	}
+	return 0;
+}
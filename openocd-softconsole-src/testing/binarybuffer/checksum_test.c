@@ -0,0 +1,79 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/*
+ * Checks buf_checksum(), the gdb packet checksum, against a byte by byte
+ * sum for all lengths up to 4096 and data patterns that make the lanes
+ * of the word at a time sum overflow. Build and run from this directory,
+ * with BUILD the configured build directory holding config.h:
+ *
+ *   gcc -std=gnu99 -O2 -DHAVE_CONFIG_H -I$BUILD -I../../src -I../../src/helper \
+ *       -I../../jimtcl checksum_test.c ../../src/helper/binarybuffer.c \
+ *       -o checksum_test
+ *   ./checksum_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "binarybuffer.h"
+
+#define MAX_LEN	4096
+
+static uint8_t reference(const uint8_t *buf, size_t len)
+{
+	uint8_t sum = 0;
+	for (size_t i = 0; i < len; i++)
+		sum += buf[i];
+	return sum;
+}
+
+int main(void)
+{
+	static uint8_t data[MAX_LEN + 8];
+	const int fills[] = { 0x00, 0x01, 0x7f, 0x80, 0xfe, 0xff, -1 };
+	unsigned failures = 0;
+
+	for (unsigned f = 0; f < sizeof(fills) / sizeof(fills[0]); f++) {
+		if (fills[f] < 0) {
+			srand(1);
+			for (size_t i = 0; i < sizeof(data); i++)
+				data[i] = rand();
+		} else {
+			memset(data, fills[f], sizeof(data));
+		}
+
+		/* also at an odd offset, the words are loaded unaligned */
+		for (size_t offset = 0; offset < 2; offset++) {
+			for (size_t len = 1; len <= MAX_LEN; len++) {
+				uint8_t want = reference(data + offset, len);
+				uint8_t got = buf_checksum(data + offset, len);
+				if (got != want) {
+					if (failures++ < 10)
+						printf("fill %d offset %zu len %zu: got %02x, want %02x\n",
+								fills[f], offset, len, got, want);
+				}
+			}
+		}
+	}
+
+	if (failures) {
+		printf("FAIL: %u mismatches\n", failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}